@@ -695,3 +695,711 @@ def testWithMultiExec(env):
         env.assertTrue(True, message='Did not get error when running gear in multi exec')
     except Exception:
         env.assertTrue(True, message='Got error when running gear in multi exec')
+
+def testExecutionBatchSize(env):
+    conn = getConnectionByEnv(env)
+    for i in range(1000):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    for batchSize in [1, 7, 100, 5000]:
+        env.broadcast('RG.CONFIGSET', 'ExecutionBatchSize', batchSize)
+        res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).filter(lambda x: x % 2 == 0)."
+                                      "aggregate(0, lambda a, r: a + r, lambda a, r: a + r).run()")
+        env.assertEqual(res, [[str(sum(range(0, 1000, 2)))], []])
+    env.broadcast('RG.CONFIGSET', 'ExecutionBatchSize', 100)
+
+def testExecutionBatchSizeBadValue(env):
+    res = env.execute_command('RG.CONFIGSET', 'ExecutionBatchSize', 0)
+    env.assertTrue('(error)' in str(res[0]))
+    env.expect('RG.CONFIGGET', 'ExecutionBatchSize').equal([100])
+
+def testErrorInTheMiddleOfABatch(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: 1 / 0 if x['key'] == 'k50' else x['key']).run()")
+    env.assertEqual(len(res[0]), 99)
+    env.assertEqual(len(res[1]), 1)
+    env.assertNotContains('k50', res[0])
+
+def testFusedSteps(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).filter(lambda x: x % 2 == 0)."
+                                  "flatmap(lambda x: [x, x]).foreach(lambda x: x).map(lambda x: x * 10).run()")
+    env.assertEqual(len(res[1]), 0)
+    env.assertEqual(sorted([int(r) for r in res[0]]), sorted([i * 10 for i in range(0, 100, 2)] * 2))
+
+def testFusedStepsKeepTheirStats(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    id = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).filter(lambda x: x % 2 == 0).run()", 'UNBLOCKING')
+    env.cmd('RG.GETRESULTSBLOCKING', id)
+    res = env.cmd('RG.GETEXECUTION', id)
+    # the fused steps are still reported one by one, from the last step to the first
+    steps = res[0][3][15]
+    env.assertEqual([s[1] for s in steps], ['collect', 'map', 'filter', 'map'])
+    stats = res[0][3][17]
+    env.assertEqual([s[1] for s in stats], ['collect', 'map', 'filter', 'map', 'reader'])
+    env.assertEqual([s[5] for s in stats], [50, 50, 50, 100, 100]) # records_out
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testFusedStepsError(env):
+    conn = getConnectionByEnv(env)
+    for i in range(10):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).filter(lambda x: 1 / (x - 5) != 0).map(lambda x: x).run()")
+    env.assertEqual(len(res[0]), 9)
+    env.assertEqual(len(res[1]), 1)
+
+def testExecutionParallelism(env):
+    conn = getConnectionByEnv(env)
+    for i in range(1000):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    for parallelism in [1, 4]:
+        env.broadcast('RG.CONFIGSET', 'ExecutionParallelism', parallelism)
+        # python steps always run on a single thread
+        env.expect('RG.PYEXECUTE', "GB().map(lambda x: int(x['value']))."
+                                   "aggregate(0, lambda a, r: a + r, lambda a, r: a + r).run()").equal([[str(sum(range(1000)))], []])
+        env.expect('RG.PYEXECUTE', "GB().count().run()").equal([['1000'], []])
+    env.broadcast('RG.CONFIGSET', 'ExecutionParallelism', 1)
+
+def testGroupByManyKeys(env):
+    conn = getConnectionByEnv(env)
+    for i in range(2000):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    # keys longer than the ones kept inline on the aggregation table
+    res = env.cmd('RG.PYEXECUTE', "GB().countby(lambda x: 'a-group-key-that-is-long-%d' % (int(x['value']) % 500)).run()")
+    env.assertEqual(len(res[1]), 0)
+    res = [eval(r) for r in res[0]]
+    env.assertEqual(len(res), 500)
+    env.assertEqual(set([r['key'] for r in res]), set(['a-group-key-that-is-long-%d' % i for i in range(500)]))
+    env.assertEqual(set([r['value'] for r in res]), set([4]))
+
+    res = env.cmd('RG.PYEXECUTE', "GB().aggregateby(lambda x: str(int(x['value']) % 3), 0, "
+                                  "lambda k, a, r: a + int(r['value']), lambda k, a, r: a + r).run()")
+    env.assertEqual(len(res[1]), 0)
+    res = dict([(r['key'], r['value']) for r in [eval(r) for r in res[0]]])
+    env.assertEqual(res, dict([(str(m), sum(range(m, 2000, 3))) for m in range(3)]))
+
+def testAggregateByAcrossShards(env):
+    conn = getConnectionByEnv(env)
+    for i in range(1000):
+        conn.execute_command('set', 'k%d' % i, str(i % 10))
+    id = env.cmd('RG.PYEXECUTE', "GB().aggregateby(lambda x: x['value'], 0, lambda k, a, r: a + 1, lambda k, a, r: a + r).run()", 'UNBLOCKING')
+    res = env.cmd('RG.GETRESULTSBLOCKING', id)
+    env.assertEqual(len(res[1]), 0)
+    res = dict([(r['key'], r['value']) for r in [eval(r) for r in res[0]]])
+    env.assertEqual(res, dict([(str(i), 100) for i in range(10)]))
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testCountByCombiner(env):
+    conn = getConnectionByEnv(env)
+    for i in range(1000):
+        conn.execute_command('set', 'k%d' % i, str(i % 10))
+
+    def recordsIn(plans, stepType):
+        return sum([s[3] for p in plans for s in p[17] if s[1] == stepType])
+
+    id = env.cmd('RG.PYEXECUTE', "GB().countby(lambda x: x['value']).run()", 'UNBLOCKING')
+    res = env.cmd('RG.GETRESULTSBLOCKING', id)
+    env.assertEqual(len(res[1]), 0)
+    res = dict([(r['key'], r['value']) for r in [eval(r) for r in res[0]]])
+    env.assertEqual(res, dict([(str(i), 100) for i in range(10)]))
+    plans = [p[3] for p in env.cmd('RG.GETEXECUTION', id)]
+    # a single associative accumulatebykey, no hand built local and global steps
+    env.assertEqual([s[5] for s in plans[0][15] if s[1] == 'accumulatebykey'], ['CountByKeyAccumulator'])
+    if env.shardsCount > 1:
+        # the combiner counts each shard's records before the repartition,
+        # so only one partial count per key and shard crosses the shards
+        env.assertEqual(recordsIn(plans, 'repartition'), 1000)
+        env.assertLessEqual(recordsIn(plans, 'accumulatebykey'), 10 * env.shardsCount)
+    env.cmd('RG.DROPEXECUTION', id)
+
+    # a python reducer is not associative, all the records are repartitioned
+    id = env.cmd('RG.PYEXECUTE', "GB().groupby(lambda x: x['value'], lambda k, a, r: (a if a else 0) + 1).run()", 'UNBLOCKING')
+    res = env.cmd('RG.GETRESULTSBLOCKING', id)
+    env.assertEqual(len(res[1]), 0)
+    plans = [p[3] for p in env.cmd('RG.GETEXECUTION', id)]
+    env.assertEqual(recordsIn(plans, 'group'), 1000)
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testSpillToDisk(env):
+    conn = getConnectionByEnv(env)
+    for i in range(1000):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    # a tiny budget makes the group, collect and repartition steps spill almost all their records
+    env.broadcast('RG.CONFIGSET', 'ExecutionMemoryBudget', 1)
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).run()")
+    env.assertEqual(len(res[1]), 0)
+    env.assertEqual(sorted([int(r) for r in res[0]]), list(range(1000)))
+    res = env.cmd('RG.PYEXECUTE', "GB().groupby(lambda x: str(int(x['value']) % 7), lambda k, a, r: (a if a else 0) + 1).run()")
+    env.assertEqual(len(res[1]), 0)
+    res = dict([(r['key'], r['value']) for r in [eval(r) for r in res[0]]])
+    env.assertEqual(res, dict([(str(m), len(range(m, 1000, 7))) for m in range(7)]))
+    res = env.cmd('RG.PYEXECUTE', "GB().repartition(lambda x: x['value']).map(lambda x: x['key']).run()")
+    env.assertEqual(len(res[1]), 0)
+    env.assertEqual(set(res[0]), set(['k%d' % i for i in range(1000)]))
+    env.broadcast('RG.CONFIGSET', 'ExecutionMemoryBudget', 0)
+
+def testExecutionSpillDirNotConfigurableAtRuntime(env):
+    res = env.execute_command('RG.CONFIGSET', 'ExecutionSpillDir', '/')
+    env.assertTrue('(error)' in str(res[0]))
+
+def testExecutionArena(env):
+    conn = getConnectionByEnv(env)
+    for i in range(1000):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    env.broadcast('RG.CONFIGSET', 'ExecutionArena', 1)
+    env.expect('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).filter(lambda x: x % 2 == 1).count().run()").equal([['500'], []])
+    # the results are allocated from the arena and must outlive the steps that created them
+    id = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).run()", 'UNBLOCKING')
+    env.cmd('RG.GETRESULTSBLOCKING', id)
+    res = env.cmd('RG.GETRESULTS', id)
+    env.assertEqual(set(res[0]), set(['k%d' % i for i in range(1000)]))
+    env.cmd('RG.DROPEXECUTION', id)
+    env.broadcast('RG.CONFIGSET', 'ExecutionArena', 0)
+
+def testExecutionArenaBadValue(env):
+    res = env.execute_command('RG.CONFIGSET', 'ExecutionArena', 2)
+    env.assertTrue('(error)' in str(res[0]))
+
+def testGetResultsCursor(env):
+    conn = getConnectionByEnv(env)
+    for i in range(10):
+        conn.execute_command('set', 'x%d' % i, str(i))
+    id = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['value']).run()", 'UNBLOCKING')
+    env.cmd('RG.GETRESULTSBLOCKING', id)
+
+    results = []
+    while True:
+        res = env.cmd('RG.GETRESULTS', id, 'CURSOR', 3)
+        env.assertLessEqual(len(res[0]), 3)
+        results += res[0]
+        if res[2] == 0:
+            env.assertEqual(res[1], [])
+            break
+        env.assertEqual(res[2], 1)
+    env.assertEqual(sorted(results), sorted([str(i) for i in range(10)]))
+
+    # results taken by the cursor are not returned again
+    env.expect('RG.GETRESULTS', id, 'CURSOR', 3).equal([[], [], 0])
+    env.expect('RG.GETRESULTS', id).equal([[], []])
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testGetResultsCursorWhileRunning(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    for i in range(300):
+        conn.execute_command('set', 'x%d' % i, str(i))
+    # small batches so the results are published while the slow map still runs
+    env.broadcast('RG.CONFIGSET', 'ExecutionBatchSize', 64)
+    id = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: (__import__('time').sleep(0.01), x['value'])[1]).run()", 'UNBLOCKING')
+
+    results = []
+    try:
+        with TimeLimit(10):
+            while len(results) == 0:
+                res = env.cmd('RG.GETRESULTS', id, 'CURSOR', 1000)
+                results += res[0]
+                time.sleep(0.05)
+    except Exception as e:
+        env.assertTrue(False, message='Failed waiting for the first results')
+    # the cursor advanced before the execution finished
+    env.assertEqual(res[2], 1)
+    env.assertLess(len(results), 300)
+
+    with TimeLimit(10):
+        while res[2] == 1:
+            time.sleep(0.05)
+            res = env.cmd('RG.GETRESULTS', id, 'CURSOR', 1000)
+            results += res[0]
+    env.assertEqual(res[1], [])
+    env.assertEqual(sorted(results), sorted([str(i) for i in range(300)]))
+    env.broadcast('RG.CONFIGSET', 'ExecutionBatchSize', 100)
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testGetResultsCursorBadArgs(env):
+    id = env.cmd('RG.PYEXECUTE', "GB().run()", 'UNBLOCKING')
+    env.cmd('RG.GETRESULTSBLOCKING', id)
+    env.expect('RG.GETRESULTS', id, 'CURSOR', 0).error().contains('cursor count must be a positive number')
+    env.expect('RG.GETRESULTS', id, 'CURSOR', 'foo').error().contains('cursor count must be a positive number')
+    env.expect('RG.GETRESULTS', id, 'FOO', 1).error().contains('unknown argument given')
+    env.expect('RG.GETRESULTS', id, 'CURSOR').error().contains('wrong number of arguments')
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testLimitPushDown(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'k%d' % i, str(i))
+
+    id = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).limit(5, 10).run()", 'UNBLOCKING')
+    res = env.cmd('RG.GETRESULTSBLOCKING', id)
+    env.assertEqual(len(res[0]), 5)
+    env.assertEqual(res[1], [])
+    stats = env.cmd('RG.GETEXECUTION', id)[0][3][17]
+    env.assertEqual(stats[-1][1], 'reader')
+    env.assertEqual(stats[-1][5], 15) # the reader stops after offset + len records
+    env.cmd('RG.DROPEXECUTION', id)
+
+    # a filter might drop records, the limit can not be pushed down to the reader
+    id = env.cmd('RG.PYEXECUTE', "GB().filter(lambda x: True).limit(5, 10).run()", 'UNBLOCKING')
+    res = env.cmd('RG.GETRESULTSBLOCKING', id)
+    env.assertEqual(len(res[0]), 5)
+    stats = env.cmd('RG.GETEXECUTION', id)[0][3][17]
+    env.assertEqual(stats[-1][5], 100)
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testLimitPushDownStreamReader(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    ids = [conn.execute_command('xadd', 's', '*', 'foo', str(i)) for i in range(20)]
+
+    id = env.cmd('RG.PYEXECUTE', "GB('StreamReader').map(lambda x: x['id']).limit(5).run('s')", 'UNBLOCKING')
+    res = env.cmd('RG.GETRESULTSBLOCKING', id)
+    env.assertEqual(res[0], ids[:5])
+    stats = env.cmd('RG.GETEXECUTION', id)[0][3][17]
+    env.assertEqual(stats[-1][5], 5)
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testKeysReaderKeyTypes(env):
+    conn = getConnectionByEnv(env)
+    for i in range(5):
+        conn.execute_command('set', 'x%d' % i, str(i))
+    for i in range(3):
+        conn.execute_command('hset', 'h%d' % i, 'foo', str(i))
+    conn.execute_command('lpush', 'l', '1')
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).run(keyTypes=['hash'])")
+    env.assertEqual(sorted(res[0]), ['h0', 'h1', 'h2'])
+    env.assertEqual(res[1], [])
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).run(keyTypes=['string', 'list'])")
+    env.assertEqual(sorted(res[0]), ['l', 'x0', 'x1', 'x2', 'x3', 'x4'])
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).run(keyTypes=['zset'])")
+    env.assertEqual(res[0], [])
+
+    # the key types are applied together with the pattern
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).run('h1*', keyTypes=['hash'])")
+    env.assertEqual(res[0], ['h1'])
+
+def testKeysReaderBadKeyTypes(env):
+    env.expect('RG.PYEXECUTE', "GB().run(keyTypes=['foo'])").error().contains('unknown key type')
+    env.expect('RG.PYEXECUTE', "GB().run(keyTypes=1)").error().contains('given keyTypes is not iterable')
+
+def testSort(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'x%d' % i, str(i))
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).sort().run()")
+    env.assertEqual(res[0], [str(i) for i in range(100)])
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).sort(reverse=False).run()")
+    env.assertEqual(res[0], [str(i) for i in reversed(range(100))])
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).sort(key=lambda x: -x).run()")
+    env.assertEqual(res[0], [str(i) for i in reversed(range(100))])
+
+def testTopK(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'x%d' % i, str(i))
+
+    # the k largest by default, same as sort with reverse=False
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).topk(5).run()")
+    env.assertEqual(res[0], ['99', '98', '97', '96', '95'])
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).topk(5, reverse=True).run()")
+    env.assertEqual(res[0], ['0', '1', '2', '3', '4'])
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).topk(3, key=lambda x: x % 10).run()")
+    env.assertEqual([int(r) % 10 for r in res[0]], [9, 9, 9])
+
+    # k larger than the number of records returns all of them
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).topk(1000, reverse=True).run()")
+    env.assertEqual(res[0], [str(i) for i in range(100)])
+
+def testTopKBadK(env):
+    env.expect('RG.PYEXECUTE', "GB().topk(0).run()").error().contains('topk first argument must be a positive number')
+    env.expect('RG.PYEXECUTE', "GB().topk(-1).run()").error().contains('topk first argument must be a positive number')
+
+def testBuiltinAggregate(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'x%d' % i, str(i))
+
+    env.expect('RG.PYEXECUTE', "GB().builtinaggregate('count').run()").equal([['100'], []])
+    env.expect('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).builtinaggregate('sum').run()").equal([['4950'], []])
+    env.expect('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).builtinaggregate('min').run()").equal([['0'], []])
+    env.expect('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).builtinaggregate('max').run()").equal([['99'], []])
+    env.expect('RG.PYEXECUTE', "GB().map(lambda x: int(x['value'])).builtinaggregate('avg').run()").equal([['49.5'], []])
+    env.expect('RG.PYEXECUTE', "GB().avg(lambda x: int(x['value'])).run()").equal([['49.5'], []])
+    env.expect('RG.PYEXECUTE', "GB().count().run()").equal([['100'], []])
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value']) % 10).builtinaggregate('distinct').run()")
+    env.assertEqual(sorted([int(r) for r in res[0]]), range(10))
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: str(int(x['value']) % 3)).builtinaggregate('distinct').run()")
+    env.assertEqual(sorted(res[0]), ['0', '1', '2'])
+
+def testBuiltinAggregateErrors(env):
+    conn = getConnectionByEnv(env)
+    conn.execute_command('set', 'x', '1')
+    env.expect('RG.PYEXECUTE', "GB().builtinaggregate('foo').run()").error().contains('unknown builtin aggregation')
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: (1, 2)).builtinaggregate('distinct').run()")
+    env.assertContains('native aggregation only supports ints, floats and strings', str(res[1]))
+
+def testDistinctPythonObjects(env):
+    conn = getConnectionByEnv(env)
+    for i in range(10):
+        conn.execute_command('set', 'x%d' % i, str(i))
+    # python objects are compared with python equality
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: (int(x['value']) % 2, None)).distinct().run()")
+    env.assertEqual(sorted(res[0]), ['(0, None)', '(1, None)'])
+    env.assertEqual(res[1], [])
+
+def testApproxCountDistinct(env):
+    conn = getConnectionByEnv(env)
+    for i in range(1000):
+        conn.execute_command('set', 'x%d' % i, str(i))
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).approxcountdistinct().run()")
+    env.assertLess(abs(int(res[0][0]) - 1000), 50)
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value']) % 100).approxcountdistinct().run()")
+    env.assertLess(abs(int(res[0][0]) - 100), 5)
+
+def testApproxQuantiles(env):
+    conn = getConnectionByEnv(env)
+    for i in range(1000):
+        conn.execute_command('set', 'x%d' % i, str(i))
+
+    res = env.cmd('RG.PYEXECUTE', "GB().approxquantiles([0, 0.5, 0.99, 1], lambda x: int(x['value'])).run()")
+    env.assertEqual(res[1], [])
+    quantiles = eval(res[0][0])
+    env.assertEqual(len(quantiles), 4)
+    env.assertEqual(quantiles[0], 0)
+    env.assertLess(abs(quantiles[1] - 500), 20)
+    env.assertLess(abs(quantiles[2] - 990), 10)
+    env.assertEqual(quantiles[3], 999)
+
+def testApproxQuantilesBadArgs(env):
+    env.expect('RG.PYEXECUTE', "GB().approxquantiles([]).run()").error().contains('builtinquantiles argument must be a non empty list')
+    env.expect('RG.PYEXECUTE', "GB().approxquantiles([1.5]).run()").error().contains('quantiles must be numbers between 0 and 1')
+
+def testWindow(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    for t in [1000, 1500, 2500, 4000]:
+        conn.execute_command('xadd', 's', '%d-0' % t, 'v', '1')
+
+    # a window is emitted once a record at or after its end arrives
+    res = env.cmd('RG.PYEXECUTE', "GB('StreamReader').window(1000, 0, lambda a, r: a + 1).run('s')")
+    env.assertEqual(res[1], [])
+    env.assertEqual([eval(r) for r in res[0]], [{'start': 1000, 'end': 2000, 'value': 2},
+                                                {'start': 2000, 'end': 3000, 'value': 1}])
+
+    res = env.cmd('RG.PYEXECUTE', "GB('StreamReader').window(2000, 0, lambda a, r: a + 1, slide=1000).run('s')")
+    env.assertEqual(res[1], [])
+    env.assertEqual([eval(r) for r in res[0]], [{'start': 0, 'end': 2000, 'value': 2},
+                                                {'start': 1000, 'end': 3000, 'value': 3},
+                                                {'start': 2000, 'end': 4000, 'value': 1}])
+
+    # the time can also be a number of milliseconds
+    res = env.cmd('RG.PYEXECUTE', "GB('StreamReader').window(1000, 0, lambda a, r: a + 1, extractor=lambda r: str(int(r['id'].split('-')[0]) + 500)).run('s')")
+    env.assertEqual([eval(r) for r in res[0]], [{'start': 1000, 'end': 2000, 'value': 1},
+                                                {'start': 2000, 'end': 3000, 'value': 1},
+                                                {'start': 3000, 'end': 4000, 'value': 1}])
+
+def testWindowBadArgs(env):
+    env.expect('RG.PYEXECUTE', "GB('StreamReader').window(0, 0, lambda a, r: a + 1).run('s')").error().contains('window size must be positive')
+    env.expect('RG.PYEXECUTE', "GB('StreamReader').window(1000, 0, lambda a, r: a + 1, slide=2000).run('s')").error().contains('window size must be positive')
+    env.expect('RG.PYEXECUTE', "GB('StreamReader').window(1000000, 0, lambda a, r: a + 1, slide=1).run('s')").error().contains('more than 1000 windows')
+
+def testWindowBadTime(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    conn.execute_command('xadd', 's', '*', 'v', '1')
+    res = env.cmd('RG.PYEXECUTE', "GB('StreamReader').window(1000, 0, lambda a, r: a + 1, extractor=lambda r: 'foo').run('s')")
+    env.assertContains('window step got a record without a valid time', str(res[1]))
+
+def testJoin(env):
+    conn = getConnectionByEnv(env)
+    for c in range(1, 4):
+        conn.execute_command('hset', 'customer:%d' % c, 'name', 'c%d' % c)
+    # customer 1 is matched by several orders, customer 3 by none and customer 4 does not exists
+    orders = {'order:1': 1, 'order:2': 1, 'order:3': 1, 'order:4': 2, 'order:5': 2, 'order:6': 4}
+    for o, c in orders.items():
+        conn.execute_command('hset', o, 'customer', str(c))
+    expected = sorted([(o, 'c%d' % c) for o, c in orders.items() if c < 4])
+
+    for broadcast in ['False', 'True']:
+        res = env.cmd('RG.PYEXECUTE', "GB().join('customer:*', lambda o: 'customer:%%s' %% o['value']['customer'], broadcast=%s)."
+                                      "map(lambda r: (r['left']['key'], r['right']['value']['name'])).run('order:*')" % broadcast)
+        env.assertEqual(res[1], [])
+        env.assertEqual(sorted([eval(r) for r in res[0]]), expected)
+
+    # the join key of each result is the extracted key
+    res = env.cmd('RG.PYEXECUTE', "GB().join('customer:*', lambda o: 'customer:%s' % o['value']['customer']).map(lambda r: r['key']).run('order:4')")
+    env.assertEqual(res[0], ['customer:2'])
+
+def testJoinBuildExtractor(env):
+    conn = getConnectionByEnv(env)
+    for i in range(10):
+        conn.execute_command('set', 'left:%d' % i, str(i))
+        conn.execute_command('set', 'right:%d' % i, str(i * 2))
+    res = env.cmd('RG.PYEXECUTE', "GB().join('right:*', lambda r: r['value'], buildExtractor=lambda r: r['value'])."
+                                  "map(lambda r: r['key']).run('left:*')")
+    env.assertEqual(res[1], [])
+    env.assertEqual(sorted([int(r) for r in res[0]]), [0, 2, 4, 6, 8])
+
+def testStepsStats(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    id = env.cmd('RG.PYEXECUTE', "GB().filter(lambda x: int(x['value']) < 10).run()", 'UNBLOCKING')
+    env.cmd('RG.GETRESULTSBLOCKING', id)
+    stats = env.cmd('RG.GETEXECUTION', id)[0][3][17]
+    env.assertEqual([s[1] for s in stats], ['collect', 'map', 'filter', 'reader'])
+    for s in stats:
+        env.assertEqual(s[0::2], ['type', 'records_in', 'records_out', 'bytes_serialized', 'lock_wait_duration',
+                                  'run_duration', 'latency_p50_usec', 'latency_p99_usec', 'latency_max_usec'])
+        env.assertEqual(s[7], 0) # nothing was sent to other shards
+        env.assertGreaterEqual(s[9], 0)
+        env.assertGreaterEqual(s[11], 0)
+        env.assertLessEqual(s[13], s[15])
+        env.assertLessEqual(s[15], s[17])
+    env.assertEqual([s[3] for s in stats], [10, 10, 100, 100]) # records_in
+    env.assertEqual([s[5] for s in stats], [10, 10, 10, 100]) # records_out
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testStepsStatsBytesSerialized(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'k%d' % i, str(i))
+    id = env.cmd('RG.PYEXECUTE', "GB().repartition(lambda x: 'k').run()", 'UNBLOCKING')
+    env.cmd('RG.GETRESULTSBLOCKING', id)
+    stats = env.cmd('RG.GETEXECUTION', id)[0][3][17]
+    env.assertEqual([s[1] for s in stats], ['collect', 'map', 'repartition', 'reader'])
+    if env.shardsCount > 1:
+        env.assertGreater(stats[2][7], 0)
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testProfileSampling(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    for i in range(10):
+        conn.execute_command('set', 'x%d' % i, str(i))
+    env.expect('RG.PROFILE', 'RESET').ok()
+    env.expect('RG.CONFIGSET', 'ProfileSampleRate', 1000).equal(['OK'])
+    script = '''
+import time
+def slow(x):
+    time.sleep(0.05)
+    return x
+GB().map(slow).run()
+'''
+    env.cmd('RG.PYEXECUTE', script)
+    env.expect('RG.CONFIGSET', 'ProfileSampleRate', 0).equal(['OK'])
+
+    res = env.cmd('RG.PROFILE')
+    lines = [l for l in res.split('\n') if l]
+    env.assertGreater(len(lines), 0)
+    for l in lines:
+        stack, count = l.rsplit(' ', 1)
+        env.assertGreater(int(count), 0)
+    # most of the time is spent in the python callback of the map step
+    env.assertTrue(any(['map;' in l and 'slow' in l for l in lines]))
+
+    env.expect('RG.PROFILE', 'RESET').ok()
+    env.expect('RG.PROFILE').equal('')
+
+def testProfileSampleRateBadValue(env):
+    for val in [-1, 1001, 'foo']:
+        res = env.execute_command('RG.CONFIGSET', 'ProfileSampleRate', val)
+        env.assertTrue('(error)' in str(res[0]))
+    env.expect('RG.CONFIGGET', 'ProfileSampleRate').equal([0])
+
+def testRecordsPoolInfo(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'x%d' % i, str(i))
+    env.expect('RG.CONFIGGET', 'RecordsPool').equal([1])
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['value']).run()")
+    env.assertEqual(len(res[0]), 100)
+
+    info = conn.info('rg_records_pool')
+    pools = dict([(k, v) for k, v in info.items() if k.endswith('StringRecord')])
+    env.assertEqual(len(pools), 1)
+    stats = pools.values()[0]
+    env.assertGreater(stats['hits'] + stats['misses'], 0)
+    env.assertGreater(stats['slabs'], 0)
+
+def testRecordsPoolNotConfigurableAtRuntime(env):
+    res = env.execute_command('RG.CONFIGSET', 'RecordsPool', 0)
+    env.assertTrue('(error)' in str(res[0]))
+    env.expect('RG.CONFIGGET', 'RecordsPool').equal([1])
+
+def testBinaryValues(env):
+    conn = getConnectionByEnv(env)
+    big = 'x' * 20000 + '\x00' + 'y' * 20000
+    conn.execute_command('set', 'str', 'a\x00b')
+    conn.execute_command('set', 'big', big)
+    conn.execute_command('hset', 'hash', 'f', 'v\x00v')
+    conn.execute_command('rpush', 'list', 'a\x00', '', 'b')
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: (x['key'], x['value'])).run()")
+    env.assertEqual(res[1], [])
+    res = dict([eval(r) for r in res[0]])
+    env.assertEqual(res['str'], 'a\x00b')
+    env.assertEqual(res['big'], big)
+    env.assertEqual(res['hash'], {'f': 'v\x00v'})
+    env.assertEqual(res['list'], ['a\x00', '', 'b'])
+
+    # the values that were read are not changed by later writes to the keys
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['value']).foreach(lambda x: execute('set', 'str', 'changed')).run('str')")
+    env.assertEqual(res[0], ['a\x00b'])
+
+def testBinaryStreamValues(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    big = 'x' * 20000 + '\x00'
+    conn.execute_command('xadd', 's', '*', 'f', 'v\x00', 'big', big)
+    res = env.cmd('RG.PYEXECUTE', "GB('StreamReader').map(lambda x: x['value']).run('s')")
+    env.assertEqual(res[1], [])
+    env.assertEqual(eval(res[0][0]), {'f': 'v\x00', 'big': big})
+
+def testHashRecords(env):
+    conn = getConnectionByEnv(env)
+    hashes = {
+        'h:small': dict([('f%d' % i, str(i)) for i in range(3)]),
+        'h:full': dict([('f%d' % i, str(i)) for i in range(8)]),
+        'h:many': dict([('f%d' % i, str(i)) for i in range(50)]),
+        'h:longnames': dict([(('f%d' % i) * 30, str(i)) for i in range(3)]),
+        'h:emptyvalue': {'f': ''},
+    }
+    for k, v in hashes.items():
+        for f, val in v.items():
+            conn.execute_command('hset', k, f, val)
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: (x['key'], x['value'])).run('h:*')")
+    env.assertEqual(res[1], [])
+    env.assertEqual(dict([eval(r) for r in res[0]]), hashes)
+
+    # GB() turns the records into python dicts, so the repartition moves pickled dicts
+    res = env.cmd('RG.PYEXECUTE', "GB().repartition(lambda x: 'k').map(lambda x: (x['key'], x['value'])).run('h:*')")
+    env.assertEqual(res[1], [])
+    env.assertEqual(dict([eval(r) for r in res[0]]), hashes)
+
+def testStreamHashRecords(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    entries = [dict([('f%d' % i, str(i)) for i in range(n)]) for n in [1, 8, 9, 30]]
+    for e in entries:
+        args = []
+        for f, v in e.items():
+            args += [f, v]
+        conn.execute_command('xadd', 's', '*', *args)
+
+    res = env.cmd('RG.PYEXECUTE', "GB('StreamReader').map(lambda x: x['value']).run('s')")
+    env.assertEqual(res[1], [])
+    env.assertEqual([eval(r) for r in res[0]], entries)
+
+    res = env.cmd('RG.PYEXECUTE', "GB('StreamReader').repartition(lambda x: 'k').map(lambda x: x['value']).run('s')")
+    env.assertEqual(res[1], [])
+    env.assertEqual(sorted([eval(r) for r in res[0]]), sorted(entries))
+
+def testNativeHashRecordsAcrossShards(env):
+    conn = getConnectionByEnv(env)
+    for i in range(200):
+        conn.execute_command('set', 'x%d' % i, str(i))
+    # each shard sends its distinct values to the initiator in a native hash record,
+    # with more than 8 values the record keeps its fields in a dict
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value']) % 50).builtinaggregate('distinct').run()")
+    env.assertEqual(res[1], [])
+    env.assertEqual(sorted([int(r) for r in res[0]]), range(50))
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value']) % 50 if int(x['value']) % 2 else str(int(x['value']) % 50)).builtinaggregate('distinct').run()")
+    env.assertEqual(res[1], [])
+    env.assertEqual(sorted(res[0]), sorted([str(i) for i in range(50)]))
+
+def testMixedRecordsAcrossShards(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 's%d' % i, str(i))
+        conn.execute_command('hset', 'h%d' % i, 'f', str(i), 'g%d' % (i % 5), 'x')
+        conn.execute_command('rpush', 'l%d' % i, str(i), '')
+
+    # GB() turns the key records of all the value types into python records before the repartition
+    for budget in [0, 1]:
+        # with a budget of 1 the records are also written to the spill files
+        env.broadcast('RG.CONFIGSET', 'ExecutionMemoryBudget', budget)
+        res = env.cmd('RG.PYEXECUTE', "GB().repartition(lambda x: x['key'][1:]).map(lambda x: (x['key'], x['value'])).run()")
+        env.assertEqual(res[1], [])
+        res = dict([eval(r) for r in res[0]])
+        env.assertEqual(len(res), 300)
+        for i in range(100):
+            env.assertEqual(res['s%d' % i], str(i))
+            env.assertEqual(res['h%d' % i], {'f': str(i), 'g%d' % (i % 5): 'x'})
+            env.assertEqual(res['l%d' % i], [str(i), ''])
+    env.broadcast('RG.CONFIGSET', 'ExecutionMemoryBudget', 0)
+
+def testNativeRecordsSharedFieldNames(env):
+    conn = getConnectionByEnv(env)
+    for i in range(300):
+        conn.execute_command('set', 'x%d' % i, str(i))
+    for budget in [0, 1]:
+        # with a budget of 1 the received records are also written to the spill files
+        env.broadcast('RG.CONFIGSET', 'ExecutionMemoryBudget', budget)
+        # every shard collects a native hash record with the same field names (the distinct
+        # values), the initiator spills them together so the names are written once per file
+        res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: 'v%d' % (int(x['value']) % 20)).builtinaggregate('distinct').run()")
+        env.assertEqual(res[1], [])
+        env.assertEqual(sorted(res[0]), sorted(['v%d' % i for i in range(20)]))
+        # the countby combiner repartitions native key records holding the partial counts
+        res = env.cmd('RG.PYEXECUTE', "GB().countby(lambda x: 'v%d' % (int(x['value']) % 20)).run()")
+        env.assertEqual(res[1], [])
+        res = dict([(r['key'], r['value']) for r in [eval(r) for r in res[0]]])
+        env.assertEqual(res, dict([('v%d' % i, 15) for i in range(20)]))
+    env.broadcast('RG.CONFIGSET', 'ExecutionMemoryBudget', 0)
+
+def testNativeAggregationsAcrossShards(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.execute_command('set', 'x%d' % i, str(i))
+
+    # doubles are not truncated when the shards results are combined
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value']) + 0.125).builtinaggregate('sum').run()")
+    env.assertEqual(float(res[0][0]), 4950 + 100 * 0.125)
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value']) + 0.125).builtinaggregate('min').run()")
+    env.assertEqual(float(res[0][0]), 0.125)
+
+    # ints, floats and strings in the same distinct set
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: [int(x['value']) % 3, (int(x['value']) % 3) + 0.5, str(int(x['value']) % 3)][int(x['value']) % 3]).builtinaggregate('distinct').run()")
+    env.assertEqual(res[1], [])
+    env.assertEqual(sorted(res[0]), ['0', '1.5', '2'])
+
+    # the sketches are extension record types
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).approxcountdistinct().run()")
+    env.assertLess(abs(int(res[0][0]) - 100), 5)
+    res = env.cmd('RG.PYEXECUTE', "GB().approxquantiles([0, 1], lambda x: int(x['value']) + 0.5).run()")
+    env.assertEqual(eval(res[0][0]), [0.5, 99.5])
+
+def testLargeValuesAcrossShards(env):
+    conn = getConnectionByEnv(env)
+    values = dict([('big%d' % i, chr(ord('a') + i) * (2 * 1024 * 1024 + i)) for i in range(5)])
+    for k, v in values.items():
+        conn.execute_command('set', k, v)
+
+    res = env.cmd('RG.PYEXECUTE', "GB().repartition(lambda x: 'k').map(lambda x: (x['key'], len(x['value']), x['value'][:1], x['value'][-1:])).run('big*')")
+    env.assertEqual(res[1], [])
+    res = sorted([eval(r) for r in res[0]])
+    env.assertEqual(res, sorted([(k, len(v), v[:1], v[-1:]) for k, v in values.items()]))
+
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['value']).run('big*')")
+    env.assertEqual(sorted(res[0]), sorted(values.values()))
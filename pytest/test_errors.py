@@ -335,3 +335,50 @@ class testGetExecutionErrorReporting:
             self.env.assertContains("name 'notexists' is not defined", error)
         self.env.cmd('RG.DROPEXECUTION', id)
         self.env.cmd('RG.CONFIGSET', 'PythonAttemptTraceback', 1)
+
+def testExecutionTimeout(env):
+    conn = getConnectionByEnv(env)
+    for i in range(10):
+        conn.execute_command('set', 'x%d' % i, '1')
+    script = '''
+import time
+def slow(x):
+    time.sleep(0.1)
+    return x
+GB().map(slow).run(timeout=300)
+'''
+    start = time.time()
+    res = env.cmd('RG.PYEXECUTE', script)
+    env.assertLess(time.time() - start, 1.5)
+    env.assertContains('Execution timeout reached', str(res[1]))
+
+def testExecutionTimeoutStopsALongStep(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    conn.execute_command('set', 'x', '1')
+    script = '''
+def spin(x):
+    while True:
+        pass
+GB().map(spin).run(timeout=200)
+'''
+    # the step never returns by itself, it must be stopped from the outside
+    start = time.time()
+    id = env.cmd('RG.PYEXECUTE', script, 'UNBLOCKING')
+    res = env.cmd('RG.GETRESULTSBLOCKING', id)
+    env.assertLess(time.time() - start, 2)
+    env.assertEqual(res[0], [])
+    env.assertContains('Execution timeout reached', str(res[1]))
+    env.cmd('RG.DROPEXECUTION', id)
+
+def testExecutionTimeoutNotReached(env):
+    conn = getConnectionByEnv(env)
+    for i in range(10):
+        conn.execute_command('set', 'x%d' % i, '1')
+    res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['key']).run(timeout=10000)")
+    env.assertEqual(sorted(res[0]), sorted(['x%d' % i for i in range(10)]))
+    env.assertEqual(res[1], [])
+
+def testExecutionTimeoutBadValue(env):
+    env.expect('RG.PYEXECUTE', "GB().run(timeout=-1)").error().contains('timeout argument must be a positive number')
+    env.expect('RG.PYEXECUTE', "GB().run(timeout='1')").error().contains('timeout argument must be a number')
@@ -976,4 +976,221 @@ def testKeyReaderRegisterDontReadValues(env):
                     break
                 time.sleep(0.1)
     except Exception as e:
-        env.assertTrue(False, message='Failed waiting for list to popultae')
\ No newline at end of file
+        env.assertTrue(False, message='Failed waiting for list to popultae')
+
+def testRegisterWithExecutionPoolSize(env):
+    env.skipOnCluster()
+    env.expect('RG.PYEXECUTE', "GB('CommandReader').flatmap(lambda x: x[1:]).countby(lambda x: x).register(trigger='pooled', executionPoolSize=2)").ok()
+
+    # pooled executions are reused, make sure each run starts from a clean state
+    for i in range(10):
+        env.expect('RG.TRIGGER', 'pooled', 'a', 'a', 'a').equal(["{'key': 'a', 'value': 3}"])
+
+    env.expect('RG.PYEXECUTE', "GB('KeysReader').foreach(lambda x: execute('incr', 'counter')).register(prefix='x*', eventTypes=['set'], mode='sync', executionPoolSize=1)").ok()
+    for i in range(100):
+        env.cmd('set', 'x%d' % i, '1')
+    env.expect('get', 'counter').equal('100')
+
+    # 0 keeps no execution, each run gets a new one
+    env.expect('RG.PYEXECUTE', "GB('CommandReader').flatmap(lambda x: x[1:]).countby(lambda x: x).register(trigger='unpooled', executionPoolSize=0)").ok()
+    for i in range(10):
+        env.expect('RG.TRIGGER', 'unpooled', 'a', 'a').equal(["{'key': 'a', 'value': 2}"])
+
+def testRegisterWithBadExecutionPoolSize(env):
+    env.skipOnCluster()
+    env.expect('RG.PYEXECUTE', "GB('CommandReader').register(trigger='pooled', executionPoolSize=-1)").error().contains('executionPoolSize argument must be a non negative number')
+    env.expect('RG.PYEXECUTE', "GB('CommandReader').register(trigger='pooled', executionPoolSize='1')").error().contains('executionPoolSize argument must be a number')
+
+def testWindowStreamReaderRegistration(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    env.expect('RG.PYEXECUTE', "GB('StreamReader').window(1000, 0, lambda a, r: a + float(r['value']['v']))."
+                               "foreach(lambda w: execute('hset', 'windows', str(w['start']), str(w['value'])))."
+                               "register('s')").ok()
+
+    conn.execute_command('xadd', 's', '1000-0', 'v', '0.25')
+    conn.execute_command('xadd', 's', '1500-0', 'v', '0.5')
+
+    try:
+        with TimeLimit(4):
+            while len([e for e in env.cmd('RG.DUMPEXECUTIONS') if e[3] == 'done']) < 2:
+                time.sleep(0.1)
+    except Exception as e:
+        env.assertTrue(False, message='Failed waiting for the executions to finish')
+
+    # the open window is kept between the executions and saved with the registration
+    env.cmd('DEBUG', 'RELOAD')
+    env.assertEqual(conn.execute_command('exists', 'windows'), 0)
+
+    conn.execute_command('xadd', 's', '2000-0', 'v', '1')
+    try:
+        with TimeLimit(4):
+            while conn.execute_command('hget', 'windows', '1000') is None:
+                time.sleep(0.1)
+    except Exception as e:
+        env.assertTrue(False, message='Failed waiting for the window to be emitted')
+    env.assertEqual(conn.execute_command('hget', 'windows', '1000'), '0.75')
+
+    registrations = env.cmd('RG.DUMPREGISTRATIONS')
+    for r in registrations:
+        env.expect('RG.UNREGISTER', r[1]).equal('OK')
+
+def waitForView(env, conn, viewKey, expected):
+    try:
+        with TimeLimit(4):
+            while conn.hgetall(viewKey) != expected:
+                time.sleep(0.1)
+    except Exception as e:
+        env.assertEqual(conn.hgetall(viewKey), expected)
+
+def testMaterializedView(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    conn.hset('product:1', 'category', 'a')
+    conn.hset('product:2', 'category', 'a')
+    conn.hset('product:3', 'category', 'b')
+    conn.set('product:4', 'not a hash')
+    conn.hset('other:1', 'category', 'a')
+
+    env.expect('RG.PYEXECUTE', "GB('KeysReader').materialize('view', groupField='category', prefix='product:*')").ok()
+
+    # the view is built in the background from the existing keys
+    waitForView(env, conn, 'view', {'a': '2', 'b': '1'})
+
+    # the events are applied as soon as they happen
+    conn.hset('product:5', 'category', 'b')
+    env.assertEqual(conn.hgetall('view'), {'a': '2', 'b': '2'})
+    conn.hset('product:1', 'category', 'b')
+    env.assertEqual(conn.hgetall('view'), {'a': '1', 'b': '3'})
+    conn.delete('product:2')
+    env.assertEqual(conn.hgetall('view'), {'b': '3'})
+    conn.hdel('product:3', 'category')
+    env.assertEqual(conn.hgetall('view'), {'b': '2'})
+
+    # the view is rebuilt after a flush
+    conn.flushall()
+    waitForView(env, conn, 'view', {})
+    conn.hset('product:6', 'category', 'c')
+    waitForView(env, conn, 'view', {'c': '1'})
+
+    registrations = env.cmd('RG.DUMPREGISTRATIONS')
+    for r in registrations:
+        env.expect('RG.UNREGISTER', r[1]).equal('OK')
+
+def testMaterializedViewSum(env):
+    env.skipOnCluster()
+    conn = getConnectionByEnv(env)
+    conn.hset('product:1', 'price', '1.5')
+    conn.hset('product:2', 'price', '2')
+    conn.hset('product:3', 'price', 'not a number')
+
+    env.expect('RG.PYEXECUTE', "GB('KeysReader').materialize('total', aggregation='sum', valueField='price', prefix='product:*')").ok()
+    waitForView(env, conn, 'total', {'all': '3.5'})
+
+    conn.hset('product:2', 'price', '3')
+    env.assertEqual(conn.hgetall('total'), {'all': '4.5'})
+    conn.hset('product:3', 'price', '0.25')
+    env.assertEqual(conn.hgetall('total'), {'all': '4.75'})
+    conn.delete('product:1')
+    env.assertEqual(conn.hgetall('total'), {'all': '3.25'})
+
+    registrations = env.cmd('RG.DUMPREGISTRATIONS')
+    for r in registrations:
+        env.expect('RG.UNREGISTER', r[1]).equal('OK')
+
+def testMaterializedViewCluster(env):
+    conn = getConnectionByEnv(env)
+    for i in range(100):
+        conn.hset('product:%d' % i, 'category', 'a')
+    env.expect('RG.PYEXECUTE', "GB('KeysReader').materialize('view', groupField='category', prefix='product:*')").ok()
+
+    # each shard keeps the view of its own keys on a key tagged with its hash tag
+    try:
+        with TimeLimit(4):
+            while True:
+                res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: int(x['value']['a'])).aggregate(0, lambda a, x: a + x, lambda a, x: a + x).run('view*')")
+                if res[0] == ['100']:
+                    break
+                time.sleep(0.1)
+    except Exception as e:
+        env.assertTrue(False, message='Failed waiting for the view to be built')
+
+    registrations = env.cmd('RG.DUMPREGISTRATIONS')
+    for r in registrations:
+        env.expect('RG.UNREGISTER', r[1]).equal('OK')
+
+def testMaterializedViewBadArgs(env):
+    env.expect('RG.PYEXECUTE', "GB('KeysReader').materialize('view', valueField='price')").error().contains('count view does not take a value field')
+    env.expect('RG.PYEXECUTE', "GB('KeysReader').materialize('view', aggregation='sum')").error().contains('sum view requires a value field')
+    env.expect('RG.PYEXECUTE', "GB('KeysReader').materialize('view', aggregation='avg')").error().contains('unknown view aggregation')
+    env.expect('RG.PYEXECUTE', "GB('KeysReader').materialize('view', eventTypes=['hset'])").error().contains('view can not be combined with eventTypes or keyTypes')
+
+def testRegistrationStepsStats(env):
+    env.skipOnCluster()
+    env.expect('RG.PYEXECUTE', "GB('CommandReader').flatmap(lambda x: x[1:]).register(trigger='stats')").ok()
+    registrations = env.cmd('RG.DUMPREGISTRATIONS')
+    env.assertEqual(registrations[0][10], 'StepsStats')
+    env.assertEqual(registrations[0][11], [])
+
+    for i in range(3):
+        env.cmd('RG.TRIGGER', 'stats', 'a', 'b')
+
+    # the stats of all the registration executions are summed
+    try:
+        with TimeLimit(2):
+            while True:
+                stats = env.cmd('RG.DUMPREGISTRATIONS')[0][11]
+                if len(stats) > 0 and stats[-1][5] == 3:
+                    break
+                time.sleep(0.1)
+    except Exception as e:
+        env.assertTrue(False, message='Failed waiting for the registration stats')
+    env.assertEqual([s[1] for s in stats], ['collect', 'map', 'flatmap', 'reader'])
+    env.assertEqual([s[5] for s in stats], [6, 6, 6, 3]) # records_out
+
+    registrations = env.cmd('RG.DUMPREGISTRATIONS')
+    for r in registrations:
+        env.expect('RG.UNREGISTER', r[1]).equal('OK')
+
+def testLargeRegistration(env):
+    env.skipOnCluster()
+    script = '''
+big = 'x' * (3 * 1024 * 1024)
+GB('CommandReader').map(lambda x: len(big)).register(trigger='big')
+'''
+    env.expect('RG.PYEXECUTE', script).ok()
+    env.expect('RG.TRIGGER', 'big').equal([str(3 * 1024 * 1024)])
+
+    # the large plan is saved to and loaded from the rdb
+    env.cmd('DEBUG', 'RELOAD')
+    env.expect('RG.TRIGGER', 'big').equal([str(3 * 1024 * 1024)])
+
+    registrations = env.cmd('RG.DUMPREGISTRATIONS')
+    for r in registrations:
+        env.expect('RG.UNREGISTER', r[1]).equal('OK')
+
+def testLargeRegistrationCluster(env):
+    conn = getConnectionByEnv(env)
+    script = '''
+big = 'x' * (3 * 1024 * 1024)
+GB().foreach(lambda x: execute('set', 'len{%s}' % hashtag(), str(len(big)))).register(prefix='trigger*', mode='async_local')
+'''
+    env.expect('RG.PYEXECUTE', script).ok()
+    time.sleep(0.5) # wait for the registration to reach all the shards
+
+    # the registration was sent to all the shards, each of them runs it on its own keys
+    for i in range(20):
+        conn.execute_command('set', 'trigger%d' % i, '1')
+    try:
+        with TimeLimit(4):
+            while True:
+                res = env.cmd('RG.PYEXECUTE', "GB().map(lambda x: x['value']).run('len*')")
+                if len(res[0]) > 0 and set(res[0]) == set([str(3 * 1024 * 1024)]):
+                    break
+                time.sleep(0.1)
+    except Exception as e:
+        env.assertTrue(False, message='Failed waiting for the registration to run')
+
+    registrations = env.cmd('RG.DUMPREGISTRATIONS')
+    for r in registrations:
+        env.expect('RG.UNREGISTER', r[1]).equal('OK')
@@ -46,6 +46,19 @@ def createKeysOnlyReader(pattern='*', count=1000, noScan=False, patternGenerator
                 yield k
     return keysOnlyReader
 
+def createComparator(reverse, key):
+    '''
+    Create a compare function for the sort and topk steps from a python style
+    sort arguments.
+    '''
+    def compare(a, b):
+        if key is not None:
+            a = key(a)
+            b = key(b)
+        res = (a > b) - (a < b)
+        return -res if reverse else res
+    return compare
+
 def shardReaderCallback():
     res = execute('RG.INFOCLUSTER')
     if res == 'no cluster mode':
@@ -97,9 +110,7 @@ class GearsBuilder():
         '''
         Count the number of records in the execution
         '''
-        self.gearsCtx.accumulate(lambda a, r: 1 + (a if a else 0))
-        self.gearsCtx.collect()
-        self.gearsCtx.accumulate(lambda a, r: r + (a if a else 0))
+        self.gearsCtx.builtinaggregate('count')
         return self
 
     def countby(self, extractor=lambda x: x):
@@ -107,22 +118,41 @@ class GearsBuilder():
         Count, for each key, the number of recors contains this key.
         extractor - a function that get as input the record and return the key by which to perform the counting
         '''
-        self.aggregateby(extractor, 0, lambda k, a, r: 1 + a, lambda k, a, r: r + a)
+        self.gearsCtx.builtincountby(lambda x: extractor(x))
+        return self
+
+    def sort(self, reverse=True, key=None):
+        '''
+        Sorting the data, each shard sorts its own records and the initiator merges them.
+        reverse - when False sort in descending order (ascending by default)
+        key - a function that gets the record and return the value to sort by
+        '''
+        # sort used to return the sorted list from its end, so the records always came out
+        # in ascending order with the default reverse=True, keep it that way.
+        self.gearsCtx.sort(createComparator(not reverse, key))
+        self.gearsCtx.collect()
         return self
 
-    def sort(self, reverse=True):
+    def topk(self, k, reverse=False, key=None):
         '''
-        Sorting the data
+        Keep only the first k records of the sorted data (the k largest by default),
+        only k records of each shard are sent to the initiator.
+        k - the number of records to keep
+        reverse - same as sort, when False sort in descending order (keep the k largest)
+                  and when True in ascending order (keep the k smallest)
+        key - a function that gets the record and return the value to sort by
         '''
-        self.aggregate([], lambda a, r: a + [r], lambda a, r: a + r)
-        self.map(lambda r: sorted(r, reverse=reverse))
-        self.flatmap(lambda r: r)
+        self.gearsCtx.topk(k, createComparator(not reverse, key))
+        self.gearsCtx.collect()
+        self.gearsCtx.limit(k)
         return self
 
     def distinct(self):
         '''
         Keep only the distinct values in the data
         '''
+        # python objects are compared with python equality, use builtinaggregate('distinct')
+        # to compare ints, floats and strings natively.
         return self.aggregate(set(), lambda a, r: a | set([r]), lambda a, r: a | r).flatmap(lambda x: list(x))
 
     def avg(self, extractor=lambda x: float(x)):
@@ -130,16 +160,62 @@ class GearsBuilder():
         Calculating average on all the records
         extractor - a function that gets the record and return the value by which to calculate the average
         '''
-        # we aggregate using a tupple, the first entry is the sum of all the elements,
-        # the second element is the amount of elements.
-        # After the aggregate phase we just devide the sum in the amount of elements and get the avg.
-        return self.map(extractor).aggregate((0, 0),
-                                             lambda a, r: (a[0] + r, a[1] + 1),
-                                             lambda a, r: (a[0] + r[0], a[1] + r[1])).map(lambda x: x[0] / x[1])
+        # the sum and the count are accumulated natively, only the extractor runs in python.
+        self.map(extractor)
+        self.gearsCtx.builtinaggregate('avg')
+        return self
+
+    def approxcountdistinct(self):
+        '''
+        Estimate the number of distinct records using a HyperLogLog sketch
+        (~0.8% standard error), only the sketches are sent to the initiator.
+        '''
+        self.gearsCtx.builtinaggregate('approxcountdistinct')
+        return self
 
-    def run(self, arg=None, convertToStr=True, collect=True, **kargs):
+    def approxquantiles(self, quantiles, extractor=lambda x: float(x)):
+        '''
+        Approximate the given quantiles using a t-digest sketch, returns a list with the
+        value of each quantile. Only the sketches are sent to the initiator.
+        quantiles - a list of numbers between 0 and 1
+        extractor - a function that gets the record and return the value
+        '''
+        self.map(extractor)
+        self.gearsCtx.builtinquantiles(list(quantiles))
+        return self
+
+    def join(self, pattern, extractor, buildExtractor=lambda r: r['key'], broadcast=False):
+        '''
+        Inner join the records with the records of the keys that match the given pattern,
+        each result is {'key': <join key>, 'left': <record>, 'right': <joined key record>}.
+        pattern - the keys to join with, read like the KeysReader reads them
+        extractor - a function that gets a record and return its join key
+        buildExtractor - a function that gets a joined key record and return its join key
+        broadcast - send the joined keys records to all the shards instead of repartitioning
+                    both sides, should be used when there are only a few of them
+        '''
+        self.gearsCtx.join(pattern, lambda r: extractor(r), lambda r: buildExtractor(r), broadcast)
+        return self
+
+    def window(self, size, zero, accumulator, slide=None, extractor=lambda r: r['id']):
+        '''
+        Aggregate the records into time windows, a window is emitted once a record with a time
+        at or after its end arrives. The open windows are kept between the executions of a
+        registration (and saved on the StreamReader registrations rdb).
+        Each window is emitted as {'start': <ms>, 'end': <ms>, 'value': <aggregated value>}.
+        size - the window size in milliseconds
+        zero - the first value that will pass to the aggregation function
+        accumulator - a function that gets the window value and the record and return the new value
+        slide - start a new window every slide milliseconds (default to size, i.e. tumbling windows)
+        extractor - a function that gets the record and return its time, a stream id or milliseconds
+        '''
+        self.gearsCtx.window(size, size if slide is None else slide, lambda r: extractor(r), lambda a, r: accumulator(a if a is not None else zero, r))
+        return self
+
+    def run(self, arg=None, convertToStr=True, collect=True, timeout=None, **kargs):
         '''
         Starting the execution
+        timeout - cancel the execution if it did not finish within the given milliseconds
         '''
         if(convertToStr):
             self.gearsCtx.map(lambda x: str(x))
@@ -150,7 +226,7 @@ class GearsBuilder():
             arg = shardReaderCallback
         if(self.realReader == 'KeysOnlyReader'):
             arg = createKeysOnlyReader(arg, **kargs)
-        self.gearsCtx.run(arg, **kargs)
+        self.gearsCtx.run(arg, timeout=timeout, **kargs)
 
     def register(self, prefix='*', convertToStr=True, collect=True, **kargs):
         if(convertToStr):
@@ -163,6 +239,19 @@ class GearsBuilder():
             kargs['prefix'] = kargs['regex']
         self.gearsCtx.register(**kargs)
 
+    def materialize(self, viewKey, aggregation='count', groupField=None, valueField=None, prefix='*', **kargs):
+        '''
+        Register a materialized view, the aggregation of the hash keys that match the prefix is kept
+        in the viewKey hash (a field per group) and updated natively on each key event.
+        viewKey - the name of the hash key that holds the view
+        aggregation - 'count' or 'sum'
+        groupField - the hash field to group the keys by, None aggregates all the keys into the 'all' field
+        valueField - the hash field to sum (sum only)
+        prefix - the prefix of the keys to aggregate
+        '''
+        kargs['view'] = (viewKey, aggregation, groupField, valueField)
+        self.register(prefix=prefix, convertToStr=False, collect=False, **kargs)
+
 def createDecorator(f):
     def deco(self, *args):
         f(self.gearsCtx, *args)
@@ -60,11 +60,21 @@ typedef enum MsgType{
     SEND_MSG, CLUSTER_REFRESH_MSG, CLUSTER_SET_MSG
 }MsgType;
 
+/*
+ * The message payload is shared by all the nodes it is sent to and by their pending
+ * messages (kept for resending), it is freed when the last of them is freed.
+ * The ref count is only touched on the cluster thread.
+ */
+typedef struct SendMsgPayload{
+    size_t refCount;
+    size_t len;
+    char data[];
+}SendMsgPayload;
+
 typedef struct SendMsg{
     char idToSend[REDISMODULE_NODE_ID_LEN + 1];
     char* function;
-    char* msg;
-    size_t msgLen;
+    SendMsgPayload* payload;
 }SendMsg;
 
 typedef struct ClusterRefreshMsg{
@@ -123,12 +133,19 @@ typedef struct SentMessages{
     size_t sizes[5];
     char* args[5];
     size_t retries;
+    SendMsgPayload* payload; // args[3] points to its data
 }SentMessages;
 
+static void SendMsgPayload_Release(SendMsgPayload* payload){
+    if(--payload->refCount == 0){
+        RG_FREE(payload);
+    }
+}
+
 static void SentMessages_Free(void* ptr){
     SentMessages* msg = ptr;
     RG_FREE(msg->args[2]);
-    RG_FREE(msg->args[3]);
+    SendMsgPayload_Release(msg->payload);
     RG_FREE(msg->args[4]);
     RG_FREE(msg);
 }
@@ -511,7 +528,7 @@ static void Cluster_FreeMsg(Msg* msg){
     switch(msg->type){
     case SEND_MSG:
         RG_FREE(msg->sendMsg.function);
-        RG_FREE(msg->sendMsg.msg);
+        SendMsgPayload_Release(msg->sendMsg.payload);
         break;
     case CLUSTER_REFRESH_MSG:
     case CLUSTER_SET_MSG:
@@ -531,9 +548,10 @@ static void Cluster_SendMsgToNode(Node* node, SendMsg* msg){
     sentMsg->sizes[1] = strlen(sentMsg->args[1]);
     sentMsg->args[2] = RG_STRDUP(msg->function);
     sentMsg->sizes[2] = strlen(sentMsg->args[2]);
-    sentMsg->args[3] = RG_ALLOC(sizeof(char) * msg->msgLen);
-    memcpy(sentMsg->args[3], msg->msg, msg->msgLen);
-    sentMsg->sizes[3] = msg->msgLen;
+    sentMsg->payload = msg->payload;
+    ++sentMsg->payload->refCount;
+    sentMsg->args[3] = sentMsg->payload->data;
+    sentMsg->sizes[3] = sentMsg->payload->len;
 
     RedisModuleString *msgIdStr = RedisModule_CreateStringFromLongLong(NULL, node->msgId++);
     size_t msgIdStrLen;
@@ -653,9 +671,10 @@ void Cluster_SendMsg(const char* id, char* function, char* msg, size_t len){
         msgStruct->sendMsg.idToSend[0] = '\0';
     }
     msgStruct->sendMsg.function = RG_STRDUP(function);
-    msgStruct->sendMsg.msg = RG_ALLOC(len);
-    memcpy(msgStruct->sendMsg.msg, msg, len);
-    msgStruct->sendMsg.msgLen = len;
+    msgStruct->sendMsg.payload = RG_ALLOC(sizeof(SendMsgPayload) + len);
+    msgStruct->sendMsg.payload->refCount = 1;
+    msgStruct->sendMsg.payload->len = len;
+    memcpy(msgStruct->sendMsg.payload->data, msg, len);
     msgStruct->type = SEND_MSG;
     write(notify[1], &msgStruct, sizeof(Msg*));
 }
@@ -52,8 +52,35 @@ static void Command_ExecutionDone(ExecutionPlan* gearsCtx, void *privateData){
     RedisModule_FreeThreadSafeContext(rctx);
 }
 
+/*
+ * Reply with the next 'count' results and remove them from the execution.
+ * The reply is [results, errors, cursor], cursor is 0 once the execution is done
+ * and all its results were taken, errors are only returned at this point.
+ */
+static void Command_ReturnResultsCursor(ExecutionPlan* gearsCtx, RedisModuleCtx *ctx, long long count){
+	// check done before taking the results, so no results can be added after we took them
+	bool isDone = RedisGears_IsDone(gearsCtx);
+	Record** records = ExecutionPlan_TakeResults(gearsCtx, array_new(Record*, count), count);
+	bool isExhausted = isDone && RedisGears_GetRecordsLen(gearsCtx) == 0;
+
+	RedisModule_ReplyWithArray(ctx, 3);
+	RedisModule_ReplyWithArray(ctx, array_len(records));
+	for(size_t i = 0 ; i < array_len(records) ; ++i){
+		Command_ReturnResult(ctx, records[i]);
+		// the chunk was sent, no need to hold it any longer
+		RedisGears_FreeRecord(records[i]);
+	}
+	array_free(records);
+	if(isExhausted){
+		Command_ReturnErrors(gearsCtx, ctx);
+	}else{
+		RedisModule_ReplyWithArray(ctx, 0);
+	}
+	RedisModule_ReplyWithLongLong(ctx, isExhausted ? 0 : 1);
+}
+
 int Command_GetResults(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
-	if(argc < 2){
+	if(argc != 2 && argc != 4){
 		return RedisModule_WrongArity(ctx);
 	}
 
@@ -65,6 +92,21 @@ int Command_GetResults(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
 		return REDISMODULE_OK;
 	}
 
+	if(argc == 4){
+		const char* arg = RedisModule_StringPtrLen(argv[2], NULL);
+		long long count;
+		if(strcasecmp(arg, "CURSOR") != 0){
+			RedisModule_ReplyWithError(ctx, "unknown argument given");
+			return REDISMODULE_OK;
+		}
+		if(RedisModule_StringToLongLong(argv[3], &count) != REDISMODULE_OK || count <= 0){
+			RedisModule_ReplyWithError(ctx, "cursor count must be a positive number");
+			return REDISMODULE_OK;
+		}
+		Command_ReturnResultsCursor(gearsCtx, ctx, count);
+		return REDISMODULE_OK;
+	}
+
 	if(!RedisGears_IsDone(gearsCtx)){
 		RedisModule_ReplyWithError(ctx, "execution is still running");
 		return REDISMODULE_OK;
@@ -122,8 +164,9 @@ Record* Command_AbortExecutionMap(ExecutionCtx* rctx, Record *data, void* arg){
             LockHandler_Release(ctx);
             return RedisGears_StringRecordCreate(RG_STRDUP("OK"), strlen("OK"));
         }
+        // execution is running, stop its reader and drop the records that were already read
+        ExecutionPlan_Cancel(gearsCtx, EXECUTION_ABORTED_MSG);
 #ifdef WITHPYTHON
-        // execution is running
         unsigned long threadID = (unsigned long)gearsCtx->executionPD;
         LockHandler_Release(ctx);
 
@@ -55,6 +55,13 @@ typedef struct RedisGears_Config{
     ConfigVal downloadDeps;
     ConfigVal foreceDownloadDepsOnEnterprise;
     ConfigVal sendMsgRetries;
+    ConfigVal executionBatchSize;
+    ConfigVal executionParallelism;
+    ConfigVal executionMemoryBudget;
+    ConfigVal executionSpillDir;
+    ConfigVal executionArena;
+    ConfigVal recordsPool;
+    ConfigVal profileSampleRate;
 }RedisGears_Config;
 
 typedef const ConfigVal* (*GetValueCallback)();
@@ -313,6 +320,141 @@ static bool ConfigVal_PythonInstallReqMaxIdleTimeSet(ArgsIterator* iter){
     }
 }
 
+static const ConfigVal* ConfigVal_ExecutionBatchSizeGet(){
+    return &DefaultGearsConfig.executionBatchSize;
+}
+
+static bool ConfigVal_ExecutionBatchSizeSet(ArgsIterator* iter){
+    RedisModuleString* val = ArgsIterator_Next(iter);
+    if(!val) return false;
+    long long n;
+
+    if (RedisModule_StringToLongLong(val, &n) == REDISMODULE_OK) {
+        if(n <= 0){
+            return false;
+        }
+        DefaultGearsConfig.executionBatchSize.val.longVal = n;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static const ConfigVal* ConfigVal_ExecutionParallelismGet(){
+    return &DefaultGearsConfig.executionParallelism;
+}
+
+static bool ConfigVal_ExecutionParallelismSet(ArgsIterator* iter){
+    RedisModuleString* val = ArgsIterator_Next(iter);
+    if(!val) return false;
+    long long n;
+
+    if (RedisModule_StringToLongLong(val, &n) == REDISMODULE_OK) {
+        if(n <= 0){
+            return false;
+        }
+        DefaultGearsConfig.executionParallelism.val.longVal = n;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static const ConfigVal* ConfigVal_ExecutionMemoryBudgetGet(){
+    return &DefaultGearsConfig.executionMemoryBudget;
+}
+
+static bool ConfigVal_ExecutionMemoryBudgetSet(ArgsIterator* iter){
+    RedisModuleString* val = ArgsIterator_Next(iter);
+    if(!val) return false;
+    long long n;
+
+    if (RedisModule_StringToLongLong(val, &n) == REDISMODULE_OK) {
+        if(n < 0){
+            return false;
+        }
+        DefaultGearsConfig.executionMemoryBudget.val.longVal = n;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static const ConfigVal* ConfigVal_ExecutionSpillDirGet(){
+    return &DefaultGearsConfig.executionSpillDir;
+}
+
+static bool ConfigVal_ExecutionSpillDirSet(ArgsIterator* iter){
+    RedisModuleString* val = ArgsIterator_Next(iter);
+    if(!val){
+        return false;
+    }
+    RG_FREE(DefaultGearsConfig.executionSpillDir.val.str);
+    const char* valStr = RedisModule_StringPtrLen(val, NULL);
+    DefaultGearsConfig.executionSpillDir.val.str = RG_STRDUP(valStr);
+    return true;
+}
+
+static const ConfigVal* ConfigVal_RecordsPoolGet(){
+    return &DefaultGearsConfig.recordsPool;
+}
+
+static bool ConfigVal_RecordsPoolSet(ArgsIterator* iter){
+    RedisModuleString* val = ArgsIterator_Next(iter);
+    if(!val) return false;
+    long long n;
+
+    if (RedisModule_StringToLongLong(val, &n) == REDISMODULE_OK) {
+        if(n != 0 && n != 1){
+            return false;
+        }
+        DefaultGearsConfig.recordsPool.val.longVal = n;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static const ConfigVal* ConfigVal_ExecutionArenaGet(){
+    return &DefaultGearsConfig.executionArena;
+}
+
+static bool ConfigVal_ExecutionArenaSet(ArgsIterator* iter){
+    RedisModuleString* val = ArgsIterator_Next(iter);
+    if(!val) return false;
+    long long n;
+
+    if (RedisModule_StringToLongLong(val, &n) == REDISMODULE_OK) {
+        if(n != 0 && n != 1){
+            return false;
+        }
+        DefaultGearsConfig.executionArena.val.longVal = n;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static const ConfigVal* ConfigVal_ProfileSampleRateGet(){
+    return &DefaultGearsConfig.profileSampleRate;
+}
+
+static bool ConfigVal_ProfileSampleRateSet(ArgsIterator* iter){
+    RedisModuleString* val = ArgsIterator_Next(iter);
+    if(!val) return false;
+    long long n;
+
+    if (RedisModule_StringToLongLong(val, &n) == REDISMODULE_OK) {
+        if(n < 0 || n > 1000){
+            return false;
+        }
+        DefaultGearsConfig.profileSampleRate.val.longVal = n;
+        return true;
+    } else {
+        return false;
+    }
+}
+
 static Gears_dict* Gears_ExtraConfig = NULL;
 
 static Gears_ConfigVal Gears_ConfigVals[] = {
@@ -400,6 +542,48 @@ static Gears_ConfigVal Gears_ConfigVals[] = {
         .setter = ConfigVal_SendMsgRetriesSet,
         .configurableAtRunTime = true,
     },
+    {
+        .name = "ExecutionBatchSize",
+        .getter = ConfigVal_ExecutionBatchSizeGet,
+        .setter = ConfigVal_ExecutionBatchSizeSet,
+        .configurableAtRunTime = true,
+    },
+    {
+        .name = "ExecutionParallelism",
+        .getter = ConfigVal_ExecutionParallelismGet,
+        .setter = ConfigVal_ExecutionParallelismSet,
+        .configurableAtRunTime = true,
+    },
+    {
+        .name = "ExecutionMemoryBudget",
+        .getter = ConfigVal_ExecutionMemoryBudgetGet,
+        .setter = ConfigVal_ExecutionMemoryBudgetSet,
+        .configurableAtRunTime = true,
+    },
+    {
+        .name = "ExecutionSpillDir",
+        .getter = ConfigVal_ExecutionSpillDirGet,
+        .setter = ConfigVal_ExecutionSpillDirSet,
+        .configurableAtRunTime = false,
+    },
+    {
+        .name = "ExecutionArena",
+        .getter = ConfigVal_ExecutionArenaGet,
+        .setter = ConfigVal_ExecutionArenaSet,
+        .configurableAtRunTime = true,
+    },
+    {
+        .name = "RecordsPool",
+        .getter = ConfigVal_RecordsPoolGet,
+        .setter = ConfigVal_RecordsPoolSet,
+        .configurableAtRunTime = false,
+    },
+    {
+        .name = "ProfileSampleRate",
+        .getter = ConfigVal_ProfileSampleRateGet,
+        .setter = ConfigVal_ProfileSampleRateSet,
+        .configurableAtRunTime = true,
+    },
     {
         NULL,
     },
@@ -596,6 +780,34 @@ long long GearsConfig_SendMsgRetries(){
     return DefaultGearsConfig.sendMsgRetries.val.longVal;
 }
 
+long long GearsConfig_ExecutionBatchSize(){
+    return DefaultGearsConfig.executionBatchSize.val.longVal;
+}
+
+long long GearsConfig_ExecutionParallelism(){
+    return DefaultGearsConfig.executionParallelism.val.longVal;
+}
+
+long long GearsConfig_ExecutionMemoryBudget(){
+    return DefaultGearsConfig.executionMemoryBudget.val.longVal;
+}
+
+const char* GearsConfig_ExecutionSpillDir(){
+    return DefaultGearsConfig.executionSpillDir.val.str;
+}
+
+long long GearsConfig_ExecutionArena(){
+    return DefaultGearsConfig.executionArena.val.longVal;
+}
+
+long long GearsConfig_RecordsPool(){
+    return DefaultGearsConfig.recordsPool.val.longVal;
+}
+
+long long GearsConfig_ProfileSampleRate(){
+    return DefaultGearsConfig.profileSampleRate.val.longVal;
+}
+
 long long GearsConfig_PythonInstallReqMaxIdleTime(){
     return DefaultGearsConfig.executionMaxIdleTime.val.longVal;
 }
@@ -695,6 +907,34 @@ int GearsConfig_Init(RedisModuleCtx* ctx, RedisModuleString** argv, int argc){
             .val.longVal = 3,
             .type = LONG,
         },
+        .executionBatchSize = {
+            .val.longVal = 100,
+            .type = LONG,
+        },
+        .executionParallelism = {
+            .val.longVal = 1,
+            .type = LONG,
+        },
+        .executionMemoryBudget = {
+            .val.longVal = 0,
+            .type = LONG,
+        },
+        .executionSpillDir = {
+            .val.str = RG_STRDUP("/tmp"),
+            .type = STR,
+        },
+        .executionArena = {
+            .val.longVal = 0,
+            .type = LONG,
+        },
+        .recordsPool = {
+            .val.longVal = 1,
+            .type = LONG,
+        },
+        .profileSampleRate = {
+            .val.longVal = 0,
+            .type = LONG,
+        },
     };
 
     Gears_ExtraConfig = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
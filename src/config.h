@@ -23,6 +23,13 @@ long long GearsConfig_ForceDownloadDepsOnEnterprise();
 long long GearsConfig_ExecutionThreads();
 long long GearsConfig_ExecutionMaxIdleTime();
 long long GearsConfig_SendMsgRetries();
+long long GearsConfig_ExecutionBatchSize();
+long long GearsConfig_ExecutionParallelism();
+long long GearsConfig_ExecutionMemoryBudget();
+const char* GearsConfig_ExecutionSpillDir();
+long long GearsConfig_ExecutionArena();
+long long GearsConfig_RecordsPool();
+long long GearsConfig_ProfileSampleRate();
 long long GearsConfig_PythonInstallReqMaxIdleTime();
 const char* GearsConfig_GetExtraConfigVals(const char* key);
 const char* GearsConfig_GetPythonInstallationDir();
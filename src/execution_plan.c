@@ -11,12 +11,17 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <time.h>
+#include <limits.h>
 #include "redisgears.h"
 #include "redisgears_memory.h"
 #include <event2/event.h>
 #include "lock_handler.h"
+#include "profiler.h"
 #include "utils/thpool.h"
 #include "version.h"
+#ifdef WITHPYTHON
+#include "redisgears_python.h"
+#endif
 
 #define INIT_TIMER  struct timespec _ts = {0}, _te = {0}; \
                     bool timerInitialized = false;
@@ -35,6 +40,17 @@
                             } \
                         }
 #define DURATION2MS(d)  (long long)(d/(long long)1000000)
+#define DURATION2US(d)  (long long)(d/(long long)1000)
+
+// per record timer, used for the steps latency histogram
+#define INIT_RECORD_TIMER   struct timespec _rs = {0}, _re = {0}; \
+                            bool recordTimer = GearsConfig_GetProfileExecutions();
+#define START_RECORD_TIMER  if(recordTimer) GETTIME(&_rs);
+#define ADD_RECORD_LATENCY(s)   if(recordTimer){ \
+                                    GETTIME(&_re); \
+                                    ExecutionStep_AddLatency(s, (long long)1000000000 * (_re.tv_sec - _rs.tv_sec) \
+                                                                + (_re.tv_nsec - _rs.tv_nsec)); \
+                                }
 
 char* stepsNames[] = {
 #define X(a, b) b,
@@ -99,6 +115,271 @@ static ArgType LimitArgType = {
         .deserialize = LimitArgDeserialize,
 };
 
+typedef struct WindowAccumulator{
+    long long start;
+    Record* accumulator;
+}WindowAccumulator;
+
+/*
+ * Window step argument, the windows state lives here and not on the execution step
+ * so it survives from one execution of the registration to the next.
+ * The records kept on the state are allocated from the heap and never from an execution arena.
+ */
+typedef struct WindowExecutionStepArg{
+    long long sizeMS;
+    long long slideMS;
+    char* accumulateName;
+    ExecutionStepArg accumulateArg;
+    pthread_mutex_t lock;
+    long long watermark; // the latest record time seen so far
+    long long closedUntil; // windows that ends at or before this time were already emitted
+    WindowAccumulator* windows; // open windows ordered by their start time
+    size_t lateRecords; // records that arrived after all their windows were closed
+    Gears_Buffer* snapshot; // serialized windows state for rdb save, only replaced under the redis lock
+}WindowExecutionStepArg;
+
+static WindowExecutionStepArg* WindowArgCreate(long long sizeMS, long long slideMS, const char* accumulateName, void* accumulateArg){
+    WindowExecutionStepArg* ret = RG_ALLOC(sizeof(*ret));
+    *ret = (WindowExecutionStepArg){
+        .sizeMS = sizeMS,
+        .slideMS = slideMS,
+        .accumulateName = RG_STRDUP(accumulateName),
+        .accumulateArg = {
+                .stepArg = accumulateArg,
+                .type = AccumulatesMgmt_GetArgType(accumulateName),
+        },
+        .watermark = LLONG_MIN,
+        .closedUntil = LLONG_MIN,
+        .windows = array_new(WindowAccumulator, 10),
+        .lateRecords = 0,
+        .snapshot = NULL,
+    };
+    pthread_mutex_init(&ret->lock, NULL);
+    return ret;
+}
+
+static void FreeWindowArg(void* arg){
+    WindowExecutionStepArg* windowArg = arg;
+    for(size_t i = 0 ; i < array_len(windowArg->windows) ; ++i){
+        RedisGears_FreeRecord(windowArg->windows[i].accumulator);
+    }
+    array_free(windowArg->windows);
+    if(windowArg->accumulateArg.stepArg && windowArg->accumulateArg.type && windowArg->accumulateArg.type->free){
+        windowArg->accumulateArg.type->free(windowArg->accumulateArg.stepArg);
+    }
+    if(windowArg->snapshot){
+        Gears_BufferFree(windowArg->snapshot);
+    }
+    pthread_mutex_destroy(&windowArg->lock);
+    RG_FREE(windowArg->accumulateName);
+    RG_FREE(windowArg);
+}
+
+static void* DupWindowArg(void* arg){
+    // only the definition is duplicated, the copy starts with no open windows
+    WindowExecutionStepArg* windowArg = arg;
+    void* accumulateArg = windowArg->accumulateArg.stepArg;
+    if(accumulateArg){
+        RedisModule_Assert(windowArg->accumulateArg.type && windowArg->accumulateArg.type->dup);
+        accumulateArg = windowArg->accumulateArg.type->dup(accumulateArg);
+    }
+    return WindowArgCreate(windowArg->sizeMS, windowArg->slideMS, windowArg->accumulateName, accumulateArg);
+}
+
+static int WindowArgSerialize(void* arg, Gears_BufferWriter* bw, char** err){
+    WindowExecutionStepArg* windowArg = arg;
+    RedisGears_BWWriteLong(bw, windowArg->sizeMS);
+    RedisGears_BWWriteLong(bw, windowArg->slideMS);
+    RedisGears_BWWriteString(bw, windowArg->accumulateName);
+    if(windowArg->accumulateArg.stepArg){
+        ArgType* type = windowArg->accumulateArg.type;
+        RedisModule_Assert(type && type->serialize);
+        RedisGears_BWWriteLong(bw, 1); // has accumulator arg
+        RedisGears_BWWriteLong(bw, type->version);
+        return type->serialize(windowArg->accumulateArg.stepArg, bw, err);
+    }
+    RedisGears_BWWriteLong(bw, 0); // no accumulator arg
+    return REDISMODULE_OK;
+}
+
+#define windowArgVersion 1
+
+static void* WindowArgDeserialize(FlatExecutionPlan* fep, Gears_BufferReader* br, int version, char** err){
+    if(version > windowArgVersion){
+        return NULL;
+    }
+    long long sizeMS = RedisGears_BRReadLong(br);
+    long long slideMS = RedisGears_BRReadLong(br);
+    const char* accumulateName = RedisGears_BRReadString(br);
+    void* accumulateArg = NULL;
+    if(RedisGears_BRReadLong(br)){
+        int argVersion = RedisGears_BRReadLong(br);
+        ArgType* type = AccumulatesMgmt_GetArgType(accumulateName);
+        if(!type || !type->deserialize){
+            *err = RG_STRDUP("Failed deserialize window accumulator argument");
+            return NULL;
+        }
+        accumulateArg = type->deserialize(fep, br, argVersion, err);
+        if(!accumulateArg){
+            return NULL;
+        }
+    }
+    return WindowArgCreate(sizeMS, slideMS, accumulateName, accumulateArg);
+}
+
+static ArgType WindowArgType = {
+        .free = FreeWindowArg,
+        .dup = DupWindowArg,
+        .serialize = WindowArgSerialize,
+        .deserialize = WindowArgDeserialize,
+};
+
+/*
+ * A callback name and its argument, the argument type is taken from the callback registration.
+ */
+typedef struct JoinCallback{
+    char* name;
+    ExecutionStepArg arg;
+}JoinCallback;
+
+typedef struct JoinSourceExecutionStepArg{
+    char* buildPattern;
+    JoinCallback probeExtractor;
+    JoinCallback buildExtractor;
+    JoinCallback buildMapper; // optional, applied on the build side records before the extractor
+    bool broadcast;
+}JoinSourceExecutionStepArg;
+
+static JoinCallback JoinCallbackCreate(const char* name, void* arg, ArgType* (*getArgType)(const char*)){
+    return (JoinCallback){
+        .name = name ? RG_STRDUP(name) : NULL,
+        .arg = {
+                .stepArg = arg,
+                .type = name ? getArgType(name) : NULL,
+        },
+    };
+}
+
+static void JoinCallbackFree(JoinCallback* callback){
+    if(callback->arg.stepArg && callback->arg.type && callback->arg.type->free){
+        callback->arg.type->free(callback->arg.stepArg);
+    }
+    if(callback->name){
+        RG_FREE(callback->name);
+    }
+}
+
+static JoinCallback JoinCallbackDup(JoinCallback* callback, ArgType* (*getArgType)(const char*)){
+    void* arg = callback->arg.stepArg;
+    if(arg){
+        RedisModule_Assert(callback->arg.type && callback->arg.type->dup);
+        arg = callback->arg.type->dup(arg);
+    }
+    return JoinCallbackCreate(callback->name, arg, getArgType);
+}
+
+static int JoinCallbackSerialize(JoinCallback* callback, Gears_BufferWriter* bw, char** err){
+    if(!callback->name){
+        RedisGears_BWWriteLong(bw, 0); // no callback
+        return REDISMODULE_OK;
+    }
+    RedisGears_BWWriteLong(bw, 1); // has callback
+    RedisGears_BWWriteString(bw, callback->name);
+    if(!callback->arg.stepArg){
+        RedisGears_BWWriteLong(bw, 0); // no callback arg
+        return REDISMODULE_OK;
+    }
+    ArgType* type = callback->arg.type;
+    RedisModule_Assert(type && type->serialize);
+    RedisGears_BWWriteLong(bw, 1); // has callback arg
+    RedisGears_BWWriteLong(bw, type->version);
+    return type->serialize(callback->arg.stepArg, bw, err);
+}
+
+static int JoinCallbackDeserialize(FlatExecutionPlan* fep, JoinCallback* callback, Gears_BufferReader* br,
+                                   ArgType* (*getArgType)(const char*), char** err){
+    *callback = (JoinCallback){0};
+    if(!RedisGears_BRReadLong(br)){
+        return REDISMODULE_OK;
+    }
+    const char* name = RedisGears_BRReadString(br);
+    void* arg = NULL;
+    if(RedisGears_BRReadLong(br)){
+        int version = RedisGears_BRReadLong(br);
+        ArgType* type = getArgType(name);
+        if(!type || !type->deserialize){
+            *err = RG_STRDUP("Failed deserialize join callback argument");
+            return REDISMODULE_ERR;
+        }
+        arg = type->deserialize(fep, br, version, err);
+        if(!arg){
+            return REDISMODULE_ERR;
+        }
+    }
+    *callback = JoinCallbackCreate(name, arg, getArgType);
+    return REDISMODULE_OK;
+}
+
+static void FreeJoinSourceArg(void* arg){
+    JoinSourceExecutionStepArg* joinArg = arg;
+    JoinCallbackFree(&joinArg->probeExtractor);
+    JoinCallbackFree(&joinArg->buildExtractor);
+    JoinCallbackFree(&joinArg->buildMapper);
+    RG_FREE(joinArg->buildPattern);
+    RG_FREE(joinArg);
+}
+
+static void* DupJoinSourceArg(void* arg){
+    JoinSourceExecutionStepArg* joinArg = arg;
+    JoinSourceExecutionStepArg* ret = RG_ALLOC(sizeof(*ret));
+    *ret = (JoinSourceExecutionStepArg){
+        .buildPattern = RG_STRDUP(joinArg->buildPattern),
+        .probeExtractor = JoinCallbackDup(&joinArg->probeExtractor, ExtractorsMgmt_GetArgType),
+        .buildExtractor = JoinCallbackDup(&joinArg->buildExtractor, ExtractorsMgmt_GetArgType),
+        .buildMapper = JoinCallbackDup(&joinArg->buildMapper, MapsMgmt_GetArgType),
+        .broadcast = joinArg->broadcast,
+    };
+    return ret;
+}
+
+static int JoinSourceArgSerialize(void* arg, Gears_BufferWriter* bw, char** err){
+    JoinSourceExecutionStepArg* joinArg = arg;
+    RedisGears_BWWriteString(bw, joinArg->buildPattern);
+    RedisGears_BWWriteLong(bw, joinArg->broadcast);
+    if(JoinCallbackSerialize(&joinArg->probeExtractor, bw, err) != REDISMODULE_OK){
+        return REDISMODULE_ERR;
+    }
+    if(JoinCallbackSerialize(&joinArg->buildExtractor, bw, err) != REDISMODULE_OK){
+        return REDISMODULE_ERR;
+    }
+    return JoinCallbackSerialize(&joinArg->buildMapper, bw, err);
+}
+
+#define joinSourceArgVersion 1
+
+static void* JoinSourceArgDeserialize(FlatExecutionPlan* fep, Gears_BufferReader* br, int version, char** err){
+    if(version > joinSourceArgVersion){
+        return NULL;
+    }
+    JoinSourceExecutionStepArg* joinArg = RG_CALLOC(1, sizeof(*joinArg));
+    joinArg->buildPattern = RG_STRDUP(RedisGears_BRReadString(br));
+    joinArg->broadcast = RedisGears_BRReadLong(br);
+    if(JoinCallbackDeserialize(fep, &joinArg->probeExtractor, br, ExtractorsMgmt_GetArgType, err) != REDISMODULE_OK ||
+       JoinCallbackDeserialize(fep, &joinArg->buildExtractor, br, ExtractorsMgmt_GetArgType, err) != REDISMODULE_OK ||
+       JoinCallbackDeserialize(fep, &joinArg->buildMapper, br, MapsMgmt_GetArgType, err) != REDISMODULE_OK){
+        FreeJoinSourceArg(joinArg);
+        return NULL;
+    }
+    return joinArg;
+}
+
+static ArgType JoinSourceArgType = {
+        .free = FreeJoinSourceArg,
+        .dup = DupJoinSourceArg,
+        .serialize = JoinSourceArgSerialize,
+        .deserialize = JoinSourceArgDeserialize,
+};
+
 typedef struct ExecutionPlansData{
     // protected by mutex, mutex must be acquire when access those vars
     Gears_dict* epDict;
@@ -116,6 +397,7 @@ static long long lastEPId = 0;
 static long long lastFEPId = 0;
 
 static Record* ExecutionPlan_NextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx);
+static ExecutionStepBatch* ExecutionPlan_NextBatch(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx);
 static ExecutionPlan* ExecutionPlan_New(FlatExecutionPlan* fep, ExecutionMode mode, void* arg);
 static FlatExecutionReader* FlatExecutionPlan_NewReader(char* reader);
 static void ExecutionPlan_RegisterForRun(ExecutionPlan* ep);
@@ -127,6 +409,7 @@ static void FlatExecutionPlan_SetID(FlatExecutionPlan* fep, char* id);
 static FlatExecutionPlan* FlatExecutionPlan_ShallowCopy(FlatExecutionPlan* fep);
 static void ExecutionPlan_MessageThreadMain(void *arg);
 static void ExecutionPlan_FreeWorkerInternal(WorkerData* wd);
+static void ExecutionPlan_FreeRaw(ExecutionPlan* ep);
 
 typedef enum MsgType{
     RUN_MSG, ADD_RECORD_MSG, SHARD_COMPLETED_MSG, EXECUTION_DONE, EXECUTION_TERMINATE, WORKER_FREE
@@ -153,6 +436,7 @@ typedef struct AddRecordWorkerMsg{
 	Record* record;
 	size_t stepId;
 	enum StepType stepType;
+	char senderId[REDISMODULE_NODE_ID_LEN]; // only set for collect records
 }AddRecordWorkerMsg;
 
 typedef struct WorkerMsg{
@@ -283,6 +567,13 @@ static ArgType* FlatExecutionPlan_GetArgTypeByStepType(enum StepType type, const
         return NULL;
     case LIMIT:
         return &LimitArgType;
+    case SORT:
+    case TOPK:
+        return ComparesMgmt_GetArgType(name);
+    case WINDOW:
+        return &WindowArgType;
+    case JOIN_SOURCE:
+        return &JoinSourceArgType;
     default:
         return NULL;
     }
@@ -439,6 +730,10 @@ static const char* FlatExecutionPlan_SerializeInternal(FlatExecutionPlan* fep, s
         RedisGears_BWWriteLong(&bw, 0); // no onExecutionStartStep
     }
 
+    // optional trailing fields, older versions simply do not read them
+    RedisGears_BWWriteLong(&bw, fep->executionPoolMaxSize);
+    RedisGears_BWWriteLong(&bw, fep->executionTimeout);
+
     if(len){
         *len = fep->serializedFep->size;
     }
@@ -595,6 +890,14 @@ static int FlatExecutionPlan_DeserializeInternal(FlatExecutionPlan* ret, const c
         };
     }
 
+    if(br.location < buff.size){
+        ret->executionPoolMaxSize = RedisGears_BRReadLong(&br);
+    }
+
+    if(br.location < buff.size){
+        ret->executionTimeout = RedisGears_BRReadLong(&br);
+    }
+
     // we need to deserialize the fep now so we will have the deserialize clean version of it.
     // it might changed after to something we can not serialize
     const char* d = FlatExecutionPlan_SerializeInternal(ret, NULL, NULL);
@@ -675,328 +978,2124 @@ static void ExecutionPlan_Distribute(ExecutionPlan* ep){
         RedisGears_BWWriteString(&bw, ep->assignWorker->pool->name);
     }
 
+    RedisGears_BWWriteLong(&bw, ep->timeout);
+
     Cluster_SendMsgM(NULL, ExecutionPlan_OnReceived, buff->buff, buff->size);
     Gears_BufferFree(buff);
 }
 
-static Record* ExecutionPlan_FilterNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
-    Record* record = NULL;
-    INIT_TIMER;
-    while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx))){
-        if(record == &StopRecord){
-            return record;
-        }
-        if(RedisGears_RecordGetType(record) == errorRecordType){
-            return record;
-        }
-	    START_TIMER;
-        ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
-        bool filterRes = step->filter.filter(&ectx, record, step->filter.stepArg.stepArg);
-        if(ectx.err){
-            RedisGears_FreeRecord(record);
-            record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
-            goto end;
-        }
-        if(filterRes){
-            goto end;
-        }else{
-            RedisGears_FreeRecord(record);
+static void ExecutionStepBatch_Add(ExecutionStepBatch* batch, Record* record){
+    if(batch->len == batch->cap){
+        batch->cap = batch->cap ? batch->cap * 2 : GearsConfig_ExecutionBatchSize();
+        batch->records = RG_REALLOC(batch->records, batch->cap * sizeof(Record*));
+    }
+    batch->records[batch->len++] = record;
+}
+
+static void ExecutionStepBatch_Clear(ExecutionStepBatch* batch){
+    // free the records that was produced but never consumed
+    for(size_t i = batch->index ; i < batch->len ; ++i){
+        if(batch->records[i] != &StopRecord){
+            RedisGears_FreeRecord(batch->records[i]);
         }
     }
-    record = NULL;
-end:
-	ADD_DURATION(step->executionDuration);
-    return record;
+    batch->len = 0;
+    batch->index = 0;
+    batch->isDone = false;
 }
 
-static Record* ExecutionPlan_MapNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
-    Record* record = ExecutionPlan_NextRecord(ep, step->prev, rctx);
+static void ExecutionStepBatch_Free(ExecutionStepBatch* batch){
+    ExecutionStepBatch_Clear(batch);
+    if(batch->records){
+        RG_FREE(batch->records);
+    }
+}
 
-    INIT_TIMER;
-	START_TIMER;
-	if(record == NULL){
-        goto end;
+static bool ExecutionStep_IsBatched(ExecutionStep* step){
+    switch(step->type){
+    case READER:
+    case MAP:
+    case FLAT_MAP:
+    case FILTER:
+    case FOREACH:
+    case FUSED:
+    case PARALLEL:
+        return true;
+    default:
+        return false;
     }
-    if(record == &StopRecord){
-    	goto end;
+}
+
+static void ExecutionStepStats_Reset(ExecutionStepStats* stats){
+    Gears_Histogram* latency = stats->latency;
+    *stats = (ExecutionStepStats){0};
+    if(latency){
+        memset(latency, 0, sizeof(*latency));
+        stats->latency = latency;
     }
-    if(RedisGears_RecordGetType(record) == errorRecordType){
-        goto end;
+}
+
+static void ExecutionStepStats_Free(ExecutionStepStats* stats){
+    if(stats->latency){
+        Gears_HistogramFree(stats->latency);
+        stats->latency = NULL;
     }
-    if(record != NULL){
-        ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
-        record = step->map.map(&ectx, record, step->map.stepArg.stepArg);
-        if(ectx.err){
-            if(record){
-                RedisGears_FreeRecord(record);
-            }
-            record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+}
+
+static void ExecutionStepStats_Merge(ExecutionStepStats* dst, ExecutionStepStats* src){
+    dst->recordsOut += src->recordsOut;
+    dst->bytesSerialized += src->bytesSerialized;
+    dst->lockWaitDuration += src->lockWaitDuration;
+    if(src->latency){
+        if(!dst->latency){
+            dst->latency = Gears_HistogramCreate();
         }
+        Gears_HistogramMerge(dst->latency, src->latency);
     }
-end:
-	ADD_DURATION(step->executionDuration);
-    return record;
 }
 
-static Record* ExecutionPlan_FlatMapNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
-	Record* r = NULL;
+static void ExecutionStep_AddLatency(ExecutionStep* step, long long duration){
+    if(!step->stats.latency){
+        step->stats.latency = Gears_HistogramCreate();
+    }
+    Gears_HistogramRecord(step->stats.latency, duration > 0 ? duration : 0);
+}
 
-    INIT_TIMER;
-	if(step->flatMap.pendings){
-        START_TIMER;
-        r = RedisGears_ListRecordPop(step->flatMap.pendings);
-        if(RedisGears_ListRecordLen(step->flatMap.pendings) == 0){
-            RedisGears_FreeRecord(step->flatMap.pendings);
-            step->flatMap.pendings = NULL;
+/*
+ * Readers return records in batches, each record is accounted with the batch average.
+ */
+static void ExecutionStep_AddReadLatency(ExecutionStep* step, long long duration, size_t len){
+    if(!GearsConfig_GetProfileExecutions() || len == 0){
+        return;
+    }
+    for(size_t i = 0 ; i < len ; ++i){
+        ExecutionStep_AddLatency(step, duration / (long long)len);
+    }
+}
+
+/*
+ * Count the records the step produced, the StopRecord is not a real record.
+ */
+static void ExecutionStep_CountRecordsOut(ExecutionStep* step, Record** records, size_t len){
+    for(size_t i = 0 ; i < len ; ++i){
+        if(records[i] != &StopRecord){
+            ++step->stats.recordsOut;
         }
-        goto end;
     }
-    do{
-        if(r){
-            // if we reach here r is an empty list record
-            RedisGears_FreeRecord(r);
+}
+
+void ExecutionPlan_Cancel(ExecutionPlan* ep, const char* reason){
+    const char* expected = NULL;
+    __atomic_compare_exchange_n(&ep->cancelReason, &expected, reason, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+bool ExecutionPlan_IsCancelled(ExecutionPlan* ep){
+    return __atomic_load_n(&ep->cancelReason, __ATOMIC_RELAXED) != NULL;
+}
+
+#define EXECUTION_TIMEOUT_REACHED_MSG "Execution timeout reached"
+
+/*
+ * Sync executions run on the main thread so the timeout timer can not fire while they run,
+ * the reader also checks the deadline on each batch.
+ */
+static void ExecutionPlan_CheckDeadline(ExecutionPlan* ep){
+    if(ep->deadline && RedisModule_Milliseconds() >= ep->deadline){
+        ExecutionPlan_Cancel(ep, EXECUTION_TIMEOUT_REACHED_MSG);
+    }
+}
+
+/*
+ * Run the map callback on each record of the previous step batch.
+ * On flatmap, list records returned by the callback are flattened into the batch.
+ * Error records and the StopRecord are passed as is.
+ * A NULL return value (without an error) means the step is depleted, same as in
+ * the single record flow.
+ */
+static void ExecutionPlan_MapNextBatch(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx, bool flatten){
+    ExecutionStepBatch* prevBatch = ExecutionPlan_NextBatch(ep, step->prev, rctx);
+
+    INIT_TIMER;
+    INIT_RECORD_TIMER;
+    START_TIMER;
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    for(; prevBatch->index < prevBatch->len ; ++prevBatch->index){
+        Record* record = prevBatch->records[prevBatch->index];
+        if(record == &StopRecord || RedisGears_RecordGetType(record) == errorRecordType){
+            ExecutionStepBatch_Add(&step->batch, record);
+            continue;
         }
-        r = ExecutionPlan_MapNextRecord(ep, step, rctx);
-        START_TIMER;
-        if(r == NULL){
-            goto end;
+        if(ExecutionPlan_IsCancelled(ep)){
+            RedisGears_FreeRecord(record);
+            continue;
         }
-        if(r == &StopRecord){
-            goto end;
+        START_RECORD_TIMER;
+        record = step->map.map(&ectx, record, step->map.stepArg.stepArg);
+        ADD_RECORD_LATENCY(step);
+        if(ectx.err){
+            if(record){
+                RedisGears_FreeRecord(record);
+            }
+            record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+            ectx.err = NULL;
         }
-        if(RedisGears_RecordGetType(r) == errorRecordType){
-            goto end;
+        if(!record){
+            ++prevBatch->index;
+            step->batch.isDone = true;
+            break;
         }
-        if(RedisGears_RecordGetType(r) != listRecordType){
-            goto end;
+        if(flatten && RedisGears_RecordGetType(record) == listRecordType){
+            while(RedisGears_ListRecordLen(record) > 0){
+                ExecutionStepBatch_Add(&step->batch, RedisGears_ListRecordPop(record));
+            }
+            RedisGears_FreeRecord(record);
+            continue;
         }
-    	ADD_DURATION(step->executionDuration);
-    }while(RedisGears_ListRecordLen(r) == 0);
-    START_TIMER;
-    if(RedisGears_ListRecordLen(r) == 1){
-        Record* ret;
-        ret = RedisGears_ListRecordPop(r);
-        RedisGears_FreeRecord(r);
-        r = ret;
-        goto end;
+        ExecutionStepBatch_Add(&step->batch, record);
     }
-    step->flatMap.pendings = r;
-    r = RedisGears_ListRecordPop(step->flatMap.pendings);
-end:
-	ADD_DURATION(step->executionDuration);
-    return r;
+    ADD_DURATION(step->executionDuration);
 }
 
-static Record* ExecutionPlan_ExtractKeyNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
-    size_t buffLen;
-    Record* r = NULL;
-    Record* record = ExecutionPlan_NextRecord(ep, step->prev, rctx);
+static void ExecutionPlan_FilterNextBatch(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    ExecutionStepBatch* prevBatch = ExecutionPlan_NextBatch(ep, step->prev, rctx);
 
     INIT_TIMER;
+    INIT_RECORD_TIMER;
     START_TIMER;
-    if(record == NULL){
-        goto end;
-    }
-    if(record == &StopRecord){
-    	r = record;
-    	goto end;
-    }
-    if(RedisGears_RecordGetType(record) == errorRecordType){
-        r = record;
-        goto end;
-    }
     ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
-    char* buff = step->extractKey.extractor(&ectx, record, step->extractKey.extractorArg.stepArg, &buffLen);
-    if(ectx.err){
-        RedisGears_FreeRecord(record);
-        r = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
-        goto end;
+    for(; prevBatch->index < prevBatch->len ; ++prevBatch->index){
+        Record* record = prevBatch->records[prevBatch->index];
+        if(record != &StopRecord && RedisGears_RecordGetType(record) != errorRecordType){
+            if(ExecutionPlan_IsCancelled(ep)){
+                RedisGears_FreeRecord(record);
+                continue;
+            }
+            START_RECORD_TIMER;
+            bool filterRes = step->filter.filter(&ectx, record, step->filter.stepArg.stepArg);
+            ADD_RECORD_LATENCY(step);
+            if(ectx.err){
+                RedisGears_FreeRecord(record);
+                record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+                ectx.err = NULL;
+            }else if(!filterRes){
+                RedisGears_FreeRecord(record);
+                continue;
+            }
+        }
+        ExecutionStepBatch_Add(&step->batch, record);
     }
-    r = RedisGears_KeyRecordCreate();
-    RedisGears_KeyRecordSetKey(r, buff, buffLen);
-    RedisGears_KeyRecordSetVal(r, record);
-end:
-	ADD_DURATION(step->executionDuration);
-    return r;
+    ADD_DURATION(step->executionDuration);
 }
 
-static Record* ExecutionPlan_GroupNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
-#define GROUP_RECORD_INIT_LEN 10
-    Record* record = NULL;
+static void ExecutionPlan_ForEachNextBatch(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    ExecutionStepBatch* prevBatch = ExecutionPlan_NextBatch(ep, step->prev, rctx);
 
     INIT_TIMER;
-    if(step->group.isGrouped){
-        if(array_len(step->group.groupedRecords) == 0){
-            return NULL;
+    INIT_RECORD_TIMER;
+    START_TIMER;
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    for(; prevBatch->index < prevBatch->len ; ++prevBatch->index){
+        Record* record = prevBatch->records[prevBatch->index];
+        if(record != &StopRecord && RedisGears_RecordGetType(record) != errorRecordType){
+            if(ExecutionPlan_IsCancelled(ep)){
+                RedisGears_FreeRecord(record);
+                continue;
+            }
+            START_RECORD_TIMER;
+            step->forEach.forEach(&ectx, record, step->forEach.stepArg.stepArg);
+            ADD_RECORD_LATENCY(step);
+            if(ectx.err){
+                RedisGears_FreeRecord(record);
+                record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+                ectx.err = NULL;
+            }
         }
-        return array_pop(step->group.groupedRecords);
+        ExecutionStepBatch_Add(&step->batch, record);
     }
-    while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx))){
+    ADD_DURATION(step->executionDuration);
+}
+
+/*
+ * Count a record that passes as is through the fused steps, starting at 'stepIndex'.
+ */
+static void ExecutionPlan_FusedCountPassed(ExecutionStep* step, size_t stepIndex){
+    for(size_t i = stepIndex ; i < array_len(step->fused.steps) ; ++i){
+        ++step->fused.steps[i]->stats.recordsOut;
+    }
+}
+
+/*
+ * Run a single record through the fused steps, starting at 'stepIndex'.
+ * Returns false if one of the steps is depleted (a map returned NULL without an error).
+ */
+static bool ExecutionPlan_FusedRunRecord(ExecutionPlan* ep, ExecutionStep* step, ExecutionCtx* ectx, Record* record, size_t stepIndex){
+    INIT_TIMER;
+    LockHandlerWaitScope lockScope;
+    for(size_t i = stepIndex ; i < array_len(step->fused.steps) ; ++i){
+        ExecutionStep* s = step->fused.steps[i];
+        bool filtered = false;
         START_TIMER;
-        if(record == &StopRecord){
-            goto end;
+        if(timerInitialized){
+            LockHandler_WaitScopeStart(&lockScope);
         }
-        if(RedisGears_RecordGetType(record) == errorRecordType){
-            goto end;
+        bool sampled = Profiler_PushStep(stepsNames[s->type]);
+        switch(s->type){
+        case MAP:
+        case FLAT_MAP:
+            record = s->map.map(ectx, record, s->map.stepArg.stepArg);
+            break;
+        case FILTER:
+            filtered = !s->filter.filter(ectx, record, s->filter.stepArg.stepArg) && !ectx->err;
+            break;
+        case FOREACH:
+            s->forEach.forEach(ectx, record, s->forEach.stepArg.stepArg);
+            break;
+        default:
+            RedisModule_Assert(false);
         }
-        RedisModule_Assert(RedisGears_RecordGetType(record) == keyRecordType);
-        size_t keyLen;
-        char* key = RedisGears_KeyRecordGetKey(record, &keyLen);
-        Gears_dictEntry* entry = Gears_dictFind(step->group.d, key);
-        Record* r = NULL;
-        if(!entry){
-            r = RedisGears_KeyRecordCreate();
-            RedisGears_KeyRecordSetKey(r, key, keyLen);
+        if(sampled){
+            Profiler_PopStep();
+        }
+        ADD_DURATION(s->executionDuration);
+        if(timerInitialized){
+            ExecutionStep_AddLatency(s, DURATION);
+            s->stats.lockWaitDuration += LockHandler_WaitScopeEnd(&lockScope);
+        }
+        if(filtered){
+            RedisGears_FreeRecord(record);
+            return true;
+        }
+        if(ectx->err){
+            if(record){
+                RedisGears_FreeRecord(record);
+            }
+            record = RG_ErrorRecordCreate(ectx->err, strlen(ectx->err) + 1);
+            ectx->err = NULL;
+            ExecutionPlan_FusedCountPassed(step, i);
+            break; // error records are not passed to the rest of the steps
+        }
+        if(!record){
+            return false;
+        }
+        if(s->type == FLAT_MAP && RedisGears_RecordGetType(record) == listRecordType){
+            bool res = true;
+            s->stats.recordsOut += RedisGears_ListRecordLen(record);
+            while(res && RedisGears_ListRecordLen(record) > 0){
+                res = ExecutionPlan_FusedRunRecord(ep, step, ectx, RedisGears_ListRecordPop(record), i + 1);
+            }
+            RedisGears_FreeRecord(record);
+            return res;
+        }
+        ++s->stats.recordsOut;
+    }
+    ExecutionStepBatch_Add(&step->batch, record);
+    return true;
+}
+
+static void ExecutionPlan_FusedNextBatch(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    ExecutionStepBatch* prevBatch = ExecutionPlan_NextBatch(ep, step->prev, rctx);
+
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    for(; prevBatch->index < prevBatch->len ; ++prevBatch->index){
+        Record* record = prevBatch->records[prevBatch->index];
+        if(record == &StopRecord || RedisGears_RecordGetType(record) == errorRecordType){
+            if(record != &StopRecord){
+                ExecutionPlan_FusedCountPassed(step, 0);
+            }
+            ExecutionStepBatch_Add(&step->batch, record);
+            continue;
+        }
+        if(ExecutionPlan_IsCancelled(ep)){
+            RedisGears_FreeRecord(record);
+            continue;
+        }
+#ifdef WITHPYTHON
+        // take the python GIL once for all the steps instead of once per step
+        PythonSessionCtx* oldSession = NULL;
+        if(step->fused.lockPython){
+            oldSession = RedisGearsPy_Lock(ep->fep->PD);
+        }
+#endif
+        bool res = ExecutionPlan_FusedRunRecord(ep, step, &ectx, record, 0);
+#ifdef WITHPYTHON
+        if(step->fused.lockPython){
+            RedisGearsPy_Unlock(oldSession);
+        }
+#endif
+        if(!res){
+            ++prevBatch->index;
+            step->batch.isDone = true;
+            break;
+        }
+    }
+}
+
+static void ExecutionPlan_ReaderNextBatch(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    // a proxy reader might run on a helper thread, the shared reader keeps track of errors for it
+    if(!step->reader.isProxy && array_len(ep->errors) > 0){
+        return;
+    }
+    ExecutionPlan_CheckDeadline(ep);
+    if(ExecutionPlan_IsCancelled(ep)){
+        // stop reading, only the first reader to notice reports the error
+        if(!__atomic_exchange_n(&ep->cancelReported, true, __ATOMIC_SEQ_CST)){
+            const char* reason = ep->cancelReason;
+            ExecutionStepBatch_Add(&step->batch, RG_ErrorRecordCreate(RG_STRDUP(reason), strlen(reason)));
+        }
+        step->batch.isDone = true;
+        return;
+    }
+    size_t batchSize = GearsConfig_ExecutionBatchSize();
+    Reader* r = step->reader.r;
+
+    // always timed, the reader duration is part of the steps stats
+    struct timespec _ts, _te;
+    GETTIME(&_ts);
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    if(step->reader.hasExtensions && r->nextBatch){
+        if(step->batch.cap < batchSize){
+            step->batch.cap = batchSize;
+            step->batch.records = RG_REALLOC(step->batch.records, step->batch.cap * sizeof(Record*));
+        }
+        step->batch.len = r->nextBatch(&ectx, r->ctx, step->batch.records, batchSize);
+        if(step->batch.len == 0){
+            step->batch.isDone = true;
+        }
+    }else{
+        // single record reader, pull records one by one
+        while(step->batch.len < batchSize){
+            Record* record = r->next(&ectx, r->ctx);
+            if(!record){
+                step->batch.isDone = true;
+                break;
+            }
+            ExecutionStepBatch_Add(&step->batch, record);
+        }
+    }
+    if(ectx.err){
+        ExecutionStepBatch_Add(&step->batch, RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1));
+        step->batch.isDone = true;
+    }
+    GETTIME(&_te);
+    step->executionDuration += DURATION;
+    if(!step->reader.isProxy){
+        ExecutionStep_AddReadLatency(step, DURATION, step->batch.len);
+    }
+}
+
+/*
+ * State shared between the execution thread and the helper workers of a parallel step.
+ * Helpers that were queued on the pool might start after the step was reset or freed,
+ * so the context is ref counted and helpers only touch the step while counted as running.
+ */
+typedef struct ParallelWorkersCtx{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Record*** pendingBatches;
+    size_t runningWorkers;
+    size_t refCount;
+    bool readerDone;
+    bool stopped;
+}ParallelWorkersCtx;
+
+typedef struct ParallelWorkerArg{
+    ExecutionPlan* ep;
+    ExecutionStep* step;
+    ParallelWorkersCtx* workersCtx;
+    size_t worker;
+}ParallelWorkerArg;
+
+#define PARALLEL_MAX_PENDING_BATCHES_PER_WORKER 2
+
+static ParallelWorkersCtx* ParallelWorkersCtx_Create(){
+    ParallelWorkersCtx* ret = RG_ALLOC(sizeof(*ret));
+    pthread_mutex_init(&ret->lock, NULL);
+    pthread_cond_init(&ret->cond, NULL);
+    ret->pendingBatches = array_new(Record**, 10);
+    ret->runningWorkers = 0;
+    ret->refCount = 1;
+    ret->readerDone = false;
+    ret->stopped = false;
+    return ret;
+}
+
+static void ParallelWorkersCtx_FreeBatch(Record** records){
+    for(size_t i = 0 ; i < array_len(records) ; ++i){
+        RedisGears_FreeRecord(records[i]);
+    }
+    array_free(records);
+}
+
+static void ParallelWorkersCtx_Unref(ParallelWorkersCtx* wctx){
+    pthread_mutex_lock(&wctx->lock);
+    bool last = (--wctx->refCount == 0);
+    pthread_mutex_unlock(&wctx->lock);
+    if(!last){
+        return;
+    }
+    RedisModule_Assert(array_len(wctx->pendingBatches) == 0);
+    array_free(wctx->pendingBatches);
+    pthread_cond_destroy(&wctx->cond);
+    pthread_mutex_destroy(&wctx->lock);
+    RG_FREE(wctx);
+}
+
+/*
+ * The reader of each parallel worker prefix, reads the next batch from the shared reader.
+ * The shared reader takes the Redis lock under wctx->lock, so the lock order is
+ * wctx->lock and then the Redis lock, the steps callbacks must not wait for the other
+ * workers while holding the Redis lock (see the callbacks definition in redisgears.h).
+ */
+static size_t ExecutionPlan_ParallelReaderNextBatch(ExecutionCtx* ectx, void* ctx, Record** batch, size_t len){
+    ExecutionStep* step = ctx;
+    ParallelWorkersCtx* wctx = step->parallel.workersCtx;
+    ExecutionStep* readerStep = step->prev;
+    Reader* r = readerStep->reader.r;
+    size_t n = 0;
+
+    pthread_mutex_lock(&wctx->lock);
+    if(!wctx->readerDone){
+        struct timespec _ts, _te;
+        LockHandlerWaitScope lockScope;
+        LockHandler_WaitScopeStart(&lockScope);
+        GETTIME(&_ts);
+        if(readerStep->reader.hasExtensions && r->nextBatch){
+            n = r->nextBatch(ectx, r->ctx, batch, len);
+        }else{
+            for(Record* record = NULL ; n < len && (record = r->next(ectx, r->ctx)) ; ){
+                batch[n++] = record;
+            }
+        }
+        GETTIME(&_te);
+        readerStep->executionDuration += DURATION;
+        // the helpers copies of the reader are not counted, the shared reader step is
+        readerStep->stats.lockWaitDuration += LockHandler_WaitScopeEnd(&lockScope);
+        ExecutionStep_CountRecordsOut(readerStep, batch, n);
+        ExecutionStep_AddReadLatency(readerStep, DURATION, n);
+        if(n == 0 || ectx->err){
+            wctx->readerDone = true;
+        }
+        if(n == len){
+            step->parallel.fullBatchRead = true;
+        }
+    }
+    pthread_mutex_unlock(&wctx->lock);
+    return n;
+}
+
+/*
+ * Pull the next batch out of the given worker prefix.
+ * Return NULL when the prefix is depleted.
+ */
+static Record** ExecutionPlan_ParallelPrefixNextBatch(ExecutionPlan* ep, ExecutionStep* step, size_t worker, RedisModuleCtx* rctx){
+    ExecutionStepBatch* batch = ExecutionPlan_NextBatch(ep, step->parallel.prefixes[worker], rctx);
+    if(batch->len == 0){
+        return NULL;
+    }
+    Record** records = array_new(Record*, batch->len);
+    bool hasError = false;
+    for(; batch->index < batch->len ; ++batch->index){
+        Record* record = batch->records[batch->index];
+        if(RedisGears_RecordGetType(record) == errorRecordType){
+            hasError = true;
+        }
+        records = array_append(records, record);
+    }
+    if(hasError){
+        // stop reading on the first error, same as the single threaded flow
+        ParallelWorkersCtx* wctx = step->parallel.workersCtx;
+        pthread_mutex_lock(&wctx->lock);
+        wctx->readerDone = true;
+        pthread_mutex_unlock(&wctx->lock);
+    }
+    return records;
+}
+
+static void ExecutionPlan_ParallelWorkerMain(void* arg){
+    ParallelWorkerArg* pwArg = arg;
+    ExecutionPlan* ep = pwArg->ep;
+    ExecutionStep* step = pwArg->step;
+    ParallelWorkersCtx* wctx = pwArg->workersCtx;
+    size_t worker = pwArg->worker;
+    RG_FREE(pwArg);
+
+    pthread_mutex_lock(&wctx->lock);
+    if(wctx->stopped){
+        // the execution finished before we got a thread, the step might already be gone
+        pthread_mutex_unlock(&wctx->lock);
+        ParallelWorkersCtx_Unref(wctx);
+        return;
+    }
+    ++wctx->runningWorkers;
+    pthread_mutex_unlock(&wctx->lock);
+
+    size_t maxPendings = array_len(step->parallel.prefixes) * PARALLEL_MAX_PENDING_BATCHES_PER_WORKER;
+    RedisModuleCtx* rctx = RedisModule_GetThreadSafeContext(NULL);
+    Record** records = NULL;
+    while((records = ExecutionPlan_ParallelPrefixNextBatch(ep, step, worker, rctx))){
+        pthread_mutex_lock(&wctx->lock);
+        while(!wctx->stopped && array_len(wctx->pendingBatches) >= maxPendings){
+            pthread_cond_wait(&wctx->cond, &wctx->lock);
+        }
+        if(wctx->stopped){
+            pthread_mutex_unlock(&wctx->lock);
+            ParallelWorkersCtx_FreeBatch(records);
+            break;
+        }
+        wctx->pendingBatches = array_append(wctx->pendingBatches, records);
+        pthread_cond_broadcast(&wctx->cond);
+        pthread_mutex_unlock(&wctx->lock);
+    }
+    RedisModule_FreeThreadSafeContext(rctx);
+
+    pthread_mutex_lock(&wctx->lock);
+    --wctx->runningWorkers;
+    pthread_cond_broadcast(&wctx->cond);
+    pthread_mutex_unlock(&wctx->lock);
+    ParallelWorkersCtx_Unref(wctx);
+}
+
+static void ExecutionPlan_ParallelStartWorkers(ExecutionPlan* ep, ExecutionStep* step){
+    step->parallel.started = true;
+    ParallelWorkersCtx* wctx = step->parallel.workersCtx;
+    for(size_t i = 1 ; i < array_len(step->parallel.prefixes) ; ++i){
+        ParallelWorkerArg* pwArg = RG_ALLOC(sizeof(*pwArg));
+        *pwArg = (ParallelWorkerArg){.ep = ep, .step = step, .workersCtx = wctx, .worker = i};
+        pthread_mutex_lock(&wctx->lock);
+        ++wctx->refCount;
+        pthread_mutex_unlock(&wctx->lock);
+        Gears_thpool_add_work(ep->assignWorker->pool->pool, ExecutionPlan_ParallelWorkerMain, pwArg);
+    }
+}
+
+/*
+ * Stop the reading and wait for all the running helpers to finish.
+ * Helpers that did not yet started will notice the step was stopped and will exit.
+ * Must not be called while holding the Redis lock, a helper takes it under wctx->lock
+ * to read from the shared reader.
+ */
+static void ExecutionPlan_ParallelStop(ExecutionStep* step){
+    ParallelWorkersCtx* wctx = step->parallel.workersCtx;
+    pthread_mutex_lock(&wctx->lock);
+    wctx->stopped = true;
+    wctx->readerDone = true;
+    pthread_cond_broadcast(&wctx->cond);
+    while(wctx->runningWorkers > 0){
+        pthread_cond_wait(&wctx->cond, &wctx->lock);
+    }
+    while(array_len(wctx->pendingBatches) > 0){
+        ParallelWorkersCtx_FreeBatch(array_pop(wctx->pendingBatches));
+    }
+    pthread_mutex_unlock(&wctx->lock);
+}
+
+/*
+ * Drop the pending batches of a parallel step that is reset or freed, this might happen
+ * under the Redis lock (e.g. RG.ABORTEXECUTION of a paused execution) so the helpers are
+ * not waited for. They are already done at this point: ExecutionPlan_Execute stops them
+ * with ExecutionPlan_ParallelDone before the execution finishes, and the global steps only
+ * pause the execution after they read all the records of the parallel step, which ends only
+ * once all its helpers exited. Helpers that did not get a thread yet only check the stopped flag.
+ */
+static void ExecutionPlan_ParallelClear(ExecutionStep* step){
+    ParallelWorkersCtx* wctx = step->parallel.workersCtx;
+    pthread_mutex_lock(&wctx->lock);
+    RedisModule_Assert(wctx->runningWorkers == 0);
+    wctx->stopped = true;
+    wctx->readerDone = true;
+    while(array_len(wctx->pendingBatches) > 0){
+        ParallelWorkersCtx_FreeBatch(array_pop(wctx->pendingBatches));
+    }
+    pthread_mutex_unlock(&wctx->lock);
+}
+
+static void ExecutionPlan_ParallelNextBatch(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    ParallelWorkersCtx* wctx = step->parallel.workersCtx;
+    Record** records = NULL;
+    pthread_mutex_lock(&wctx->lock);
+    while(true){
+        if(array_len(wctx->pendingBatches) > 0){
+            records = array_pop(wctx->pendingBatches);
+            // wake up helpers that are waiting for room on the pending list
+            pthread_cond_broadcast(&wctx->cond);
+            break;
+        }
+        if(!step->parallel.mainDone){
+            // nothing is ready, instead of waiting lets run our own prefix
+            pthread_mutex_unlock(&wctx->lock);
+            records = ExecutionPlan_ParallelPrefixNextBatch(ep, step, 0, rctx);
+            if(!records){
+                step->parallel.mainDone = true;
+            }else if(!step->parallel.started && step->parallel.fullBatchRead && ep->mode != ExecutionModeSync){
+                // there is more then a single batch to read, lets bring some help.
+                // a pooled execution might be reused on sync mode, in which case we are holding the redis lock.
+                ExecutionPlan_ParallelStartWorkers(ep, step);
+            }
+            pthread_mutex_lock(&wctx->lock);
+            if(records){
+                break;
+            }
+            continue;
+        }
+        if(wctx->runningWorkers == 0){
+            // helpers that did not yet start have nothing left to read
+            wctx->stopped = true;
+            break;
+        }
+        pthread_cond_wait(&wctx->cond, &wctx->lock);
+    }
+    pthread_mutex_unlock(&wctx->lock);
+
+    if(!records){
+        return;
+    }
+    for(size_t i = 0 ; i < array_len(records) ; ++i){
+        ExecutionStepBatch_Add(&step->batch, records[i]);
+    }
+    array_free(records);
+}
+
+static void ExecutionPlan_ParallelAddDuration(ExecutionPlan* ep, ExecutionStep* es){
+    if(es->type == FUSED){
+        for(size_t i = 0 ; i < array_len(es->fused.steps) ; ++i){
+            ExecutionPlan_ParallelAddDuration(ep, es->fused.steps[i]);
+        }
+        return;
+    }
+    if(es->type == READER){
+        // the time spent on the shared reader is already accounted on the reader step
+        return;
+    }
+    ExecutionStep* original = ep->steps[es->stepId];
+    original->executionDuration += es->executionDuration;
+    es->executionDuration = 0;
+    ExecutionStepStats_Merge(&original->stats, &es->stats);
+    ExecutionStepStats_Reset(&es->stats);
+}
+
+/*
+ * Stop the parallel steps of a finished execution and add the time the helpers
+ * spent on their steps copies to the original steps.
+ */
+static void ExecutionPlan_ParallelDone(ExecutionPlan* ep){
+    for(ExecutionStep* es = ep->headStep ; es ; es = es->prev){
+        if(es->type != PARALLEL){
+            continue;
+        }
+        ExecutionPlan_ParallelStop(es);
+        for(size_t i = 1 ; i < array_len(es->parallel.prefixes) ; ++i){
+            for(ExecutionStep* s = es->parallel.prefixes[i] ; s ; s = s->prev){
+                ExecutionPlan_ParallelAddDuration(ep, s);
+            }
+        }
+    }
+}
+
+static Record* ExecutionPlan_ExtractKeyNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    size_t buffLen;
+    Record* r = NULL;
+    Record* record = ExecutionPlan_NextRecord(ep, step->prev, rctx);
+
+    INIT_TIMER;
+    START_TIMER;
+    if(record == NULL){
+        goto end;
+    }
+    if(record == &StopRecord){
+    	r = record;
+    	goto end;
+    }
+    if(RedisGears_RecordGetType(record) == errorRecordType){
+        r = record;
+        goto end;
+    }
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    char* buff = step->extractKey.extractor(&ectx, record, step->extractKey.extractorArg.stepArg, &buffLen);
+    if(ectx.err){
+        RedisGears_FreeRecord(record);
+        r = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+        goto end;
+    }
+    r = RedisGears_KeyRecordCreate();
+    RedisGears_KeyRecordSetKey(r, buff, buffLen);
+    RedisGears_KeyRecordSetVal(r, record);
+end:
+	ADD_DURATION(step->executionDuration);
+    return r;
+}
+
+#define GROUP_SPILL_PARTITIONS 16
+
+static void ExecutionStep_FreeAggTableVal(void* val){
+    RedisGears_FreeRecord(val);
+}
+
+static void ExecutionStep_FreeGroupPartitions(ExecutionStep* es){
+    if(!es->group.partitions){
+        return;
+    }
+    for(size_t i = 0 ; i < GROUP_SPILL_PARTITIONS ; ++i){
+        SpillFile_Free(es->group.partitions[i]);
+    }
+    RG_FREE(es->group.partitions);
+    es->group.partitions = NULL;
+    es->group.currPartition = 0;
+}
+
+/*
+ * Add a group (key record with a list value) to the groups table,
+ * if the key already exists the values are moved to the existing group.
+ */
+static void ExecutionPlan_GroupMerge(ExecutionStep* step, Record* group){
+    size_t keyLen;
+    char* key = RedisGears_KeyRecordGetKey(group, &keyLen);
+    bool isNew;
+    Record** slot = (Record**)Gears_AggTableFindOrAdd(step->group.groups, key, strlen(key), &isNew);
+    if(isNew){
+        *slot = group;
+        return;
+    }
+    Record* listRecord = RedisGears_KeyRecordGetVal(*slot);
+    Record* spilledList = RedisGears_KeyRecordGetVal(group);
+    while(RedisGears_ListRecordLen(spilledList) > 0){
+        RedisGears_ListRecordAdd(listRecord, RedisGears_ListRecordPop(spilledList));
+    }
+    RedisGears_FreeRecord(group);
+}
+
+/*
+ * Move all the groups to the partition files, groups of the same key always go to the same
+ * partition so each partition can later be loaded and merged on its own.
+ * Return an error record if the groups could not be written, those groups are kept in memory.
+ */
+static Record* ExecutionPlan_GroupSpill(ExecutionPlan* ep, ExecutionStep* step){
+    char* err = NULL;
+    if(!step->group.partitions){
+        SpillFile** partitions = RG_CALLOC(GROUP_SPILL_PARTITIONS, sizeof(SpillFile*));
+        for(size_t i = 0 ; i < GROUP_SPILL_PARTITIONS ; ++i){
+            partitions[i] = SpillFile_Create(&err);
+            if(!partitions[i]){
+                RedisModule_Log(NULL, "warning", "Failed creating spill file on %s, %s, group will be kept in memory", GearsConfig_ExecutionSpillDir(), err);
+                RG_FREE(err);
+                for(size_t j = 0 ; j < i ; ++j){
+                    SpillFile_Free(partitions[j]);
+                }
+                RG_FREE(partitions);
+                step->group.spillFailed = true;
+                return NULL;
+            }
+        }
+        step->group.partitions = partitions;
+    }
+
+    Record** failed = array_new(Record*, 10);
+    size_t pos = 0;
+    Record* r;
+    while((r = Gears_AggTableTakeNext(step->group.groups, &pos))){
+        size_t keyLen;
+        char* key = RedisGears_KeyRecordGetKey(r, &keyLen);
+        SpillFile* sf = step->group.partitions[Gears_dictGenHashFunction(key, strlen(key)) % GROUP_SPILL_PARTITIONS];
+        if(err || SpillFile_Write(sf, r, &err) != REDISMODULE_OK){
+            failed = array_append(failed, r);
+            continue;
+        }
+        RedisGears_FreeRecord(r);
+    }
+    Gears_AggTableClear(step->group.groups, ExecutionStep_FreeAggTableVal);
+    ep->bufferedMemory -= step->group.memoryUsage < ep->bufferedMemory ? step->group.memoryUsage : ep->bufferedMemory;
+    step->group.memoryUsage = 0;
+
+    Record* errRecord = NULL;
+    if(array_len(failed) > 0){
+        // the failed groups might share keys with groups that were already spilled,
+        // so the results will not be correct, report it and stop spilling.
+        for(size_t i = 0 ; i < array_len(failed) ; ++i){
+            ExecutionPlan_GroupMerge(step, failed[i]);
+        }
+        step->group.spillFailed = true;
+        char* msg;
+        rg_asprintf(&msg, "Failed spilling group records, %s", err ? err : "");
+        errRecord = RG_ErrorRecordCreate(msg, strlen(msg) + 1);
+    }
+    if(err){
+        RG_FREE(err);
+    }
+    array_free(failed);
+    return errRecord;
+}
+
+/*
+ * Return the next group, once the groups in memory are exhausted
+ * the spilled partitions are loaded one by one.
+ */
+static Record* ExecutionPlan_GroupTakeNext(ExecutionStep* step){
+    Record* r;
+    while(!(r = Gears_AggTableTakeNext(step->group.groups, &step->group.iterPos))){
+        if(!step->group.partitions || step->group.currPartition == GROUP_SPILL_PARTITIONS){
+            return NULL;
+        }
+        Gears_AggTableClear(step->group.groups, ExecutionStep_FreeAggTableVal);
+        step->group.iterPos = 0;
+        SpillFile* sf = step->group.partitions[step->group.currPartition++];
+        Record* spilled;
+        while((spilled = SpillFile_Read(sf))){
+            if(RedisGears_RecordGetType(spilled) == errorRecordType){
+                return spilled;
+            }
+            ExecutionPlan_GroupMerge(step, spilled);
+        }
+    }
+    return r;
+}
+
+static Record* ExecutionPlan_GroupNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+#define GROUP_RECORD_INIT_LEN 10
+    Record* record = NULL;
+
+    INIT_TIMER;
+    if(step->group.isGrouped){
+        return ExecutionPlan_GroupTakeNext(step);
+    }
+    bool hasBudget = GearsConfig_ExecutionMemoryBudget() > 0;
+    while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx))){
+        START_TIMER;
+        if(record == &StopRecord){
+            goto end;
+        }
+        if(RedisGears_RecordGetType(record) == errorRecordType){
+            goto end;
+        }
+        RedisModule_Assert(RedisGears_RecordGetType(record) == keyRecordType);
+        size_t keyLen;
+        char* key = RedisGears_KeyRecordGetKey(record, &keyLen);
+        bool isNew;
+        size_t size = 0;
+        Record** slot = (Record**)Gears_AggTableFindOrAdd(step->group.groups, key, strlen(key), &isNew);
+        if(isNew){
+            *slot = RedisGears_KeyRecordCreate();
+            RedisGears_KeyRecordSetKey(*slot, key, keyLen);
             RedisGears_KeyRecordSetKey(record, NULL, 0);
             Record* val  = RedisGears_ListRecordCreate(GROUP_RECORD_INIT_LEN);
-            RedisGears_KeyRecordSetVal(r, val);
-            Gears_dictAdd(step->group.d, key, r);
-            step->group.groupedRecords = array_append(step->group.groupedRecords, r);
-        }else{
-            r = Gears_dictGetVal(entry);
+            RedisGears_KeyRecordSetVal(*slot, val);
+            if(hasBudget){
+                size = RG_RecordEstimateMemory(*slot);
+            }
         }
+        Record* r = *slot;
         Record* listRecord = RedisGears_KeyRecordGetVal(r);
-        RedisGears_ListRecordAdd(listRecord, RedisGears_KeyRecordGetVal(record));
+        Record* val = RedisGears_KeyRecordGetVal(record);
+        if(hasBudget){
+            size += RG_RecordEstimateMemory(val) + sizeof(Record*);
+        }
+        RedisGears_ListRecordAdd(listRecord, val);
         RedisGears_KeyRecordSetVal(record, NULL);
         RedisGears_FreeRecord(record);
+        if(hasBudget){
+            step->group.memoryUsage += size;
+            ep->bufferedMemory += size;
+            if(!step->group.spillFailed && Spill_IsOverBudget(ep->bufferedMemory)){
+                if((record = ExecutionPlan_GroupSpill(ep, step))){
+                    goto end;
+                }
+            }
+        }
         ADD_DURATION(step->executionDuration);
     }
     START_TIMER;
     step->group.isGrouped = true;
-    if(array_len(step->group.groupedRecords) == 0){
-        record = NULL;
-    }else{
-        record = array_pop(step->group.groupedRecords);
+    if(step->group.partitions && !step->group.spillFailed){
+        // spill what's left so groups of the same key will be merged when their partition is loaded
+        if((record = ExecutionPlan_GroupSpill(ep, step))){
+            goto end;
+        }
+    }
+    record = ExecutionPlan_GroupTakeNext(step);
+end:
+	ADD_DURATION(step->executionDuration);
+    return record;
+}
+
+static Record* ExecutionPlan_ReduceNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    Record* record = ExecutionPlan_NextRecord(ep, step->prev, rctx);
+
+    INIT_TIMER;
+    START_TIMER;
+    if(record == NULL){
+        goto end;
+    }
+    if(record == &StopRecord){
+        goto end;
+    }
+    if(RedisGears_RecordGetType(record) == errorRecordType){
+        goto end;
+    }
+    RedisModule_Assert(RedisGears_RecordGetType(record) == keyRecordType);
+    size_t keyLen;
+    char* key = RedisGears_KeyRecordGetKey(record, &keyLen);
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    Record* r = step->reduce.reducer(&ectx, key, keyLen, RedisGears_KeyRecordGetVal(record), step->reduce.reducerArg.stepArg);
+    RedisGears_KeyRecordSetVal(record, r);
+    if(ectx.err){
+        RedisGears_FreeRecord(record);
+        record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
     }
 end:
 	ADD_DURATION(step->executionDuration);
     return record;
 }
 
-static Record* ExecutionPlan_ReduceNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
-    Record* record = ExecutionPlan_NextRecord(ep, step->prev, rctx);
+#define JOIN_PROBE_SIDE "probe"
+#define JOIN_BUILD_SIDE "build"
+
+/*
+ * Join source records are key records (the join key) holding a key record (the side) holding the record.
+ */
+static bool ExecutionPlan_IsJoinBuildRecord(Record* record){
+    if(RedisGears_RecordGetType(record) != keyRecordType){
+        return false;
+    }
+    Record* tagged = RedisGears_KeyRecordGetVal(record);
+    if(!tagged || RedisGears_RecordGetType(tagged) != keyRecordType){
+        return false;
+    }
+    return strcmp(RedisGears_KeyRecordGetKey(tagged, NULL), JOIN_BUILD_SIDE) == 0;
+}
+
+#define RECORDS_BATCH_MAX_SIZE (64 * 1024)
+
+static void RecordsBatch_Start(ExecutionPlan* ep, ExecutionStep* step, RecordsBatch* batch){
+    Gears_BufferWriter bw;
+    Gears_BufferClear(batch->buff);
+    Gears_BufferWriterInit(&bw, batch->buff);
+    RedisGears_BWWriteBuffer(&bw, ep->id, ID_LEN); // serialize execution plan id
+    RedisGears_BWWriteLong(&bw, step->stepId); // serialize step id
+    RG_RecordsEncoderStart(&batch->enc, &bw);
+    batch->len = 0;
+}
+
+static RecordsBatch* RecordsBatch_Create(ExecutionPlan* ep, ExecutionStep* step){
+    RecordsBatch* batch = RG_ALLOC(sizeof(*batch));
+    batch->buff = Gears_BufferNew(RECORDS_BATCH_MAX_SIZE);
+    RG_RecordsEncoderInit(&batch->enc);
+    RecordsBatch_Start(ep, step, batch);
+    return batch;
+}
+
+static void RecordsBatch_Free(RecordsBatch* batch){
+    Gears_BufferFree(batch->buff);
+    RG_RecordsEncoderFree(&batch->enc);
+    RG_FREE(batch);
+}
+
+/*
+ * Add the record to the batch, if the record can not be serialized an error record is added instead.
+ * Return the error record if one was added so the caller can keep it, the record is not freed.
+ */
+static Record* RecordsBatch_Add(RecordsBatch* batch, Record* record){
+    Gears_BufferWriter bw;
+    Gears_BufferWriterInit(&bw, batch->buff);
+    size_t start = batch->buff->size;
+    char* err = NULL;
+    Record* errRecord = NULL;
+    if(RG_RecordEncode(&batch->enc, &bw, record, &err) != REDISMODULE_OK){
+        batch->buff->size = start;
+        errRecord = RG_ErrorRecordCreate(err, strlen(err));
+        err = NULL;
+        int res = RG_RecordEncode(&batch->enc, &bw, errRecord, &err);
+        RedisModule_Assert(res == REDISMODULE_OK);
+    }
+    ++batch->len;
+    return errRecord;
+}
+
+/*
+ * Send the batch (if it is not empty) and start a new one, a NULL shard id sends it to all the shards.
+ */
+#define RecordsBatch_SendM(ep, step, batch, id, function) \
+    do{ \
+        if((batch)->len > 0){ \
+            (step)->stats.bytesSerialized += (batch)->buff->size; \
+            Cluster_SendMsgM(id, function, (batch)->buff->buff, (batch)->buff->size); \
+            RecordsBatch_Start(ep, step, batch); \
+        } \
+    }while(0)
+
+static void ExecutionPlan_RepartitionFlush(ExecutionPlan* ep, ExecutionStep* step){
+    if(step->repartion.broadcastBatch){
+        RecordsBatch_SendM(ep, step, step->repartion.broadcastBatch, NULL, ExecutionPlan_OnRepartitionRecordReceived);
+    }
+    if(!step->repartion.batches){
+        return;
+    }
+    Gears_dictIterator* iter = Gears_dictGetIterator(step->repartion.batches);
+    Gears_dictEntry* entry = NULL;
+    while((entry = Gears_dictNext(iter))){
+        const char* shardId = Gears_dictGetKey(entry);
+        RecordsBatch* batch = Gears_dictGetVal(entry);
+        RecordsBatch_SendM(ep, step, batch, shardId, ExecutionPlan_OnRepartitionRecordReceived);
+    }
+    Gears_dictReleaseIterator(iter);
+}
+
+static void ExecutionPlan_RepartitionFreeBatches(ExecutionStep* step){
+    if(step->repartion.broadcastBatch){
+        RecordsBatch_Free(step->repartion.broadcastBatch);
+        step->repartion.broadcastBatch = NULL;
+    }
+    if(!step->repartion.batches){
+        return;
+    }
+    Gears_dictIterator* iter = Gears_dictGetIterator(step->repartion.batches);
+    Gears_dictEntry* entry = NULL;
+    while((entry = Gears_dictNext(iter))){
+        RecordsBatch_Free(Gears_dictGetVal(entry));
+    }
+    Gears_dictReleaseIterator(iter);
+    Gears_dictRelease(step->repartion.batches);
+    step->repartion.batches = NULL;
+}
+
+/*
+ * Add the record to the batch sent to all the other shards, on failure the record is replaced with an error record.
+ */
+static void ExecutionPlan_BroadcastRecord(ExecutionPlan* ep, ExecutionStep* step, Record** record){
+    if(!step->repartion.broadcastBatch){
+        step->repartion.broadcastBatch = RecordsBatch_Create(ep, step);
+    }
+    RecordsBatch* batch = step->repartion.broadcastBatch;
+    Record* errRecord = RecordsBatch_Add(batch, *record);
+    if(errRecord){
+        RedisGears_FreeRecord(*record);
+        *record = errRecord;
+    }
+    if(batch->buff->size >= RECORDS_BATCH_MAX_SIZE){
+        RecordsBatch_SendM(ep, step, batch, NULL, ExecutionPlan_OnRepartitionRecordReceived);
+    }
+}
+
+static Record* ExecutionPlan_RepartitionNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    Record* record = NULL;
+    Gears_Buffer* buff;
+    Gears_BufferWriter bw;
+
+    if(!Cluster_IsClusterMode() || EPIsFlagOn(ep, EFIsLocal)){
+        return ExecutionPlan_NextRecord(ep, step->prev, rctx);
+    }
+
+    INIT_TIMER;
+    START_TIMER;
+    if(step->repartion.stoped){
+        if(SpillableRecords_Len(&step->repartion.pendings) > 0){
+            record = SpillableRecords_Pop(&step->repartion.pendings);
+            goto end;
+        }
+        if((Cluster_GetSize() - 1) == step->repartion.totalShardsCompleted){
+			goto end; // we are done!!
+		}
+        record = &StopRecord;
+        goto end;
+    }
+    STOP_TIMER;
+	step->executionDuration += DURATION;
+
+    while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx)) != NULL){
+        START_TIMER;
+        if(record == &StopRecord){
+            // we are going to wait so send what we have, the other shards might be waiting for it
+            ExecutionPlan_RepartitionFlush(ep, step);
+            goto end;
+        }
+        if(RedisGears_RecordGetType(record) == errorRecordType){
+            // this is an error record which should stay with us so lets return it
+            goto end;
+        }
+        if(step->repartion.broadcastJoinBuild){
+            // probe side records stay with us, build side records are sent to all the shards and also kept
+            if(ExecutionPlan_IsJoinBuildRecord(record)){
+                ExecutionPlan_BroadcastRecord(ep, step, &record);
+            }
+            goto end;
+        }
+        size_t len;
+        char* key = RedisGears_KeyRecordGetKey(record, &len);
+        const char* shardIdToSendRecord = Cluster_GetNodeIdByKey(key);
+        if(memcmp(shardIdToSendRecord, Cluster_GetMyId(), REDISMODULE_NODE_ID_LEN) == 0){
+            // this record should stay with us, lets return it.
+            goto end;
+        }
+        else{
+            // we need to send the record to another shard, it is added to the shard batch which is sent when full
+            if(!step->repartion.batches){
+                step->repartion.batches = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
+            }
+            RecordsBatch* batch = Gears_dictFetchValue(step->repartion.batches, shardIdToSendRecord);
+            if(!batch){
+                batch = RecordsBatch_Create(ep, step);
+                Gears_dictAdd(step->repartion.batches, (char*)shardIdToSendRecord, batch);
+            }
+            Record* errRecord = RecordsBatch_Add(batch, record);
+            RedisGears_FreeRecord(record);
+            if(errRecord){
+                RedisGears_FreeRecord(errRecord);
+            }
+            if(batch->buff->size >= RECORDS_BATCH_MAX_SIZE){
+                RecordsBatch_SendM(ep, step, batch, shardIdToSendRecord, ExecutionPlan_OnRepartitionRecordReceived);
+            }
+        }
+    	ADD_DURATION(step->executionDuration);
+    }
+
+    START_TIMER;
+    ExecutionPlan_RepartitionFlush(ep, step);
+    ExecutionPlan_RepartitionFreeBatches(step);
+
+    buff = Gears_BufferCreate();
+    Gears_BufferWriterInit(&bw, buff);
+    RedisGears_BWWriteBuffer(&bw, ep->id, ID_LEN); // serialize execution plan id
+    RedisGears_BWWriteLong(&bw, step->stepId); // serialize step id
+
+    Cluster_SendMsgM(NULL, ExecutionPlan_DoneRepartition, buff->buff, buff->size);
+
+    Gears_BufferFree(buff);
+    step->repartion.stoped = true;
+    if(SpillableRecords_Len(&step->repartion.pendings) > 0){
+        record = SpillableRecords_Pop(&step->repartion.pendings);
+        goto end;
+	}
+	if((Cluster_GetSize() - 1) == step->repartion.totalShardsCompleted){
+		record = NULL; // we are done!!
+        goto end;
+	}
+    record = &StopRecord;
+end:
+	ADD_DURATION(step->executionDuration);
+    return record;
+}
+
+static int ExecutionPlan_CompareRecords(ExecutionCtx* ectx, ExecutionStep* sortStep, Record* a, Record* b){
+    if(ectx->err){
+        // a previous comparison failed, the order does not matter anymore
+        return 0;
+    }
+    return sortStep->sort.compare(ectx, a, b, sortStep->sort.stepArg.stepArg);
+}
+
+/*
+ * Bottom up merge sort, stable and only requires the compare callback.
+ */
+static void ExecutionPlan_SortRecords(ExecutionCtx* ectx, ExecutionStep* step, Record** records, size_t len){
+    if(len < 2){
+        return;
+    }
+    Record** tmp = RG_ALLOC(len * sizeof(Record*));
+    Record** src = records;
+    Record** dst = tmp;
+    for(size_t width = 1 ; width < len ; width *= 2){
+        for(size_t lo = 0 ; lo < len ; lo += 2 * width){
+            size_t mid = MIN(lo + width, len);
+            size_t hi = MIN(lo + 2 * width, len);
+            size_t i = lo, j = mid, k = lo;
+            while(i < mid && j < hi){
+                if(ExecutionPlan_CompareRecords(ectx, step, src[j], src[i]) < 0){
+                    dst[k++] = src[j++];
+                }else{
+                    dst[k++] = src[i++];
+                }
+            }
+            while(i < mid){
+                dst[k++] = src[i++];
+            }
+            while(j < hi){
+                dst[k++] = src[j++];
+            }
+        }
+        Record** t = src;
+        src = dst;
+        dst = t;
+    }
+    if(src != records){
+        memcpy(records, src, len * sizeof(Record*));
+    }
+    RG_FREE(tmp);
+}
+
+/*
+ * The topk heap keeps the last record (by the sort order) on top so it can be replaced.
+ */
+static void ExecutionPlan_TopKSiftDown(ExecutionCtx* ectx, ExecutionStep* step, Record** heap, size_t len, size_t i){
+    while(true){
+        size_t last = i;
+        size_t l = 2 * i + 1;
+        size_t r = 2 * i + 2;
+        if(l < len && ExecutionPlan_CompareRecords(ectx, step, heap[l], heap[last]) > 0){
+            last = l;
+        }
+        if(r < len && ExecutionPlan_CompareRecords(ectx, step, heap[r], heap[last]) > 0){
+            last = r;
+        }
+        if(last == i){
+            return;
+        }
+        Record* t = heap[i];
+        heap[i] = heap[last];
+        heap[last] = t;
+        i = last;
+    }
+}
+
+static void ExecutionPlan_TopKAdd(ExecutionCtx* ectx, ExecutionStep* step, Record* record){
+    Record** heap = step->sort.records;
+    size_t len = array_len(heap);
+    if(len < step->sort.k){
+        step->sort.records = heap = array_append(heap, record);
+        size_t i = len;
+        while(i > 0){
+            size_t parent = (i - 1) / 2;
+            if(ExecutionPlan_CompareRecords(ectx, step, heap[i], heap[parent]) <= 0){
+                break;
+            }
+            Record* t = heap[i];
+            heap[i] = heap[parent];
+            heap[parent] = t;
+            i = parent;
+        }
+        return;
+    }
+    if(ExecutionPlan_CompareRecords(ectx, step, record, heap[0]) >= 0){
+        RedisGears_FreeRecord(record);
+        return;
+    }
+    RedisGears_FreeRecord(heap[0]);
+    heap[0] = record;
+    ExecutionPlan_TopKSiftDown(ectx, step, heap, len, 0);
+}
+
+static void ExecutionStep_ClearSortRecords(ExecutionStep* es){
+    for(size_t i = es->sort.iterPos ; i < array_len(es->sort.records) ; ++i){
+        RedisGears_FreeRecord(es->sort.records[i]);
+    }
+    es->sort.records = array_trimm_len(es->sort.records, 0);
+    es->sort.iterPos = 0;
+}
+
+static Record* ExecutionPlan_SortNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    Record* record = NULL;
+
+    INIT_TIMER;
+    if(step->sort.isSorted){
+        START_TIMER;
+        goto next;
+    }
+    bool isTopK = step->type == TOPK && step->sort.k > 0;
+    while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx))){
+        START_TIMER;
+        if(record == &StopRecord){
+            goto end;
+        }
+        if(RedisGears_RecordGetType(record) == errorRecordType){
+            goto end;
+        }
+        if(isTopK){
+            ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+            ExecutionPlan_TopKAdd(&ectx, step, record);
+            if(ectx.err){
+                record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+                goto end;
+            }
+        }else{
+            step->sort.records = array_append(step->sort.records, record);
+        }
+        ADD_DURATION(step->executionDuration);
+    }
+    START_TIMER;
+    step->sort.isSorted = true;
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    size_t len = array_len(step->sort.records);
+#ifdef WITHPYTHON
+    // take the python GIL once for the entire sort instead of once per comparison
+    bool lockPython = RedisGearsPy_IsPyCallbackArgType(step->sort.stepArg.type);
+    PythonSessionCtx* oldSession = NULL;
+    if(lockPython){
+        oldSession = RedisGearsPy_Lock(ep->fep->PD);
+    }
+#endif
+    if(isTopK){
+        // heap sort, the last record is moved to the end on each round
+        for(size_t end = len ; end > 1 ; --end){
+            Record* t = step->sort.records[0];
+            step->sort.records[0] = step->sort.records[end - 1];
+            step->sort.records[end - 1] = t;
+            ExecutionPlan_TopKSiftDown(&ectx, step, step->sort.records, end - 1, 0);
+        }
+    }else{
+        ExecutionPlan_SortRecords(&ectx, step, step->sort.records, len);
+    }
+#ifdef WITHPYTHON
+    if(lockPython){
+        RedisGearsPy_Unlock(oldSession);
+    }
+#endif
+    if(ectx.err){
+        ExecutionStep_ClearSortRecords(step);
+        record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+        goto end;
+    }
+
+next:
+    if(step->sort.iterPos < array_len(step->sort.records)){
+        record = step->sort.records[step->sort.iterPos++];
+    }else{
+        record = NULL;
+        step->sort.records = array_trimm_len(step->sort.records, 0);
+        step->sort.iterPos = 0;
+    }
+end:
+    ADD_DURATION(step->executionDuration);
+    return record;
+}
+
+static int WindowArgSerializeState(WindowExecutionStepArg* arg, Gears_BufferWriter* bw, char** err){
+    RedisGears_BWWriteLong(bw, arg->watermark);
+    RedisGears_BWWriteLong(bw, arg->closedUntil);
+    RedisGears_BWWriteLong(bw, arg->lateRecords);
+    RedisGears_BWWriteLong(bw, array_len(arg->windows));
+    for(size_t i = 0 ; i < array_len(arg->windows) ; ++i){
+        RedisGears_BWWriteLong(bw, arg->windows[i].start);
+        if(RG_SerializeRecord(bw, arg->windows[i].accumulator, err) != REDISMODULE_OK){
+            return REDISMODULE_ERR;
+        }
+    }
+    return REDISMODULE_OK;
+}
+
+static void WindowArgDeserializeState(WindowExecutionStepArg* arg, Gears_BufferReader* br){
+    for(size_t i = 0 ; i < array_len(arg->windows) ; ++i){
+        RedisGears_FreeRecord(arg->windows[i].accumulator);
+    }
+    arg->windows = array_trimm_len(arg->windows, 0);
+    arg->watermark = RedisGears_BRReadLong(br);
+    arg->closedUntil = RedisGears_BRReadLong(br);
+    arg->lateRecords = RedisGears_BRReadLong(br);
+    size_t len = RedisGears_BRReadLong(br);
+    for(size_t i = 0 ; i < len ; ++i){
+        WindowAccumulator w;
+        w.start = RedisGears_BRReadLong(br);
+        w.accumulator = RG_DeserializeRecord(br);
+        arg->windows = array_append(arg->windows, w);
+    }
+}
+
+/*
+ * Serialize the record once and deserialize it n times with no current arena,
+ * the copies can be kept on the windows state after the execution is freed.
+ */
+static int ExecutionPlan_WindowHeapCopies(ExecutionCtx* ectx, Record* record, Record** copies, size_t n){
+    Gears_Buffer* buff = Gears_BufferCreate();
+    Gears_BufferWriter bw;
+    Gears_BufferWriterInit(&bw, buff);
+    char* err = NULL;
+    if(RG_SerializeRecord(&bw, record, &err) != REDISMODULE_OK){
+        RedisGears_SetError(ectx, err ? err : RG_STRDUP("window step failed serializing record"));
+        Gears_BufferFree(buff);
+        return REDISMODULE_ERR;
+    }
+    Gears_Arena* oldArena = Gears_ArenaSetCurrent(NULL);
+    for(size_t i = 0 ; i < n ; ++i){
+        Gears_BufferReader br;
+        Gears_BufferReaderInit(&br, buff);
+        copies[i] = RG_DeserializeRecord(&br);
+    }
+    Gears_ArenaSetCurrent(oldArena);
+    Gears_BufferFree(buff);
+    return REDISMODULE_OK;
+}
+
+static Record* ExecutionPlan_WindowRecordCreate(long long start, long long end, Record* accumulator){
+    Record* r = RedisGears_HashSetRecordCreate();
+    RedisGears_HashSetRecordSet(r, "start", RedisGears_LongRecordCreate(start));
+    RedisGears_HashSetRecordSet(r, "end", RedisGears_LongRecordCreate(end));
+    RedisGears_HashSetRecordSet(r, "value", accumulator);
+    return r;
+}
+
+/*
+ * Accumulate the record into all the windows that contains its time, then
+ * move the windows that ends at or before the latest time seen to the closed list.
+ * Must be called with the arg lock held.
+ */
+static void ExecutionPlan_WindowAdd(ExecutionCtx* ectx, ExecutionStep* step, WindowExecutionStepArg* arg, Record* record){
+    if(RedisGears_RecordGetType(record) != keyRecordType){
+        RedisGears_FreeRecord(record);
+        RedisGears_SetError(ectx, RG_STRDUP("window step works only on key records"));
+        return;
+    }
+    size_t keyLen;
+    char* key = RedisGears_KeyRecordGetKey(record, &keyLen);
+    char* end;
+    // stream ids (<ms>-<seq>) and numbers are accepted, the time is the milliseconds part
+    long long time = strtoll(key, &end, 10);
+    bool badTime = end == key || (*end != '\0' && *end != '-' && *end != '.');
+    Record* val = RedisGears_KeyRecordGetVal(record);
+    RedisGears_KeyRecordSetVal(record, NULL);
+    RedisGears_FreeRecord(record);
+    if(badTime || !val){
+        if(val){
+            RedisGears_FreeRecord(val);
+        }
+        RedisGears_SetError(ectx, RG_STRDUP("window step got a record without a valid time, expected a stream id or a number"));
+        return;
+    }
+
+    long long lastStart = time - (((time % arg->slideMS) + arg->slideMS) % arg->slideMS);
+    size_t n = 0;
+    for(long long start = lastStart ; start > time - arg->sizeMS && start + arg->sizeMS > arg->closedUntil ; start -= arg->slideMS){
+        ++n;
+    }
+    if(n == 0){
+        // all the windows of this record were already emitted
+        ++arg->lateRecords;
+        RedisGears_FreeRecord(val);
+        return;
+    }
+
+    Record** copies = RG_ALLOC(n * sizeof(*copies));
+    if(RG_RecordGetArena(val) || n > 1){
+        int res = ExecutionPlan_WindowHeapCopies(ectx, val, copies, n);
+        RedisGears_FreeRecord(val);
+        if(res != REDISMODULE_OK){
+            RG_FREE(copies);
+            return;
+        }
+    }else{
+        copies[0] = val;
+    }
+
+    // accumulators created here are kept on the state, they must not come from the execution arena
+    Gears_Arena* oldArena = Gears_ArenaSetCurrent(NULL);
+    for(size_t i = 0 ; i < n ; ++i){
+        long long start = lastStart - (long long)i * arg->slideMS;
+        size_t pos = array_len(arg->windows);
+        while(pos > 0 && arg->windows[pos - 1].start > start){
+            --pos;
+        }
+        if(pos == 0 || arg->windows[pos - 1].start != start){
+            WindowAccumulator w = {.start = start, .accumulator = NULL};
+            arg->windows = array_append(arg->windows, w);
+            memmove(arg->windows + pos + 1, arg->windows + pos, (array_len(arg->windows) - pos - 1) * sizeof(*arg->windows));
+            arg->windows[pos] = w;
+        }else{
+            --pos;
+        }
+        WindowAccumulator* w = arg->windows + pos;
+        w->accumulator = step->window.accumulate(ectx, w->accumulator, copies[i], arg->accumulateArg.stepArg);
+        if(ectx->err){
+            if(w->accumulator){
+                RedisGears_FreeRecord(w->accumulator);
+            }
+            size_t len = array_len(arg->windows);
+            memmove(arg->windows + pos, arg->windows + pos + 1, (len - pos - 1) * sizeof(*arg->windows));
+            arg->windows = array_trimm_len(arg->windows, len - 1);
+            for(size_t j = i + 1 ; j < n ; ++j){
+                RedisGears_FreeRecord(copies[j]);
+            }
+            break;
+        }
+    }
+    Gears_ArenaSetCurrent(oldArena);
+    RG_FREE(copies);
+    if(ectx->err){
+        return;
+    }
+
+    if(time > arg->watermark){
+        arg->watermark = time;
+    }
+    size_t closed = 0;
+    while(closed < array_len(arg->windows) && arg->windows[closed].start + arg->sizeMS <= arg->watermark){
+        WindowAccumulator* w = arg->windows + closed;
+        step->window.closed = array_append(step->window.closed, ExecutionPlan_WindowRecordCreate(w->start, w->start + arg->sizeMS, w->accumulator));
+        ++closed;
+    }
+    if(closed > 0){
+        size_t len = array_len(arg->windows);
+        memmove(arg->windows, arg->windows + closed, (len - closed) * sizeof(*arg->windows));
+        arg->windows = array_trimm_len(arg->windows, len - closed);
+    }
+    arg->closedUntil = arg->watermark;
+    step->window.isChanged = true;
+}
+
+/*
+ * Replace the windows snapshot that is written on rdb save. The snapshot is taken
+ * once per execution and replaced under the redis lock, so rdb save (and the fork
+ * that does it) never waits for an execution or sees a partially updated state.
+ */
+static void ExecutionPlan_WindowSaveSnapshot(RedisModuleCtx* rctx, WindowExecutionStepArg* arg){
+    Gears_Buffer* snapshot = Gears_BufferCreate();
+    Gears_BufferWriter bw;
+    Gears_BufferWriterInit(&bw, snapshot);
+    char* err = NULL;
+    pthread_mutex_lock(&arg->lock);
+    int res = WindowArgSerializeState(arg, &bw, &err);
+    pthread_mutex_unlock(&arg->lock);
+    if(res != REDISMODULE_OK){
+        RedisModule_Log(NULL, "warning", "Failed serializing windows state, the open windows will not be saved, error='%s'", err ? err : "unknown");
+        if(err){
+            RG_FREE(err);
+        }
+        Gears_BufferFree(snapshot);
+        return;
+    }
+    LockHandler_Acquire(rctx);
+    Gears_Buffer* old = arg->snapshot;
+    arg->snapshot = snapshot;
+    LockHandler_Release(rctx);
+    if(old){
+        Gears_BufferFree(old);
+    }
+}
+
+static Record* ExecutionPlan_WindowNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    Record* record = NULL;
+    WindowExecutionStepArg* arg = step->window.stepArg.stepArg;
+
+    INIT_TIMER;
+    START_TIMER;
+    while(!step->window.isDone){
+        if(step->window.iterPos < array_len(step->window.closed)){
+            goto next;
+        }
+        ADD_DURATION(step->executionDuration);
+        record = ExecutionPlan_NextRecord(ep, step->prev, rctx);
+        START_TIMER;
+        if(!record){
+            step->window.isDone = true;
+            if(step->window.isChanged){
+                ExecutionPlan_WindowSaveSnapshot(rctx, arg);
+                step->window.isChanged = false;
+            }
+            break;
+        }
+        if(record == &StopRecord){
+            goto end;
+        }
+        if(RedisGears_RecordGetType(record) == errorRecordType){
+            goto end;
+        }
+        ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+        pthread_mutex_lock(&arg->lock);
+        ExecutionPlan_WindowAdd(&ectx, step, arg, record);
+        pthread_mutex_unlock(&arg->lock);
+        if(ectx.err){
+            record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+            goto end;
+        }
+    }
+
+next:
+    if(step->window.iterPos < array_len(step->window.closed)){
+        record = step->window.closed[step->window.iterPos++];
+    }else{
+        record = NULL;
+        step->window.closed = array_trimm_len(step->window.closed, 0);
+        step->window.iterPos = 0;
+    }
+end:
+    ADD_DURATION(step->executionDuration);
+    return record;
+}
+
+static void ExecutionStep_ClearWindowRecords(ExecutionStep* es){
+    for(size_t i = es->window.iterPos ; i < array_len(es->window.closed) ; ++i){
+        RedisGears_FreeRecord(es->window.closed[i]);
+    }
+    es->window.closed = array_trimm_len(es->window.closed, 0);
+    es->window.iterPos = 0;
+}
+
+void FlatExecutionPlan_SerializeWindowsState(FlatExecutionPlan* fep, Gears_BufferWriter* bw){
+    size_t numWindowSteps = 0;
+    for(size_t i = 0 ; i < array_len(fep->steps) ; ++i){
+        numWindowSteps += fep->steps[i].type == WINDOW;
+    }
+    RedisGears_BWWriteLong(bw, numWindowSteps);
+    for(size_t i = 0 ; i < array_len(fep->steps) ; ++i){
+        if(fep->steps[i].type != WINDOW){
+            continue;
+        }
+        WindowExecutionStepArg* arg = fep->steps[i].bStep.arg.stepArg;
+        if(arg->snapshot){
+            RedisGears_BWWriteLong(bw, 1); // has snapshot
+            RedisGears_BWWriteBuffer(bw, arg->snapshot->buff, arg->snapshot->size);
+        }else{
+            RedisGears_BWWriteLong(bw, 0); // no snapshot
+        }
+    }
+}
+
+int FlatExecutionPlan_DeserializeWindowsState(FlatExecutionPlan* fep, Gears_BufferReader* br, char** err){
+    size_t numWindowSteps = RedisGears_BRReadLong(br);
+    size_t found = 0;
+    for(size_t i = 0 ; i < array_len(fep->steps) ; ++i){
+        found += fep->steps[i].type == WINDOW;
+    }
+    if(found != numWindowSteps){
+        *err = RG_STRDUP("Windows state does not match the execution windows steps");
+        return REDISMODULE_ERR;
+    }
+    for(size_t i = 0 ; i < array_len(fep->steps) ; ++i){
+        if(fep->steps[i].type != WINDOW){
+            continue;
+        }
+        if(!RedisGears_BRReadLong(br)){
+            continue;
+        }
+        WindowExecutionStepArg* arg = fep->steps[i].bStep.arg.stepArg;
+        size_t len;
+        char* data = RedisGears_BRReadBuffer(br, &len);
+        Gears_Buffer buff = {
+                .buff = data,
+                .size = len,
+                .cap = len,
+        };
+        Gears_BufferReader snapshotReader;
+        Gears_BufferReaderInit(&snapshotReader, &buff);
+        pthread_mutex_lock(&arg->lock);
+        WindowArgDeserializeState(arg, &snapshotReader);
+        pthread_mutex_unlock(&arg->lock);
+        // keep the snapshot so a save that comes before the next execution will not lose the windows
+        if(arg->snapshot){
+            Gears_BufferFree(arg->snapshot);
+        }
+        arg->snapshot = Gears_BufferNew(len);
+        Gears_BufferAdd(arg->snapshot, data, len);
+    }
+    return REDISMODULE_OK;
+}
+
+static Record* ExecutionPlan_JoinSourceTag(ExecutionCtx* ectx, RedisGears_ExtractorCallback extractor, void* extractorArg,
+                                           Record* record, const char* side){
+    size_t len;
+    char* key = extractor(ectx, record, extractorArg, &len);
+    if(ectx->err){
+        RedisGears_FreeRecord(record);
+        return RG_ErrorRecordCreate(ectx->err, strlen(ectx->err) + 1);
+    }
+    Record* tagged = RedisGears_KeyRecordCreate();
+    RedisGears_KeyRecordSetKey(tagged, RG_STRDUP(side), strlen(side));
+    RedisGears_KeyRecordSetVal(tagged, record);
+    Record* r = RedisGears_KeyRecordCreate();
+    RedisGears_KeyRecordSetKey(r, key, len);
+    RedisGears_KeyRecordSetVal(r, tagged);
+    return r;
+}
+
+static Reader* ExecutionPlan_JoinSourceCreateBuildReader(JoinSourceExecutionStepArg* arg){
+    RedisGears_ReaderCallbacks* callbacks = ReadersMgmt_Get("KeysReader");
+    RedisModule_Assert(callbacks);
+    return callbacks->create(RedisGears_KeysReaderCtxCreate(arg->buildPattern, true, NULL, false));
+}
+
+static Record* ExecutionPlan_JoinSourceNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    Record* record = NULL;
+    JoinSourceExecutionStepArg* arg = step->joinSource.stepArg.stepArg;
 
     INIT_TIMER;
-    START_TIMER;
-    if(record == NULL){
-        goto end;
+    if(!step->joinSource.buildReader){
+        record = ExecutionPlan_NextRecord(ep, step->prev, rctx);
+        START_TIMER;
+        if(record == &StopRecord){
+            goto end;
+        }
+        if(record){
+            if(RedisGears_RecordGetType(record) == errorRecordType){
+                goto end;
+            }
+            ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+            record = ExecutionPlan_JoinSourceTag(&ectx, step->joinSource.probeExtractor, arg->probeExtractor.arg.stepArg,
+                                                 record, JOIN_PROBE_SIDE);
+            goto end;
+        }
+        // the probe side is depleted, continue with the build side records of this shard
+        step->joinSource.buildReader = ExecutionPlan_JoinSourceCreateBuildReader(arg);
+    }else{
+        START_TIMER;
     }
-    if(record == &StopRecord){
+    if(step->joinSource.isDone){
+        record = NULL;
         goto end;
     }
-    if(RedisGears_RecordGetType(record) == errorRecordType){
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    Reader* r = step->joinSource.buildReader;
+    record = r->next(&ectx, r->ctx);
+    if(!record || ectx.err){
+        step->joinSource.isDone = true;
+        if(ectx.err){
+            if(record){
+                RedisGears_FreeRecord(record);
+            }
+            record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+        }
         goto end;
     }
-    RedisModule_Assert(RedisGears_RecordGetType(record) == keyRecordType);
-    size_t keyLen;
-    char* key = RedisGears_KeyRecordGetKey(record, &keyLen);
-    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
-    Record* r = step->reduce.reducer(&ectx, key, keyLen, RedisGears_KeyRecordGetVal(record), step->reduce.reducerArg.stepArg);
-    RedisGears_KeyRecordSetVal(record, r);
-    if(ectx.err){
-        RedisGears_FreeRecord(record);
-        record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+    if(step->joinSource.buildMapper){
+        record = step->joinSource.buildMapper(&ectx, record, arg->buildMapper.arg.stepArg);
+        if(ectx.err){
+            if(record){
+                RedisGears_FreeRecord(record);
+            }
+            record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+            goto end;
+        }
     }
+    record = ExecutionPlan_JoinSourceTag(&ectx, step->joinSource.buildExtractor, arg->buildExtractor.arg.stepArg,
+                                         record, JOIN_BUILD_SIDE);
 end:
-	ADD_DURATION(step->executionDuration);
+    ADD_DURATION(step->executionDuration);
     return record;
 }
 
-static Record* ExecutionPlan_RepartitionNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
-    Record* record = NULL;
-    Gears_Buffer* buff;
+static void ExecutionStep_ClearJoinSource(ExecutionStep* es){
+    Reader* r = es->joinSource.buildReader;
+    if(r){
+        if(r->free){
+            r->free(r->ctx);
+        }
+        RG_FREE(r);
+        es->joinSource.buildReader = NULL;
+    }
+    es->joinSource.isDone = false;
+}
+
+/*
+ * Deep copy the record by serializing it, used when one record is part of more than one join result
+ * and this is not its last one.
+ */
+static Record* ExecutionPlan_DupRecord(ExecutionCtx* ectx, Record* record){
+    Gears_Buffer* buff = Gears_BufferCreate();
     Gears_BufferWriter bw;
+    Gears_BufferWriterInit(&bw, buff);
+    char* err = NULL;
+    Record* ret = NULL;
+    if(RG_SerializeRecord(&bw, record, &err) == REDISMODULE_OK){
+        Gears_BufferReader br;
+        Gears_BufferReaderInit(&br, buff);
+        ret = RG_DeserializeRecord(&br);
+    }else{
+        RedisGears_SetError(ectx, err ? err : RG_STRDUP("failed serializing record"));
+    }
+    Gears_BufferFree(buff);
+    return ret;
+}
 
-    if(!Cluster_IsClusterMode() || EPIsFlagOn(ep, EFIsLocal)){
-        return ExecutionPlan_NextRecord(ep, step->prev, rctx);
+static Record* ExecutionPlan_JoinRecordCreate(char* key, size_t keyLen, Record* left, Record* right){
+    Record* r = RedisGears_HashSetRecordCreate();
+    char* keyCopy = RG_ALLOC(keyLen + 1);
+    memcpy(keyCopy, key, keyLen);
+    keyCopy[keyLen] = '\0';
+    RedisGears_HashSetRecordSet(r, "key", RedisGears_StringRecordCreate(keyCopy, keyLen));
+    RedisGears_HashSetRecordSet(r, "left", left);
+    RedisGears_HashSetRecordSet(r, "right", right);
+    return r;
+}
+
+/*
+ * The build side records of a join key and the amount of probe records with that key
+ * that were not yet joined, the last probe record takes the build records instead of copying them.
+ */
+typedef struct JoinBuildEntry{
+    Record* matches;
+    size_t probesLeft;
+}JoinBuildEntry;
+
+static void ExecutionStep_FreeJoinBuildEntry(void* val){
+    JoinBuildEntry* entry = val;
+    RedisGears_FreeRecord(entry->matches);
+    RG_FREE(entry);
+}
+
+static void ExecutionStep_ClearJoin(ExecutionStep* es){
+    for(size_t i = es->join.probePos ; i < array_len(es->join.probes) ; ++i){
+        RedisGears_FreeRecord(es->join.probes[i]);
     }
+    es->join.probes = array_trimm_len(es->join.probes, 0);
+    es->join.probePos = 0;
+    es->join.matchPos = 0;
+    Gears_AggTableClear(es->join.builds, ExecutionStep_FreeJoinBuildEntry);
+    es->join.isBuilt = false;
+}
+
+static Record* ExecutionPlan_JoinNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    Record* record = NULL;
 
     INIT_TIMER;
-    START_TIMER;
-    if(step->repartion.stoped){
-        if(array_len(step->repartion.pendings) > 0){
-            record = array_pop(step->repartion.pendings);
-            goto end;
-        }
-        if((Cluster_GetSize() - 1) == step->repartion.totalShardsCompleted){
-			goto end; // we are done!!
-		}
-        record = &StopRecord;
-        goto end;
+    if(step->join.isBuilt){
+        START_TIMER;
+        goto next;
     }
-    buff = Gears_BufferCreate();
-    STOP_TIMER;
-	step->executionDuration += DURATION;
-
-    while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx)) != NULL){
+    while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx))){
         START_TIMER;
         if(record == &StopRecord){
-            Gears_BufferFree(buff);
             goto end;
         }
         if(RedisGears_RecordGetType(record) == errorRecordType){
-            // this is an error record which should stay with us so lets return it
-            Gears_BufferFree(buff);
             goto end;
         }
-        size_t len;
-        char* key = RedisGears_KeyRecordGetKey(record, &len);
-        const char* shardIdToSendRecord = Cluster_GetNodeIdByKey(key);
-        if(memcmp(shardIdToSendRecord, Cluster_GetMyId(), REDISMODULE_NODE_ID_LEN) == 0){
-            // this record should stay with us, lets return it.
-        	Gears_BufferFree(buff);
-            goto end;
-        }
-        else{
-            // we need to send the record to another shard
-            char* err = NULL;
-            Gears_BufferWriterInit(&bw, buff);
-            RedisGears_BWWriteBuffer(&bw, ep->id, ID_LEN); // serialize execution plan id
-            RedisGears_BWWriteLong(&bw, step->stepId); // serialize step id
-            int serializationRes = RG_SerializeRecord(&bw, record, &err);
+        if(ExecutionPlan_IsJoinBuildRecord(record)){
+            size_t keyLen;
+            char* key = RedisGears_KeyRecordGetKey(record, &keyLen);
+            Record* tagged = RedisGears_KeyRecordGetVal(record);
+            Record* val = RedisGears_KeyRecordGetVal(tagged);
+            RedisGears_KeyRecordSetVal(tagged, NULL);
+            bool isNew;
+            JoinBuildEntry** entry = (JoinBuildEntry**)Gears_AggTableFindOrAdd(step->join.builds, key, keyLen, &isNew);
+            if(isNew){
+                *entry = RG_ALLOC(sizeof(**entry));
+                (*entry)->matches = RedisGears_ListRecordCreate(1);
+                (*entry)->probesLeft = 0;
+            }
+            RedisGears_ListRecordAdd((*entry)->matches, val);
             RedisGears_FreeRecord(record);
-            if(serializationRes != REDISMODULE_OK){
-                // we need to clear and rewrite cause buff contains garbage
-                Gears_BufferClear(buff);
-                RedisGears_BWWriteBuffer(&bw, ep->id, ID_LEN); // serialize execution plan id
-                RedisGears_BWWriteLong(&bw, step->stepId); // serialize step id
-                record = RG_ErrorRecordCreate(err, strlen(err));
-                err = NULL;
-                serializationRes = RG_SerializeRecord(&bw, record, &err);
-                RedisModule_Assert(serializationRes == REDISMODULE_OK);
-                RedisGears_FreeRecord(record);
+        }else{
+            // the build side might still be on its way, probe once the previous step is depleted
+            step->join.probes = array_append(step->join.probes, record);
+        }
+        ADD_DURATION(step->executionDuration);
+    }
+    START_TIMER;
+    step->join.isBuilt = true;
+    for(size_t i = 0 ; i < array_len(step->join.probes) ; ++i){
+        size_t keyLen;
+        char* key = RedisGears_KeyRecordGetKey(step->join.probes[i], &keyLen);
+        JoinBuildEntry* entry = Gears_AggTableFind(step->join.builds, key, keyLen);
+        if(entry){
+            ++entry->probesLeft;
+        }
+    }
+
+next:
+    while(step->join.probePos < array_len(step->join.probes)){
+        Record* probe = step->join.probes[step->join.probePos];
+        size_t keyLen;
+        char* key = RedisGears_KeyRecordGetKey(probe, &keyLen);
+        JoinBuildEntry* entry = Gears_AggTableFind(step->join.builds, key, keyLen);
+        size_t len = entry ? RedisGears_ListRecordLen(entry->matches) : 0;
+        // the last probe record of the key pops the build records instead of copying them
+        bool lastProbe = entry && entry->probesLeft == 1;
+        size_t remaining = lastProbe ? len : len - step->join.matchPos;
+        if(remaining == 0){
+            RedisGears_FreeRecord(probe);
+            ++step->join.probePos;
+            step->join.matchPos = 0;
+            if(entry){
+                --entry->probesLeft;
+            }
+            continue;
+        }
+        ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+        Record* tagged = RedisGears_KeyRecordGetVal(probe);
+        Record* left = NULL;
+        if(remaining == 1){
+            // last match of this probe record, no need to copy it
+            left = RedisGears_KeyRecordGetVal(tagged);
+            RedisGears_KeyRecordSetVal(tagged, NULL);
+        }else{
+            left = ExecutionPlan_DupRecord(&ectx, RedisGears_KeyRecordGetVal(tagged));
+        }
+        Record* right = NULL;
+        if(left){
+            right = lastProbe ? RedisGears_ListRecordPop(entry->matches) :
+                                ExecutionPlan_DupRecord(&ectx, RedisGears_ListRecordGet(entry->matches, step->join.matchPos));
+        }
+        if(ectx.err){
+            if(left){
+                RedisGears_FreeRecord(left);
             }
+            RedisGears_FreeRecord(probe);
+            ++step->join.probePos;
+            step->join.matchPos = 0;
+            --entry->probesLeft;
+            record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+            goto end;
+        }
+        record = ExecutionPlan_JoinRecordCreate(key, keyLen, left, right);
+        ++step->join.matchPos;
+        if(remaining == 1){
+            RedisGears_FreeRecord(probe);
+            ++step->join.probePos;
+            step->join.matchPos = 0;
+            --entry->probesLeft;
+        }
+        goto end;
+    }
+    record = NULL;
+    ExecutionStep_ClearJoin(step);
+    step->join.isBuilt = true;
+end:
+    ADD_DURATION(step->executionDuration);
+    return record;
+}
 
-            Cluster_SendMsgM(shardIdToSendRecord, ExecutionPlan_OnRepartitionRecordReceived, buff->buff, buff->size);
+static CollectMergeRun* ExecutionStep_GetMergeRun(ExecutionStep* es, const char* shardId){
+#define MERGE_RUN_INIT_CAP 100
+    for(size_t i = 0 ; i < array_len(es->collect.runs) ; ++i){
+        if(memcmp(es->collect.runs[i].shardId, shardId, REDISMODULE_NODE_ID_LEN) == 0){
+            return es->collect.runs + i;
+        }
+    }
+    CollectMergeRun run = {
+        .records = array_new(Record*, MERGE_RUN_INIT_CAP),
+        .pos = 0,
+    };
+    memcpy(run.shardId, shardId, REDISMODULE_NODE_ID_LEN);
+    es->collect.runs = array_append(es->collect.runs, run);
+    return es->collect.runs + array_len(es->collect.runs) - 1;
+}
 
-            Gears_BufferClear(buff);
+static void ExecutionStep_ClearMergeRuns(ExecutionStep* es){
+    if(!es->collect.runs){
+        return;
+    }
+    for(size_t i = 0 ; i < array_len(es->collect.runs) ; ++i){
+        CollectMergeRun* run = es->collect.runs + i;
+        for(size_t j = run->pos ; j < array_len(run->records) ; ++j){
+            RedisGears_FreeRecord(run->records[j]);
         }
-    	ADD_DURATION(step->executionDuration);
+        array_free(run->records);
     }
+    es->collect.runs = array_trimm_len(es->collect.runs, 0);
+    es->collect.heap = array_trimm_len(es->collect.heap, 0);
+    es->collect.isMerging = false;
+}
 
-    START_TIMER;
-    Gears_BufferWriterInit(&bw, buff);
-    RedisGears_BWWriteBuffer(&bw, ep->id, ID_LEN); // serialize execution plan id
-    RedisGears_BWWriteLong(&bw, step->stepId); // serialize step id
+static int ExecutionPlan_CompareMergeRuns(ExecutionCtx* ectx, ExecutionStep* step, size_t a, size_t b){
+    CollectMergeRun* runA = step->collect.runs + a;
+    CollectMergeRun* runB = step->collect.runs + b;
+    int res = ExecutionPlan_CompareRecords(ectx, step->collect.sortStep, runA->records[runA->pos], runB->records[runB->pos]);
+    if(res != 0){
+        return res;
+    }
+    // keep the runs order on ties so the merge is stable
+    return a < b ? -1 : 1;
+}
 
-    Cluster_SendMsgM(NULL, ExecutionPlan_DoneRepartition, buff->buff, buff->size);
+static void ExecutionPlan_MergeSiftDown(ExecutionCtx* ectx, ExecutionStep* step, size_t i){
+    size_t* heap = step->collect.heap;
+    size_t len = array_len(heap);
+    while(true){
+        size_t first = i;
+        size_t l = 2 * i + 1;
+        size_t r = 2 * i + 2;
+        if(l < len && ExecutionPlan_CompareMergeRuns(ectx, step, heap[l], heap[first]) < 0){
+            first = l;
+        }
+        if(r < len && ExecutionPlan_CompareMergeRuns(ectx, step, heap[r], heap[first]) < 0){
+            first = r;
+        }
+        if(first == i){
+            return;
+        }
+        size_t t = heap[i];
+        heap[i] = heap[first];
+        heap[first] = t;
+        i = first;
+    }
+}
 
-    Gears_BufferFree(buff);
-    step->repartion.stoped = true;
-    if(array_len(step->repartion.pendings) > 0){
-        record = array_pop(step->repartion.pendings);
-        goto end;
-	}
-	if((Cluster_GetSize() - 1) == step->repartion.totalShardsCompleted){
-		record = NULL; // we are done!!
-        goto end;
-	}
-    record = &StopRecord;
-end:
-	ADD_DURATION(step->executionDuration);
+/*
+ * K-way merge of the shards runs, each call returns the next record by the sort order.
+ */
+static Record* ExecutionPlan_CollectMergeNext(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
+    if(!step->collect.isMerging){
+        step->collect.isMerging = true;
+        for(size_t i = 0 ; i < array_len(step->collect.runs) ; ++i){
+            if(array_len(step->collect.runs[i].records) > 0){
+                step->collect.heap = array_append(step->collect.heap, i);
+            }
+        }
+        for(size_t i = array_len(step->collect.heap) / 2 ; i > 0 ; --i){
+            ExecutionPlan_MergeSiftDown(&ectx, step, i - 1);
+        }
+    }
+    if(array_len(step->collect.heap) == 0){
+        return NULL;
+    }
+    CollectMergeRun* run = step->collect.runs + step->collect.heap[0];
+    Record* record = run->records[run->pos++];
+    if(run->pos == array_len(run->records)){
+        // the run is depleted, release it and replace it with the last run on the heap
+        run->records = array_trimm_len(run->records, 0);
+        run->pos = 0;
+        size_t last = array_pop(step->collect.heap);
+        if(array_len(step->collect.heap) > 0){
+            step->collect.heap[0] = last;
+        }
+    }
+    if(array_len(step->collect.heap) > 1){
+        ExecutionPlan_MergeSiftDown(&ectx, step, 0);
+    }
+    if(ectx.err){
+        RedisGears_FreeRecord(record);
+        ExecutionStep_ClearMergeRuns(step);
+        step->collect.isMerging = true; // nothing left to merge
+        return RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
+    }
     return record;
 }
 
+/*
+ * A join source that follows a repartition tells the repartition whether the build side
+ * should be broadcast to all the shards instead of being partitioned by the join key.
+ */
+static void ExecutionPlan_SetupJoinSteps(ExecutionPlan* ep){
+    for(size_t i = 1 ; i < array_len(ep->steps) ; ++i){
+        ExecutionStep* step = ep->steps[i];
+        if(step->type != JOIN_SOURCE || ep->steps[i - 1]->type != REPARTITION){
+            continue;
+        }
+        JoinSourceExecutionStepArg* arg = step->joinSource.stepArg.stepArg;
+        ep->steps[i - 1]->repartion.broadcastJoinBuild = arg->broadcast;
+    }
+}
+
+/*
+ * A collect that follows a sort or a topk step (possibly through limit steps) merges the
+ * sorted records of the shards. A topk step keeps as many records as the limit step after it passes.
+ */
+static void ExecutionPlan_SetupSortSteps(ExecutionPlan* ep){
+    size_t len = array_len(ep->steps);
+    for(size_t i = 0 ; i < len ; ++i){
+        ExecutionStep* step = ep->steps[i];
+        if(step->type == TOPK && i > 0 && ep->steps[i - 1]->type == LIMIT){
+            LimitExecutionStepArg* arg = (LimitExecutionStepArg*)ep->steps[i - 1]->limit.stepArg.stepArg;
+            step->sort.k = arg->offset + arg->len;
+        }
+        if(step->type != COLLECT){
+            continue;
+        }
+        size_t j = i + 1;
+        while(j < len && ep->steps[j]->type == LIMIT){
+            ++j;
+        }
+        if(j < len && (ep->steps[j]->type == SORT || ep->steps[j]->type == TOPK)){
+            step->collect.sortStep = ep->steps[j];
+            step->collect.runs = array_new(CollectMergeRun, 10);
+            step->collect.heap = array_new(size_t, 10);
+        }
+    }
+}
+
+/*
+ * Called once all the collected records arrived.
+ */
+static Record* ExecutionPlan_CollectDone(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    if(step->collect.sortStep){
+        return ExecutionPlan_CollectMergeNext(ep, step, rctx);
+    }
+    return NULL;
+}
+
 static Record* ExecutionPlan_CollectNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
 	Record* record = NULL;
 	Gears_Buffer* buff;;
@@ -1009,53 +3108,50 @@ static Record* ExecutionPlan_CollectNextRecord(ExecutionPlan* ep, ExecutionStep*
     INIT_TIMER;
     START_TIMER;
 	if(step->collect.stoped){
-		if(array_len(step->collect.pendings) > 0){
-            record = array_pop(step->collect.pendings);
+		if(SpillableRecords_Len(&step->collect.pendings) > 0){
+            record = SpillableRecords_Pop(&step->collect.pendings);
             goto end;
 		}
 		if((Cluster_GetSize() - 1) == step->collect.totalShardsCompleted){
-			record = NULL; // we are done!!
+			record = ExecutionPlan_CollectDone(ep, step, rctx); // we are done!!
             goto end;
 		}
 		record = &StopRecord;
         goto end;
 	}
 
-	buff = Gears_BufferCreate();
 	ADD_DURATION(step->executionDuration);
 
 	while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx)) != NULL){
         START_TIMER;
 		if(record == &StopRecord){
-			Gears_BufferFree(buff);
+			if(step->collect.batch){
+			    // we are going to wait so send what we have
+			    RecordsBatch_SendM(ep, step, step->collect.batch, ep->id, ExecutionPlan_CollectOnRecordReceived);
+			}
 			goto end;
 		}
 		if(Cluster_IsMyId(ep->id)){
-			Gears_BufferFree(buff);
+			if(step->collect.sortStep && RedisGears_RecordGetType(record) != errorRecordType){
+			    // our own sorted records are merged with the other shards records
+			    CollectMergeRun* run = ExecutionStep_GetMergeRun(step, Cluster_GetMyId());
+			    run->records = array_append(run->records, record);
+			    ADD_DURATION(step->executionDuration);
+			    continue;
+			}
 			goto end; // record should stay here, just return it.
 		}else{
-		    char* err = NULL;
-			Gears_BufferWriterInit(&bw, buff);
-			RedisGears_BWWriteBuffer(&bw, ep->id, ID_LEN); // serialize execution plan id
-			RedisGears_BWWriteLong(&bw, step->stepId); // serialize step id
-			int serializationRes = RG_SerializeRecord(&bw, record, &err);
+			if(!step->collect.batch){
+			    step->collect.batch = RecordsBatch_Create(ep, step);
+			}
+			Record* errRecord = RecordsBatch_Add(step->collect.batch, record);
 			RedisGears_FreeRecord(record);
-			if(serializationRes != REDISMODULE_OK){
-			    // we need to clear and rewrite cause buff contains garbage
-			    Gears_BufferClear(buff);
-			    RedisGears_BWWriteBuffer(&bw, ep->id, ID_LEN); // serialize execution plan id
-			    RedisGears_BWWriteLong(&bw, step->stepId); // serialize step id
-			    record = RG_ErrorRecordCreate(err, strlen(err));
-			    err = NULL;
-			    serializationRes = RG_SerializeRecord(&bw, record, &err);
-			    RedisModule_Assert(serializationRes == REDISMODULE_OK);
-			    RedisGears_FreeRecord(record);
+			if(errRecord){
+			    RedisGears_FreeRecord(errRecord);
+			}
+			if(step->collect.batch->buff->size >= RECORDS_BATCH_MAX_SIZE){
+			    RecordsBatch_SendM(ep, step, step->collect.batch, ep->id, ExecutionPlan_CollectOnRecordReceived);
 			}
-
-
-			Cluster_SendMsgM(ep->id, ExecutionPlan_CollectOnRecordReceived, buff->buff, buff->size);
-
-			Gears_BufferClear(buff);
 		}
     	ADD_DURATION(step->executionDuration);
 	}
@@ -1064,17 +3160,22 @@ static Record* ExecutionPlan_CollectNextRecord(ExecutionPlan* ep, ExecutionStep*
 	step->collect.stoped = true;
 
 	if(Cluster_IsMyId(ep->id)){
-		Gears_BufferFree(buff);
-		if(array_len(step->collect.pendings) > 0){
-			record = array_pop(step->collect.pendings);
+		if(SpillableRecords_Len(&step->collect.pendings) > 0){
+			record = SpillableRecords_Pop(&step->collect.pendings);
             goto end;
 		}
 		if((Cluster_GetSize() - 1) == step->collect.totalShardsCompleted){
-			record = NULL; // we are done!!
+			record = ExecutionPlan_CollectDone(ep, step, rctx); // we are done!!
             goto end;
 		}
 		record = &StopRecord; // now we should wait for record to arrive from the other shards
 	}else{
+		if(step->collect.batch){
+		    RecordsBatch_SendM(ep, step, step->collect.batch, ep->id, ExecutionPlan_CollectOnRecordReceived);
+		    RecordsBatch_Free(step->collect.batch);
+		    step->collect.batch = NULL;
+		}
+		buff = Gears_BufferCreate();
 		Gears_BufferWriterInit(&bw, buff);
 		RedisGears_BWWriteBuffer(&bw, ep->id, ID_LEN); // serialize execution plan id
 		RedisGears_BWWriteLong(&bw, step->stepId); // serialize step id
@@ -1088,34 +3189,15 @@ end:
     return record;
 }
 
-static Record* ExecutionPlan_ForEachNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
-    Record* record = ExecutionPlan_NextRecord(ep, step->prev, rctx);
-    INIT_TIMER;
-    START_TIMER;
-    if(record == &StopRecord){
-        goto end;
-    }
-    if(record == NULL){
-        goto end;
-    }
-    if(RedisGears_RecordGetType(record) == errorRecordType){
-        goto end;
-    }
-    ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
-    step->forEach.forEach(&ectx, record, step->forEach.stepArg.stepArg);
-    if(ectx.err){
-        RedisGears_FreeRecord(record);
-        record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
-    }
-end:
-	ADD_DURATION(step->executionDuration);
-    return record;
-}
-
 static Record* ExecutionPlan_LimitNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
     Record* record = NULL;    
 
     INIT_TIMER;
+    LimitExecutionStepArg* limitArg = (LimitExecutionStepArg*)step->limit.stepArg.stepArg;
+    if(step->limit.currRecordIndex >= limitArg->offset + limitArg->len){
+        // we are done, no need to pull more records from the previous steps
+        return NULL;
+    }
     while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx))){
         START_TIMER;
         if(record == NULL){
@@ -1188,8 +3270,8 @@ static Record* ExecutionPlan_AccumulateByKeyNextRecord(ExecutionPlan* ep, Execut
 	Record* record = NULL;
 
     INIT_TIMER;
-	if(!step->accumulateByKey.accumulators){
-	    return NULL;
+	if(step->accumulateByKey.isAccumulated){
+	    goto next;
 	}
 	while((record = ExecutionPlan_NextRecord(ep, step->prev, rctx))){
         START_TIMER;
@@ -1201,13 +3283,12 @@ static Record* ExecutionPlan_AccumulateByKeyNextRecord(ExecutionPlan* ep, Execut
 		}
 		RedisModule_Assert(RedisGears_RecordGetType(record) == keyRecordType);
 		char* key = RedisGears_KeyRecordGetKey(record, NULL);
+		size_t keyLen = strlen(key);
 		Record* val = RedisGears_KeyRecordGetVal(record);
 		RedisGears_KeyRecordSetVal(record, NULL);
 		Record* accumulator = NULL;
-		Gears_dictEntry *entry = Gears_dictFind(step->accumulateByKey.accumulators, key);
-		Record* keyRecord = NULL;
-		if(entry){
-			keyRecord = Gears_dictGetVal(entry);
+		Record* keyRecord = Gears_AggTableFind(step->accumulateByKey.accumulators, key, keyLen);
+		if(keyRecord){
 			accumulator = RedisGears_KeyRecordGetVal(keyRecord);
 		}
 		ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
@@ -1220,67 +3301,52 @@ static Record* ExecutionPlan_AccumulateByKeyNextRecord(ExecutionPlan* ep, Execut
                 RedisGears_KeyRecordSetVal(keyRecord, NULL);
                 RedisGears_FreeRecord(keyRecord);
 		    }
-		    Gears_dictDelete(step->accumulateByKey.accumulators, key);
+		    Gears_AggTableDelete(step->accumulateByKey.accumulators, key, keyLen);
 			RedisGears_FreeRecord(record);
             record = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
             goto end;
 		}
 		if(!keyRecord){
 			keyRecord = RedisGears_KeyRecordCreate();
-			RedisGears_KeyRecordSetKey(keyRecord, RG_STRDUP(key), strlen(key));
-			RedisModule_Assert(Gears_dictFetchValue(step->accumulateByKey.accumulators, key) == NULL);
-			Gears_dictAdd(step->accumulateByKey.accumulators, key, keyRecord);
+			RedisGears_KeyRecordSetKey(keyRecord, RG_STRDUP(key), keyLen);
+			bool isNew;
+			*Gears_AggTableFindOrAdd(step->accumulateByKey.accumulators, key, keyLen, &isNew) = keyRecord;
+			RedisModule_Assert(isNew);
 		}
 		RedisGears_KeyRecordSetVal(keyRecord, accumulator);
 		RedisGears_FreeRecord(record);
     	ADD_DURATION(step->executionDuration);
 	}
+	step->accumulateByKey.isAccumulated = true;
+next:
 	START_TIMER;
-    if(!step->accumulateByKey.iter){
-		step->accumulateByKey.iter = Gears_dictGetIterator(step->accumulateByKey.accumulators);
-	}
-	Gears_dictEntry *entry = Gears_dictNext(step->accumulateByKey.iter);
-	if(!entry){
-		Gears_dictReleaseIterator(step->accumulateByKey.iter);
-		Gears_dictRelease(step->accumulateByKey.accumulators);
-		step->accumulateByKey.iter = NULL;
-		step->accumulateByKey.accumulators = NULL;
-		record = NULL;
+	record = Gears_AggTableTakeNext(step->accumulateByKey.accumulators, &step->accumulateByKey.iterPos);
+	if(!record){
+		// all the accumulators were handed over, release the keys at once
+		Gears_AggTableClear(step->accumulateByKey.accumulators, NULL);
+		step->accumulateByKey.iterPos = 0;
         goto end;
 	}
-	record = Gears_dictGetVal(entry);
 	RedisModule_Assert(RedisGears_RecordGetType(record) == keyRecordType);
 end:
 	ADD_DURATION(step->executionDuration);
     return record;
 }
 
-static Record* ExecutionPlan_NextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+/*
+ * Single record dispatcher for steps that do not support batching.
+ */
+static Record* ExecutionPlan_StepNextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
     Record* r = NULL;
+    bool profile = GearsConfig_GetProfileExecutions();
+    unsigned long long duration = step->executionDuration;
+    LockHandlerWaitScope lockScope;
+    if(profile){
+        LockHandler_WaitScopeStart(&lockScope);
+    }
+    bool sampled = Profiler_PushStep(stepsNames[step->type]);
 
-    INIT_TIMER;
     switch(step->type){
-    case READER:
-    	if(array_len(ep->errors) == 0){
-            GETTIME(&_ts);
-            ExecutionCtx ectx = ExecutionCtx_Initialize(rctx, ep);
-    	    r = step->reader.r->next(&ectx, step->reader.r->ctx);
-            GETTIME(&_te);
-    	    step->executionDuration += DURATION;
-    	    if(!r && ectx.err){
-    	        r = RG_ErrorRecordCreate(ectx.err, strlen(ectx.err) + 1);
-    	    }
-    	}
-        break;
-    case MAP:
-    	r = ExecutionPlan_MapNextRecord(ep, step, rctx);
-    	break;
-    case FLAT_MAP:
-    	r = ExecutionPlan_FlatMapNextRecord(ep, step, rctx);
-    	break;
-    case FILTER:
-    	r = ExecutionPlan_FilterNextRecord(ep, step, rctx);
-    	break;
     case EXTRACTKEY:
     	r = ExecutionPlan_ExtractKeyNextRecord(ep, step, rctx);
     	break;
@@ -1296,9 +3362,6 @@ static Record* ExecutionPlan_NextRecord(ExecutionPlan* ep, ExecutionStep* step,
     case COLLECT:
     	r = ExecutionPlan_CollectNextRecord(ep, step, rctx);
     	break;
-    case FOREACH:
-    	r = ExecutionPlan_ForEachNextRecord(ep, step, rctx);
-    	break;
     case LIMIT:
     	r = ExecutionPlan_LimitNextRecord(ep, step, rctx);
     	break;
@@ -1308,15 +3371,153 @@ static Record* ExecutionPlan_NextRecord(ExecutionPlan* ep, ExecutionStep* step,
     case ACCUMULATE_BY_KEY:
     	r = ExecutionPlan_AccumulateByKeyNextRecord(ep, step, rctx);
 		break;
+    case SORT:
+    case TOPK:
+        r = ExecutionPlan_SortNextRecord(ep, step, rctx);
+        break;
+    case WINDOW:
+        r = ExecutionPlan_WindowNextRecord(ep, step, rctx);
+        break;
+    case JOIN_SOURCE:
+        r = ExecutionPlan_JoinSourceNextRecord(ep, step, rctx);
+        break;
+    case JOIN:
+        r = ExecutionPlan_JoinNextRecord(ep, step, rctx);
+        break;
+    default:
+        RedisModule_Assert(false);
+        return NULL;
+    }
+    if(sampled){
+        Profiler_PopStep();
+    }
+    if(r && r != &StopRecord){
+        ++step->stats.recordsOut;
+    }
+    if(profile){
+        step->stats.lockWaitDuration += LockHandler_WaitScopeEnd(&lockScope);
+        if(r && r != &StopRecord){
+            // the steps durations do not include the time spent on the previous steps
+            ExecutionStep_AddLatency(step, step->executionDuration - duration);
+        }
+    }
+    return r;
+}
+
+/*
+ * Refill the step batch, must only be called after the previous batch was fully consumed.
+ * An empty batch means the step is depleted. A batch never continues after a StopRecord.
+ * Steps that do not support batching are adapted by pulling single records from them.
+ */
+static ExecutionStepBatch* ExecutionPlan_NextBatch(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    ExecutionStepBatch* batch = &step->batch;
+    RedisModule_Assert(batch->index == batch->len);
+    batch->len = 0;
+    batch->index = 0;
+    if(batch->isDone){
+        return batch;
+    }
+    bool profile = GearsConfig_GetProfileExecutions();
+    LockHandlerWaitScope lockScope;
+    if(profile){
+        LockHandler_WaitScopeStart(&lockScope);
+    }
+    // not batched steps are pushed by ExecutionPlan_StepNextRecord
+    bool sampled = ExecutionStep_IsBatched(step) && Profiler_PushStep(stepsNames[step->type]);
+    switch(step->type){
+    case READER:
+        ExecutionPlan_ReaderNextBatch(ep, step, rctx);
+        break;
+    case PARALLEL:
+        ExecutionPlan_ParallelNextBatch(ep, step, rctx);
+        if(batch->len == 0){
+            batch->isDone = true;
+        }
+        break;
+    case MAP:
+    case FLAT_MAP:
+    case FILTER:
+    case FOREACH:
+    case FUSED:
+        // keep going until we produce something or the previous step is depleted
+        while(!batch->isDone && batch->len == 0){
+            if(step->type == MAP || step->type == FLAT_MAP){
+                ExecutionPlan_MapNextBatch(ep, step, rctx, step->type == FLAT_MAP);
+            }else if(step->type == FILTER){
+                ExecutionPlan_FilterNextBatch(ep, step, rctx);
+            }else if(step->type == FOREACH){
+                ExecutionPlan_ForEachNextBatch(ep, step, rctx);
+            }else{
+                ExecutionPlan_FusedNextBatch(ep, step, rctx);
+            }
+            if(step->prev->batch.len == 0){
+                batch->isDone = true;
+            }
+        }
+        break;
     default:
-        RedisModule_Assert(false);
-        return NULL;
+        while(batch->len < GearsConfig_ExecutionBatchSize()){
+            Record* r = ExecutionPlan_StepNextRecord(ep, step, rctx);
+            if(!r){
+                batch->isDone = true;
+                break;
+            }
+            ExecutionStepBatch_Add(batch, r);
+            if(r == &StopRecord){
+                break;
+            }
+        }
     }
-    return r;
+    if(sampled){
+        Profiler_PopStep();
+    }
+    if(ExecutionStep_IsBatched(step)){
+        // not batched steps count their records on ExecutionPlan_StepNextRecord
+        ExecutionStep_CountRecordsOut(step, batch->records, batch->len);
+    }
+    if(profile){
+        step->stats.lockWaitDuration += LockHandler_WaitScopeEnd(&lockScope);
+    }
+    return batch;
+}
+
+static Record* ExecutionPlan_NextRecord(ExecutionPlan* ep, ExecutionStep* step, RedisModuleCtx* rctx){
+    if(!ExecutionStep_IsBatched(step)){
+        return ExecutionPlan_StepNextRecord(ep, step, rctx);
+    }
+    ExecutionStepBatch* batch = &step->batch;
+    if(batch->index == batch->len){
+        ExecutionPlan_NextBatch(ep, step, rctx);
+        if(batch->len == 0){
+            return NULL;
+        }
+    }
+    return batch->records[batch->index++];
+}
+
+static void ExecutionPlan_WriteResults(ExecutionPlan* ep, Record** records, size_t len){
+    if(len == 0){
+        return;
+    }
+    pthread_mutex_lock(&ep->resultsLock);
+    for(size_t i = 0 ; i < len ; ++i){
+        ep->results = array_append(ep->results, records[i]);
+    }
+    pthread_mutex_unlock(&ep->resultsLock);
 }
 
-static void ExecutionPlan_WriteResult(ExecutionPlan* ep, Record* record){
-    ep->results = array_append(ep->results, record);
+Record** ExecutionPlan_TakeResults(ExecutionPlan* ep, Record** records, size_t max){
+    pthread_mutex_lock(&ep->resultsLock);
+    size_t len = array_len(ep->results);
+    for(; ep->resultsOffset < len && max > 0 ; --max){
+        records = array_append(records, ep->results[ep->resultsOffset++]);
+    }
+    if(ep->resultsOffset == len){
+        ep->results = array_trimm_len(ep->results, 0);
+        ep->resultsOffset = 0;
+    }
+    pthread_mutex_unlock(&ep->resultsLock);
+    return records;
 }
 
 static void ExecutionPlan_WriteError(ExecutionPlan* ep, Record* record){
@@ -1324,21 +3525,39 @@ static void ExecutionPlan_WriteError(ExecutionPlan* ep, Record* record){
 }
 
 static bool ExecutionPlan_Execute(ExecutionPlan* ep, RedisModuleCtx* rctx){
+#define RESULTS_FLUSH_SIZE 64
     Record* record = NULL;
+    bool isDone = true;
+    // results are published in chunks so cursors can take them while the execution runs
+    Record* results[RESULTS_FLUSH_SIZE];
+    size_t resultsLen = 0;
+
+    // sync executions might run inside a step of another execution, so restore its arena when done
+    Gears_Arena* oldArena = Gears_ArenaSetCurrent(ep->arena);
 
-    while((record = ExecutionPlan_NextRecord(ep, ep->steps[0], rctx))){
+    while((record = ExecutionPlan_NextRecord(ep, ep->headStep, rctx))){
         if(record == &StopRecord){
             // Execution need to be stopped, lets wait for a while.
-            return false;
+            isDone = false;
+            goto end;
         }
         if(RedisGears_RecordGetType(record) == errorRecordType){
             ExecutionPlan_WriteError(ep, record);
         }else{
-            ExecutionPlan_WriteResult(ep, record);
+            results[resultsLen++] = record;
+            if(resultsLen == RESULTS_FLUSH_SIZE){
+                ExecutionPlan_WriteResults(ep, results, resultsLen);
+                resultsLen = 0;
+            }
         }
     }
 
-    return true;
+    ExecutionPlan_ParallelDone(ep);
+
+end:
+    ExecutionPlan_WriteResults(ep, results, resultsLen);
+    Gears_ArenaSetCurrent(oldArena);
+    return isDone;
 }
 
 ActionResult EPStatus_CreatedAction(ExecutionPlan* ep){
@@ -1375,6 +3594,27 @@ ActionResult EPStatus_AbortedAction(ExecutionPlan* ep){
     return COMPLETED;
 }
 
+/*
+ * Add the steps stats of a finished registered execution to the registration totals.
+ * Must be called while holding the redis lock (RG.DUMPREGISTRATIONS reads them).
+ */
+static void ExecutionPlan_AddRegistrationTotals(ExecutionPlan* ep){
+    FlatExecutionPlan* fep = ep->fep;
+    size_t len = array_len(ep->steps);
+    if(!fep->stepsTotals){
+        fep->stepsTotals = array_new(ExecutionStepTotals, len);
+        for(size_t i = 0 ; i < len ; ++i){
+            fep->stepsTotals = array_append(fep->stepsTotals, (ExecutionStepTotals){0});
+        }
+    }
+    RedisModule_Assert(array_len(fep->stepsTotals) == len);
+    for(size_t i = 0 ; i < len ; ++i){
+        ExecutionStep* step = ep->steps[i];
+        ExecutionStepStats_Merge(&fep->stepsTotals[i].stats, &step->stats);
+        fep->stepsTotals[i].duration += step->executionDuration;
+    }
+}
+
 ActionResult EPStatus_DoneAction(ExecutionPlan* ep){
     RedisModuleCtx* rctx = RedisModule_GetThreadSafeContext(NULL);
     LockHandler_Acquire(rctx);
@@ -1382,8 +3622,16 @@ ActionResult EPStatus_DoneAction(ExecutionPlan* ep){
     if(ep->maxIdleTimerSet){
         RedisModule_StopTimer(rctx, ep->maxIdleTimer, NULL);
     }
+    if(ep->timeoutTimerSet){
+        RedisModule_StopTimer(rctx, ep->timeoutTimer, NULL);
+        ep->timeoutTimerSet = false;
+    }
     EPTurnOnFlag(ep, EFDone);
 
+    if(ep->registered){
+        ExecutionPlan_AddRegistrationTotals(ep);
+    }
+
     // we set it to true so if execution will be freed during done callbacks we
     // will free it only after all the callbacks are executed
     EPTurnOnFlag(ep, EFIsOnDoneCallback);
@@ -1401,11 +3649,30 @@ ActionResult EPStatus_DoneAction(ExecutionPlan* ep){
     return COMPLETED;
 }
 
+/*
+ * A timeout only interrupts the python code of an execution while a worker runs its steps, a global
+ * execution that waits for the other shards has released its worker to other executions.
+ * With python the flag is changed under the GIL, and a stop that was not delivered yet is
+ * dropped when the steps return, so it can not reach the next execution that runs on the thread.
+ * Only the timeout interrupts the python code, without it the GIL is not taken.
+ */
+static void ExecutionPlan_SetRunning(ExecutionPlan* ep, bool running){
+#ifdef WITHPYTHON
+    if(ep->executionPD && ep->timeout > 0){
+        RedisGearsPy_SetExecutionRunning((unsigned long)ep->executionPD, &ep->isRunning, running);
+        return;
+    }
+#endif
+    ep->isRunning = running;
+}
+
 ActionResult EPStatus_RunningAction(ExecutionPlan* ep){
     INIT_TIMER;
     GETTIME(&_ts);
     RedisModuleCtx* rctx = RedisModule_GetThreadSafeContext(NULL);
+    ExecutionPlan_SetRunning(ep, true);
     bool isDone = ExecutionPlan_Execute(ep, rctx);
+    ExecutionPlan_SetRunning(ep, false);
     GETTIME(&_te);
     ep->executionDuration += DURATION;
     RedisModule_FreeThreadSafeContext(rctx);
@@ -1471,6 +3738,36 @@ ActionResult EPStatus_InitiatorTerminationAction(ExecutionPlan* ep){
     return CONTINUE;
 }
 
+static void ExecutionPlan_OnTimeoutReached(RedisModuleCtx *ctx, void *data){
+    ExecutionPlan* ep = data;
+    ep->timeoutTimerSet = false;
+    ExecutionPlan_Cancel(ep, EXECUTION_TIMEOUT_REACHED_MSG);
+#ifdef WITHPYTHON
+    // a python callback might never return to let us check the flag, interrupt it.
+    if(ep->executionPD && EPIsFlagOn(ep, EFStarted) && ep->status != DONE){
+        RedisGearsPy_ForceStopIfRunning((unsigned long)ep->executionPD, &ep->isRunning);
+    }
+#endif
+}
+
+/*
+ * Set the execution deadline, must be called with the redis lock before the execution starts.
+ */
+static void ExecutionPlan_SetTimeout(ExecutionPlan* ep, long long timeout){
+    ep->timeout = timeout;
+    ep->deadline = 0;
+    if(timeout <= 0){
+        return;
+    }
+    ep->deadline = RedisModule_Milliseconds() + timeout;
+    if(ep->mode != ExecutionModeSync){
+        RedisModuleCtx* ctx = RedisModule_GetThreadSafeContext(NULL);
+        ep->timeoutTimer = RedisModule_CreateTimer(ctx, timeout, ExecutionPlan_OnTimeoutReached, ep);
+        ep->timeoutTimerSet = true;
+        RedisModule_FreeThreadSafeContext(ctx);
+    }
+}
+
 static void ExecutionPlan_OnMaxIdleReacher(RedisModuleCtx *ctx, void *data){
     // If we reached here we know the execution is not running so its enough
     // to set its status to abort and call the DoneAction
@@ -1600,31 +3897,62 @@ Reader* ExecutionPlan_GetReader(ExecutionPlan* ep){
     return readerStep->reader.r;
 }
 
+/*
+ * If the steps between the reader and a limit step neither drop nor duplicate records,
+ * the reader only has to produce offset + len records.
+ */
+static void ExecutionPlan_PushDownLimit(ExecutionPlan* ep){
+    ExecutionStep* readerStep = ep->steps[array_len(ep->steps) - 1];
+    Reader* r = readerStep->reader.r;
+    if(!readerStep->reader.hasExtensions || !r->setLimit){
+        return;
+    }
+    for(int i = array_len(ep->steps) - 2 ; i >= 0 ; --i){
+        ExecutionStep* step = ep->steps[i];
+        switch(step->type){
+        case MAP:
+        case EXTRACTKEY:
+        case FOREACH:
+            continue;
+        case LIMIT:
+        {
+            LimitExecutionStepArg* arg = (LimitExecutionStepArg*)step->limit.stepArg.stepArg;
+            r->setLimit(r->ctx, arg->offset + arg->len);
+            return;
+        }
+        default:
+            return;
+        }
+    }
+}
+
 static ExecutionPlan* FlatExecutionPlan_CreateExecution(FlatExecutionPlan* fep, char* eid, ExecutionMode mode, void* arg, RedisGears_OnExecutionDoneCallback callback, void* privateData){
-    ExecutionPlan* ep;
+    ExecutionPlan* ep = NULL;
     if(fep->executionPoolSize > 0){
+        // the pool is only touched while holding the redis lock, so no extra locking is needed
         ep = fep->executionPool[--fep->executionPoolSize];
+        if(ep->mode != mode){
+            // the steps chain (parallel and combiner steps) depends on the mode
+            ExecutionPlan_FreeRaw(ep);
+            ep = NULL;
+        }
+    }
+    if(ep){
         Reader* r = ExecutionPlan_GetReader(ep);
         // we need to reset the reader with the new arguments
         if(r->reset){
             // reader is support reset, lets use it.
             r->reset(r->ctx, arg);
         }else{
-            // reader do not support reset, lets free and recreate
-            ExecutionStep* readerStep = array_pop(ep->steps);
+            // reader do not support reset, lets free and recreate.
+            // the step itself is kept so the steps chain stays as is.
+            ExecutionStep* readerStep = ep->steps[array_len(ep->steps) - 1];
             RedisModule_Assert(readerStep->type == READER);
             readerStep->reader.r->free(readerStep->reader.r->ctx);
             RG_FREE(readerStep->reader.r);
-            ReaderStep rs = ExecutionPlan_NewReader(fep->reader, arg);
-            readerStep->reader = rs;
-            if(array_len(ep->steps) > 0){
-                ep->steps[array_len(ep->steps) - 1]->prev = readerStep;
-            }
-            ep->steps = array_append(ep->steps, readerStep);
+            readerStep->reader = ExecutionPlan_NewReader(fep->reader, arg);
         }
 
-        // set the mode
-        ep->mode = mode;
         if(ep->mode == ExecutionModeSync ||
                 ep->mode == ExecutionModeAsyncLocal ||
                 !Cluster_IsClusterMode()){
@@ -1640,6 +3968,8 @@ static ExecutionPlan* FlatExecutionPlan_CreateExecution(FlatExecutionPlan* fep,
         return NULL;
     }
 
+    ExecutionPlan_PushDownLimit(ep);
+
     if(callback){
         OnDoneData onDoneData = (OnDoneData){.callback = callback, .privateData = privateData};
         ep->onDoneData = array_append(ep->onDoneData, onDoneData);
@@ -1681,7 +4011,12 @@ static ExecutionPlan* FlatExecutionPlan_CreateExecution(FlatExecutionPlan* fep,
 
     ep->assignWorker = NULL;
     ep->isPaused = true;
+    ep->isRunning = false;
     ep->maxIdleTimerSet = false;
+    ep->cancelReason = NULL;
+    ep->cancelReported = false;
+    ep->timeoutTimerSet = false;
+    ExecutionPlan_SetTimeout(ep, fep->executionTimeout);
 
     // Set if the execution plan is registered.
     ep->registered = FEPIsFlagOn(fep, FEFRegistered)? true : false;
@@ -1696,85 +4031,97 @@ static void ExecutionPlan_Run(ExecutionPlan* ep){
 }
 
 static void ExecutionStep_Reset(ExecutionStep* es){
-    Gears_dictIterator * iter = NULL;
-    Gears_dictEntry *entry = NULL;
     es->executionDuration = 0;
+    ExecutionStepStats_Reset(&es->stats);
+    if(es->type == PARALLEL){
+        // helpers are done with the shared reader before it is reset
+        ExecutionPlan_ParallelClear(es);
+    }
     if(es->prev){
         ExecutionStep_Reset(es->prev);
     }
+    ExecutionStepBatch_Clear(&es->batch);
     switch(es->type){
     case LIMIT:
         es->limit.currRecordIndex = 0;
         break;
     case MAP:
+    case FLAT_MAP:
     case FILTER:
     case EXTRACTKEY:
     case REDUCE:
     case FOREACH:
         break;
-    case FLAT_MAP:
-        if(es->flatMap.pendings){
-            RedisGears_FreeRecord(es->flatMap.pendings);
-        }
-        es->flatMap.pendings = NULL;
-        break;
     case REPARTITION:
-        if(es->repartion.pendings){
-            while(array_len(es->repartion.pendings) > 0){
-                Record* r = array_pop(es->repartion.pendings);
-                RedisGears_FreeRecord(r);
-            }
-        }
+        SpillableRecords_Clear(&es->repartion.pendings);
+        ExecutionPlan_RepartitionFreeBatches(es);
         es->repartion.stoped = false;
         es->repartion.totalShardsCompleted = 0;
         break;
     case COLLECT:
-        if(es->collect.pendings){
-            while(array_len(es->collect.pendings) > 0){
-                Record* r = array_pop(es->collect.pendings);
-                RedisGears_FreeRecord(r);
-            }
+        SpillableRecords_Clear(&es->collect.pendings);
+        if(es->collect.batch){
+            RecordsBatch_Free(es->collect.batch);
+            es->collect.batch = NULL;
         }
         es->collect.totalShardsCompleted = 0;
         es->collect.stoped = false;
+        ExecutionStep_ClearMergeRuns(es);
         break;
     case GROUP:
-        if(es->group.groupedRecords){
-            while(array_len(es->group.groupedRecords) > 0){
-                Record* r = array_pop(es->group.groupedRecords);
-                RedisGears_FreeRecord(r);
-            }
-        }
-        Gears_dictEmpty(es->group.d, NULL);
+        Gears_AggTableClear(es->group.groups, ExecutionStep_FreeAggTableVal);
+        es->group.iterPos = 0;
         es->group.isGrouped = false;
+        es->group.memoryUsage = 0;
+        es->group.spillFailed = false;
+        ExecutionStep_FreeGroupPartitions(es);
         break;
     case READER:
         // the reader will be reset with the new args or will be freed ...
         break;
+    case FUSED:
+        for(size_t i = 0 ; i < array_len(es->fused.steps) ; ++i){
+            ExecutionStep_Reset(es->fused.steps[i]);
+        }
+        break;
+    case PARALLEL:
+        for(size_t i = 0 ; i < array_len(es->parallel.prefixes) ; ++i){
+            ExecutionStep_Reset(es->parallel.prefixes[i]);
+        }
+        // helpers that are still queued on the pool hold the old context
+        ParallelWorkersCtx_Unref(es->parallel.workersCtx);
+        es->parallel.workersCtx = ParallelWorkersCtx_Create();
+        es->parallel.started = false;
+        es->parallel.fullBatchRead = false;
+        es->parallel.mainDone = false;
+        break;
     case ACCUMULATE:
         if(es->accumulate.accumulator){
             RedisGears_FreeRecord(es->accumulate.accumulator);
+            es->accumulate.accumulator = NULL;
         }
         es->accumulate.isDone = false;
         break;
     case ACCUMULATE_BY_KEY:
-        if(es->accumulateByKey.accumulators){
-            if(es->accumulateByKey.iter){
-                iter = es->accumulateByKey.iter;
-                es->accumulateByKey.iter = NULL;
-            }else{
-                iter = Gears_dictGetIterator(es->accumulateByKey.accumulators);
-            }
-            while((entry = Gears_dictNext(iter))){
-                Record* r = Gears_dictGetVal(entry);
-                RedisGears_FreeRecord(r);
-            }
-            Gears_dictReleaseIterator(iter);
-            Gears_dictEmpty(es->accumulateByKey.accumulators, NULL);
-
-        }else{
-            es->accumulateByKey.accumulators = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
-        }
+        Gears_AggTableClear(es->accumulateByKey.accumulators, ExecutionStep_FreeAggTableVal);
+        es->accumulateByKey.iterPos = 0;
+        es->accumulateByKey.isAccumulated = false;
+        break;
+    case SORT:
+    case TOPK:
+        ExecutionStep_ClearSortRecords(es);
+        es->sort.isSorted = false;
+        break;
+    case WINDOW:
+        ExecutionStep_ClearWindowRecords(es);
+        es->window.isDone = false;
+        es->window.isChanged = false;
+        break;
+    case JOIN_SOURCE:
+        ExecutionStep_ClearJoinSource(es);
+        break;
+    case JOIN:
+        ExecutionStep_ClearJoin(es);
         break;
     default:
         RedisModule_Assert(false);
@@ -1782,10 +4129,14 @@ static void ExecutionStep_Reset(ExecutionStep* es){
 }
 
 static void ExecutionPlan_Reset(ExecutionPlan* ep){
-    while(array_len(ep->results) > 0){
-        Record* record = array_pop(ep->results);
-        RedisGears_FreeRecord(record);
+    // the plan is not running, return its records to the arena so the next run will reuse them
+    Gears_Arena* oldArena = Gears_ArenaSetCurrent(ep->arena);
+
+    for(size_t i = ep->resultsOffset ; i < array_len(ep->results) ; ++i){
+        RedisGears_FreeRecord(ep->results[i]);
     }
+    ep->results = array_trimm_len(ep->results, 0);
+    ep->resultsOffset = 0;
 
     while(array_len(ep->errors) > 0){
         Record* record = array_pop(ep->errors);
@@ -1793,6 +4144,8 @@ static void ExecutionPlan_Reset(ExecutionPlan* ep){
     }
 
     ep->executionDuration = 0;
+    ep->bufferedMemory = 0;
+    ep->executionPD = NULL;
     ep->totalShardsRecieved = 0;
     ep->totalShardsCompleted = 0;
     ep->status = CREATED;
@@ -1805,7 +4158,9 @@ static void ExecutionPlan_Reset(ExecutionPlan* ep){
     EPTurnOffFlag(ep, EFIsLocalyFreedOnDoneCallback);
     EPTurnOffFlag(ep, EFStarted);
 
-    ExecutionStep_Reset(ep->steps[0]);
+    ExecutionStep_Reset(ep->headStep);
+
+    Gears_ArenaSetCurrent(oldArena);
 }
 
 static void ExecutionPlan_RunSync(ExecutionPlan* ep){
@@ -1967,10 +4322,18 @@ static void ExecutionPlan_OnReceived(RedisModuleCtx *ctx, const char *sender_id,
         }
     }
 
+    ExecutionPlan_SetTimeout(ep, RedisGears_BRReadLong(&br));
+
     ep->assignWorker = ExecutionPlan_CreateWorker(pool);
     ExecutionPlan_Run(ep);
 }
 
+static Record* ExecutionPlan_EncodingVersionErrorRecord(const char* senderId){
+    char* err;
+    rg_asprintf(&err, "Got records with an unsupported encoding version from shard %.*s", REDISMODULE_NODE_ID_LEN, senderId);
+    return RG_ErrorRecordCreate(err, strlen(err));
+}
+
 static void ExecutionPlan_CollectOnRecordReceived(RedisModuleCtx *ctx, const char *sender_id, uint8_t type, const unsigned char *payload, uint32_t len){
     Gears_Buffer buff;
     buff.buff = (char*)payload;
@@ -1991,9 +4354,25 @@ static void ExecutionPlan_CollectOnRecordReceived(RedisModuleCtx *ctx, const cha
     }
     size_t stepId = RedisGears_BRReadLong(&br);
     RedisModule_Assert(epIdLen == ID_LEN);
-    Record* r = RG_DeserializeRecord(&br);
-    WorkerMsg* msg = ExectuionPlan_WorkerMsgCreateAddRecord(ep, stepId, r, COLLECT);
-	ExectuionPlan_WorkerMsgSend(ep->assignWorker, msg);
+    RecordsDecoder dec;
+    RG_RecordsDecoderInit(&dec);
+    if(RG_RecordsDecoderStart(&dec, &br) != REDISMODULE_OK){
+        RedisModule_Log(NULL, "warning", "On ExecutionPlan_CollectOnRecordReceived, unsupported records encoding version");
+        RG_RecordsDecoderFree(&dec);
+        // the records are lost, make sure the execution reports it
+        WorkerMsg* msg = ExectuionPlan_WorkerMsgCreateAddRecord(ep, stepId, ExecutionPlan_EncodingVersionErrorRecord(sender_id), COLLECT);
+        memcpy(msg->addRecordWM.senderId, sender_id, REDISMODULE_NODE_ID_LEN);
+        ExectuionPlan_WorkerMsgSend(ep->assignWorker, msg);
+        return;
+    }
+    while(br.location < buff.size){
+        Record* r = RG_RecordDecode(&dec, &br);
+        WorkerMsg* msg = ExectuionPlan_WorkerMsgCreateAddRecord(ep, stepId, r, COLLECT);
+        // sorted records are merged by the shard they came from
+        memcpy(msg->addRecordWM.senderId, sender_id, REDISMODULE_NODE_ID_LEN);
+        ExectuionPlan_WorkerMsgSend(ep->assignWorker, msg);
+    }
+    RG_RecordsDecoderFree(&dec);
 }
 
 static void ExecutionPlan_CollectDoneSendingRecords(RedisModuleCtx *ctx, const char *sender_id, uint8_t type, const unsigned char *payload, uint32_t len){
@@ -2039,9 +4418,22 @@ static void ExecutionPlan_OnRepartitionRecordReceived(RedisModuleCtx *ctx, const
     }
     size_t stepId = RedisGears_BRReadLong(&br);
     RedisModule_Assert(epIdLen == ID_LEN);
-    Record* r = RG_DeserializeRecord(&br);
-    WorkerMsg* msg = ExectuionPlan_WorkerMsgCreateAddRecord(ep, stepId, r, REPARTITION);
-    ExectuionPlan_WorkerMsgSend(ep->assignWorker, msg);
+    RecordsDecoder dec;
+    RG_RecordsDecoderInit(&dec);
+    if(RG_RecordsDecoderStart(&dec, &br) != REDISMODULE_OK){
+        RedisModule_Log(NULL, "warning", "On ExecutionPlan_OnRepartitionRecordReceived, unsupported records encoding version");
+        RG_RecordsDecoderFree(&dec);
+        // the records are lost, make sure the execution reports it
+        WorkerMsg* msg = ExectuionPlan_WorkerMsgCreateAddRecord(ep, stepId, ExecutionPlan_EncodingVersionErrorRecord(sender_id), REPARTITION);
+        ExectuionPlan_WorkerMsgSend(ep->assignWorker, msg);
+        return;
+    }
+    while(br.location < buff.size){
+        Record* r = RG_RecordDecode(&dec, &br);
+        WorkerMsg* msg = ExectuionPlan_WorkerMsgCreateAddRecord(ep, stepId, r, REPARTITION);
+        ExectuionPlan_WorkerMsgSend(ep->assignWorker, msg);
+    }
+    RG_RecordsDecoderFree(&dec);
 }
 
 static void FlatExecutionPlan_AddBasicStep(FlatExecutionPlan* fep, const char* callbackName, void* arg, enum StepType type){
@@ -2152,23 +4544,30 @@ static void ExecutionPlan_StepDone(RedisModuleCtx* ctx, ExecutionPlan* ep, size_
 	}
 }
 
-static void ExecutionPlan_AddStepRecord(RedisModuleCtx* ctx, ExecutionPlan* ep, size_t stepId, Record* r, enum StepType stepType){
+static void ExecutionPlan_AddStepRecord(RedisModuleCtx* ctx, ExecutionPlan* ep, size_t stepId, Record* r, enum StepType stepType, const char* senderId){
 #define MAX_PENDING_TO_START_RUNNING 10000
-	Record*** pendings = NULL;
+	SpillableRecords* pendings = NULL;
 	switch(stepType){
 	case REPARTITION:
 	    RedisModule_Assert(ep->steps[stepId]->type == REPARTITION);
-		pendings = &(ep->steps[stepId]->repartion.pendings);
+		pendings = &ep->steps[stepId]->repartion.pendings;
 		break;
 	case COLLECT:
 	    RedisModule_Assert(ep->steps[stepId]->type == COLLECT);
-		pendings = &(ep->steps[stepId]->collect.pendings);
+	    if(ep->steps[stepId]->collect.sortStep && RedisGears_RecordGetType(r) != errorRecordType){
+	        // the records are merged only after all the shards are done, no point running before
+	        CollectMergeRun* run = ExecutionStep_GetMergeRun(ep->steps[stepId], senderId);
+	        run->records = array_append(run->records, r);
+	        ExecutionPlan_Pause(ctx, ep);
+	        return;
+	    }
+		pendings = &ep->steps[stepId]->collect.pendings;
 		break;
 	default:
 	    RedisModule_Assert(false);
 	}
-	*pendings = array_append(*pendings, r);
-	if(array_len(*pendings) >= MAX_PENDING_TO_START_RUNNING){
+	SpillableRecords_Add(pendings, r);
+	if(SpillableRecords_Len(pendings) >= MAX_PENDING_TO_START_RUNNING){
 	    ExecutionPlan_Main(ctx, ep);
 	}else{
 	    ExecutionPlan_Pause(ctx, ep);
@@ -2223,7 +4622,7 @@ static void ExecutionPlan_MsgArrive(RedisModuleCtx* ctx, WorkerMsg* msg){
         ExecutionPlan_Main(ctx, ep);
 		break;
 	case ADD_RECORD_MSG:
-		ExecutionPlan_AddStepRecord(ctx, ep, msg->addRecordWM.stepId, msg->addRecordWM.record, msg->addRecordWM.stepType);
+		ExecutionPlan_AddStepRecord(ctx, ep, msg->addRecordWM.stepId, msg->addRecordWM.record, msg->addRecordWM.stepType, msg->addRecordWM.senderId);
 		// setting it to NULL to indicate that we move responsibility
 		// on the record to the execution and it should not be free on ExectuionPlan_WorkerMsgFree
 		msg->addRecordWM.record = NULL;
@@ -2394,10 +4793,11 @@ ExecutionPlan* FlatExecutionPlan_Run(FlatExecutionPlan* fep, ExecutionMode mode,
 static ReaderStep ExecutionPlan_NewReader(FlatExecutionReader* reader, void* arg){
     RedisGears_ReaderCallbacks* callbacks = ReadersMgmt_Get(reader->reader);
     RedisModule_Assert(callbacks); // todo: handle as error in future
-    return (ReaderStep){.r = callbacks->create(arg)};
+    bool hasExtensions = ReadersMgmt_GetLLApiVersion(reader->reader) >= 2;
+    return (ReaderStep){.r = callbacks->create(arg), .hasExtensions = hasExtensions};
 }
 
-static ExecutionStep* ExecutionPlan_NewExecutionStep(FlatExecutionStep* step){
+static ExecutionStep* ExecutionPlan_NewExecutionStep(ExecutionPlan* ep, FlatExecutionStep* step){
 #define PENDING_INITIAL_SIZE 10
     ExecutionStep* es = RG_ALLOC(sizeof(*es));
     es->type = step->type;
@@ -2409,7 +4809,6 @@ static ExecutionStep* ExecutionPlan_NewExecutionStep(FlatExecutionStep* step){
     case FLAT_MAP:
         es->flatMap.mapStep.map = MapsMgmt_Get(step->bStep.stepName);
         es->flatMap.mapStep.stepArg = step->bStep.arg;
-        es->flatMap.pendings = NULL;
         break;
     case FILTER:
         es->filter.filter = FiltersMgmt_Get(step->bStep.stepName);
@@ -2425,19 +4824,31 @@ static ExecutionStep* ExecutionPlan_NewExecutionStep(FlatExecutionStep* step){
         break;
     case GROUP:
 #define GROUP_RECORD_INIT_LEN 10
-        es->group.groupedRecords = array_new(Record*, GROUP_RECORD_INIT_LEN);;
-        es->group.d = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
+        es->group.groups = Gears_AggTableCreate();
+        es->group.iterPos = 0;
         es->group.isGrouped = false;
+        es->group.memoryUsage = 0;
+        es->group.partitions = NULL;
+        es->group.currPartition = 0;
+        es->group.spillFailed = false;
         break;
     case REPARTITION:
         es->repartion.stoped = false;
-        es->repartion.pendings = array_new(Record*, PENDING_INITIAL_SIZE);
+        SpillableRecords_Init(&es->repartion.pendings, &ep->bufferedMemory);
         es->repartion.totalShardsCompleted = 0;
+        es->repartion.broadcastJoinBuild = false;
+        es->repartion.batches = NULL;
+        es->repartion.broadcastBatch = NULL;
         break;
     case COLLECT:
     	es->collect.totalShardsCompleted = 0;
     	es->collect.stoped = false;
-    	es->collect.pendings = array_new(Record*, PENDING_INITIAL_SIZE);
+    	SpillableRecords_Init(&es->collect.pendings, &ep->bufferedMemory);
+    	es->collect.sortStep = NULL;
+    	es->collect.runs = NULL;
+    	es->collect.heap = NULL;
+    	es->collect.isMerging = false;
+    	es->collect.batch = NULL;
     	break;
     case FOREACH:
         es->forEach.forEach = ForEachsMgmt_Get(step->bStep.stepName);
@@ -2456,13 +4867,54 @@ static ExecutionStep* ExecutionPlan_NewExecutionStep(FlatExecutionStep* step){
     case ACCUMULATE_BY_KEY:
     	es->accumulateByKey.stepArg = step->bStep.arg;
 		es->accumulateByKey.accumulate = AccumulateByKeysMgmt_Get(step->bStep.stepName);
-		es->accumulateByKey.accumulators = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
-		es->accumulateByKey.iter = NULL;
+		es->accumulateByKey.accumulators = Gears_AggTableCreate();
+		es->accumulateByKey.iterPos = 0;
+		es->accumulateByKey.isAccumulated = false;
 		break;
+    case SORT:
+    case TOPK:
+        es->sort.compare = ComparesMgmt_Get(step->bStep.stepName);
+        es->sort.stepArg = step->bStep.arg;
+        es->sort.records = array_new(Record*, PENDING_INITIAL_SIZE);
+        es->sort.k = 0;
+        es->sort.iterPos = 0;
+        es->sort.isSorted = false;
+        break;
+    case WINDOW:
+    {
+        WindowExecutionStepArg* arg = step->bStep.arg.stepArg;
+        es->window.accumulate = AccumulatesMgmt_Get(arg->accumulateName);
+        es->window.stepArg = step->bStep.arg;
+        es->window.closed = array_new(Record*, PENDING_INITIAL_SIZE);
+        es->window.iterPos = 0;
+        es->window.isDone = false;
+        es->window.isChanged = false;
+        break;
+    }
+    case JOIN_SOURCE:
+    {
+        JoinSourceExecutionStepArg* arg = step->bStep.arg.stepArg;
+        es->joinSource.stepArg = step->bStep.arg;
+        es->joinSource.probeExtractor = ExtractorsMgmt_Get(arg->probeExtractor.name);
+        es->joinSource.buildExtractor = ExtractorsMgmt_Get(arg->buildExtractor.name);
+        es->joinSource.buildMapper = arg->buildMapper.name ? MapsMgmt_Get(arg->buildMapper.name) : NULL;
+        es->joinSource.buildReader = NULL;
+        es->joinSource.isDone = false;
+        break;
+    }
+    case JOIN:
+        es->join.builds = Gears_AggTableCreate();
+        es->join.probes = array_new(Record*, PENDING_INITIAL_SIZE);
+        es->join.probePos = 0;
+        es->join.matchPos = 0;
+        es->join.isBuilt = false;
+        break;
     default:
         RedisModule_Assert(false);
     }
+    es->batch = (ExecutionStepBatch){0};
     es->executionDuration = 0;
+    es->stats = (ExecutionStepStats){0};
     return es;
 }
 
@@ -2471,7 +4923,9 @@ static ExecutionStep* ExecutionPlan_NewReaderExecutionStep(ReaderStep reader){
     es->type = READER;
     es->reader = reader;
     es->prev = NULL;
+    es->batch = (ExecutionStepBatch){0};
     es->executionDuration = 0;
+    es->stats = (ExecutionStepStats){0};
     return es;
 }
 
@@ -2483,14 +4937,234 @@ static void FlatExecutionPlan_SetID(FlatExecutionPlan* fep, char* id){
     SetId(id, fep->id, fep->idStr, &lastFEPId);
 }
 
+static bool ExecutionStep_IsFusable(ExecutionStep* step){
+    switch(step->type){
+    case MAP:
+    case FLAT_MAP:
+    case FILTER:
+    case FOREACH:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool ExecutionStep_IsStateless(ExecutionStep* step){
+    return ExecutionStep_IsFusable(step) || step->type == EXTRACTKEY;
+}
+
+static ExecutionStepArg* ExecutionStep_GetStatelessStepArg(ExecutionStep* step){
+    switch(step->type){
+    case MAP:
+    case FLAT_MAP:
+        return &step->map.stepArg;
+    case FILTER:
+        return &step->filter.stepArg;
+    case FOREACH:
+        return &step->forEach.stepArg;
+    case EXTRACTKEY:
+        return &step->extractKey.extractorArg;
+    default:
+        RedisModule_Assert(false);
+        return NULL;
+    }
+}
+
+/*
+ * Replace each run of consecutive stateless steps on the chain with a single fused step.
+ * The original steps stay in ep->steps so their stats and ids are kept,
+ * only the prev chain is changed to go through the fused step.
+ * Return the new head of the chain.
+ */
+static ExecutionStep* ExecutionPlan_FuseSteps(ExecutionStep* head){
+    ExecutionStep* newHead = head;
+    ExecutionStep* next = NULL; // the step that reads from curr
+    ExecutionStep* curr = head;
+    while(curr){
+        if(curr->type == PARALLEL){
+            for(size_t i = 0 ; i < array_len(curr->parallel.prefixes) ; ++i){
+                curr->parallel.prefixes[i] = ExecutionPlan_FuseSteps(curr->parallel.prefixes[i]);
+            }
+        }
+        if(!ExecutionStep_IsFusable(curr) || !curr->prev || !ExecutionStep_IsFusable(curr->prev)){
+            next = curr;
+            curr = curr->prev;
+            continue;
+        }
+        ExecutionStep* fused = RG_ALLOC(sizeof(*fused));
+        fused->type = FUSED;
+        fused->stepId = curr->stepId;
+        fused->batch = (ExecutionStepBatch){0};
+        fused->executionDuration = 0;
+        fused->stats = (ExecutionStepStats){0};
+        fused->fused.steps = array_new(ExecutionStep*, 2);
+        size_t pythonSteps = 0;
+        while(curr && ExecutionStep_IsFusable(curr)){
+            ExecutionStep* prev = curr->prev;
+            curr->prev = NULL;
+            fused->fused.steps = array_append(fused->fused.steps, curr);
+#ifdef WITHPYTHON
+            if(RedisGearsPy_IsPyCallbackArgType(ExecutionStep_GetStatelessStepArg(curr)->type)){
+                ++pythonSteps;
+            }
+#endif
+            curr = prev;
+        }
+        // the chain goes from the last step to the first, the fused steps are kept by execution order
+        size_t len = array_len(fused->fused.steps);
+        for(size_t i = 0 ; i < len / 2 ; ++i){
+            ExecutionStep* tmp = fused->fused.steps[i];
+            fused->fused.steps[i] = fused->fused.steps[len - 1 - i];
+            fused->fused.steps[len - 1 - i] = tmp;
+        }
+        fused->fused.lockPython = pythonSteps > 1;
+        fused->prev = curr;
+        if(next){
+            next->prev = fused;
+        }else{
+            newHead = fused;
+        }
+        next = fused;
+    }
+    return newHead;
+}
+
+/*
+ * Run the stateless steps that follows a KeysReader on multiple threads.
+ * Each helper gets its own copy of those steps and they all read from the same
+ * reader, the results are merged before the first step that keeps state.
+ */
+static void ExecutionPlan_Parallelize(ExecutionPlan* ep, FlatExecutionPlan* fep){
+    size_t parallelism = GearsConfig_ExecutionParallelism();
+    if(parallelism <= 1 || ep->mode == ExecutionModeSync){
+        return;
+    }
+    if(strcmp(fep->reader->reader, "KeysReader") != 0){
+        return;
+    }
+    size_t readerIndex = array_len(ep->steps) - 1;
+    size_t boundary = readerIndex;
+    while(boundary > 0 && ExecutionStep_IsStateless(ep->steps[boundary - 1])){
+        --boundary;
+    }
+    // ep->steps[boundary, readerIndex) is the stateless prefix, ep->steps[boundary - 1] merges the results
+    if(boundary == 0 || boundary == readerIndex){
+        return;
+    }
+    ExecutionStep* mergeStep = ep->steps[boundary - 1];
+    switch(mergeStep->type){
+    case GROUP:
+    case ACCUMULATE:
+    case ACCUMULATE_BY_KEY:
+    case COLLECT:
+    case REPARTITION:
+        break;
+    default:
+        return;
+    }
+#ifdef WITHPYTHON
+    // python steps are serialized on the GIL, no point running them in parallel
+    for(size_t i = boundary ; i < readerIndex ; ++i){
+        if(RedisGearsPy_IsPyCallbackArgType(ExecutionStep_GetStatelessStepArg(ep->steps[i])->type)){
+            return;
+        }
+    }
+#endif
+
+    ExecutionStep* readerStep = ep->steps[readerIndex];
+    ExecutionStep* ps = RG_ALLOC(sizeof(*ps));
+    ps->type = PARALLEL;
+    ps->stepId = ep->steps[boundary]->stepId;
+    ps->prev = readerStep;
+    ps->batch = (ExecutionStepBatch){0};
+    ps->executionDuration = 0;
+    ps->stats = (ExecutionStepStats){0};
+    ps->parallel.prefixes = array_new(ExecutionStep*, parallelism);
+    ps->parallel.workersCtx = ParallelWorkersCtx_Create();
+    ps->parallel.started = false;
+    ps->parallel.fullBatchRead = false;
+    ps->parallel.mainDone = false;
+    for(size_t w = 0 ; w < parallelism ; ++w){
+        Reader* proxy = RG_ALLOC(sizeof(*proxy));
+        *proxy = (Reader){
+            .ctx = ps,
+            .nextBatch = ExecutionPlan_ParallelReaderNextBatch,
+        };
+        ExecutionStep* last = ExecutionPlan_NewReaderExecutionStep((ReaderStep){.r = proxy, .isProxy = true, .hasExtensions = true});
+        last->stepId = readerStep->stepId;
+        for(size_t i = readerIndex ; i > boundary ; --i){
+            ExecutionStep* s = ep->steps[i - 1];
+            if(w > 0){
+                // steps ids are reversed compared to the flat steps
+                s = ExecutionPlan_NewExecutionStep(ep, fep->steps + (array_len(fep->steps) - 1 - s->stepId));
+                s->stepId = ep->steps[i - 1]->stepId;
+            }
+            s->prev = last;
+            last = s;
+        }
+        ps->parallel.prefixes = array_append(ps->parallel.prefixes, last);
+    }
+    mergeStep->prev = ps;
+}
+
+/*
+ * Groupby and accumulateby steps with associative callbacks are pre-aggregated locally
+ * before the repartition, so only the partial results are sent to the other shards.
+ * The combiner steps are copies of the aggregation steps, they are only part of the
+ * steps chain and not of 'steps'.
+ */
+static void ExecutionPlan_AddCombiners(ExecutionPlan* ep, FlatExecutionPlan* fep){
+    if(ep->mode == ExecutionModeSync || ep->mode == ExecutionModeAsyncLocal || !Cluster_IsClusterMode()){
+        // records are not sent anywhere
+        return;
+    }
+    size_t nSteps = array_len(fep->steps);
+    for(size_t i = 1 ; i < array_len(ep->steps) ; ++i){
+        ExecutionStep* repartition = ep->steps[i];
+        if(repartition->type != REPARTITION){
+            continue;
+        }
+        // steps ids are reversed compared to the flat steps
+        ExecutionStep* aggregate = ep->steps[i - 1];
+        FlatExecutionStep* aggregateFlatStep = fep->steps + (nSteps - 1 - aggregate->stepId);
+        ExecutionStep* combiner = NULL;
+        if(aggregate->type == ACCUMULATE_BY_KEY){
+            if(!AccumulateByKeysMgmt_IsAssociative(aggregateFlatStep->bStep.stepName)){
+                continue;
+            }
+            combiner = ExecutionPlan_NewExecutionStep(ep, aggregateFlatStep);
+            combiner->stepId = aggregate->stepId;
+            combiner->prev = repartition->prev;
+        }else if(aggregate->type == GROUP && i > 1 && ep->steps[i - 2]->type == REDUCE){
+            ExecutionStep* reduce = ep->steps[i - 2];
+            FlatExecutionStep* reduceFlatStep = fep->steps + (nSteps - 1 - reduce->stepId);
+            if(!ReducersMgmt_IsAssociative(reduceFlatStep->bStep.stepName)){
+                continue;
+            }
+            ExecutionStep* group = ExecutionPlan_NewExecutionStep(ep, aggregateFlatStep);
+            group->stepId = aggregate->stepId;
+            group->prev = repartition->prev;
+            combiner = ExecutionPlan_NewExecutionStep(ep, reduceFlatStep);
+            combiner->stepId = reduce->stepId;
+            combiner->prev = group;
+        }else{
+            continue;
+        }
+        repartition->prev = combiner;
+    }
+}
+
 static ExecutionPlan* ExecutionPlan_New(FlatExecutionPlan* fep, ExecutionMode mode, void* arg){
     ExecutionPlan* ret = RG_ALLOC(sizeof(*ret));
     ret->steps = array_new(FlatExecutionStep*, array_len(fep->steps));
     ret->executionDuration = 0;
+    ret->bufferedMemory = 0;
+    ret->executionPD = NULL;
+    ret->arena = GearsConfig_ExecutionArena() ? Gears_ArenaCreate() : NULL;
     ExecutionStep* last = NULL;
     for(int i = array_len(fep->steps) - 1 ; i >= 0 ; --i){
         FlatExecutionStep* s = fep->steps + i;
-        ExecutionStep* es = ExecutionPlan_NewExecutionStep(s);
+        ExecutionStep* es = ExecutionPlan_NewExecutionStep(ret, s);
         es->stepId = array_len(fep->steps) - 1 - i;
         if(array_len(ret->steps) > 0){
             ret->steps[array_len(ret->steps) - 1]->prev = es;
@@ -2503,15 +5177,22 @@ static ExecutionPlan* ExecutionPlan_New(FlatExecutionPlan* fep, ExecutionMode mo
         ret->steps[array_len(ret->steps) - 1]->prev = readerStep;
     }
     ret->steps = array_append(ret->steps, readerStep);
+    ret->mode = mode;
+    ExecutionPlan_SetupSortSteps(ret);
+    ExecutionPlan_SetupJoinSteps(ret);
+    ExecutionPlan_Parallelize(ret, fep);
+    ExecutionPlan_AddCombiners(ret, fep);
+    ret->headStep = ExecutionPlan_FuseSteps(ret->steps[0]);
     ret->totalShardsRecieved = 0;
     ret->totalShardsCompleted = 0;
     ret->results = array_new(Record*, 100);
+    ret->resultsOffset = 0;
+    pthread_mutex_init(&ret->resultsLock, NULL);
     ret->errors = array_new(Record*, 1);
     ret->status = CREATED;
     EPTurnOffFlag(ret, EFSentRunRequest);
     ret->onDoneData = array_new(OnDoneData, 10);
     EPTurnOffFlag(ret, EFDone);
-    ret->mode = mode;
     if(ret->mode == ExecutionModeSync ||
             ret->mode == ExecutionModeAsyncLocal ||
             !Cluster_IsClusterMode()){
@@ -2527,51 +5208,42 @@ static ExecutionPlan* ExecutionPlan_New(FlatExecutionPlan* fep, ExecutionMode mo
 }
 
 static void ExecutionStep_Free(ExecutionStep* es){
-	Gears_dictIterator * iter = NULL;
-	Gears_dictEntry *entry = NULL;
+    if(es->type == PARALLEL){
+        // helpers are done with the shared reader before it is freed
+        ExecutionPlan_ParallelClear(es);
+    }
     if(es->prev){
         ExecutionStep_Free(es->prev);
     }
+    ExecutionStepBatch_Free(&es->batch);
+    ExecutionStepStats_Free(&es->stats);
     switch(es->type){
     case LIMIT:
     case MAP:
+    case FLAT_MAP:
     case FILTER:
     case EXTRACTKEY:
     case REDUCE:
     case FOREACH:
         break;
-    case FLAT_MAP:
-        if(es->flatMap.pendings){
-            RedisGears_FreeRecord(es->flatMap.pendings);
-        }
-        break;
     case REPARTITION:
-    	if(es->repartion.pendings){
-			for(size_t i = 0 ; i < array_len(es->repartion.pendings) ; ++i){
-				Record* r = es->repartion.pendings[i];
-				RedisGears_FreeRecord(r);
-			}
-			array_free(es->repartion.pendings);
-		}
+    	SpillableRecords_Free(&es->repartion.pendings);
+    	ExecutionPlan_RepartitionFreeBatches(es);
 		break;
     case COLLECT:
-    	if(es->collect.pendings){
-    		for(size_t i = 0 ; i < array_len(es->collect.pendings) ; ++i){
-				Record* r = es->collect.pendings[i];
-				RedisGears_FreeRecord(r);
-			}
-			array_free(es->collect.pendings);
+    	SpillableRecords_Free(&es->collect.pendings);
+    	if(es->collect.batch){
+    	    RecordsBatch_Free(es->collect.batch);
+    	}
+    	if(es->collect.runs){
+    	    ExecutionStep_ClearMergeRuns(es);
+    	    array_free(es->collect.runs);
+    	    array_free(es->collect.heap);
     	}
 		break;
     case GROUP:
-        if(es->group.groupedRecords){
-            for(size_t i = 0 ; i < array_len(es->group.groupedRecords) ; ++i){
-                Record* r = es->group.groupedRecords[i];
-                RedisGears_FreeRecord(r);
-            }
-            array_free(es->group.groupedRecords);
-            Gears_dictRelease(es->group.d);
-        }
+        Gears_AggTableFree(es->group.groups, ExecutionStep_FreeAggTableVal);
+        ExecutionStep_FreeGroupPartitions(es);
         break;
     case READER:
         if(es->reader.r->free){
@@ -2579,26 +5251,44 @@ static void ExecutionStep_Free(ExecutionStep* es){
         }
         RG_FREE(es->reader.r);
         break;
+    case FUSED:
+        for(size_t i = 0 ; i < array_len(es->fused.steps) ; ++i){
+            ExecutionStep_Free(es->fused.steps[i]);
+        }
+        array_free(es->fused.steps);
+        break;
+    case PARALLEL:
+        for(size_t i = 0 ; i < array_len(es->parallel.prefixes) ; ++i){
+            ExecutionStep_Free(es->parallel.prefixes[i]);
+        }
+        array_free(es->parallel.prefixes);
+        ParallelWorkersCtx_Unref(es->parallel.workersCtx);
+        break;
     case ACCUMULATE:
     	if(es->accumulate.accumulator){
     		RedisGears_FreeRecord(es->accumulate.accumulator);
     	}
     	break;
     case ACCUMULATE_BY_KEY:
-    	if(es->accumulateByKey.accumulators){
-			if(es->accumulateByKey.iter){
-				iter = es->accumulateByKey.iter;
-			}else{
-				iter = Gears_dictGetIterator(es->accumulateByKey.accumulators);
-			}
-			while((entry = Gears_dictNext(iter))){
-				Record* r = Gears_dictGetVal(entry);
-				RedisGears_FreeRecord(r);
-			}
-			Gears_dictReleaseIterator(iter);
-			Gears_dictRelease(es->accumulateByKey.accumulators);
-    	}
+    	Gears_AggTableFree(es->accumulateByKey.accumulators, ExecutionStep_FreeAggTableVal);
 		break;
+    case SORT:
+    case TOPK:
+        ExecutionStep_ClearSortRecords(es);
+        array_free(es->sort.records);
+        break;
+    case WINDOW:
+        ExecutionStep_ClearWindowRecords(es);
+        array_free(es->window.closed);
+        break;
+    case JOIN_SOURCE:
+        ExecutionStep_ClearJoinSource(es);
+        break;
+    case JOIN:
+        ExecutionStep_ClearJoin(es);
+        Gears_AggTableFree(es->join.builds, NULL);
+        array_free(es->join.probes);
+        break;
 	default:
 	    RedisModule_Assert(false);
     }
@@ -2606,11 +5296,16 @@ static void ExecutionStep_Free(ExecutionStep* es){
 }
 
 static void ExecutionPlan_FreeRaw(ExecutionPlan* ep){
-    ExecutionStep_Free(ep->steps[0]);
+    ExecutionStep_Free(ep->headStep);
     array_free(ep->steps);
     array_free(ep->results);
+    pthread_mutex_destroy(&ep->resultsLock);
     array_free(ep->errors);
     array_free(ep->onDoneData);
+    if(ep->arena){
+        // all the records were freed by now, release their memory at once
+        Gears_ArenaFree(ep->arena);
+    }
     RG_FREE(ep);
 }
 
@@ -2628,7 +5323,10 @@ void ExecutionPlan_Free(ExecutionPlan* ep){
     ExecutionPlan_Reset(ep);
 
     FlatExecutionPlan* fep = ep->fep;
-    if(fep->executionPoolSize < EXECUTION_POOL_SIZE){
+    if(fep->executionPoolSize < fep->executionPoolMaxSize){
+        if(!fep->executionPool){
+            fep->executionPool = RG_ALLOC(fep->executionPoolMaxSize * sizeof(ExecutionPlan*));
+        }
         fep->executionPool[fep->executionPoolSize++] = ep;
     }else{
         ExecutionPlan_FreeRaw(ep);
@@ -2652,10 +5350,14 @@ FlatExecutionPlan* FlatExecutionPlan_New(){
     res->PD = NULL;
     res->PDType = NULL;
     res->desc = NULL;
+    res->executionPool = NULL;
     res->executionPoolSize = 0;
+    res->executionPoolMaxSize = EXECUTION_POOL_SIZE;
     res->serializedFep = NULL;
     res->flags = 0;
     res->executionMaxIdleTime = GearsConfig_ExecutionMaxIdleTime();
+    res->executionTimeout = 0;
+    res->stepsTotals = NULL;
     res->onExecutionStartStep = (FlatBasicStep){
             .stepName = NULL,
             .arg = {
@@ -2701,6 +5403,16 @@ void FlatExecutionPlan_Free(FlatExecutionPlan* fep){
     for(size_t i = 0 ; i < fep->executionPoolSize ; ++i){
         ExecutionPlan_FreeRaw(fep->executionPool[i]);
     }
+    if(fep->executionPool){
+        RG_FREE(fep->executionPool);
+    }
+
+    if(fep->stepsTotals){
+        for(size_t i = 0 ; i < array_len(fep->stepsTotals) ; ++i){
+            ExecutionStepStats_Free(&fep->stepsTotals[i].stats);
+        }
+        array_free(fep->stepsTotals);
+    }
 
     if(fep->PD){
         ArgType* type = FepPrivateDatasMgmt_GetArgType(fep->PDType);
@@ -2775,6 +5487,21 @@ void FlatExecutionPlan_SetDesc(FlatExecutionPlan* fep, const char* desc){
     fep->desc = RG_STRDUP(desc);
 }
 
+void FlatExecutionPlan_SetExecutionPoolSize(FlatExecutionPlan* fep, size_t size){
+    while(fep->executionPoolSize > size){
+        ExecutionPlan_FreeRaw(fep->executionPool[--fep->executionPoolSize]);
+    }
+    if(fep->executionPool){
+        if(size > 0){
+            fep->executionPool = RG_REALLOC(fep->executionPool, size * sizeof(ExecutionPlan*));
+        }else{
+            RG_FREE(fep->executionPool);
+            fep->executionPool = NULL;
+        }
+    }
+    fep->executionPoolMaxSize = size;
+}
+
 void FlatExecutionPlan_AddForEachStep(FlatExecutionPlan* fep, char* forEach, void* writerArg){
     FlatExecutionPlan_AddBasicStep(fep, forEach, writerArg, FOREACH);
 }
@@ -2852,12 +5579,84 @@ void FlatExecutionPlan_AddLimitStep(FlatExecutionPlan* fep, size_t offset, size_
     FlatExecutionPlan_AddBasicStep(fep, stepsNames[LIMIT], arg, LIMIT);
 }
 
+void FlatExecutionPlan_AddSortStep(FlatExecutionPlan* fep, const char* compareName, void* compareArg){
+    FlatExecutionPlan_AddBasicStep(fep, compareName, compareArg, SORT);
+}
+
+void FlatExecutionPlan_AddTopKStep(FlatExecutionPlan* fep, size_t k, const char* compareName, void* compareArg){
+    FlatExecutionPlan_AddBasicStep(fep, compareName, compareArg, TOPK);
+    // the topk step keeps as many records as this limit step passes
+    FlatExecutionPlan_AddLimitStep(fep, 0, k);
+}
+
 void FlatExecutionPlan_AddRepartitionStep(FlatExecutionPlan* fep, const char* extraxtorName, void* extractorArg){
     FlatExecutionPlan_AddBasicStep(fep, extraxtorName, extractorArg, EXTRACTKEY);
     FlatExecutionPlan_AddBasicStep(fep, stepsNames[REPARTITION], NULL, REPARTITION);
     FlatExecutionPlan_AddMapStep(fep, "GetValueMapper", NULL);
 }
 
+void FlatExecutionPlan_AddJoinStep(FlatExecutionPlan* fep, const char* buildPattern,
+                                   const char* probeExtractorName, void* probeExtractorArg,
+                                   const char* buildExtractorName, void* buildExtractorArg,
+                                   const char* buildMapperName, void* buildMapperArg, bool broadcast){
+    JoinSourceExecutionStepArg* arg = RG_ALLOC(sizeof(*arg));
+    *arg = (JoinSourceExecutionStepArg){
+        .buildPattern = RG_STRDUP(buildPattern),
+        .probeExtractor = JoinCallbackCreate(probeExtractorName, probeExtractorArg, ExtractorsMgmt_GetArgType),
+        .buildExtractor = JoinCallbackCreate(buildExtractorName, buildExtractorArg, ExtractorsMgmt_GetArgType),
+        .buildMapper = JoinCallbackCreate(buildMapperName, buildMapperArg, MapsMgmt_GetArgType),
+        .broadcast = broadcast,
+    };
+    FlatExecutionPlan_AddBasicStep(fep, stepsNames[JOIN_SOURCE], arg, JOIN_SOURCE);
+    FlatExecutionPlan_AddBasicStep(fep, stepsNames[REPARTITION], NULL, REPARTITION);
+    FlatExecutionPlan_AddBasicStep(fep, stepsNames[JOIN], NULL, JOIN);
+}
+
+void FlatExecutionPlan_AddWindowStep(FlatExecutionPlan* fep, long long sizeMS, long long slideMS,
+                                     const char* extraxtorName, void* extractorArg,
+                                     const char* accumulateName, void* accumulateArg){
+    // the extractor gives the record time, the window step accumulates the record value
+    FlatExecutionPlan_AddBasicStep(fep, extraxtorName, extractorArg, EXTRACTKEY);
+    WindowExecutionStepArg* arg = WindowArgCreate(sizeMS, slideMS, accumulateName, accumulateArg);
+    FlatExecutionPlan_AddBasicStep(fep, accumulateName, arg, WINDOW);
+}
+
+/*
+ * Reply with the stats of the execution steps, by the execution order of the steps ('stats' and
+ * 'durations' are indexed like ExecutionPlan.steps, the reader is the last one).
+ * A step reads the records the step before it produced.
+ */
+static void ExecutionPlan_ReplyStepsStats(RedisModuleCtx *ctx, FlatExecutionPlan* fep, ExecutionStepStats** stats, unsigned long long* durations, size_t len){
+    size_t fstepsLen = array_len(fep->steps);
+    RedisModule_ReplyWithArray(ctx, len);
+    for(size_t i = 0 ; i < len ; ++i){
+        enum StepType type = i < fstepsLen ? fep->steps[fstepsLen - i - 1].type : READER;
+        ExecutionStepStats* s = stats[i];
+        unsigned long long recordsIn = i + 1 < len ? stats[i + 1]->recordsOut : s->recordsOut;
+        unsigned long long runDuration = durations[i] > s->lockWaitDuration ? durations[i] - s->lockWaitDuration : 0;
+        RedisModule_ReplyWithArray(ctx, 18);
+        RedisModule_ReplyWithStringBuffer(ctx, "type", strlen("type"));
+        RedisModule_ReplyWithStringBuffer(ctx, stepsNames[type], strlen(stepsNames[type]));
+        RedisModule_ReplyWithStringBuffer(ctx, "records_in", strlen("records_in"));
+        RedisModule_ReplyWithLongLong(ctx, recordsIn);
+        RedisModule_ReplyWithStringBuffer(ctx, "records_out", strlen("records_out"));
+        RedisModule_ReplyWithLongLong(ctx, s->recordsOut);
+        RedisModule_ReplyWithStringBuffer(ctx, "bytes_serialized", strlen("bytes_serialized"));
+        RedisModule_ReplyWithLongLong(ctx, s->bytesSerialized);
+        RedisModule_ReplyWithStringBuffer(ctx, "lock_wait_duration", strlen("lock_wait_duration"));
+        RedisModule_ReplyWithLongLong(ctx, DURATION2MS(s->lockWaitDuration));
+        RedisModule_ReplyWithStringBuffer(ctx, "run_duration", strlen("run_duration"));
+        RedisModule_ReplyWithLongLong(ctx, DURATION2MS(runDuration));
+        Gears_Histogram* latency = s->latency;
+        RedisModule_ReplyWithStringBuffer(ctx, "latency_p50_usec", strlen("latency_p50_usec"));
+        RedisModule_ReplyWithLongLong(ctx, latency ? DURATION2US(Gears_HistogramPercentile(latency, 50)) : 0);
+        RedisModule_ReplyWithStringBuffer(ctx, "latency_p99_usec", strlen("latency_p99_usec"));
+        RedisModule_ReplyWithLongLong(ctx, latency ? DURATION2US(Gears_HistogramPercentile(latency, 99)) : 0);
+        RedisModule_ReplyWithStringBuffer(ctx, "latency_max_usec", strlen("latency_max_usec"));
+        RedisModule_ReplyWithLongLong(ctx, latency ? DURATION2US(latency->max) : 0);
+    }
+}
+
 int ExecutionPlan_DumpRegistrations(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
     if(argc < 1){
         return RedisModule_WrongArity(ctx);
@@ -2868,7 +5667,7 @@ int ExecutionPlan_DumpRegistrations(RedisModuleCtx *ctx, RedisModuleString **arg
     RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
     while((curr = Gears_dictNext(iter))){
         FlatExecutionPlan* fep = Gears_dictGetVal(curr);
-        RedisModule_ReplyWithArray(ctx, 10);
+        RedisModule_ReplyWithArray(ctx, 12);
         RedisModule_ReplyWithStringBuffer(ctx, "id", strlen("id"));
         RedisModule_ReplyWithStringBuffer(ctx, fep->idStr, strlen(fep->idStr));
         RedisModule_ReplyWithStringBuffer(ctx, "reader", strlen("reader"));
@@ -2897,6 +5696,19 @@ int ExecutionPlan_DumpRegistrations(RedisModuleCtx *ctx, RedisModuleString **arg
         }else{
             RedisModule_ReplyWithNull(ctx);
         }
+        RedisModule_ReplyWithStringBuffer(ctx, "StepsStats", strlen("StepsStats"));
+        if(fep->stepsTotals){
+            size_t len = array_len(fep->stepsTotals);
+            ExecutionStepStats* stats[len];
+            unsigned long long durations[len];
+            for(size_t i = 0 ; i < len ; ++i){
+                stats[i] = &fep->stepsTotals[i].stats;
+                durations[i] = fep->stepsTotals[i].duration;
+            }
+            ExecutionPlan_ReplyStepsStats(ctx, fep, stats, durations, len);
+        }else{
+            RedisModule_ReplyWithArray(ctx, 0);
+        }
         ++numElements;
     }
     Gears_dictReleaseIterator(iter);
@@ -3062,7 +5874,7 @@ int ExecutionPlan_ExecutionGet(RedisModuleCtx *ctx, RedisModuleString **argv, in
         }
         RedisModule_ReplyWithStringBuffer(ctx, myId, REDISMODULE_NODE_ID_LEN);
         RedisModule_ReplyWithStringBuffer(ctx, "execution_plan", strlen("execution_plan"));
-        RedisModule_ReplyWithArray(ctx, 16);
+        RedisModule_ReplyWithArray(ctx, 18);
         RedisModule_ReplyWithStringBuffer(ctx, "status", strlen("status"));
         RedisModule_ReplyWithStringBuffer(ctx, statusesNames[ep->status], strlen(statusesNames[ep->status]));
         RedisModule_ReplyWithStringBuffer(ctx, "shards_received", strlen("shards_received"));
@@ -3123,6 +5935,16 @@ int ExecutionPlan_ExecutionGet(RedisModuleCtx *ctx, RedisModuleString **argv, in
                 RedisModule_ReplyWithStringBuffer(ctx, "", strlen(""));
             }
         }
+
+        size_t stepsLen = array_len(ep->steps);
+        ExecutionStepStats* stats[stepsLen];
+        unsigned long long durations[stepsLen];
+        for(size_t i = 0 ; i < stepsLen ; ++i){
+            stats[i] = &ep->steps[i]->stats;
+            durations[i] = ep->steps[i]->executionDuration;
+        }
+        RedisModule_ReplyWithStringBuffer(ctx, "steps_stats", strlen("steps_stats"));
+        ExecutionPlan_ReplyStepsStats(ctx, ep->fep, stats, durations, stepsLen);
     }
 	return REDISMODULE_OK;
 }
@@ -12,8 +12,13 @@
 #include "redisgears.h"
 #include "commands.h"
 #include "utils/dict.h"
+#include "utils/aggtable.h"
+#include "utils/arena.h"
+#include "utils/histogram.h"
+#include "spill.h"
 #include "utils/adlist.h"
 #include "utils/buffer.h"
+#include "record.h"
 #include "common.h"
 #ifdef WITHPYTHON
 #include <redisgears_python.h>
@@ -32,7 +37,14 @@
     X(FLAT_MAP, "flatmap") \
     X(LIMIT, "limit") \
     X(ACCUMULATE, "accumulate") \
-    X(ACCUMULATE_BY_KEY, "accumulatebykey")
+    X(ACCUMULATE_BY_KEY, "accumulatebykey") \
+    X(FUSED, "fused") \
+    X(PARALLEL, "parallel") \
+    X(SORT, "sort") \
+    X(TOPK, "topk") \
+    X(WINDOW, "window") \
+    X(JOIN_SOURCE, "joinsource") \
+    X(JOIN, "join")
 
 enum StepType{
 #define X(a, b) a,
@@ -58,7 +70,6 @@ typedef struct MapExecutionStep{
 
 typedef struct FlatMapExecutionStep{
     MapExecutionStep mapStep;
-    Record* pendings;
 }FlatMapExecutionStep;
 
 typedef struct FilterExecutionStep{
@@ -72,9 +83,13 @@ typedef struct ExtractKeyExecutionStep{
 }ExtractKeyExecutionStep;
 
 typedef struct GroupExecutionStep{
-    Record** groupedRecords;
-    Gears_dict* d;
+    Gears_AggTable* groups;
+    size_t iterPos;
     bool isGrouped;
+    size_t memoryUsage; // estimated memory of the groups, part of the execution bufferedMemory
+    struct SpillFile** partitions; // groups that were spilled to disk, partitioned by the key hash
+    size_t currPartition;
+    bool spillFailed;
 }GroupExecutionStep;
 
 typedef struct ReduceExecutionStep{
@@ -82,16 +97,46 @@ typedef struct ReduceExecutionStep{
     ExecutionStepArg reducerArg;
 }ReduceExecutionStep;
 
+/*
+ * Records sent to another shard are encoded into a batch, the batch is sent once it is big
+ * enough, when the step waits for other shards and before the step reports it is done sending.
+ */
+typedef struct RecordsBatch{
+    Gears_Buffer* buff;
+    RecordsEncoder enc;
+    size_t len; // records on the batch
+}RecordsBatch;
+
 typedef struct RepartitionExecutionStep{
     bool stoped;
-    Record** pendings;
+    SpillableRecords pendings;
     size_t totalShardsCompleted;
+    bool broadcastJoinBuild; // broadcast join, build side records are sent to all the shards and probe side records stay local
+    Gears_dict* batches; // shard id -> RecordsBatch
+    RecordsBatch* broadcastBatch; // records sent to all the shards
 }RepartitionExecutionStep;
 
+typedef struct CollectMergeRun{
+    char shardId[REDISMODULE_NODE_ID_LEN];
+    Record** records;
+    size_t pos; // next record to merge
+}CollectMergeRun;
+
 typedef struct CollectExecutionStep{
     bool stoped;
-    Record** pendings;
+    SpillableRecords pendings;
     size_t totalShardsCompleted;
+    RecordsBatch* batch; // records to send to the initiator
+    /*
+     * Set when the collected records are sorted (the collect follows a sort or a topk step).
+     * Each shard sends its records by order and they are kept on a run per shard, once all
+     * the shards are done the initiator merges the runs by the sort step order instead of
+     * returning the records by arrival order.
+     */
+    struct ExecutionStep* sortStep;
+    CollectMergeRun* runs;
+    size_t* heap; // indexes of the runs that were not yet depleted, ordered by their next record
+    bool isMerging;
 }CollectExecutionStep;
 
 typedef struct LimitExecutionStep{
@@ -99,8 +144,62 @@ typedef struct LimitExecutionStep{
     size_t currRecordIndex;
 }LimitExecutionStep;
 
+/*
+ * Sort and topk steps, the records are buffered until the previous step is depleted.
+ * A topk step only keeps the first k records by the compare callback order on a heap,
+ * k is taken from the limit step that follows it (see FlatExecutionPlan_AddTopKStep).
+ */
+typedef struct SortExecutionStep{
+    RedisGears_CompareCallback compare;
+    ExecutionStepArg stepArg;
+    Record** records;
+    size_t k; // topk only, 0 means all the records are kept
+    size_t iterPos;
+    bool isSorted;
+}SortExecutionStep;
+
+/*
+ * Time window aggregation, each record is accumulated into the windows that contain
+ * its time (the key of the key record produced by the extract key step before it).
+ * The open windows are kept on the step arg across executions, the windows that were
+ * closed by this execution are returned once the previous step is depleted.
+ */
+typedef struct WindowExecutionStep{
+    RedisGears_AccumulateCallback accumulate;
+    ExecutionStepArg stepArg;
+    Record** closed;
+    size_t iterPos;
+    bool isDone;
+    bool isChanged; // records were added to the windows on this run, the snapshot must be updated
+}WindowExecutionStep;
+
+/*
+ * Join steps, a join source step passes the probe side records (the records of the previous step)
+ * and then the build side records it reads itself, each record is tagged with its side and keyed
+ * by the side extractor. After a repartition by the join key (or a broadcast of the build side)
+ * the join step builds a hash table of the build side and probes it with the probe side records.
+ */
+typedef struct JoinSourceExecutionStep{
+    ExecutionStepArg stepArg;
+    RedisGears_ExtractorCallback probeExtractor;
+    RedisGears_ExtractorCallback buildExtractor;
+    RedisGears_MapCallback buildMapper;
+    Reader* buildReader; // created once the probe side is depleted
+    bool isDone;
+}JoinSourceExecutionStep;
+
+typedef struct JoinExecutionStep{
+    Gears_AggTable* builds; // join key -> list record of the build side records
+    Record** probes; // probe side records, kept until the entire build side arrived
+    size_t probePos;
+    size_t matchPos;
+    bool isBuilt;
+}JoinExecutionStep;
+
 typedef struct ReaderStep{
     Reader* r;
+    bool isProxy; // reads from a reader shared between parallel workers
+    bool hasExtensions; // the reader was built against LLAPI version 2 and above, nextBatch and setLimit can be read
 }ReaderStep;
 
 typedef struct ForEachExecutionStep{
@@ -118,10 +217,69 @@ typedef struct AccumulateExecutionStep{
 typedef struct AccumulateByKeyExecutionStep{
     RedisGears_AccumulateByKeyCallback accumulate;
     ExecutionStepArg stepArg;
-    Gears_dict* accumulators;
-    Gears_dictIterator *iter;
+    Gears_AggTable* accumulators;
+    size_t iterPos;
+    bool isAccumulated;
 }AccumulateByKeyExecutionStep;
 
+/*
+ * Consecutive map, flatmap, filter and foreach steps fused into a single step.
+ * The original steps are kept (for their stats) and run one after the other on
+ * each record without passing through the NextRecord/NextBatch chain.
+ */
+typedef struct FusedExecutionStep{
+    struct ExecutionStep** steps;
+    bool lockPython;
+}FusedExecutionStep;
+
+/*
+ * Runs the stateless prefix of the plan (the steps between the reader and the first
+ * group/accumulate/collect/repartition step) on multiple threads of the execution pool.
+ * Each worker owns a copy of the prefix steps that reads from the shared reader (this
+ * step prev) through a proxy reader, the batches produced by the workers are merged here.
+ * prefixes[0] is the original steps and is run by the execution thread itself.
+ */
+typedef struct ParallelExecutionStep{
+    struct ExecutionStep** prefixes;
+    struct ParallelWorkersCtx* workersCtx; // shared with the helper workers
+    bool started;
+    bool fullBatchRead;
+    bool mainDone;
+}ParallelExecutionStep;
+
+/*
+ * Records produced by a step and not yet consumed by the next step.
+ * Steps that support batching (reader, map, filter, flatmap and foreach)
+ * fill it with up to ExecutionBatchSize records at a time, the consumer
+ * advances 'index' until it reaches 'len'.
+ */
+typedef struct ExecutionStepBatch{
+    Record** records;
+    size_t len;
+    size_t cap;
+    size_t index;
+    bool isDone;
+}ExecutionStepBatch;
+
+/*
+ * Per step counters shown by RG.GETEXECUTION. The latency histogram and the lock
+ * wait are only kept when executions profiling is enabled.
+ */
+typedef struct ExecutionStepStats{
+    unsigned long long recordsOut;
+    unsigned long long bytesSerialized; // size of the records sent to other shards
+    unsigned long long lockWaitDuration; // ns, time spent waiting for the redis lock
+    Gears_Histogram* latency; // ns per record, allocated on first use
+}ExecutionStepStats;
+
+/*
+ * Steps stats summed over all the executions of a registration.
+ */
+typedef struct ExecutionStepTotals{
+    ExecutionStepStats stats;
+    unsigned long long duration;
+}ExecutionStepTotals;
+
 typedef struct ExecutionStep{
     struct ExecutionStep* prev;
     size_t stepId;
@@ -139,9 +297,17 @@ typedef struct ExecutionStep{
         LimitExecutionStep limit;
         AccumulateExecutionStep accumulate;
         AccumulateByKeyExecutionStep accumulateByKey;
+        FusedExecutionStep fused;
+        ParallelExecutionStep parallel;
+        SortExecutionStep sort;
+        WindowExecutionStep window;
+        JoinSourceExecutionStep joinSource;
+        JoinExecutionStep join;
     };
     enum StepType type;
+    ExecutionStepBatch batch;
     unsigned long long executionDuration;
+    ExecutionStepStats stats;
 }ExecutionStep;
 
 typedef enum ActionResult{
@@ -217,11 +383,16 @@ typedef struct ExecutionPlan{
     char id[ID_LEN];
     char idStr[STR_ID_LEN];
     ExecutionStep** steps;
+    ExecutionStep* headStep; // the step that produces the results, not part of 'steps' if it is a fused step
     FlatExecutionPlan* fep;
     size_t totalShardsRecieved;
     size_t totalShardsCompleted;
     Record** results;
+    size_t resultsOffset; // results before this index were already taken by a cursor
+    pthread_mutex_t resultsLock; // results are added while the execution runs and can be taken by a cursor meanwhile
     Record** errors;
+    size_t bufferedMemory; // estimated memory of the records buffered by the steps, see ExecutionMemoryBudget
+    Gears_Arena* arena; // records allocator, NULL if ExecutionArena is disabled
     volatile ExecutionPlanStatus status;
     ExecutionFlags flags;
     OnDoneData* onDoneData; // Array of callbacks to run on done
@@ -233,9 +404,16 @@ typedef struct ExecutionPlan{
     ExecutionMode mode;
     Gears_listNode* nodeOnExecutionsList;
     volatile bool isPaused;
+    volatile bool isRunning; // a worker is running the execution steps, see ExecutionPlan_SetRunning
     RedisModuleTimerID maxIdleTimer;
     bool maxIdleTimerSet;
     bool registered;
+    long long timeout; // ms, 0 means no timeout
+    long long deadline; // ms since epoch, 0 means no deadline
+    RedisModuleTimerID timeoutTimer;
+    bool timeoutTimerSet;
+    const char* cancelReason; // NULL while the execution is not cancelled, set atomically
+    bool cancelReported; // the cancel error was already written, set atomically
 }ExecutionPlan;
 
 typedef struct FlatBasicStep{
@@ -252,7 +430,7 @@ typedef struct FlatExecutionReader{
     char* reader;
 }FlatExecutionReader;
 
-#define EXECUTION_POOL_SIZE 1
+#define EXECUTION_POOL_SIZE 1 // default number of finished executions kept for reuse
 typedef struct FlatExecutionPlan{
     char id[ID_LEN];
     char idStr[STR_ID_LEN];
@@ -262,13 +440,16 @@ typedef struct FlatExecutionPlan{
     FlatExecutionStep* steps;
     void* PD;
     char* PDType;
-    ExecutionPlan* executionPool[EXECUTION_POOL_SIZE];
+    ExecutionPlan** executionPool; // allocated on first use, accessed only while holding the redis lock
     size_t executionPoolSize;
+    size_t executionPoolMaxSize;
     Gears_Buffer* serializedFep;
     FlatBasicStep onExecutionStartStep;
     FlatBasicStep onRegisteredStep;
     FlatBasicStep onUnpausedStep;
     long long executionMaxIdleTime;
+    long long executionTimeout; // ms, 0 means no timeout
+    ExecutionStepTotals* stepsTotals; // by the execution steps order, allocated when the first registered execution is done
     FlatExecutionFlags flags;
 }FlatExecutionPlan;
 
@@ -293,6 +474,13 @@ bool FlatExecutionPlan_SetReader(FlatExecutionPlan* fep, char* reader);
 void FlatExecutionPlan_SetPrivateData(FlatExecutionPlan* fep, const char* type, void* PD);
 void* FlatExecutionPlan_GetPrivateData(FlatExecutionPlan* fep);
 void FlatExecutionPlan_SetDesc(FlatExecutionPlan* fep, const char* desc);
+void FlatExecutionPlan_SetExecutionPoolSize(FlatExecutionPlan* fep, size_t size);
+
+/*
+ * Move up to 'max' results, by their order, from the execution to the given records array
+ * and return the array. Can be called while the execution is running.
+ */
+Record** ExecutionPlan_TakeResults(ExecutionPlan* ep, Record** records, size_t max);
 void FlatExecutionPlan_AddForEachStep(FlatExecutionPlan* fep, char* forEach, void* writerArg);
 void FlatExecutionPlan_SetOnStartStep(FlatExecutionPlan* fep, char* onStartCallback, void* onStartArg);
 void FlatExecutionPlan_SetOnUnPausedStep(FlatExecutionPlan* fep, char* onSUnpausedCallback, void* onUnpausedArg);
@@ -309,7 +497,23 @@ void FlatExecutionPlan_AddLocalAccumulateByKeyStep(FlatExecutionPlan* fep, const
                                               const char* accumulateName, void* accumulateArg);
 void FlatExecutionPlan_AddCollectStep(FlatExecutionPlan* fep);
 void FlatExecutionPlan_AddLimitStep(FlatExecutionPlan* fep, size_t offset, size_t len);
+void FlatExecutionPlan_AddSortStep(FlatExecutionPlan* fep, const char* compareName, void* compareArg);
+void FlatExecutionPlan_AddTopKStep(FlatExecutionPlan* fep, size_t k, const char* compareName, void* compareArg);
 void FlatExecutionPlan_AddRepartitionStep(FlatExecutionPlan* fep, const char* extraxtorName, void* extractorArg);
+void FlatExecutionPlan_AddJoinStep(FlatExecutionPlan* fep, const char* buildPattern,
+                                   const char* probeExtractorName, void* probeExtractorArg,
+                                   const char* buildExtractorName, void* buildExtractorArg,
+                                   const char* buildMapperName, void* buildMapperArg, bool broadcast);
+void FlatExecutionPlan_AddWindowStep(FlatExecutionPlan* fep, long long sizeMS, long long slideMS,
+                                     const char* extraxtorName, void* extractorArg,
+                                     const char* accumulateName, void* accumulateArg);
+
+/*
+ * Save and load the open windows of the window steps, used by registrations that
+ * keep their windows across restarts. Loading must happen before the plan runs.
+ */
+void FlatExecutionPlan_SerializeWindowsState(FlatExecutionPlan* fep, Gears_BufferWriter* bw);
+int FlatExecutionPlan_DeserializeWindowsState(FlatExecutionPlan* fep, Gears_BufferReader* br, char** err);
 int FlatExecutionPlan_Register(FlatExecutionPlan* fep, ExecutionMode mode, void* key, char** err);
 const char* FlatExecutionPlan_GetReader(FlatExecutionPlan* fep);
 ExecutionPlan* FlatExecutionPlan_Run(FlatExecutionPlan* fep, ExecutionMode mode, void* arg, RedisGears_OnExecutionDoneCallback callback, void* privateData, WorkerData* worker, char** err);
@@ -328,6 +532,15 @@ int ExecutionPlan_ExecutionsDump(RedisModuleCtx *ctx, RedisModuleString **argv,
 int ExecutionPlan_InnerRegister(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 int ExecutionPlan_ExecutionGet(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 ExecutionPlan* ExecutionPlan_FindById(const char* id);
+
+/*
+ * Cancel a running execution, the reader stops reading and the records that were already
+ * read are dropped by the following steps, the reason is reported as the execution error.
+ * Only the first reason is kept, reason must be a static string. Can be called from any thread.
+ */
+#define EXECUTION_ABORTED_MSG "Execution was aborted"
+void ExecutionPlan_Cancel(ExecutionPlan* ep, const char* reason);
+bool ExecutionPlan_IsCancelled(ExecutionPlan* ep);
 ExecutionPlan* ExecutionPlan_FindByStrId(const char* id);
 Reader* ExecutionPlan_GetReader(ExecutionPlan* ep);
 
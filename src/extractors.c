@@ -3,6 +3,7 @@
 #include <string.h>
 #include "redisgears.h"
 #include "redisgears_memory.h"
+#include "extractors.h"
 
 char* KeyRecordStrValueExtractor(RedisModuleCtx* rctx, Record *record, void* arg, size_t* len, char** err){
     if(RedisGears_RecordGetType(record) != keyRecordType){
@@ -18,3 +19,25 @@ char* KeyRecordStrValueExtractor(RedisModuleCtx* rctx, Record *record, void* arg
     *len = strlen(str);
     return str;
 }
+
+char* KeyRecordKeyExtractor(ExecutionCtx* rctx, Record *record, void* arg, size_t* len){
+    if(RedisGears_RecordGetType(record) != keyRecordType){
+        RedisGears_SetError(rctx, RG_STRDUP("KeyRecordKey extractor works only on key records"));
+        return NULL;
+    }
+    char* key = RedisGears_KeyRecordGetKey(record, len);
+    return RG_STRDUP(key);
+}
+
+char* StreamRecordIdExtractor(ExecutionCtx* rctx, Record *record, void* arg, size_t* len){
+    Record* id = NULL;
+    if(RedisGears_RecordGetType(record) == hashSetRecordType){
+        id = RedisGears_HashSetRecordGet(record, "id");
+    }
+    if(!id || RedisGears_RecordGetType(id) != stringRecordType){
+        RedisGears_SetError(rctx, RG_STRDUP("StreamRecordId extractor works only on stream records"));
+        return NULL;
+    }
+    char* str = RedisGears_StringRecordGet(id, len);
+    return RG_STRDUP(str);
+}
@@ -0,0 +1,22 @@
+/*
+ * extractors.h
+ *
+ * Built in key extractors.
+ */
+
+#ifndef SRC_EXTRACTORS_H_
+#define SRC_EXTRACTORS_H_
+
+#include "redisgears.h"
+
+/*
+ * Extract the key of a key record, used to regroup the output of a local accumulate by key.
+ */
+char* KeyRecordKeyExtractor(ExecutionCtx* rctx, Record *record, void* arg, size_t* len);
+
+/*
+ * Extract the id of a StreamReader record, used as the record time of a window step.
+ */
+char* StreamRecordIdExtractor(ExecutionCtx* rctx, Record *record, void* arg, size_t* len);
+
+#endif /* SRC_EXTRACTORS_H_ */
@@ -7,8 +7,11 @@
 
 #include "lock_handler.h"
 #include "redisgears_memory.h"
+#include "config.h"
 #include "pthread.h"
 #include <assert.h>
+#include <stdbool.h>
+#include <time.h>
 #ifdef WITHPYTHON
 #include "redisgears_python.h"
 #endif
@@ -17,8 +20,22 @@ pthread_key_t _lockKey;
 
 typedef struct LockHandlerCtx{
     int lockCounter;
+    unsigned long long waitDuration; // ns, only measured when executions profiling is enabled
+    unsigned long long nestedWait; // wait of the scopes that ended inside the current scope
 }LockHandlerCtx;
 
+static LockHandlerCtx* LockHandler_GetCtx(){
+    LockHandlerCtx* lh = pthread_getspecific(_lockKey);
+    if(!lh){
+        lh = RG_ALLOC(sizeof(*lh));
+        lh->lockCounter = 0;
+        lh->waitDuration = 0;
+        lh->nestedWait = 0;
+        pthread_setspecific(_lockKey, lh);
+    }
+    return lh;
+}
+
 int LockHandler_Initialize(){
     int err = pthread_key_create(&_lockKey, NULL);
     if(err){
@@ -26,18 +43,20 @@ int LockHandler_Initialize(){
     }
     LockHandlerCtx* lh = RG_ALLOC(sizeof(*lh));
     lh->lockCounter = 1; // init is called from the main thread, the lock is always acquired
+    lh->waitDuration = 0;
+    lh->nestedWait = 0;
     pthread_setspecific(_lockKey, lh);
     return REDISMODULE_OK;
 }
 
 void LockHandler_Acquire(RedisModuleCtx* ctx){
-    LockHandlerCtx* lh = pthread_getspecific(_lockKey);
-    if(!lh){
-        lh = RG_ALLOC(sizeof(*lh));
-        lh->lockCounter = 0;
-        pthread_setspecific(_lockKey, lh);
-    }
+    LockHandlerCtx* lh = LockHandler_GetCtx();
     if(lh->lockCounter == 0){
+        struct timespec start = {0}, end = {0};
+        bool profile = GearsConfig_GetProfileExecutions();
+        if(profile){
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
 #ifdef WITHPYTHON
         // to avoid deadlocks, when we try to acquire the redis GIL we first check
         // if we hold the python GIL, if we do we first release it, then acquire the redis GIL
@@ -54,6 +73,10 @@ void LockHandler_Acquire(RedisModuleCtx* ctx){
             PyEval_RestoreThread(_save);
         }
 #endif
+        if(profile){
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            lh->waitDuration += (long long)1000000000 * (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec);
+        }
     }
     ++lh->lockCounter;
 }
@@ -67,5 +90,17 @@ void LockHandler_Release(RedisModuleCtx* ctx){
     }
 }
 
+void LockHandler_WaitScopeStart(LockHandlerWaitScope* scope){
+    LockHandlerCtx* lh = LockHandler_GetCtx();
+    scope->start = lh->waitDuration;
+    scope->outerNestedWait = lh->nestedWait;
+    lh->nestedWait = 0;
+}
 
-
+unsigned long long LockHandler_WaitScopeEnd(LockHandlerWaitScope* scope){
+    LockHandlerCtx* lh = LockHandler_GetCtx();
+    unsigned long long total = lh->waitDuration - scope->start;
+    unsigned long long own = total - lh->nestedWait;
+    lh->nestedWait = scope->outerNestedWait + total;
+    return own;
+}
@@ -14,4 +14,18 @@ int LockHandler_Initialize();
 void LockHandler_Acquire(RedisModuleCtx* ctx);
 void LockHandler_Release(RedisModuleCtx* ctx);
 
+typedef struct LockHandlerWaitScope{
+    unsigned long long start;
+    unsigned long long outerNestedWait;
+}LockHandlerWaitScope;
+
+/*
+ * Measure the time the current thread waited for the Redis lock inside a scope.
+ * Scopes can be nested, LockHandler_WaitScopeEnd returns the wait (in nanoseconds)
+ * of the scope without the wait of the scopes that were nested in it.
+ * The wait is only measured when executions profiling is enabled.
+ */
+void LockHandler_WaitScopeStart(LockHandlerWaitScope* scope);
+unsigned long long LockHandler_WaitScopeEnd(LockHandlerWaitScope* scope);
+
 #endif /* SRC_LOCK_HANDLER_H_ */
@@ -4,6 +4,8 @@
 #include <string.h>
 #include "redisgears.h"
 #include "redisgears_memory.h"
+#include "record.h"
+#include "mappers.h"
 
 
 Record* GetValueMapper(ExecutionCtx* rctx, Record *record, void* arg){
@@ -17,3 +19,33 @@ Record* GetValueMapper(ExecutionCtx* rctx, Record *record, void* arg){
     RedisGears_FreeRecord(record);
     return res;
 }
+
+Record* AvgMapper(ExecutionCtx* rctx, Record *record, void* arg){
+    if(RedisGears_RecordGetType(record) != listRecordType || RedisGears_ListRecordLen(record) != 2){
+        RedisGears_SetError(rctx, RG_STRDUP("AvgMapper works only on the output of AvgAccumulator"));
+        RedisGears_FreeRecord(record);
+        return NULL;
+    }
+    double sum = RedisGears_DoubleRecordGet(RedisGears_ListRecordGet(record, 0));
+    long count = RedisGears_LongRecordGet(RedisGears_ListRecordGet(record, 1));
+    RedisGears_FreeRecord(record);
+    return RedisGears_DoubleRecordCreate(sum / count);
+}
+
+Record* HashSetValuesMapper(ExecutionCtx* rctx, Record *record, void* arg){
+    if(RedisGears_RecordGetType(record) != hashSetRecordType){
+        RedisGears_SetError(rctx, RG_STRDUP("HashSetValuesMapper works only on hash set records"));
+        RedisGears_FreeRecord(record);
+        return NULL;
+    }
+    Record* res = RedisGears_ListRecordCreate(RG_HashSetRecordLen(record));
+    HashSetRecordIterator iter;
+    const char* key;
+    RG_HashSetRecordIteratorInit(&iter, record);
+    while(RG_HashSetRecordIteratorNext(&iter, &key, NULL)){
+        RedisGears_ListRecordAdd(res, RG_HashSetRecordTake(record, (char*)key));
+    }
+    RG_HashSetRecordIteratorDone(&iter);
+    RedisGears_FreeRecord(record);
+    return res;
+}
@@ -12,5 +12,15 @@
 
 Record* GetValueMapper(ExecutionCtx* rctx, Record *record, void* arg);
 
+/*
+ * Turn the [sum, count] output of AvgAccumulator into the average (a double record).
+ */
+Record* AvgMapper(ExecutionCtx* rctx, Record *record, void* arg);
+
+/*
+ * Turn a hash set record into a list of its values, used with flatmap after DistinctAccumulator.
+ */
+Record* HashSetValuesMapper(ExecutionCtx* rctx, Record *record, void* arg);
+
 
 #endif /* SRC_MAPPERS_H_ */
@@ -11,6 +11,8 @@
         MgmtDataHolder* holder = RG_ALLOC(sizeof(*holder));\
         holder->type = type;\
         holder->callback = callback;\
+        holder->associative = false;\
+        holder->llapiVersion = 1;\
         return Gears_dictAdd(apiName ## dict, (void*)name, holder);\
     }\
     RedisGears_ ## apiName ## Callback apiName ## sMgmt_Get(const char* name){\
@@ -30,6 +32,28 @@
         return holder->type;\
     }
 
+/*
+ * Associative callbacks can be applied on partial results, this allows
+ * the execution to pre-aggregate locally before sending records to other shards.
+ */
+#define GENERATE_ASSOCIATIVE(apiName)\
+    bool apiName ## sMgmt_SetAssociative(const char* name){\
+        Gears_dictEntry *entry = Gears_dictFind(apiName ## dict, name);\
+        if(!entry){\
+            return false;\
+        }\
+        MgmtDataHolder* holder = Gears_dictGetVal(entry);\
+        holder->associative = true;\
+        return true;\
+    }\
+    bool apiName ## sMgmt_IsAssociative(const char* name){\
+        Gears_dictEntry *entry = Gears_dictFind(apiName ## dict, name);\
+        if(!entry){\
+            return false;\
+        }\
+        MgmtDataHolder* holder = Gears_dictGetVal(entry);\
+        return holder->associative;\
+    }
 
 GENERATE(Filter)
 GENERATE(Map)
@@ -39,11 +63,40 @@ GENERATE(Extractor)
 GENERATE(Reducer)
 GENERATE(Accumulate)
 GENERATE(AccumulateByKey)
+GENERATE(Compare)
 GENERATE(FepPrivateData)
 GENERATE(ExecutionOnStart)
 GENERATE(ExecutionOnUnpaused)
 GENERATE(FlatExecutionOnRegistered)
 
+GENERATE_ASSOCIATIVE(Reducer)
+GENERATE_ASSOCIATIVE(AccumulateByKey)
+
+/*
+ * Callbacks structs grow between LLAPI versions, fields added in a later version
+ * must not be read from callbacks registered by a plugin built against an older one.
+ */
+#define GENERATE_LLAPI_VERSION(apiName)\
+    bool apiName ## sMgmt_SetLLApiVersion(const char* name, int llapiVersion){\
+        Gears_dictEntry *entry = Gears_dictFind(apiName ## dict, name);\
+        if(!entry){\
+            return false;\
+        }\
+        MgmtDataHolder* holder = Gears_dictGetVal(entry);\
+        holder->llapiVersion = llapiVersion;\
+        return true;\
+    }\
+    int apiName ## sMgmt_GetLLApiVersion(const char* name){\
+        Gears_dictEntry *entry = Gears_dictFind(apiName ## dict, name);\
+        if(!entry){\
+            return 0;\
+        }\
+        MgmtDataHolder* holder = Gears_dictGetVal(entry);\
+        return holder->llapiVersion;\
+    }
+
+GENERATE_LLAPI_VERSION(Reader)
+
 void Mgmt_Init(){
     FiltersMgmt_Init();
     MapsMgmt_Init();
@@ -53,6 +106,7 @@ void Mgmt_Init(){
     ReducersMgmt_Init();
     AccumulatesMgmt_Init();
     AccumulateByKeysMgmt_Init();
+    ComparesMgmt_Init();
     FepPrivateDatasMgmt_Init();
     ExecutionOnStartsMgmt_Init();
     ExecutionOnUnpausedsMgmt_Init();
@@ -27,6 +27,8 @@ extern Gears_dict* Readerdict;
 typedef struct MgmtDataHolder{
     ArgType* type;
     void* callback;
+    bool associative;
+    int llapiVersion; // the LLAPI version the callbacks were built against
 }MgmtDataHolder;
 
 bool FiltersMgmt_Add(const char* name, RedisGears_FilterCallback callback, ArgType* type);
@@ -41,6 +43,8 @@ typedef RedisGears_ReaderCallbacks* RedisGears_ReaderCallback;
 bool ReadersMgmt_Add(const char* name, RedisGears_ReaderCallback callbacks, ArgType* type);
 RedisGears_ReaderCallback ReadersMgmt_Get(const char* name);
 ArgType* ReadersMgmt_GetArgType(const char* name);
+bool ReadersMgmt_SetLLApiVersion(const char* name, int llapiVersion);
+int ReadersMgmt_GetLLApiVersion(const char* name);
 
 bool ForEachsMgmt_Add(const char* name, RedisGears_ForEachCallback callback, ArgType* type);
 RedisGears_ForEachCallback ForEachsMgmt_Get(const char* name);
@@ -53,6 +57,12 @@ ArgType* ExtractorsMgmt_GetArgType(const char* name);
 bool ReducersMgmt_Add(const char* name, RedisGears_ReducerCallback callback, ArgType* type);
 RedisGears_ReducerCallback ReducersMgmt_Get(const char* name);
 ArgType* ReducersMgmt_GetArgType(const char* name);
+bool ReducersMgmt_SetAssociative(const char* name);
+bool ReducersMgmt_IsAssociative(const char* name);
+
+bool ComparesMgmt_Add(const char* name, RedisGears_CompareCallback callback, ArgType* type);
+RedisGears_CompareCallback ComparesMgmt_Get(const char* name);
+ArgType* ComparesMgmt_GetArgType(const char* name);
 
 bool AccumulatesMgmt_Add(const char* name, RedisGears_AccumulateCallback callback, ArgType* type);
 RedisGears_AccumulateCallback AccumulatesMgmt_Get(const char* name);
@@ -61,6 +71,8 @@ ArgType* AccumulatesMgmt_GetArgType(const char* name);
 bool AccumulateByKeysMgmt_Add(const char* name, RedisGears_AccumulateByKeyCallback callback, ArgType* type);
 RedisGears_AccumulateByKeyCallback AccumulateByKeysMgmt_Get(const char* name);
 ArgType* AccumulateByKeysMgmt_GetArgType(const char* name);
+bool AccumulateByKeysMgmt_SetAssociative(const char* name);
+bool AccumulateByKeysMgmt_IsAssociative(const char* name);
 
 typedef void (*RedisGears_FepPrivateDataCallback)();
 bool FepPrivateDatasMgmt_Add(const char* name, RedisGears_FepPrivateDataCallback callback, ArgType* type);
@@ -29,9 +29,14 @@
 #include "readers/command_reader.h"
 #include "readers/shardid_reader.h"
 #include "mappers.h"
+#include "reducers.h"
+#include "extractors.h"
+#include "sketches.h"
 #include <stdbool.h>
 #include <unistd.h>
 #include "lock_handler.h"
+#include "profiler.h"
+#include "utils/slab.h"
 
 #ifndef REDISGEARS_GIT_SHA
 #define REDISGEARS_GIT_SHA "unknown"
@@ -60,6 +65,13 @@ static int RG_RegisterReader(char* name, RedisGears_ReaderCallbacks* reader){
     return ReadersMgmt_Add(name, reader, NULL);
 }
 
+static int RG_RegisterReaderWithVersion(char* name, RedisGears_ReaderCallbacks* reader, int llapiVersion){
+    if(!ReadersMgmt_Add(name, reader, NULL)){
+        return false;
+    }
+    return ReadersMgmt_SetLLApiVersion(name, llapiVersion);
+}
+
 static int RG_RegisterForEach(char* name, RedisGears_ForEachCallback writer, ArgType* type){
     return ForEachsMgmt_Add(name, writer, type);
 }
@@ -80,6 +92,14 @@ static int RG_RegisterAccumulatorByKey(char* name, RedisGears_AccumulateByKeyCal
 	return AccumulateByKeysMgmt_Add(name, accumulator, type);
 }
 
+static int RG_RegisterAssociativeAccumulatorByKey(char* name, RedisGears_AccumulateByKeyCallback accumulator, ArgType* type){
+    if(AccumulateByKeysMgmt_Add(name, accumulator, type) != DICT_OK){
+        return REDISMODULE_ERR;
+    }
+    AccumulateByKeysMgmt_SetAssociative(name);
+    return REDISMODULE_OK;
+}
+
 static int RG_RegisterFilter(char* name, RedisGears_FilterCallback filter, ArgType* type){
     return FiltersMgmt_Add(name, filter, type);
 }
@@ -92,6 +112,18 @@ static int RG_RegisterReducer(char* name, RedisGears_ReducerCallback reducer, Ar
     return ReducersMgmt_Add(name, reducer, type);
 }
 
+static int RG_RegisterCompare(char* name, RedisGears_CompareCallback compare, ArgType* type){
+    return ComparesMgmt_Add(name, compare, type);
+}
+
+static int RG_RegisterAssociativeReducer(char* name, RedisGears_ReducerCallback reducer, ArgType* type){
+    if(ReducersMgmt_Add(name, reducer, type) != DICT_OK){
+        return REDISMODULE_ERR;
+    }
+    ReducersMgmt_SetAssociative(name);
+    return REDISMODULE_OK;
+}
+
 static int RG_RegisterExecutionOnStartCallback(char* name, RedisGears_ExecutionOnStartCallback callback, ArgType* type){
     return ExecutionOnStartsMgmt_Add(name, callback, type);
 }
@@ -149,6 +181,14 @@ static void RG_SetMaxIdleTime(FlatExecutionPlan* fep, long long executionMaxIdle
     fep->executionMaxIdleTime = executionMaxIdleTime;
 }
 
+static void RG_SetExecutionPoolSize(FlatExecutionPlan* fep, size_t executionPoolSize){
+    FlatExecutionPlan_SetExecutionPoolSize(fep, executionPoolSize);
+}
+
+static void RG_SetExecutionTimeout(FlatExecutionPlan* fep, long long timeout){
+    fep->executionTimeout = timeout;
+}
+
 static void RG_SetFlatExecutionPrivateData(FlatExecutionPlan* fep, const char* type, void* PD){
     FlatExecutionPlan_SetPrivateData(fep, type, PD);
 }
@@ -212,6 +252,36 @@ static int RG_Limit(FlatExecutionPlan* fep, size_t offset, size_t len){
     return 1;
 }
 
+static int RG_Sort(FlatExecutionPlan* fep, char* compareName, void* compareArg){
+    FlatExecutionPlan_AddSortStep(fep, compareName, compareArg);
+    return 1;
+}
+
+static int RG_TopK(FlatExecutionPlan* fep, size_t k, char* compareName, void* compareArg){
+    if(k == 0){
+        return 0;
+    }
+    FlatExecutionPlan_AddTopKStep(fep, k, compareName, compareArg);
+    return 1;
+}
+
+static int RG_Join(FlatExecutionPlan* fep, const char* buildPattern, char* probeExtractorName, void* probeExtractorArg,
+                   char* buildExtractorName, void* buildExtractorArg, char* buildMapperName, void* buildMapperArg, int broadcast){
+    FlatExecutionPlan_AddJoinStep(fep, buildPattern, probeExtractorName, probeExtractorArg,
+                                  buildExtractorName, buildExtractorArg, buildMapperName, buildMapperArg, broadcast);
+    return 1;
+}
+
+#define MAX_WINDOWS_PER_RECORD 1000
+
+static int RG_Window(FlatExecutionPlan* fep, long long sizeMS, long long slideMS, char* extraxtorName, void* extractorArg, char* accumulatorName, void* accumulatorArg){
+    if(sizeMS <= 0 || slideMS <= 0 || slideMS > sizeMS || sizeMS / slideMS > MAX_WINDOWS_PER_RECORD){
+        return 0;
+    }
+    FlatExecutionPlan_AddWindowStep(fep, sizeMS, slideMS, extraxtorName, extractorArg, accumulatorName, accumulatorArg);
+    return 1;
+}
+
 static int RG_Register(FlatExecutionPlan* fep, ExecutionMode mode, void* key, char** err){
 
     return FlatExecutionPlan_Register(fep, mode, key, err);
@@ -237,6 +307,10 @@ static KeysReaderCtx* RG_KeysReaderCtxCreate(const char* match, bool readValue,
     return KeysReaderCtx_Create(match, readValue, event, noScan);
 }
 
+static void RG_KeysReaderCtxSetKeyTypes(KeysReaderCtx* readerCtx, int* keyTypes){
+    KeysReaderCtx_SetKeyTypes(readerCtx, keyTypes);
+}
+
 static void RG_KeysReaderCtxFree(KeysReaderCtx* readerCtx){
     KeysReaderCtx_Free(readerCtx);
 }
@@ -264,6 +338,10 @@ static void RG_KeysReaderTriggerArgsFree(KeysReaderTriggerArgs* args){
     return KeysReaderTriggerArgs_Free(args);
 }
 
+static int RG_KeysReaderTriggerArgsSetView(KeysReaderTriggerArgs* args, const char* viewKey, const char* aggregation, const char* groupField, const char* valueField, char** err){
+    return KeysReaderTriggerArgs_SetView(args, viewKey, aggregation, groupField, valueField, err);
+}
+
 static void RG_FreeFlatExecution(FlatExecutionPlan* fep){
     FlatExecutionPlan_Free(fep);
 }
@@ -279,7 +357,7 @@ static const char* RG_GetId(ExecutionPlan* ep){
 static long long RG_GetRecordsLen(ExecutionPlan* ep){
     // TODO: move results and errors to linked lists for partial parallelism w/o locking
     RedisModule_Assert(ep && RedisGears_IsDone(ep));
-	return array_len(ep->results);
+	return array_len(ep->results) - ep->resultsOffset;
 }
 
 static long long RG_GetErrorsLen(ExecutionPlan* ep){
@@ -303,8 +381,8 @@ static bool RG_AddOnDoneCallback(ExecutionPlan* ep, RedisGears_OnExecutionDoneCa
 static Record* RG_GetRecord(ExecutionPlan* ep, long long i){
     // TODO: move results and errors to linked lists for partial parallelism w/o locking
     RedisModule_Assert(ep && RedisGears_IsDone(ep));
-    RedisModule_Assert(i >= 0 && i < array_len(ep->results));
-	return ep->results[i];
+    RedisModule_Assert(i >= 0 && i < array_len(ep->results) - ep->resultsOffset);
+	return ep->results[ep->resultsOffset + i];
 }
 
 static Record* RG_GetError(ExecutionPlan* ep, long long i){
@@ -348,6 +426,8 @@ static int RG_AbortExecution(ExecutionPlan* ep){
         return REDISMODULE_OK;
     }
 
+    // stop reading, in case the execution is not running python code
+    ExecutionPlan_Cancel(ep, EXECUTION_ABORTED_MSG);
     while(ep->status != DONE){
         // we are checking for DONE status cause this one is set without getting the lock.
         // Once status changed to DONE we know that no more python code will be executed and
@@ -457,6 +537,10 @@ static void RG_SetPrivateData(ExecutionCtx* ectx, void* PD){
     ectx->ep->executionPD = PD;
 }
 
+static bool RG_IsCancelled(ExecutionCtx* ectx){
+    return ectx->ep && ExecutionPlan_IsCancelled(ectx->ep);
+}
+
 static ExecutionThreadPool* RG_ExecutionThreadPoolCreate(const char* name, size_t numOfThreads){
     return ExecutionPlan_CreateThreadPool(name, numOfThreads);
 }
@@ -573,6 +657,7 @@ static int RedisGears_RegisterApi(RedisModuleCtx* ctx){
     REGISTER_API(BRReadBuffer, ctx);
 
     REGISTER_API(RegisterReader, ctx);
+    REGISTER_API(RegisterReaderWithVersion, ctx);
     REGISTER_API(RegisterForEach, ctx);
     REGISTER_API(RegisterMap, ctx);
     REGISTER_API(RegisterAccumulator, ctx);
@@ -580,9 +665,14 @@ static int RedisGears_RegisterApi(RedisModuleCtx* ctx){
     REGISTER_API(RegisterFilter, ctx);
     REGISTER_API(RegisterGroupByExtractor, ctx);
     REGISTER_API(RegisterReducer, ctx);
+    REGISTER_API(RegisterCompare, ctx);
+    REGISTER_API(RegisterAssociativeAccumulatorByKey, ctx);
+    REGISTER_API(RegisterAssociativeReducer, ctx);
     REGISTER_API(CreateCtx, ctx);
     REGISTER_API(SetDesc, ctx);
     REGISTER_API(SetMaxIdleTime, ctx);
+    REGISTER_API(SetExecutionPoolSize, ctx);
+    REGISTER_API(SetExecutionTimeout, ctx);
     REGISTER_API(RegisterFlatExecutionPrivateDataType, ctx);
     REGISTER_API(SetFlatExecutionPrivateData, ctx);
     REGISTER_API(GetFlatExecutionPrivateDataFromFep, ctx);
@@ -597,6 +687,10 @@ static int RedisGears_RegisterApi(RedisModuleCtx* ctx){
     REGISTER_API(Repartition, ctx);
     REGISTER_API(ForEach, ctx);
     REGISTER_API(Limit, ctx);
+    REGISTER_API(Sort, ctx);
+    REGISTER_API(TopK, ctx);
+    REGISTER_API(Window, ctx);
+    REGISTER_API(Join, ctx);
     REGISTER_API(Run, ctx);
     REGISTER_API(Register, ctx);
     REGISTER_API(FreeFlatExecution, ctx);
@@ -604,11 +698,13 @@ static int RedisGears_RegisterApi(RedisModuleCtx* ctx){
     REGISTER_API(StreamReaderCtxCreate, ctx);
     REGISTER_API(StreamReaderCtxFree, ctx);
     REGISTER_API(KeysReaderCtxCreate, ctx);
+    REGISTER_API(KeysReaderCtxSetKeyTypes, ctx);
     REGISTER_API(KeysReaderCtxFree, ctx);
     REGISTER_API(StreamReaderTriggerArgsCreate, ctx);
     REGISTER_API(StreamReaderTriggerArgsFree, ctx);
     REGISTER_API(KeysReaderTriggerArgsCreate, ctx);
     REGISTER_API(KeysReaderTriggerArgsFree, ctx);
+    REGISTER_API(KeysReaderTriggerArgsSetView, ctx);
     REGISTER_API(CommandReaderTriggerArgsCreate, ctx);
     REGISTER_API(CommandReaderTriggerArgsFree, ctx);
 
@@ -638,6 +734,7 @@ static int RedisGears_RegisterApi(RedisModuleCtx* ctx){
     REGISTER_API(ListRecordGet, ctx);
     REGISTER_API(ListRecordPop, ctx);
     REGISTER_API(StringRecordCreate, ctx);
+    REGISTER_API(StringRecordCreateBorrowed, ctx);
     REGISTER_API(StringRecordGet, ctx);
     REGISTER_API(StringRecordSet, ctx);
     REGISTER_API(DoubleRecordCreate, ctx);
@@ -661,6 +758,7 @@ static int RedisGears_RegisterApi(RedisModuleCtx* ctx){
     REGISTER_API(GetFlatExecutionPrivateData, ctx);
     REGISTER_API(GetPrivateData, ctx);
     REGISTER_API(SetPrivateData, ctx);
+    REGISTER_API(IsCancelled, ctx);
     REGISTER_API(RegisterExecutionOnStartCallback, ctx);
     REGISTER_API(RegisterExecutionOnUnpausedCallback, ctx);
     REGISTER_API(RegisterFlatExecutionOnRegisteredCallback, ctx);
@@ -734,6 +832,14 @@ static void RedisGears_OnModuleLoad(struct RedisModuleCtx *ctx, RedisModuleEvent
     }
 }
 
+static void RedisGears_InfoFunc(RedisModuleInfoCtx *ctx, int forCrashReport){
+    if(forCrashReport){
+        // collecting the pools counters takes locks that might be held by the crashed thread
+        return;
+    }
+    Record_AddInfo(ctx);
+}
+
 static bool isInitiated = false;
 
 int RedisGears_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -763,6 +869,21 @@ int RedisGears_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         return REDISMODULE_ERR;
     }
 
+    if(Gears_ArenaInitialize() != REDISMODULE_OK){
+        RedisModule_Log(ctx, "warning", "could not initialize execution arena");
+        return REDISMODULE_ERR;
+    }
+
+    if(Gears_SlabInitialize() != REDISMODULE_OK){
+        RedisModule_Log(ctx, "warning", "could not initialize records pools");
+        return REDISMODULE_ERR;
+    }
+
+    if(Profiler_Initialize() != REDISMODULE_OK){
+        RedisModule_Log(ctx, "warning", "could not initialize profiler");
+        return REDISMODULE_ERR;
+    }
+
     if(RedisGears_RegisterApi(ctx) != REDISMODULE_OK){
         RedisModule_Log(ctx, "warning", "could not register RedisGears api");
         return REDISMODULE_ERR;
@@ -802,6 +923,21 @@ int RedisGears_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RGM_RegisterReader(ShardIDReader);
     RGM_RegisterFilter(Example_Filter, NULL);
     RGM_RegisterMap(GetValueMapper, NULL);
+    RGM_RegisterMap(AvgMapper, NULL);
+    RGM_RegisterMap(HashSetValuesMapper, NULL);
+    RGM_RegisterReducer(CountReducer, NULL);
+    RGM_RegisterAccumulator(CountAccumulator, NULL);
+    RGM_RegisterAccumulator(SumAccumulator, NULL);
+    RGM_RegisterAccumulator(MinAccumulator, NULL);
+    RGM_RegisterAccumulator(MaxAccumulator, NULL);
+    RGM_RegisterAccumulator(AvgAccumulator, NULL);
+    RGM_RegisterAccumulator(DistinctAccumulator, NULL);
+    RGM_RegisterAssociativeAccumulatorByKey(CountByKeyAccumulator, NULL);
+    RGM_RegisterAssociativeAccumulatorByKey(SumByKeyAccumulator, NULL);
+    RGM_RegisterGroupByExtractor(KeyRecordKeyExtractor, NULL);
+    RGM_RegisterGroupByExtractor(StreamRecordIdExtractor, NULL);
+
+    Sketches_Initialize();
     RGM_RegisterForEach(AddToStream, NULL);
 
     ExecutionPlan_Initialize();
@@ -910,6 +1046,16 @@ int RedisGears_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         return REDISMODULE_ERR;
     }
 
+    if (RedisModule_CreateCommand(ctx, "rg.profile", Profiler_ProfileCommand, "readonly", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.profile");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_RegisterInfoFunc(ctx, RedisGears_InfoFunc) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register info function");
+        return REDISMODULE_ERR;
+    }
+
     RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_ModuleChange, RedisGears_OnModuleLoad);
 
     isInitiated = true;
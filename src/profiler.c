@@ -0,0 +1,226 @@
+/*
+ * profiler.c
+ *
+ * Sampling profiler for executions, see profiler.h.
+ */
+
+#include "profiler.h"
+#include "config.h"
+#include "redisgears_memory.h"
+#include "utils/arr_rm_alloc.h"
+#include "utils/dict.h"
+#include "utils/buffer.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef WITHPYTHON
+#include "redisgears_python.h"
+#endif
+
+#define PROFILER_IDLE_SLEEP_US 100000 // how often a disabled sampler checks if sampling was enabled
+
+/*
+ * The steps stack of a thread, written only by the thread itself and read by the sampler
+ * without locking. Entries are static strings so a stale entry is harmless.
+ */
+typedef struct ProfilerThreadSlot{
+    unsigned long threadId;
+    int depth; // might be bigger than PROFILER_MAX_DEPTH, deeper steps are not kept
+    const char* stack[PROFILER_MAX_DEPTH];
+    bool inPython;
+}ProfilerThreadSlot;
+
+typedef struct ProfilerData{
+    pthread_key_t slotKey;
+    pthread_mutex_t slotsLock; // protects slots and samplerStarted
+    ProfilerThreadSlot** slots; // slots are never freed, execution threads live as long as the module
+    bool samplerStarted;
+    pthread_mutex_t samplesLock; // protects samples
+    Gears_dict* samples; // collapsed stack -> number of samples
+}ProfilerData;
+
+static ProfilerData profilerData;
+
+static void* Profiler_SamplerMain(void* arg);
+
+int Profiler_Initialize(){
+    if(pthread_key_create(&profilerData.slotKey, NULL)){
+        return REDISMODULE_ERR;
+    }
+    pthread_mutex_init(&profilerData.slotsLock, NULL);
+    pthread_mutex_init(&profilerData.samplesLock, NULL);
+    profilerData.slots = array_new(ProfilerThreadSlot*, 10);
+    profilerData.samplerStarted = false;
+    profilerData.samples = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
+    return REDISMODULE_OK;
+}
+
+/*
+ * The slot of the current thread is created on its first step after sampling was enabled,
+ * the sampler thread is started at the same time.
+ */
+static ProfilerThreadSlot* Profiler_CreateSlot(){
+    ProfilerThreadSlot* slot = RG_CALLOC(1, sizeof(*slot));
+    slot->threadId = (unsigned long)pthread_self();
+    pthread_setspecific(profilerData.slotKey, slot);
+
+    pthread_mutex_lock(&profilerData.slotsLock);
+    profilerData.slots = array_append(profilerData.slots, slot);
+    if(!profilerData.samplerStarted){
+        pthread_t sampler;
+        if(pthread_create(&sampler, NULL, Profiler_SamplerMain, NULL) == 0){
+            pthread_detach(sampler);
+            profilerData.samplerStarted = true;
+        }else{
+            RedisModule_Log(NULL, "warning", "Failed starting the profiler sampler thread");
+        }
+    }
+    pthread_mutex_unlock(&profilerData.slotsLock);
+    return slot;
+}
+
+bool Profiler_PushStep(const char* name){
+    if(GearsConfig_ProfileSampleRate() <= 0){
+        return false;
+    }
+    ProfilerThreadSlot* slot = pthread_getspecific(profilerData.slotKey);
+    if(!slot){
+        slot = Profiler_CreateSlot();
+    }
+    int depth = slot->depth;
+    if(depth < PROFILER_MAX_DEPTH){
+        slot->stack[depth] = name;
+    }
+    // the entry must be written before the sampler can see it
+    __atomic_store_n(&slot->depth, depth + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void Profiler_PopStep(){
+    ProfilerThreadSlot* slot = pthread_getspecific(profilerData.slotKey);
+    RedisModule_Assert(slot && slot->depth > 0);
+    __atomic_store_n(&slot->depth, slot->depth - 1, __ATOMIC_RELEASE);
+}
+
+void Profiler_SetInPython(bool inPython){
+    ProfilerThreadSlot* slot = pthread_getspecific(profilerData.slotKey);
+    if(slot){
+        __atomic_store_n(&slot->inPython, inPython, __ATOMIC_RELAXED);
+    }
+}
+
+static void Profiler_AddSample(const char* stack){
+    pthread_mutex_lock(&profilerData.samplesLock);
+    Gears_dictEntry* existing = NULL;
+    Gears_dictEntry* entry = Gears_dictAddRaw(profilerData.samples, (void*)stack, &existing);
+    if(entry){
+        Gears_dictSetUnsignedIntegerVal(entry, 1);
+    }else{
+        Gears_dictSetUnsignedIntegerVal(existing, Gears_dictGetUnsignedIntegerVal(existing) + 1);
+    }
+    pthread_mutex_unlock(&profilerData.samplesLock);
+}
+
+static void Profiler_Sample(){
+    pthread_mutex_lock(&profilerData.slotsLock);
+    size_t len = array_len(profilerData.slots);
+    ProfilerThreadSlot* slots[len];
+    memcpy(slots, profilerData.slots, len * sizeof(*slots));
+    pthread_mutex_unlock(&profilerData.slotsLock);
+
+    Gears_Buffer* stacks[len];
+    unsigned long pythonThreads[len];
+    Gears_Buffer* pythonStacks[len];
+    size_t nPython = 0;
+    for(size_t i = 0 ; i < len ; ++i){
+        stacks[i] = NULL;
+        int depth = __atomic_load_n(&slots[i]->depth, __ATOMIC_ACQUIRE);
+        if(depth == 0){
+            continue; // idle thread
+        }
+        if(depth > PROFILER_MAX_DEPTH){
+            depth = PROFILER_MAX_DEPTH;
+        }
+        stacks[i] = Gears_BufferNew(128);
+        for(int j = 0 ; j < depth ; ++j){
+            if(j > 0){
+                Gears_BufferAdd(stacks[i], ";", 1);
+            }
+            Gears_BufferAdd(stacks[i], slots[i]->stack[j], strlen(slots[i]->stack[j]));
+        }
+        if(__atomic_load_n(&slots[i]->inPython, __ATOMIC_RELAXED)){
+            pythonThreads[nPython] = slots[i]->threadId;
+            pythonStacks[nPython++] = stacks[i];
+        }
+    }
+
+#ifdef WITHPYTHON
+    if(nPython > 0){
+        // the python stacks are taken a bit after the steps stacks, while waiting for the python GIL
+        RedisGearsPy_AddThreadsStacks(pythonThreads, pythonStacks, nPython);
+    }
+#endif
+
+    for(size_t i = 0 ; i < len ; ++i){
+        if(!stacks[i]){
+            continue;
+        }
+        Gears_BufferAdd(stacks[i], "", 1); // null terminate
+        Profiler_AddSample(stacks[i]->buff);
+        Gears_BufferFree(stacks[i]);
+    }
+}
+
+static void* Profiler_SamplerMain(void* arg){
+    while(true){
+        long long rate = GearsConfig_ProfileSampleRate();
+        if(rate <= 0){
+            usleep(PROFILER_IDLE_SLEEP_US);
+            continue;
+        }
+        usleep(1000000 / rate);
+        Profiler_Sample();
+    }
+    return NULL;
+}
+
+/*
+ * RG.PROFILE [RESET]
+ * Return the samples as collapsed stacks, a line per stack followed by its number of samples.
+ * With RESET the samples are cleared.
+ */
+int Profiler_ProfileCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc > 2){
+        return RedisModule_WrongArity(ctx);
+    }
+    if(argc == 2){
+        const char* subCommand = RedisModule_StringPtrLen(argv[1], NULL);
+        if(strcasecmp(subCommand, "reset") != 0){
+            RedisModule_ReplyWithError(ctx, "unknown subcommand, only RESET is supported");
+            return REDISMODULE_OK;
+        }
+        pthread_mutex_lock(&profilerData.samplesLock);
+        Gears_dictEmpty(profilerData.samples, NULL);
+        pthread_mutex_unlock(&profilerData.samplesLock);
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+        return REDISMODULE_OK;
+    }
+
+    Gears_Buffer* buff = Gears_BufferNew(1024);
+    pthread_mutex_lock(&profilerData.samplesLock);
+    Gears_dictIterator* iter = Gears_dictGetIterator(profilerData.samples);
+    Gears_dictEntry* entry = NULL;
+    while((entry = Gears_dictNext(iter))){
+        const char* stack = Gears_dictGetKey(entry);
+        char count[32];
+        int countLen = snprintf(count, sizeof(count), " %llu\n", (unsigned long long)Gears_dictGetUnsignedIntegerVal(entry));
+        Gears_BufferAdd(buff, stack, strlen(stack));
+        Gears_BufferAdd(buff, count, countLen);
+    }
+    Gears_dictReleaseIterator(iter);
+    pthread_mutex_unlock(&profilerData.samplesLock);
+
+    RedisModule_ReplyWithStringBuffer(ctx, buff->buff, buff->size);
+    Gears_BufferFree(buff);
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,37 @@
+/*
+ * profiler.h
+ *
+ * Sampling profiler for executions (see ProfileSampleRate configuration).
+ *
+ * Threads that run executions publish the stack of the steps they are currently
+ * running, a sampler thread reads those stacks ProfileSampleRate times a second
+ * (adding the python stack when a python callback is running) and counts them.
+ * RG.PROFILE returns the counted stacks in the collapsed flamegraph format.
+ */
+
+#ifndef SRC_PROFILER_H_
+#define SRC_PROFILER_H_
+
+#include <stdbool.h>
+#include "redismodule.h"
+
+#define PROFILER_MAX_DEPTH 64
+
+int Profiler_Initialize();
+
+/*
+ * Mark the start of a step on the current thread, 'name' must outlive the step (usually a static string).
+ * Return false if sampling is disabled, in which case Profiler_PopStep must not be called.
+ */
+bool Profiler_PushStep(const char* name);
+void Profiler_PopStep();
+
+/*
+ * Mark that the current thread runs python code, only tracked for threads that already
+ * ran steps while sampling was enabled.
+ */
+void Profiler_SetInPython(bool inPython);
+
+int Profiler_ProfileCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+#endif /* SRC_PROFILER_H_ */
@@ -9,14 +9,23 @@
 #include "lock_handler.h"
 #include "record.h"
 #include "config.h"
+#include "cluster.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #define KEYS_NAME_FIELD "key_name"
 #define KEYS_SPEC_NAME "keys_spec"
 
 #define ALL_KEY_REGISTRATION_INIT_SIZE 10
 
+typedef enum KeysReaderViewState{
+    KeysReaderViewStateNotBuilt,
+    KeysReaderViewStateBuilding, // scanned on a background thread, events are applied but not written
+    KeysReaderViewStateBuilt,
+}KeysReaderViewState;
+
 typedef struct KeysReaderRegisterData{
     long long refCount;
     FlatExecutionPlan* fep;
@@ -30,6 +39,11 @@ typedef struct KeysReaderRegisterData{
     Gears_list* localPendingExecutions;
     Gears_list* localDoneExecutions;
     WorkerData* wd;
+    KeysReaderViewState viewState;
+    unsigned long long viewBuildId; // changed when the view state is cleared, a running build stops when it sees it
+    char* viewKey; // the view key name, on cluster it is tagged with the shard hash tag
+    RedisModuleDict* viewContributions; // source key -> KeysReaderViewContribution
+    RedisModuleDict* viewGroups; // group -> KeysReaderViewGroup
 }KeysReaderRegisterData;
 
 Gears_list* keysReaderRegistration = NULL;
@@ -46,17 +60,49 @@ typedef struct KeysReaderCtx{
     Record** pendingRecords;
     bool readValue;
     bool noScan;
+    size_t limit; // 0 means no limit
+    size_t readCount;
+    int* keyTypes; // NULL means all types
 }KeysReaderCtx;
 
+typedef enum KeysReaderViewType{
+    KeysReaderViewTypeCount,
+    KeysReaderViewTypeSum,
+}KeysReaderViewType;
+
+typedef struct KeysReaderViewArgs{
+    char* key;
+    KeysReaderViewType type;
+    char* groupField; // NULL means all the keys are aggregated into a single group
+    char* valueField; // NULL on count
+}KeysReaderViewArgs;
+
+#define VIEW_SINGLE_GROUP "all"
+
 typedef struct KeysReaderTriggerArgs{
     char* prefix;
     char** eventTypes;
     int* keyTypes;
     bool readValue;
+    KeysReaderViewArgs* view; // NULL if the registration runs its execution on each event
 }KeysReaderTriggerArgs;
 
+static void KeysReaderViewArgs_Free(KeysReaderViewArgs* view){
+    RG_FREE(view->key);
+    if(view->groupField){
+        RG_FREE(view->groupField);
+    }
+    if(view->valueField){
+        RG_FREE(view->valueField);
+    }
+    RG_FREE(view);
+}
+
 void KeysReaderTriggerArgs_Free(KeysReaderTriggerArgs* args){
     RG_FREE(args->prefix);
+    if(args->view){
+        KeysReaderViewArgs_Free(args->view);
+    }
     if(args->eventTypes){
         array_free_ex(args->eventTypes, RG_FREE(*(char**)ptr));
     }
@@ -66,6 +112,46 @@ void KeysReaderTriggerArgs_Free(KeysReaderTriggerArgs* args){
     RG_FREE(args);
 }
 
+typedef struct KeysReaderViewContribution{
+    char* group;
+    double value;
+}KeysReaderViewContribution;
+
+typedef struct KeysReaderViewGroup{
+    long long numKeys;
+    double sum;
+}KeysReaderViewGroup;
+
+static void KeysReader_ViewClearState(KeysReaderRegisterData* rData){
+    if(rData->viewContributions){
+        RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(rData->viewContributions, "^", NULL, 0);
+        KeysReaderViewContribution* contribution;
+        while(RedisModule_DictNextC(iter, NULL, (void**)&contribution)){
+            RG_FREE(contribution->group);
+            RG_FREE(contribution);
+        }
+        RedisModule_DictIteratorStop(iter);
+        RedisModule_FreeDict(NULL, rData->viewContributions);
+        rData->viewContributions = NULL;
+    }
+    if(rData->viewGroups){
+        RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(rData->viewGroups, "^", NULL, 0);
+        KeysReaderViewGroup* group;
+        while(RedisModule_DictNextC(iter, NULL, (void**)&group)){
+            RG_FREE(group);
+        }
+        RedisModule_DictIteratorStop(iter);
+        RedisModule_FreeDict(NULL, rData->viewGroups);
+        rData->viewGroups = NULL;
+    }
+    if(rData->viewKey){
+        RG_FREE(rData->viewKey);
+        rData->viewKey = NULL;
+    }
+    rData->viewState = KeysReaderViewStateNotBuilt;
+    ++rData->viewBuildId;
+}
+
 static void KeysReaderRegisterData_Free(KeysReaderRegisterData* rData){
     if((--rData->refCount) == 0){
 
@@ -94,6 +180,7 @@ static void KeysReaderRegisterData_Free(KeysReaderRegisterData* rData){
         if(rData->lastError){
             RG_FREE(rData->lastError);
         }
+        KeysReader_ViewClearState(rData);
         KeysReaderTriggerArgs_Free(rData->args);
         FlatExecutionPlan_Free(rData->fep);
         RedisGears_WorkerDataFree(rData->wd);
@@ -116,6 +203,11 @@ static KeysReaderRegisterData* KeysReaderRegisterData_Create(FlatExecutionPlan*
         .localPendingExecutions = Gears_listCreate(),
         .localDoneExecutions = Gears_listCreate(),
         .wd = RedisGears_WorkerDataCreate(NULL),
+        .viewState = KeysReaderViewStateNotBuilt,
+        .viewBuildId = 0,
+        .viewKey = NULL,
+        .viewContributions = NULL,
+        .viewGroups = NULL,
     };
     return rData;
 }
@@ -153,10 +245,25 @@ KeysReaderCtx* KeysReaderCtx_Create(const char* match, bool readValue, const cha
         .readValue = readValue,
         .noScan = noScan,
         .pendingRecords = array_new(Record*, PENDING_KEYS_INIT_CAP),
+        .limit = 0,
+        .readCount = 0,
+        .keyTypes = NULL,
     };
     return krctx;
 }
 
+void KeysReaderCtx_SetKeyTypes(KeysReaderCtx* krctx, int* keyTypes){
+    if(krctx->keyTypes){
+        array_free(krctx->keyTypes);
+    }
+    krctx->keyTypes = keyTypes;
+}
+
+static void KeysReaderCtx_SetLimit(void* ctx, size_t limit){
+    KeysReaderCtx* krctx = ctx;
+    krctx->limit = limit;
+}
+
 void KeysReaderCtx_Free(void* ctx){
     KeysReaderCtx* krctx = ctx;
     if(krctx->match){
@@ -165,6 +272,9 @@ void KeysReaderCtx_Free(void* ctx){
     if(krctx->event){
         RG_FREE(krctx->event);
     }
+    if(krctx->keyTypes){
+        array_free(krctx->keyTypes);
+    }
     for(size_t i = 0 ; i < array_len(krctx->pendingRecords) ; ++i){
         RedisGears_FreeRecord(krctx->pendingRecords[i]);
     }
@@ -183,6 +293,15 @@ static void RG_KeysReaderCtxSerialize(void* ctx, Gears_BufferWriter* bw){
     }
     RedisGears_BWWriteLong(bw, krctx->readValue);
     RedisGears_BWWriteLong(bw, krctx->noScan);
+    if(krctx->keyTypes){
+        RedisGears_BWWriteLong(bw, 1); // keyTypes exists
+        RedisGears_BWWriteLong(bw, array_len(krctx->keyTypes));
+        for(size_t i = 0 ; i < array_len(krctx->keyTypes) ; ++i){
+            RedisGears_BWWriteLong(bw, krctx->keyTypes[i]);
+        }
+    }else{
+        RedisGears_BWWriteLong(bw, 0); // keyTypes does not exist
+    }
 }
 
 static void RG_KeysReaderCtxDeserialize(FlatExecutionPlan* fep, void* ctx, Gears_BufferReader* br){
@@ -197,6 +316,13 @@ static void RG_KeysReaderCtxDeserialize(FlatExecutionPlan* fep, void* ctx, Gears
     }
     krctx->readValue = RedisGears_BRReadLong(br);
     krctx->noScan = RedisGears_BRReadLong(br);
+    if(RedisGears_BRReadLong(br)){
+        size_t len = RedisGears_BRReadLong(br);
+        krctx->keyTypes = array_new(int, len);
+        for(size_t i = 0 ; i < len ; ++i){
+            krctx->keyTypes = array_append(krctx->keyTypes, RedisGears_BRReadLong(br));
+        }
+    }
 }
 
 static Record* GetStringValueRecord(RedisModuleKey* handler, RedisModuleCtx* ctx, const char* keyStr){
@@ -257,14 +383,9 @@ static Record* ValueToListMapper(const char* keyStr, RedisModuleCtx* ctx){
     for(int i = 0 ; i < len ; ++i){
         RedisModuleCallReply *r = RedisModule_CallReplyArrayElement(reply, i);
         RedisModule_Assert(RedisModule_CallReplyType(r) == REDISMODULE_REPLY_STRING);
-        RedisModuleString* key = RedisModule_CreateStringFromCallReply(r);
-        size_t vaLen;
-        const char* val = RedisModule_StringPtrLen(key, &vaLen);
-        char* str = RG_ALLOC(vaLen + 1);
-        memcpy(str, val, vaLen);
-        str[vaLen] = '\0';
-        Record* strRecord = RedisGears_StringRecordCreate(str, vaLen);
-        RedisModule_FreeString(ctx, key);
+        size_t valLen;
+        const char* val = RedisModule_CallReplyStringPtr(r, &valLen);
+        Record* strRecord = RedisGears_StringRecordCreateBorrowed(RedisModule_CreateString(NULL, val, valLen));
         RedisGears_ListRecordAdd(listRecord, strRecord);
     }
     RedisModule_FreeCallReply(reply);
@@ -315,31 +436,79 @@ static Record* GetTypeRecord(RedisModuleKey* handler){
     return RedisGears_StringRecordCreate(RG_STRDUP(typeStr), strlen(typeStr));
 }
 
+static bool KeysReader_IsKeyTypeAllowed(int* keyTypes, int type){
+    for(size_t i = 0 ; i < array_len(keyTypes) ; i++){
+        if(type == keyTypes[i]){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Return the SCAN TYPE argument that gives the same filtering as the given key types,
+ * or NULL if the filtering can not be done by SCAN (it will be done when reading the key).
+ */
+static const char* KeysReader_GetScanType(int* keyTypes){
+    if(!keyTypes || array_len(keyTypes) != 1){
+        return NULL;
+    }
+    switch(keyTypes[0]){
+    case REDISMODULE_KEYTYPE_STRING:
+        return "string";
+    case REDISMODULE_KEYTYPE_LIST:
+        return "list";
+    case REDISMODULE_KEYTYPE_HASH:
+        return "hash";
+    case REDISMODULE_KEYTYPE_SET:
+        return "set";
+    case REDISMODULE_KEYTYPE_ZSET:
+        return "zset";
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Takes the given key name, it is borrowed by the key record (or freed if the key is filtered out).
+ */
 static Record* KeysReader_ReadKey(RedisModuleCtx* rctx, KeysReaderCtx* readerCtx, RedisModuleString* key){
-    size_t keyLen;
-    const char* keyStr = RedisModule_StringPtrLen(key, &keyLen);
-    Record* record = RedisGears_HashSetRecordCreate();
+    RedisModuleKey *keyHandler = NULL;
+    if(readerCtx->keyTypes || readerCtx->readValue){
+        keyHandler = RedisModule_OpenKey(rctx, key, REDISMODULE_READ);
+    }
+    if(readerCtx->keyTypes){
+        // checking the type only looks at the key, keys that are filtered out
+        // never get their value read or a record allocated.
+        if(!KeysReader_IsKeyTypeAllowed(readerCtx->keyTypes, RedisModule_KeyType(keyHandler))){
+            if(keyHandler){
+                RedisModule_CloseKey(keyHandler);
+            }
+            RedisModule_FreeString(NULL, key);
+            return NULL;
+        }
+    }
 
-    char* keyCStr = RG_ALLOC(keyLen + 1);
-    memcpy(keyCStr, keyStr, keyLen);
-    keyCStr[keyLen] = '\0';
+    const char* keyCStr = RedisModule_StringPtrLen(key, NULL);
+    Record* record = RedisGears_HashSetRecordCreate();
 
-    Record* keyRecord = RedisGears_StringRecordCreate(keyCStr, keyLen);
+    Record* keyRecord = RedisGears_StringRecordCreateBorrowed(key);
     RedisGears_HashSetRecordSet(record, "key", keyRecord);
 
     if(readerCtx->readValue){
-        RedisModuleKey *keyHandler = RedisModule_OpenKey(rctx, key, REDISMODULE_READ);
         if(keyHandler){
             Record* keyType = GetTypeRecord(keyHandler);
             Record* val = GetValueRecord(rctx, keyCStr, keyHandler);
             RedisGears_HashSetRecordSet(record, "value", val);
             RedisGears_HashSetRecordSet(record, "type", keyType);
-            RedisModule_CloseKey(keyHandler);
         }else{
             RedisGears_HashSetRecordSet(record, "value", NULL);
             RedisGears_HashSetRecordSet(record, "type", RedisGears_StringRecordCreate(RG_STRDUP("empty"), strlen("empty")));
         }
     }
+    if(keyHandler){
+        RedisModule_CloseKey(keyHandler);
+    }
 
     if(readerCtx->event){
         Record* eventRecord = RedisGears_StringRecordCreate(RG_STRDUP(readerCtx->event), strlen(readerCtx->event));
@@ -351,16 +520,33 @@ static Record* KeysReader_ReadKey(RedisModuleCtx* rctx, KeysReaderCtx* readerCtx
     return record;
 }
 
-static Record* KeysReader_ScanNextKey(RedisModuleCtx* rctx, KeysReaderCtx* readerCtx){
+static Record* KeysReader_ScanNextKey(ExecutionCtx* ectx, KeysReaderCtx* readerCtx){
+    RedisModuleCtx* rctx = RedisGears_GetRedisModuleCtx(ectx);
     if(array_len(readerCtx->pendingRecords) > 0){
         return array_pop(readerCtx->pendingRecords);
     }
     if(readerCtx->isDone){
         return NULL;
     }
+    if(readerCtx->limit && readerCtx->readCount >= readerCtx->limit){
+        readerCtx->isDone = true;
+        return NULL;
+    }
+    const char* scanType = KeysReader_GetScanType(readerCtx->keyTypes);
     LockHandler_Acquire(rctx);
     while(true){
-        RedisModuleCallReply *reply = RedisModule_Call(rctx, "SCAN", "lcccc", readerCtx->cursorIndex, "COUNT", "10000", "MATCH", readerCtx->match);
+        if(RedisGears_IsCancelled(ectx)){
+            // keys that are filtered out might keep us scanning for long, no need to go on.
+            readerCtx->isDone = true;
+            LockHandler_Release(rctx);
+            return NULL;
+        }
+        RedisModuleCallReply *reply;
+        if(scanType){
+            reply = RedisModule_Call(rctx, "SCAN", "lcccccc", readerCtx->cursorIndex, "COUNT", "10000", "MATCH", readerCtx->match, "TYPE", scanType);
+        }else{
+            reply = RedisModule_Call(rctx, "SCAN", "lcccc", readerCtx->cursorIndex, "COUNT", "10000", "MATCH", readerCtx->match);
+        }
         if (reply == NULL || RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
             if(reply) RedisModule_FreeCallReply(reply);
             LockHandler_Release(rctx);
@@ -391,20 +577,41 @@ static Record* KeysReader_ScanNextKey(RedisModuleCtx* rctx, KeysReaderCtx* reade
                 LockHandler_Release(rctx);
                 return NULL;
             }
+            // let other threads take the lock between the pages, the cursor does not depend on it
+            LockHandler_Release(rctx);
+            LockHandler_Acquire(rctx);
             continue;
         }
         for(int i = 0 ; i < RedisModule_CallReplyLength(keysReply) ; ++i){
+            if(readerCtx->limit && readerCtx->readCount >= readerCtx->limit){
+                // no need to read the rest of the keys (and their values), they will not be used
+                readerCtx->isDone = true;
+                break;
+            }
             RedisModuleCallReply *keyReply = RedisModule_CallReplyArrayElement(keysReply, i);
             RedisModule_Assert(RedisModule_CallReplyType(keyReply) == REDISMODULE_REPLY_STRING);
-            RedisModuleString* key = RedisModule_CreateStringFromCallReply(keyReply);
+            size_t keyLen;
+            const char* keyStr = RedisModule_CallReplyStringPtr(keyReply, &keyLen);
+            // not created on rctx, the key record holds it after the execution is done with rctx
+            RedisModuleString* key = RedisModule_CreateString(NULL, keyStr, keyLen);
             Record* record = KeysReader_ReadKey(rctx, readerCtx, key);
             if(record == NULL){
                 continue;
             }
-            RedisModule_FreeString(rctx, key);
             readerCtx->pendingRecords = array_append(readerCtx->pendingRecords, record);
+            ++readerCtx->readCount;
         }
         RedisModule_FreeCallReply(reply);
+        if(array_len(readerCtx->pendingRecords) == 0){
+            // all the keys on this reply were filtered out
+            if(readerCtx->isDone){
+                LockHandler_Release(rctx);
+                return NULL;
+            }
+            LockHandler_Release(rctx);
+            LockHandler_Acquire(rctx);
+            continue;
+        }
         LockHandler_Release(rctx);
         return array_pop(readerCtx->pendingRecords);
     }
@@ -415,7 +622,7 @@ static Record* KeysReader_Next(ExecutionCtx* ectx, void* ctx){
     KeysReaderCtx* readerCtx = ctx;
     Record* record = NULL;
     if(!readerCtx->noScan){
-        record = KeysReader_ScanNextKey(RedisGears_GetRedisModuleCtx(ectx), readerCtx);
+        record = KeysReader_ScanNextKey(ectx, readerCtx);
     }else{
         if(readerCtx->isDone){
             return NULL;
@@ -425,12 +632,38 @@ static Record* KeysReader_Next(ExecutionCtx* ectx, void* ctx){
         LockHandler_Acquire(rctx);
         record = KeysReader_ReadKey(rctx, readerCtx, key);
         LockHandler_Release(rctx);
-        RedisModule_FreeString(NULL, key);
         readerCtx->isDone = true;
     }
     return record;
 }
 
+static size_t KeysReader_NextBatch(ExecutionCtx* ectx, void* ctx, Record** batch, size_t len){
+    KeysReaderCtx* readerCtx = ctx;
+    size_t n = 0;
+    if(readerCtx->noScan){
+        Record* record = KeysReader_Next(ectx, ctx);
+        if(record){
+            batch[n++] = record;
+        }
+        return n;
+    }
+    while(n < len){
+        // hand over the keys we already read from the last scan reply before scanning again
+        while(n < len && array_len(readerCtx->pendingRecords) > 0){
+            batch[n++] = array_pop(readerCtx->pendingRecords);
+        }
+        if(n == len){
+            break;
+        }
+        Record* record = KeysReader_ScanNextKey(ectx, readerCtx);
+        if(!record){
+            break;
+        }
+        batch[n++] = record;
+    }
+    return n;
+}
+
 static void KeysReader_ExecutionDone(ExecutionPlan* ctx, void* privateData){
     KeysReaderRegisterData* rData = privateData;
 
@@ -537,6 +770,267 @@ static int KeysReader_ShouldFire(RedisModuleCtx *ctx, KeysReaderTriggerArgs* arg
     return KeysReader_IsKeyMatch(args->prefix, keyCStr);
 }
 
+/*
+ * Read the contribution of the given key to the view, return false if the key does not
+ * contribute (not a hash, or missing the group or the value field).
+ * On success the caller owns the returned group.
+ */
+static bool KeysReader_ViewReadContribution(RedisModuleCtx* ctx, KeysReaderViewArgs* view, RedisModuleString* key, char** group, double* value){
+    RedisModuleKey *kp = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+    if(RedisModule_KeyType(kp) != REDISMODULE_KEYTYPE_HASH){
+        RedisModule_CloseKey(kp);
+        return false;
+    }
+    RedisModuleString* groupStr = NULL;
+    RedisModuleString* valueStr = NULL;
+    if(view->groupField){
+        RedisModule_HashGet(kp, REDISMODULE_HASH_CFIELDS, view->groupField, &groupStr, NULL);
+    }
+    if(view->valueField){
+        RedisModule_HashGet(kp, REDISMODULE_HASH_CFIELDS, view->valueField, &valueStr, NULL);
+    }
+    RedisModule_CloseKey(kp);
+
+    bool res = true;
+    if(view->groupField && !groupStr){
+        res = false;
+    }
+    *value = 1;
+    if(view->valueField && (!valueStr || RedisModule_StringToDouble(valueStr, value) != REDISMODULE_OK)){
+        res = false;
+    }
+    if(res){
+        *group = RG_STRDUP(groupStr ? RedisModule_StringPtrLen(groupStr, NULL) : VIEW_SINGLE_GROUP);
+    }
+    if(groupStr){
+        RedisModule_FreeString(ctx, groupStr);
+    }
+    if(valueStr){
+        RedisModule_FreeString(ctx, valueStr);
+    }
+    return res;
+}
+
+static void KeysReader_ViewWriteGroup(RedisModuleCtx* ctx, KeysReaderRegisterData* rData, const char* groupName, KeysReaderViewGroup* group){
+    if(rData->viewState != KeysReaderViewStateBuilt){
+        // all the groups are written when the build finishes
+        return;
+    }
+    RedisModuleCallReply *reply;
+    if(!group){
+        reply = RedisModule_Call(ctx, "HDEL", "!cc", rData->viewKey, groupName);
+    }else{
+        char buf[64];
+        if(rData->args->view->type == KeysReaderViewTypeCount){
+            snprintf(buf, sizeof(buf), "%lld", group->numKeys);
+        }else{
+            snprintf(buf, sizeof(buf), "%.17g", group->sum);
+        }
+        reply = RedisModule_Call(ctx, "HSET", "!ccc", rData->viewKey, groupName, buf);
+    }
+    if(!reply || RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR){
+        RedisModule_Log(ctx, "warning", "Failed updating view %s", rData->viewKey);
+    }
+    if(reply){
+        RedisModule_FreeCallReply(reply);
+    }
+}
+
+/*
+ * Add (sign = 1) or retract (sign = -1) a contribution to its group, return the group or NULL
+ * if no key contributes to it anymore.
+ */
+static KeysReaderViewGroup* KeysReader_ViewUpdateGroup(KeysReaderRegisterData* rData, const char* groupName, double value, int sign){
+    size_t len = strlen(groupName);
+    KeysReaderViewGroup* group = RedisModule_DictGetC(rData->viewGroups, (void*)groupName, len, NULL);
+    if(!group){
+        RedisModule_Assert(sign > 0);
+        group = RG_CALLOC(1, sizeof(*group));
+        RedisModule_DictSetC(rData->viewGroups, (void*)groupName, len, group);
+    }
+    group->numKeys += sign;
+    group->sum += sign * value;
+    if(group->numKeys == 0){
+        RedisModule_DictDelC(rData->viewGroups, (void*)groupName, len, NULL);
+        RG_FREE(group);
+        return NULL;
+    }
+    return group;
+}
+
+typedef struct KeysReaderViewBuildCtx{
+    KeysReaderRegisterData* rData;
+    unsigned long long buildId;
+}KeysReaderViewBuildCtx;
+
+/*
+ * Scan one page of the matching keys and add their contributions to the view, called with the
+ * Redis lock held. Return false when the scan is done (or failed).
+ */
+static bool KeysReader_ViewScanPage(RedisModuleCtx* ctx, KeysReaderRegisterData* rData, long long* cursor){
+    KeysReaderViewArgs* view = rData->args->view;
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, "SCAN", "lcccc", *cursor, "COUNT", "10000", "MATCH", rData->args->prefix);
+    if(!reply || RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY){
+        RedisModule_Log(ctx, "warning", "Failed scanning keys for view %s", rData->viewKey);
+        if(reply){
+            RedisModule_FreeCallReply(reply);
+        }
+        return false;
+    }
+    RedisModuleString *cursorStr = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(reply, 0));
+    RedisModule_StringToLongLong(cursorStr, cursor);
+    RedisModule_FreeString(ctx, cursorStr);
+
+    RedisModuleCallReply *keysReply = RedisModule_CallReplyArrayElement(reply, 1);
+    for(size_t i = 0 ; i < RedisModule_CallReplyLength(keysReply) ; ++i){
+        RedisModuleString* key = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(keysReply, i));
+        size_t keyLen;
+        const char* keyStr = RedisModule_StringPtrLen(key, &keyLen);
+        char* group;
+        double value;
+        // a key that was already added by scan (which might return a key more than once) or by an
+        // event that arrived during the build is up to date.
+        if(strcmp(keyStr, rData->viewKey) != 0 &&
+           !RedisModule_DictGetC(rData->viewContributions, (void*)keyStr, keyLen, NULL) &&
+           KeysReader_IsKeyMatch(rData->args->prefix, keyStr) &&
+           KeysReader_ViewReadContribution(ctx, view, key, &group, &value)){
+            KeysReaderViewContribution* contribution = RG_ALLOC(sizeof(*contribution));
+            contribution->group = group;
+            contribution->value = value;
+            RedisModule_DictSetC(rData->viewContributions, (void*)keyStr, keyLen, contribution);
+            KeysReader_ViewUpdateGroup(rData, group, value, 1);
+        }
+        RedisModule_FreeString(ctx, key);
+    }
+    RedisModule_FreeCallReply(reply);
+    return *cursor != 0;
+}
+
+static void KeysReader_ViewWriteAllGroups(RedisModuleCtx* ctx, KeysReaderRegisterData* rData){
+    RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(rData->viewGroups, "^", NULL, 0);
+    char* groupName;
+    size_t groupNameLen;
+    KeysReaderViewGroup* group;
+    while((groupName = RedisModule_DictNextC(iter, &groupNameLen, (void**)&group))){
+        char groupNameCStr[groupNameLen + 1];
+        memcpy(groupNameCStr, groupName, groupNameLen);
+        groupNameCStr[groupNameLen] = '\0';
+        KeysReader_ViewWriteGroup(ctx, rData, groupNameCStr, group);
+    }
+    RedisModule_DictIteratorStop(iter);
+}
+
+static void* KeysReader_ViewBuildThread(void* arg){
+    KeysReaderViewBuildCtx* bctx = arg;
+    KeysReaderRegisterData* rData = bctx->rData;
+    // we do not use the lockhandler cause this thread is temporary
+    RedisModuleCtx* ctx = RedisModule_GetThreadSafeContext(NULL);
+    long long cursor = 0;
+    bool more = true;
+    while(more){
+        RedisModule_ThreadSafeContextLock(ctx);
+        if(rData->viewBuildId != bctx->buildId){
+            // the view was cleared (unregistered, flushed or rebuilt) while we were waiting
+            RedisModule_ThreadSafeContextUnlock(ctx);
+            break;
+        }
+        more = KeysReader_ViewScanPage(ctx, rData, &cursor);
+        if(!more){
+            rData->viewState = KeysReaderViewStateBuilt;
+            KeysReader_ViewWriteAllGroups(ctx, rData);
+        }
+        RedisModule_ThreadSafeContextUnlock(ctx);
+    }
+
+    RedisModule_ThreadSafeContextLock(ctx);
+    KeysReaderRegisterData_Free(rData);
+    RedisModule_ThreadSafeContextUnlock(ctx);
+    RedisModule_FreeThreadSafeContext(ctx);
+    RG_FREE(bctx);
+    return NULL;
+}
+
+/*
+ * Start computing the view from scratch, the matching keys are scanned on a background thread
+ * which releases the Redis lock between the scan pages. Events that arrive during the build
+ * are applied to the view state, the view is written once the scan is done.
+ * Must be called with the Redis lock held.
+ */
+static void KeysReader_ViewBuildStart(RedisModuleCtx* ctx, KeysReaderRegisterData* rData){
+    KeysReaderViewArgs* view = rData->args->view;
+    KeysReader_ViewClearState(rData);
+    rData->viewContributions = RedisModule_CreateDict(NULL);
+    rData->viewGroups = RedisModule_CreateDict(NULL);
+    const char* hashTag = Cluster_IsClusterMode() ? Cluster_GetMyHashTag() : NULL;
+    if(hashTag){
+        // each shard maintains the view of its own keys on a key it owns
+        rg_asprintf(&rData->viewKey, "%s{%s}", view->key, hashTag);
+    }else{
+        rData->viewKey = RG_STRDUP(view->key);
+    }
+    rData->viewState = KeysReaderViewStateBuilding;
+
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, "DEL", "!c", rData->viewKey);
+    if(reply){
+        RedisModule_FreeCallReply(reply);
+    }
+
+    KeysReaderViewBuildCtx* bctx = RG_ALLOC(sizeof(*bctx));
+    bctx->rData = KeysReaderRegisterData_GetShallowCopy(rData);
+    bctx->buildId = rData->viewBuildId;
+    pthread_t buildThread;
+    pthread_create(&buildThread, NULL, KeysReader_ViewBuildThread, bctx);
+    pthread_detach(buildThread);
+}
+
+/*
+ * Apply a key event to the view, the old contribution of the key is retracted and the new
+ * one is added, only the groups that changed are written.
+ * Return false if the event is ignored because it is the view's own write.
+ */
+static bool KeysReader_ViewOnKeyTouched(RedisModuleCtx* ctx, KeysReaderRegisterData* rData, RedisModuleString* key){
+    size_t keyLen;
+    const char* keyStr = RedisModule_StringPtrLen(key, &keyLen);
+    if(rData->viewState != KeysReaderViewStateNotBuilt && strcmp(keyStr, rData->viewKey) == 0){
+        // our own write to the view
+        return false;
+    }
+    if(rData->viewState == KeysReaderViewStateNotBuilt){
+        // first event after we became a master, the event itself is applied below
+        KeysReader_ViewBuildStart(ctx, rData);
+    }
+
+    char* group = NULL;
+    double value;
+    bool contributes = KeysReader_ViewReadContribution(ctx, rData->args->view, key, &group, &value);
+    KeysReaderViewContribution* old = RedisModule_DictGetC(rData->viewContributions, (void*)keyStr, keyLen, NULL);
+    if(old && contributes && old->value == value && strcmp(old->group, group) == 0){
+        // the fields of the view did not change
+        RG_FREE(group);
+        return true;
+    }
+
+    if(old){
+        RedisModule_DictDelC(rData->viewContributions, (void*)keyStr, keyLen, NULL);
+        KeysReaderViewGroup* g = KeysReader_ViewUpdateGroup(rData, old->group, old->value, -1);
+        if(!contributes || strcmp(old->group, group) != 0){
+            KeysReader_ViewWriteGroup(ctx, rData, old->group, g);
+        }
+        RG_FREE(old->group);
+        RG_FREE(old);
+    }
+
+    if(contributes){
+        KeysReaderViewContribution* contribution = RG_ALLOC(sizeof(*contribution));
+        contribution->group = group;
+        contribution->value = value;
+        RedisModule_DictSetC(rData->viewContributions, (void*)keyStr, keyLen, contribution);
+        KeysReaderViewGroup* g = KeysReader_ViewUpdateGroup(rData, group, value, 1);
+        KeysReader_ViewWriteGroup(ctx, rData, group, g);
+    }
+    return true;
+}
+
 static int KeysReader_OnKeyTouched(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key){
     int flags = RedisModule_GetContextFlags(ctx);
     if(!(flags & REDISMODULE_CTX_FLAGS_MASTER)){
@@ -553,6 +1047,13 @@ static int KeysReader_OnKeyTouched(RedisModuleCtx *ctx, int type, const char *ev
     while((node = Gears_listNext(iter))){
         KeysReaderRegisterData* rData = Gears_listNodeValue(node);
         if(KeysReader_ShouldFire(ctx, rData->args, key, event)){
+            if(rData->args->view){
+                if(KeysReader_ViewOnKeyTouched(ctx, rData, key)){
+                    ++rData->numTriggered;
+                    ++rData->numSuccess;
+                }
+                continue;
+            }
             ++rData->numTriggered;
             RedisGears_OnExecutionDoneCallback callback = NULL;
             void* privateData = NULL;
@@ -605,8 +1106,18 @@ static KeysReaderRegisterData* KeysReader_FindRegistrationData(FlatExecutionPlan
     return NULL;
 }
 
+/*
+ * The args are sent to the other shards and replicated before the registration mode, so
+ * the receiver can not tell where they end. Versioned args start with a zero long, which
+ * can not be the length of the prefix of the legacy format (a string length includes the \0).
+ */
+#define KEYS_READER_ARGS_VERSION_MARK 0
+#define KEYS_READER_ARGS_VERSION 1
+
 static void KeysReader_SerializeArgs(void* var, Gears_BufferWriter* bw){
     KeysReaderTriggerArgs* args = var;
+    RedisGears_BWWriteLong(bw, KEYS_READER_ARGS_VERSION_MARK);
+    RedisGears_BWWriteLong(bw, KEYS_READER_ARGS_VERSION);
     RedisGears_BWWriteString(bw, args->prefix);
     if(args->eventTypes){
         RedisGears_BWWriteLong(bw, 1); // eventTypes exists
@@ -628,9 +1139,33 @@ static void KeysReader_SerializeArgs(void* var, Gears_BufferWriter* bw){
     }
 
     RedisGears_BWWriteLong(bw, args->readValue);
+
+    if(args->view){
+        RedisGears_BWWriteLong(bw, 1); // view exists
+        RedisGears_BWWriteString(bw, args->view->key);
+        RedisGears_BWWriteLong(bw, args->view->type);
+        RedisGears_BWWriteLong(bw, args->view->groupField ? 1 : 0);
+        if(args->view->groupField){
+            RedisGears_BWWriteString(bw, args->view->groupField);
+        }
+        RedisGears_BWWriteLong(bw, args->view->valueField ? 1 : 0);
+        if(args->view->valueField){
+            RedisGears_BWWriteString(bw, args->view->valueField);
+        }
+    }else{
+        RedisGears_BWWriteLong(bw, 0); // view does not exist
+    }
 }
 
 static void* KeysReader_DeserializeArgs(Gears_BufferReader* br){
+    long version = 0; // legacy args without a version
+    size_t start = br->location;
+    if(RedisGears_BRReadLong(br) == KEYS_READER_ARGS_VERSION_MARK){
+        version = RedisGears_BRReadLong(br);
+        RedisModule_Assert(version > 0 && version <= KEYS_READER_ARGS_VERSION);
+    }else{
+        br->location = start;
+    }
     char* regex = RedisGears_BRReadString(br);
     char** eventTypes = NULL;
     int* keyTypes = NULL;
@@ -650,7 +1185,18 @@ static void* KeysReader_DeserializeArgs(Gears_BufferReader* br){
     }
 
     bool readValue = RedisGears_BRReadLong(br);
-    return KeysReaderTriggerArgs_Create(regex, eventTypes, keyTypes, readValue);
+    KeysReaderTriggerArgs* args = KeysReaderTriggerArgs_Create(regex, eventTypes, keyTypes, readValue);
+
+    // legacy args has no view
+    if(version >= 1 && RedisGears_BRReadLong(br)){
+        KeysReaderViewArgs* view = RG_ALLOC(sizeof(*view));
+        view->key = RG_STRDUP(RedisGears_BRReadString(br));
+        view->type = RedisGears_BRReadLong(br);
+        view->groupField = RedisGears_BRReadLong(br) ? RG_STRDUP(RedisGears_BRReadString(br)) : NULL;
+        view->valueField = RedisGears_BRReadLong(br) ? RG_STRDUP(RedisGears_BRReadString(br)) : NULL;
+        args->view = view;
+    }
+    return args;
 }
 
 static void KeysReader_UnregisterTrigger(FlatExecutionPlan* fep, bool abortPending){
@@ -688,6 +1234,11 @@ static void KeysReader_UnregisterTrigger(FlatExecutionPlan* fep, bool abortPendi
         array_free(abortEpArray);
     }
 
+    if(rData->args->view){
+        // stop a running view build
+        KeysReader_ViewClearState(rData);
+    }
+
     KeysReaderRegisterData_Free(rData);
 }
 
@@ -740,7 +1291,7 @@ static void KeysReader_DumpRegistrationData(RedisModuleCtx* ctx, FlatExecutionPl
         RedisModule_ReplyWithNull(ctx);
     }
     RedisModule_ReplyWithStringBuffer(ctx, "args", strlen("args"));
-    RedisModule_ReplyWithArray(ctx, 6);
+    RedisModule_ReplyWithArray(ctx, rData->args->view ? 8 : 6);
     RedisModule_ReplyWithStringBuffer(ctx, "regex", strlen("regex"));
     RedisModule_ReplyWithStringBuffer(ctx, rData->args->prefix, strlen(rData->args->prefix));
     RedisModule_ReplyWithStringBuffer(ctx, "eventTypes", strlen("eventTypes"));
@@ -762,6 +1313,28 @@ static void KeysReader_DumpRegistrationData(RedisModuleCtx* ctx, FlatExecutionPl
     }else{
         RedisModule_ReplyWithNull(ctx);
     }
+    if(rData->args->view){
+        KeysReaderViewArgs* view = rData->args->view;
+        const char* type = view->type == KeysReaderViewTypeCount ? "count" : "sum";
+        RedisModule_ReplyWithStringBuffer(ctx, "view", strlen("view"));
+        RedisModule_ReplyWithArray(ctx, 8);
+        RedisModule_ReplyWithStringBuffer(ctx, "key", strlen("key"));
+        RedisModule_ReplyWithStringBuffer(ctx, view->key, strlen(view->key));
+        RedisModule_ReplyWithStringBuffer(ctx, "aggregation", strlen("aggregation"));
+        RedisModule_ReplyWithStringBuffer(ctx, type, strlen(type));
+        RedisModule_ReplyWithStringBuffer(ctx, "groupField", strlen("groupField"));
+        if(view->groupField){
+            RedisModule_ReplyWithStringBuffer(ctx, view->groupField, strlen(view->groupField));
+        }else{
+            RedisModule_ReplyWithNull(ctx);
+        }
+        RedisModule_ReplyWithStringBuffer(ctx, "valueField", strlen("valueField"));
+        if(view->valueField){
+            RedisModule_ReplyWithStringBuffer(ctx, view->valueField, strlen(view->valueField));
+        }else{
+            RedisModule_ReplyWithNull(ctx);
+        }
+    }
 }
 
 static void KeysReader_RegisterKeySpaceEvent(){
@@ -786,10 +1359,49 @@ static int KeysReader_RegisrterTrigger(FlatExecutionPlan* fep, ExecutionMode mod
     KeysReaderRegisterData* rData = KeysReaderRegisterData_Create(fep, args, mode);
 
     Gears_listAddNodeTail(keysReaderRegistration, rData);
+
+    if(rData->args->view){
+        // compute the view right away, on replica or while loading it will be
+        // computed on the first event after we become a master.
+        RedisModuleCtx* ctx = RedisModule_GetThreadSafeContext(NULL);
+        LockHandler_Acquire(ctx);
+        int flags = RedisModule_GetContextFlags(ctx);
+        if((flags & REDISMODULE_CTX_FLAGS_MASTER) && !(flags & REDISMODULE_CTX_FLAGS_LOADING)){
+            KeysReader_ViewBuildStart(ctx, rData);
+        }
+        LockHandler_Release(ctx);
+        RedisModule_FreeThreadSafeContext(ctx);
+    }
     return REDISMODULE_OK;
 }
 
+/*
+ * A flush does not fire an event per key, so the views are rebuilt from scratch.
+ */
+static void KeysReader_OnFlush(RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent, void *data){
+    if(subevent != REDISMODULE_SUBEVENT_FLUSHDB_END || !keysReaderRegistration){
+        return;
+    }
+    int flags = RedisModule_GetContextFlags(ctx);
+    bool isMaster = (flags & REDISMODULE_CTX_FLAGS_MASTER) && !(flags & REDISMODULE_CTX_FLAGS_LOADING);
+    Gears_listIter *iter = Gears_listGetIterator(keysReaderRegistration, AL_START_HEAD);
+    Gears_listNode* node = NULL;
+    while((node = Gears_listNext(iter))){
+        KeysReaderRegisterData* rData = Gears_listNodeValue(node);
+        if(!rData->args->view || rData->viewState == KeysReaderViewStateNotBuilt){
+            continue;
+        }
+        if(isMaster){
+            KeysReader_ViewBuildStart(ctx, rData);
+        }else{
+            KeysReader_ViewClearState(rData);
+        }
+    }
+    Gears_listReleaseIterator(iter);
+}
+
 int KeysReader_Initialize(RedisModuleCtx* ctx){
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_FlushDB, KeysReader_OnFlush);
 	return REDISMODULE_OK;
 }
 
@@ -800,10 +1412,49 @@ KeysReaderTriggerArgs* KeysReaderTriggerArgs_Create(const char* prefix, char** e
         .eventTypes = eventTypes,
         .keyTypes = keyTypes,
         .readValue = readValue,
+        .view = NULL,
     };
     return ret;
 }
 
+int KeysReaderTriggerArgs_SetView(KeysReaderTriggerArgs* args, const char* viewKey, const char* aggregation,
+                                  const char* groupField, const char* valueField, char** err){
+    KeysReaderViewType type;
+    if(strcasecmp(aggregation, "count") == 0){
+        type = KeysReaderViewTypeCount;
+        if(valueField){
+            *err = RG_STRDUP("count view does not take a value field");
+            return REDISMODULE_ERR;
+        }
+    }else if(strcasecmp(aggregation, "sum") == 0){
+        type = KeysReaderViewTypeSum;
+        if(!valueField){
+            *err = RG_STRDUP("sum view requires a value field");
+            return REDISMODULE_ERR;
+        }
+    }else{
+        *err = RG_STRDUP("unknown view aggregation, only count and sum can be maintained incrementally");
+        return REDISMODULE_ERR;
+    }
+    if(args->eventTypes || args->keyTypes){
+        // the view must see every change of the keys to stay correct
+        *err = RG_STRDUP("view can not be combined with eventTypes or keyTypes");
+        return REDISMODULE_ERR;
+    }
+    KeysReaderViewArgs* view = RG_ALLOC(sizeof(*view));
+    *view = (KeysReaderViewArgs){
+        .key = RG_STRDUP(viewKey),
+        .type = type,
+        .groupField = groupField ? RG_STRDUP(groupField) : NULL,
+        .valueField = valueField ? RG_STRDUP(valueField) : NULL,
+    };
+    if(args->view){
+        KeysReaderViewArgs_Free(args->view);
+    }
+    args->view = view;
+    return REDISMODULE_OK;
+}
+
 static Reader* KeysReader_Create(void* arg){
     KeysReaderCtx* ctx = arg;
     if(!ctx){
@@ -813,6 +1464,8 @@ static Reader* KeysReader_Create(void* arg){
     *r = (Reader){
         .ctx = ctx,
         .next = KeysReader_Next,
+        .nextBatch = KeysReader_NextBatch,
+        .setLimit = KeysReaderCtx_SetLimit,
         .free = KeysReaderCtx_Free,
         .serialize = RG_KeysReaderCtxSerialize,
         .deserialize = RG_KeysReaderCtxDeserialize,
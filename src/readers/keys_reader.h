@@ -18,8 +18,27 @@ KeysReaderTriggerArgs* KeysReaderTriggerArgs_Create(const char* prefix, char** e
 
 void KeysReaderTriggerArgs_Free(KeysReaderTriggerArgs* args);
 
+/*
+ * Turn the registration into a materialized view. Instead of running the execution on each
+ * event, the registration keeps the aggregation of the matching hash keys in the viewKey hash
+ * (a field per group) and applies each event as a delta, the key old contribution is retracted
+ * and its new one is added. The view is computed with a full scan on registration.
+ * aggregation - "count" or "sum" (of the valueField), only those can be retracted in O(1)
+ * groupField - the hash field to group the keys by, NULL aggregates all the keys into the "all" field
+ * valueField - the hash field to sum, must be NULL for count
+ * Return REDISMODULE_ERR and set err if the arguments are invalid.
+ */
+int KeysReaderTriggerArgs_SetView(KeysReaderTriggerArgs* args, const char* viewKey, const char* aggregation,
+                                  const char* groupField, const char* valueField, char** err);
+
 
 KeysReaderCtx* KeysReaderCtx_Create(const char* match, bool readValue, const char* event, bool exactMatch);
+
+/*
+ * Only read keys of the given types, NULL means all types.
+ * keyTypes - array of keys types, function takes ownership on this value, the caller should not use it anymore
+ */
+void KeysReaderCtx_SetKeyTypes(KeysReaderCtx* krctx, int* keyTypes);
 void KeysReaderCtx_Free(void* ctx);
 
 #endif /* SRC_KEYS_READER_H_ */
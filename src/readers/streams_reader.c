@@ -30,6 +30,7 @@ typedef struct StreamReaderCtx{
     bool isDone;
     RedisModuleString** batchIds;
     StreamId lastReadId;
+    size_t limit; // 0 means no limit, records read from a consumer group are acked as a batch so it is ignored there
 }StreamReaderCtx;
 
 typedef struct StreamReaderTriggerArgs{
@@ -290,6 +291,7 @@ StreamReaderCtx* StreamReaderCtx_Create(const char* streamName, const char* stre
             .batchSize = 0,
             .readPenging = false,
             .lastReadId = StreamIdZero,
+            .limit = 0,
     };
     return readerCtx;
 }
@@ -310,6 +312,7 @@ StreamReaderCtx* StreamReaderCtx_CreateWithConsumerGroup(const char* streamName,
             .batchSize = batchSize,
             .readPenging = readPenging,
             .lastReadId = StreamIdZero,
+            .limit = 0,
     };
     return readerCtx;
 }
@@ -353,7 +356,11 @@ static void StreamReader_ReadRecords(RedisModuleCtx* ctx, StreamReaderCtx* reade
 
     }else{
         RedisModule_Assert(readerCtx->streamId);
-        reply = RedisModule_Call(ctx, "XREAD", "ccc", "STREAMS", readerCtx->streamKeyName, readerCtx->streamId);
+        if(readerCtx->limit > 0){
+            reply = RedisModule_Call(ctx, "XREAD", "clccc", "COUNT", readerCtx->limit, "STREAMS", readerCtx->streamKeyName, readerCtx->streamId);
+        }else{
+            reply = RedisModule_Call(ctx, "XREAD", "ccc", "STREAMS", readerCtx->streamKeyName, readerCtx->streamId);
+        }
         if(RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR){
             LockHandler_Release(ctx);
             size_t errorLen;
@@ -495,6 +502,11 @@ static void StreamReader_Free(void* ctx){
     RG_FREE(ctx);
 }
 
+static void StreamReader_SetLimit(void* ctx, size_t limit){
+    StreamReaderCtx* readerCtx = ctx;
+    readerCtx->limit = limit;
+}
+
 static Record* StreamReader_Next(ExecutionCtx* ectx, void* ctx){
     StreamReaderCtx* readerCtx = ctx;
     RedisModuleCtx* rctx = RedisGears_GetRedisModuleCtx(ectx);
@@ -979,6 +991,7 @@ static Reader* StreamReader_Create(void* arg){
     *r = (Reader){
         .ctx = readerCtx,
         .next = StreamReader_Next,
+        .setLimit = StreamReader_SetLimit,
         .free = StreamReader_Free,
         .serialize = StreamReader_CtxSerialize,
         .deserialize = StreamReader_CtxDeserialize,
@@ -1079,6 +1092,9 @@ static void StreamReader_RdbSave(RedisModuleIO *rdb){
 
         StreamReader_SerializeArgs(srctx->args, &bw);
 
+        // trailing data, open windows of the registration window steps
+        FlatExecutionPlan_SerializeWindowsState(srctx->fep, &bw);
+
         RedisModule_SaveStringBuffer(rdb, buff->buff, buff->size);
 
         RedisModule_SaveUnsigned(rdb, srctx->mode);
@@ -1113,6 +1129,15 @@ static void StreamReader_RdbLoad(RedisModuleIO *rdb, int encver){
         }
 
         void* args = StreamReader_DeserializeArgs(&reader);
+
+        // older versions do not save the windows state
+        if(reader.location < buff.size){
+            if(FlatExecutionPlan_DeserializeWindowsState(fep, &reader, &err) != REDISMODULE_OK){
+                RedisModule_Log(NULL, "warning", "Could not load windows state, the windows will start empty, error='%s'", err);
+                RG_FREE(err);
+                err = NULL;
+            }
+        }
         RedisModule_Free(data);
 
         int mode = RedisModule_LoadUnsigned(rdb);
@@ -1,5 +1,8 @@
 #include "utils/arr_rm_alloc.h"
 #include "utils/dict.h"
+#include "utils/arena.h"
+#include "utils/slab.h"
+#include "config.h"
 #include "record.h"
 
 #include "redisgears.h"
@@ -16,6 +19,7 @@ typedef struct RecordType{
     int (*serialize)(Gears_BufferWriter* bw, Record* base, char** err);
     Record* (*deserialize)(Gears_BufferReader* br);
     void (*free)(Record* base);
+    Gears_SlabPool* pool; // NULL if the records are allocated from the heap
 }RecordType;
 
 typedef struct KeysHandlerRecord{
@@ -37,6 +41,7 @@ typedef struct StringRecord{
     Record base;
     size_t len;
     char* str;
+    RedisModuleString* owner; // when set, str is borrowed from it and is not freed with the record
 }StringRecord;
 
 typedef struct ListRecord{
@@ -51,9 +56,24 @@ typedef struct KeyRecord{
     Record* record;
 }KeyRecord;
 
+/*
+ * Small hash sets (most of them are keys and stream entries with a few fields) keep their
+ * fields flat on the record, with the keys bytes inline, so creating one is a single allocation.
+ * Once a field does not fit they are moved to a dict.
+ */
+#define HASH_SET_RECORD_FLAT_FIELDS 8
+#define HASH_SET_RECORD_FLAT_KEYS_SIZE 128
+#define HASH_SET_RECORD_REMOVED_FIELD UINT8_MAX
+
 typedef struct HashSetRecord{
     Record base;
-    Gears_dict* d;
+    Gears_dict* d; // NULL while the fields are flat
+    uint8_t len; // number of flat fields
+    uint8_t used; // number of flat slots used, including removed fields
+    uint8_t keysUsed;
+    uint8_t keysOffsets[HASH_SET_RECORD_FLAT_FIELDS]; // HASH_SET_RECORD_REMOVED_FIELD on removed fields
+    Record* vals[HASH_SET_RECORD_FLAT_FIELDS];
+    char keys[HASH_SET_RECORD_FLAT_KEYS_SIZE];
 }HashSetRecord;
 
 RecordType StopRecordType;
@@ -71,15 +91,43 @@ RecordType* hashSetRecordType;
 
 static RecordType** recordsTypes;
 
+/*
+ * The arena a record was allocated from is kept in a header right before the record, so
+ * the public Record struct that plugins embed in their records keeps its size.
+ */
+typedef union RecordHeader{
+    Gears_Arena* arena; // NULL if the record was allocated from the heap or a pool
+    long double align; // keep the record aligned as malloc would
+}RecordHeader;
+
+#define RecordAllocSize(type) (sizeof(RecordHeader) + (type)->size)
+#define RecordGetHeader(r) (((RecordHeader*)(r)) - 1)
+
 Record* RG_RecordCreate(RecordType* type){
-    Record* ret = RG_ALLOC(type->size);
+    // records created while an execution is running are taken from the execution arena
+    Gears_Arena* arena = Gears_ArenaGetCurrent();
+    RecordHeader* header = arena ? Gears_ArenaAlloc(arena, RecordAllocSize(type)) : NULL;
+    if(!header){
+        header = type->pool ? Gears_SlabAlloc(type->pool) : RG_ALLOC(RecordAllocSize(type));
+        arena = NULL;
+    }
+    header->arena = arena;
+    Record* ret = (Record*)(header + 1);
     ret->type = type;
     return ret;
 }
 
+Gears_Arena* RG_RecordGetArena(Record* r){
+    return RecordGetHeader(r)->arena;
+}
+
 static void StringRecord_Free(Record* base){
     StringRecord* record = (StringRecord*)base;
-    RG_FREE(record->str);
+    if(record->owner){
+        RedisModule_FreeString(NULL, record->owner);
+    }else{
+        RG_FREE(record->str);
+    }
 }
 
 static void DoubleRecord_Free(Record* base){}
@@ -111,16 +159,16 @@ static void KeysHandlerRecord_Free(Record* base){
 
 static void HashSetRecord_Free(Record* base){
     HashSetRecord* record = (HashSetRecord*)base;
-    Gears_dictIterator *iter;
-    Gears_dictEntry *entry;
-    iter = Gears_dictGetIterator(record->d);
-    entry = NULL;
-    while((entry = Gears_dictNext(iter))){
-        Record* temp = Gears_dictGetVal(entry);
+    HashSetRecordIterator iter;
+    Record* temp;
+    RG_HashSetRecordIteratorInit(&iter, base);
+    while(RG_HashSetRecordIteratorNext(&iter, NULL, &temp)){
         RG_FreeRecord(temp);
     }
-    Gears_dictReleaseIterator(iter);
-    Gears_dictRelease(record->d);
+    RG_HashSetRecordIteratorDone(&iter);
+    if(record->d){
+        Gears_dictRelease(record->d);
+    }
 }
 
 static int StringRecord_Serialize(Gears_BufferWriter* bw, Record* base, char** err){
@@ -137,7 +185,7 @@ static int LongRecord_Serialize(Gears_BufferWriter* bw, Record* base, char** err
 
 static int DoubleRecord_Serialize(Gears_BufferWriter* bw, Record* base, char** err){
     DoubleRecord* r = (DoubleRecord*)base;
-    RedisGears_BWWriteLong(bw, (long)r->num);
+    RedisGears_BWWriteBuffer(bw, (char*)&r->num, sizeof(double));
     return REDISMODULE_OK;
 }
 
@@ -173,21 +221,19 @@ static int KeysHandlerRecord_Serialize(Gears_BufferWriter* bw, Record* base, cha
 }
 
 static int HashSetRecord_Serialize(Gears_BufferWriter* bw, Record* base, char** err){
-    HashSetRecord* record = (HashSetRecord*)base;
-    Gears_dictIterator *iter;
-    Gears_dictEntry *entry;
-    RedisGears_BWWriteLong(bw, Gears_dictSize(record->d));
-    iter = Gears_dictGetIterator(record->d);
-    entry = NULL;
-    while((entry = Gears_dictNext(iter))){
-        const char* k = Gears_dictGetKey(entry);
-        Record* temp = Gears_dictGetVal(entry);
+    HashSetRecordIterator iter;
+    const char* k;
+    Record* temp;
+    RedisGears_BWWriteLong(bw, RG_HashSetRecordLen(base));
+    RG_HashSetRecordIteratorInit(&iter, base);
+    while(RG_HashSetRecordIteratorNext(&iter, &k, &temp)){
         RedisGears_BWWriteString(bw, k);
         if(RG_SerializeRecord(bw, temp, err) != REDISMODULE_OK){
+            RG_HashSetRecordIteratorDone(&iter);
             return REDISMODULE_ERR;
         }
     }
-    Gears_dictReleaseIterator(iter);
+    RG_HashSetRecordIteratorDone(&iter);
     return REDISMODULE_OK;
 }
 
@@ -212,7 +258,12 @@ static Record* ErrorRecord_Deserialize(Gears_BufferReader* br){
 }
 
 static Record* DoubleRecord_Deserialize(Gears_BufferReader* br){
-    return RG_DoubleRecordCreate((double)RedisGears_BRReadLong(br));
+    size_t len;
+    const char* buff = RedisGears_BRReadBuffer(br, &len);
+    RedisModule_Assert(len == sizeof(double));
+    double num;
+    memcpy(&num, buff, sizeof(double));
+    return RG_DoubleRecordCreate(num);
 }
 
 static Record* ListRecord_Deserialize(Gears_BufferReader* br){
@@ -295,20 +346,17 @@ static int KeysHandlerRecord_SendReply(Record* r, RedisModuleCtx* rctx){
 }
 
 static int HashSetRecord_SendReply(Record* base, RedisModuleCtx* rctx){
-    HashSetRecord* record = (HashSetRecord*)base;
-    Gears_dictIterator *iter;
-    Gears_dictEntry *entry;
-    RedisModule_ReplyWithArray(rctx, Gears_dictSize(record->d));
-    iter = Gears_dictGetIterator(record->d);
-    entry = NULL;
-    while((entry = Gears_dictNext(iter))){
-        const char* k = Gears_dictGetKey(entry);
-        Record* temp = Gears_dictGetVal(entry);
+    HashSetRecordIterator iter;
+    const char* k;
+    Record* temp;
+    RedisModule_ReplyWithArray(rctx, RG_HashSetRecordLen(base));
+    RG_HashSetRecordIteratorInit(&iter, base);
+    while(RG_HashSetRecordIteratorNext(&iter, &k, &temp)){
         RedisModule_ReplyWithArray(rctx, 2);
         RedisModule_ReplyWithCString(rctx, k);
         RG_RecordSendReply(temp, rctx);
     }
-    Gears_dictReleaseIterator(iter);
+    RG_HashSetRecordIteratorDone(&iter);
     return REDISMODULE_OK;
 }
 
@@ -324,6 +372,319 @@ Record* RG_DeserializeRecord(Gears_BufferReader* br){
     return type->deserialize(br);
 }
 
+/*
+ * Compact encoding, each record starts with a tag (a single byte varint). Numbers and lengths
+ * are varints, strings are not NUL terminated and a hash set field name is written once per
+ * batch, later occurrences refer to it by its index. Records of other types are written with
+ * their type name, once per batch like the fields names, and their own serialize callback.
+ */
+typedef enum RecordEncodingTag{
+    RecordEncodingTag_Null = 0,
+    RecordEncodingTag_String,
+    RecordEncodingTag_Error,
+    RecordEncodingTag_Long,
+    RecordEncodingTag_Double,
+    RecordEncodingTag_List,
+    RecordEncodingTag_Key,
+    RecordEncodingTag_HashSet,
+    RecordEncodingTag_Other,
+}RecordEncodingTag;
+
+#define ZIGZAG_ENCODE(n) ((((unsigned long long)(n)) << 1) ^ (unsigned long long)((n) >> 63))
+#define ZIGZAG_DECODE(n) ((long)((n) >> 1) ^ -(long)((n) & 1))
+
+void RG_RecordsEncoderInit(RecordsEncoder* enc){
+    enc->fields = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
+    enc->types = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
+}
+
+void RG_RecordsEncoderFree(RecordsEncoder* enc){
+    Gears_dictRelease(enc->fields);
+    Gears_dictRelease(enc->types);
+}
+
+void RG_RecordsEncoderReset(RecordsEncoder* enc){
+    Gears_dictEmpty(enc->fields, NULL);
+    Gears_dictEmpty(enc->types, NULL);
+}
+
+void RG_RecordsEncoderStart(RecordsEncoder* enc, Gears_BufferWriter* bw){
+    RG_RecordsEncoderReset(enc);
+    Gears_BufferWriterWriteVarint(bw, RECORDS_ENCODING_VERSION);
+}
+
+/*
+ * Write a name that is sent once per batch, a field name or an extension record type name.
+ */
+static void RG_RecordEncodeName(Gears_dict* names, Gears_BufferWriter* bw, const char* name){
+    Gears_dictEntry* existing = NULL;
+    Gears_dictEntry* entry = Gears_dictAddRaw(names, (void*)name, &existing);
+    if(!entry){
+        Gears_BufferWriterWriteVarint(bw, Gears_dictGetUnsignedIntegerVal(existing) + 1);
+        return;
+    }
+    Gears_dictSetUnsignedIntegerVal(entry, Gears_dictSize(names) - 1);
+    Gears_BufferWriterWriteVarint(bw, 0); // a new name, it follows
+    Gears_BufferWriterWriteVarintBuff(bw, name, strlen(name));
+}
+
+static int RG_RecordEncodeInternal(RecordsEncoder* enc, Gears_BufferWriter* bw, Record* r, char** err){
+    if(!r){
+        Gears_BufferWriterWriteVarint(bw, RecordEncodingTag_Null);
+        return REDISMODULE_OK;
+    }
+    RecordType* type = r->type;
+    if(type == stringRecordType || type == errorRecordType){
+        StringRecord* sr = (StringRecord*)r;
+        Gears_BufferWriterWriteVarint(bw, type == stringRecordType ? RecordEncodingTag_String : RecordEncodingTag_Error);
+        Gears_BufferWriterWriteVarintBuff(bw, sr->str, sr->len);
+    }else if(type == longRecordType){
+        Gears_BufferWriterWriteVarint(bw, RecordEncodingTag_Long);
+        Gears_BufferWriterWriteVarint(bw, ZIGZAG_ENCODE(((LongRecord*)r)->num));
+    }else if(type == doubleRecordType){
+        Gears_BufferWriterWriteVarint(bw, RecordEncodingTag_Double);
+        Gears_BufferAdd(bw->buff, (char*)&((DoubleRecord*)r)->num, sizeof(double));
+    }else if(type == listRecordType){
+        ListRecord* lr = (ListRecord*)r;
+        size_t len = array_len(lr->records);
+        Gears_BufferWriterWriteVarint(bw, RecordEncodingTag_List);
+        Gears_BufferWriterWriteVarint(bw, len);
+        for(size_t i = 0 ; i < len ; ++i){
+            if(RG_RecordEncodeInternal(enc, bw, lr->records[i], err) != REDISMODULE_OK){
+                return REDISMODULE_ERR;
+            }
+        }
+    }else if(type == keyRecordType){
+        KeyRecord* kr = (KeyRecord*)r;
+        Gears_BufferWriterWriteVarint(bw, RecordEncodingTag_Key);
+        Gears_BufferWriterWriteVarintBuff(bw, kr->key, kr->len);
+        return RG_RecordEncodeInternal(enc, bw, kr->record, err);
+    }else if(type == hashSetRecordType){
+        HashSetRecordIterator iter;
+        const char* field;
+        Record* val;
+        Gears_BufferWriterWriteVarint(bw, RecordEncodingTag_HashSet);
+        Gears_BufferWriterWriteVarint(bw, RG_HashSetRecordLen(r));
+        RG_HashSetRecordIteratorInit(&iter, r);
+        while(RG_HashSetRecordIteratorNext(&iter, &field, &val)){
+            RG_RecordEncodeName(enc->fields, bw, field);
+            if(RG_RecordEncodeInternal(enc, bw, val, err) != REDISMODULE_OK){
+                RG_HashSetRecordIteratorDone(&iter);
+                return REDISMODULE_ERR;
+            }
+        }
+        RG_HashSetRecordIteratorDone(&iter);
+    }else{
+        Gears_BufferWriterWriteVarint(bw, RecordEncodingTag_Other);
+        RG_RecordEncodeName(enc->types, bw, type->name);
+        return type->serialize(bw, r, err);
+    }
+    return REDISMODULE_OK;
+}
+
+/*
+ * Forget the names added after the first 'len' ones.
+ */
+static void RG_RecordsEncoderTrimNames(Gears_dict* names, size_t len){
+    if(Gears_dictSize(names) <= len){
+        return;
+    }
+    Gears_dictIterator* iter = Gears_dictGetSafeIterator(names);
+    Gears_dictEntry* entry;
+    while((entry = Gears_dictNext(iter))){
+        if(Gears_dictGetUnsignedIntegerVal(entry) >= len){
+            Gears_dictDelete(names, Gears_dictGetKey(entry));
+        }
+    }
+    Gears_dictReleaseIterator(iter);
+}
+
+int RG_RecordEncode(RecordsEncoder* enc, Gears_BufferWriter* bw, Record* r, char** err){
+    size_t fieldsLen = Gears_dictSize(enc->fields);
+    size_t typesLen = Gears_dictSize(enc->types);
+    if(RG_RecordEncodeInternal(enc, bw, r, err) == REDISMODULE_OK){
+        return REDISMODULE_OK;
+    }
+    // the record will not be sent, forget the names it added so the decoder will stay in sync
+    RG_RecordsEncoderTrimNames(enc->fields, fieldsLen);
+    RG_RecordsEncoderTrimNames(enc->types, typesLen);
+    return REDISMODULE_ERR;
+}
+
+void RG_RecordsDecoderInit(RecordsDecoder* dec){
+    dec->fields = array_new(char*, 10);
+    dec->types = array_new(RecordType*, 10);
+}
+
+void RG_RecordsDecoderReset(RecordsDecoder* dec){
+    for(size_t i = 0 ; i < array_len(dec->fields) ; ++i){
+        RG_FREE(dec->fields[i]);
+    }
+    dec->fields = array_trimm_len(dec->fields, 0);
+    dec->types = array_trimm_len(dec->types, 0);
+}
+
+void RG_RecordsDecoderFree(RecordsDecoder* dec){
+    RG_RecordsDecoderReset(dec);
+    array_free(dec->fields);
+    array_free(dec->types);
+}
+
+int RG_RecordsDecoderStart(RecordsDecoder* dec, Gears_BufferReader* br){
+    RG_RecordsDecoderReset(dec);
+    unsigned long long version;
+    if(Gears_BufferReaderReadVarint(br, &version) != REDISMODULE_OK || version != RECORDS_ENCODING_VERSION){
+        return REDISMODULE_ERR;
+    }
+    return REDISMODULE_OK;
+}
+
+static unsigned long long RG_RecordDecodeVarint(Gears_BufferReader* br){
+    unsigned long long val;
+    int res = Gears_BufferReaderReadVarint(br, &val);
+    RedisModule_Assert(res == REDISMODULE_OK);
+    return val;
+}
+
+/*
+ * Return a copy of the encoded bytes, NUL terminated.
+ */
+static char* RG_RecordDecodeString(Gears_BufferReader* br, size_t* len){
+    const char* data = Gears_BufferReaderReadVarintBuff(br, len);
+    RedisModule_Assert(data != BUFF_READ_ERROR);
+    char* ret = RG_ALLOC(*len + 1);
+    memcpy(ret, data, *len);
+    ret[*len] = '\0';
+    return ret;
+}
+
+static const char* RG_RecordDecodeField(RecordsDecoder* dec, Gears_BufferReader* br){
+    unsigned long long index = RG_RecordDecodeVarint(br);
+    if(index == 0){
+        size_t len;
+        dec->fields = array_append(dec->fields, RG_RecordDecodeString(br, &len));
+        return dec->fields[array_len(dec->fields) - 1];
+    }
+    RedisModule_Assert(index <= array_len(dec->fields));
+    return dec->fields[index - 1];
+}
+
+static RecordType* RG_RecordDecodeType(RecordsDecoder* dec, Gears_BufferReader* br){
+    unsigned long long index = RG_RecordDecodeVarint(br);
+    if(index == 0){
+        size_t len;
+        char* name = RG_RecordDecodeString(br, &len);
+        RecordType* type = NULL;
+        for(size_t i = 0 ; i < array_len(recordsTypes) ; ++i){
+            if(strcmp(recordsTypes[i]->name, name) == 0){
+                type = recordsTypes[i];
+                break;
+            }
+        }
+        RG_FREE(name);
+        RedisModule_Assert(type && "unknown record type");
+        dec->types = array_append(dec->types, type);
+        return type;
+    }
+    RedisModule_Assert(index <= array_len(dec->types));
+    return dec->types[index - 1];
+}
+
+Record* RG_RecordDecode(RecordsDecoder* dec, Gears_BufferReader* br){
+    size_t len;
+    char* str;
+    Record* r;
+    switch(RG_RecordDecodeVarint(br)){
+    case RecordEncodingTag_Null:
+        return NULL;
+    case RecordEncodingTag_String:
+        str = RG_RecordDecodeString(br, &len);
+        return RG_StringRecordCreate(str, len);
+    case RecordEncodingTag_Error:
+        str = RG_RecordDecodeString(br, &len);
+        return RG_ErrorRecordCreate(str, len);
+    case RecordEncodingTag_Long:
+        return RG_LongRecordCreate(ZIGZAG_DECODE(RG_RecordDecodeVarint(br)));
+    case RecordEncodingTag_Double:{
+        double num;
+        RedisModule_Assert(br->location + sizeof(double) <= br->buff->size);
+        memcpy(&num, br->buff->buff + br->location, sizeof(double));
+        br->location += sizeof(double);
+        return RG_DoubleRecordCreate(num);
+    }
+    case RecordEncodingTag_List:
+        len = RG_RecordDecodeVarint(br);
+        r = RG_ListRecordCreate(len);
+        for(size_t i = 0 ; i < len ; ++i){
+            RG_ListRecordAdd(r, RG_RecordDecode(dec, br));
+        }
+        return r;
+    case RecordEncodingTag_Key:
+        r = RG_KeyRecordCreate();
+        str = RG_RecordDecodeString(br, &len);
+        RG_KeyRecordSetKey(r, str, len);
+        RG_KeyRecordSetVal(r, RG_RecordDecode(dec, br));
+        return r;
+    case RecordEncodingTag_HashSet:
+        len = RG_RecordDecodeVarint(br);
+        r = RG_HashSetRecordCreate();
+        for(size_t i = 0 ; i < len ; ++i){
+            const char* field = RG_RecordDecodeField(dec, br);
+            RG_HashSetRecordSet(r, (char*)field, RG_RecordDecode(dec, br));
+        }
+        return r;
+    case RecordEncodingTag_Other:
+        return RG_RecordDecodeType(dec, br)->deserialize(br);
+    default:
+        RedisModule_Assert(false && "unknown record encoding tag");
+        return NULL;
+    }
+}
+
+/*
+ * Records of types we do not know the internals of are estimated
+ * as their struct size plus this amount.
+ */
+#define RECORD_OPAQUE_PAYLOAD_ESTIMATE 64
+
+size_t RG_RecordEstimateMemory(Record* r){
+    RecordType* type = r->type;
+    size_t ret = type->size;
+    if(type == stringRecordType || type == errorRecordType){
+        ret += ((StringRecord*)r)->len;
+    }else if(type == listRecordType){
+        ListRecord* lr = (ListRecord*)r;
+        ret += array_len(lr->records) * sizeof(Record*);
+        for(size_t i = 0 ; i < array_len(lr->records) ; ++i){
+            ret += RG_RecordEstimateMemory(lr->records[i]);
+        }
+    }else if(type == keyRecordType){
+        KeyRecord* kr = (KeyRecord*)r;
+        ret += kr->len;
+        if(kr->record){
+            ret += RG_RecordEstimateMemory(kr->record);
+        }
+    }else if(type == hashSetRecordType){
+        HashSetRecord* hr = (HashSetRecord*)r;
+        HashSetRecordIterator iter;
+        const char* k;
+        Record* temp;
+        RG_HashSetRecordIteratorInit(&iter, r);
+        while(RG_HashSetRecordIteratorNext(&iter, &k, &temp)){
+            if(hr->d){
+                ret += sizeof(Gears_dictEntry) + strlen(k);
+            }
+            if(temp){
+                ret += RG_RecordEstimateMemory(temp);
+            }
+        }
+        RG_HashSetRecordIteratorDone(&iter);
+    }else if(type != longRecordType && type != doubleRecordType){
+        ret += RECORD_OPAQUE_PAYLOAD_ESTIMATE;
+    }
+    return ret;
+}
+
 int RG_RecordSendReply(Record* record, RedisModuleCtx* rctx){
     if(!record){
         RedisModule_ReplyWithNull(rctx);
@@ -349,12 +710,30 @@ RecordType* RG_RecordTypeCreate(const char* name, size_t size,
             .serialize = serialize,
             .deserialize = deserialize,
             .free = free,
+            .pool = GearsConfig_RecordsPool() ? Gears_SlabPoolCreate(sizeof(RecordHeader) + size) : NULL,
     };
     recordsTypes = array_append(recordsTypes, ret);
     ret->id = array_len(recordsTypes) - 1;
     return ret;
 }
 
+void Record_AddInfo(RedisModuleInfoCtx *ctx){
+    RedisModule_InfoAddSection(ctx, "records_pool");
+    for(size_t i = 0 ; i < array_len(recordsTypes) ; ++i){
+        RecordType* type = recordsTypes[i];
+        if(!type->pool){
+            continue;
+        }
+        Gears_SlabPoolStats stats;
+        Gears_SlabPoolGetStats(type->pool, &stats);
+        RedisModule_InfoBeginDictField(ctx, type->name);
+        RedisModule_InfoAddFieldULongLong(ctx, "hits", stats.hits);
+        RedisModule_InfoAddFieldULongLong(ctx, "misses", stats.misses);
+        RedisModule_InfoAddFieldULongLong(ctx, "slabs", stats.slabs);
+        RedisModule_InfoEndDictField(ctx);
+    }
+}
+
 void Record_Initialize(){
     recordsTypes = array_new(RecordType*, 10);
     listRecordType = RG_RecordTypeCreate("ListRecord", sizeof(ListRecord),
@@ -411,7 +790,17 @@ void RG_FreeRecord(Record* record){
         return;
     }
     record->type->free(record);
-    RG_FREE(record);
+    RecordHeader* header = RecordGetHeader(record);
+    if(!header->arena){
+        if(record->type->pool){
+            Gears_SlabRelease(record->type->pool, header);
+        }else{
+            RG_FREE(header);
+        }
+    }else if(header->arena == Gears_ArenaGetCurrent()){
+        Gears_ArenaRelease(header->arena, header, RecordAllocSize(record->type));
+    }
+    // otherwise we are not on the execution thread, the memory is released with the arena
 }
 
 RecordType* RG_RecordGetType(Record* r){
@@ -485,6 +874,14 @@ Record* RG_StringRecordCreate(char* val, size_t len){
     StringRecord* ret = (StringRecord*)RG_RecordCreate(stringRecordType);
     ret->str = val;
     ret->len = len;
+    ret->owner = NULL;
+    return &ret->base;
+}
+
+Record* RG_StringRecordCreateBorrowed(RedisModuleString* str){
+    StringRecord* ret = (StringRecord*)RG_RecordCreate(stringRecordType);
+    ret->str = (char*)RedisModule_StringPtrLen(str, &ret->len);
+    ret->owner = str;
     return &ret->base;
 }
 
@@ -500,6 +897,11 @@ char* RG_StringRecordGet(Record* base, size_t* len){
 void RG_StringRecordSet(Record* base, char* val, size_t len){
     RedisModule_Assert(base->type == stringRecordType || base->type == errorRecordType);
     StringRecord* r = (StringRecord*)base;
+    if(r->owner){
+        // the borrowed string was never owned by the caller, so it is released here
+        RedisModule_FreeString(NULL, r->owner);
+        r->owner = NULL;
+    }
     r->str = val;
     r->len = len;
 }
@@ -540,17 +942,82 @@ void RG_LongRecordSet(Record* base, long val){
 
 Record* RG_HashSetRecordCreate(){
     HashSetRecord* ret = (HashSetRecord*)RG_RecordCreate(hashSetRecordType);
-    ret->d = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
+    ret->d = NULL;
+    ret->len = 0;
+    ret->used = 0;
+    ret->keysUsed = 0;
     return &ret->base;
 }
 
+/*
+ * Return the flat slot of the key or -1 if it is not on the record.
+ */
+static int HashSetRecord_FlatFind(HashSetRecord* r, const char* key){
+    for(int i = 0 ; i < r->used ; ++i){
+        uint8_t offset = r->keysOffsets[i];
+        if(offset != HASH_SET_RECORD_REMOVED_FIELD && strcmp(r->keys + offset, key) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Drop the removed slots, the keys bytes are not moved so keys given out stay valid.
+ */
+static void HashSetRecord_FlatCompact(HashSetRecord* r){
+    uint8_t used = 0;
+    for(uint8_t i = 0 ; i < r->used ; ++i){
+        if(r->keysOffsets[i] == HASH_SET_RECORD_REMOVED_FIELD){
+            continue;
+        }
+        r->keysOffsets[used] = r->keysOffsets[i];
+        r->vals[used++] = r->vals[i];
+    }
+    r->used = used;
+}
+
+static void HashSetRecord_MoveToDict(HashSetRecord* r){
+    r->d = Gears_dictCreate(&Gears_dictTypeHeapStrings, NULL);
+    for(uint8_t i = 0 ; i < r->used ; ++i){
+        if(r->keysOffsets[i] != HASH_SET_RECORD_REMOVED_FIELD){
+            Gears_dictAdd(r->d, r->keys + r->keysOffsets[i], r->vals[i]);
+        }
+    }
+    r->len = 0;
+    r->used = 0;
+    r->keysUsed = 0;
+}
+
 int RG_HashSetRecordSet(Record* base, char* key, Record* val){
     RedisModule_Assert(base->type == hashSetRecordType);
     HashSetRecord* r = (HashSetRecord*)base;
-    Record* oldVal = RG_HashSetRecordGet(base, key);
-    if(oldVal){
-        RG_FreeRecord(oldVal);
-        Gears_dictDelete(r->d, key);
+    if(!r->d){
+        int slot = HashSetRecord_FlatFind(r, key);
+        if(slot >= 0){
+            RG_FreeRecord(r->vals[slot]);
+            r->vals[slot] = val;
+            return 1;
+        }
+        size_t keyLen = strlen(key) + 1;
+        if(r->used == HASH_SET_RECORD_FLAT_FIELDS){
+            HashSetRecord_FlatCompact(r);
+        }
+        if(r->used < HASH_SET_RECORD_FLAT_FIELDS && keyLen <= HASH_SET_RECORD_FLAT_KEYS_SIZE - r->keysUsed){
+            memcpy(r->keys + r->keysUsed, key, keyLen);
+            r->keysOffsets[r->used] = r->keysUsed;
+            r->vals[r->used++] = val;
+            r->keysUsed += keyLen;
+            ++r->len;
+            return 1;
+        }
+        HashSetRecord_MoveToDict(r);
+    }
+    Gears_dictEntry *entry = Gears_dictFind(r->d, key);
+    if(entry){
+        RG_FreeRecord(Gears_dictGetVal(entry));
+        Gears_dictSetVal(r->d, entry, val);
+        return 1;
     }
     return Gears_dictAdd(r->d, key, val) == DICT_OK;
 }
@@ -558,6 +1025,10 @@ int RG_HashSetRecordSet(Record* base, char* key, Record* val){
 Record* RG_HashSetRecordGet(Record* base, char* key){
     RedisModule_Assert(base->type == hashSetRecordType);
     HashSetRecord* r = (HashSetRecord*)base;
+    if(!r->d){
+        int slot = HashSetRecord_FlatFind(r, key);
+        return slot >= 0 ? r->vals[slot] : NULL;
+    }
     Gears_dictEntry *entry = Gears_dictFind(r->d, key);
     if(!entry){
         return 0;
@@ -565,20 +1036,94 @@ Record* RG_HashSetRecordGet(Record* base, char* key){
     return Gears_dictGetVal(entry);
 }
 
-char** RG_HashSetRecordGetAllKeys(Record* base){
+Record* RG_HashSetRecordTake(Record* base, char* key){
     RedisModule_Assert(base->type == hashSetRecordType);
     HashSetRecord* r = (HashSetRecord*)base;
-    Gears_dictIterator *iter = Gears_dictGetIterator(r->d);
-    Gears_dictEntry *entry = NULL;
-    char** ret = array_new(char*, Gears_dictSize(r->d));
-    while((entry = Gears_dictNext(iter))){
-        char* key = Gears_dictGetKey(entry);
-        ret = array_append(ret, key);
+    if(!r->d){
+        int slot = HashSetRecord_FlatFind(r, key);
+        if(slot < 0){
+            return NULL;
+        }
+        // the slot is only marked, so a running iterator is not affected
+        r->keysOffsets[slot] = HASH_SET_RECORD_REMOVED_FIELD;
+        --r->len;
+        return r->vals[slot];
     }
-    Gears_dictReleaseIterator(iter);
+    Record* val = RG_HashSetRecordGet(base, key);
+    if(val){
+        Gears_dictDelete(r->d, key);
+    }
+    return val;
+}
+
+size_t RG_HashSetRecordLen(Record* base){
+    RedisModule_Assert(base->type == hashSetRecordType);
+    HashSetRecord* r = (HashSetRecord*)base;
+    return r->d ? Gears_dictSize(r->d) : r->len;
+}
+
+char** RG_HashSetRecordGetAllKeys(Record* base){
+    RedisModule_Assert(base->type == hashSetRecordType);
+    HashSetRecordIterator iter;
+    const char* key;
+    char** ret = array_new(char*, RG_HashSetRecordLen(base));
+    RG_HashSetRecordIteratorInit(&iter, base);
+    while(RG_HashSetRecordIteratorNext(&iter, &key, NULL)){
+        ret = array_append(ret, (char*)key);
+    }
+    RG_HashSetRecordIteratorDone(&iter);
     return ret;
 }
 
+void RG_HashSetRecordIteratorInit(HashSetRecordIterator* iter, Record* base){
+    RedisModule_Assert(base->type == hashSetRecordType);
+    HashSetRecord* r = (HashSetRecord*)base;
+    iter->record = base;
+    iter->index = 0;
+    if(r->d){
+        // a safe iterator so the current field can be taken
+        Gears_dictInitSafeIterator(&iter->dictIter, r->d);
+    }
+}
+
+bool RG_HashSetRecordIteratorNext(HashSetRecordIterator* iter, const char** key, Record** val){
+    HashSetRecord* r = (HashSetRecord*)iter->record;
+    if(r->d){
+        Gears_dictEntry* entry = Gears_dictNext(&iter->dictIter);
+        if(!entry){
+            return false;
+        }
+        if(key){
+            *key = Gears_dictGetKey(entry);
+        }
+        if(val){
+            *val = Gears_dictGetVal(entry);
+        }
+        return true;
+    }
+    while(iter->index < r->used){
+        size_t i = iter->index++;
+        if(r->keysOffsets[i] == HASH_SET_RECORD_REMOVED_FIELD){
+            continue;
+        }
+        if(key){
+            *key = r->keys + r->keysOffsets[i];
+        }
+        if(val){
+            *val = r->vals[i];
+        }
+        return true;
+    }
+    return false;
+}
+
+void RG_HashSetRecordIteratorDone(HashSetRecordIterator* iter){
+    HashSetRecord* r = (HashSetRecord*)iter->record;
+    if(r->d){
+        Gears_dictResetIterator(&iter->dictIter);
+    }
+}
+
 Record* RG_KeyHandlerRecordCreate(RedisModuleKey* handler){
     KeysHandlerRecord* ret = (KeysHandlerRecord*)RG_RecordCreate(keysHandlerRecordType);
     ret->keyHandler = handler;
@@ -595,5 +1140,6 @@ Record* RG_ErrorRecordCreate(char* val, size_t len){
     StringRecord* ret = (StringRecord*)RG_RecordCreate(errorRecordType);
     ret->str = val;
     ret->len = len;
+    ret->owner = NULL;
     return &ret->base;
 }
@@ -10,12 +10,19 @@
 
 #include "redisgears.h"
 #include "utils/buffer.h"
+#include "utils/dict.h"
+#include <stdbool.h>
 #ifdef WITHPYTHON
 #include <Python.h>
 #endif
 
 extern Record StopRecord;
 
+/*
+ * Records taken from an execution arena only go back to its free lists when they are freed on
+ * the thread the arena is current on. Records freed on any other thread (e.g. results freed by
+ * the main thread) are reclaimed when the execution, and its arena, is freed.
+ */
 void RG_FreeRecord(Record* record);
 RecordType* RG_RecordGetType(Record* r);
 
@@ -35,6 +42,13 @@ Record* RG_ListRecordPop(Record* r);
 
 /** string record api **/
 Record* RG_StringRecordCreate(char* val, size_t len);
+/*
+ * Create a string record that points to the given string instead of copying it, the record
+ * takes the given reference. The string must not be shared with Redis (i.e. it was created by
+ * the caller) as it might be freed on another thread, and it must not be changed in place
+ * through RG_StringRecordGet, setting a new value releases it.
+ */
+Record* RG_StringRecordCreateBorrowed(RedisModuleString* str);
 char* RG_StringRecordGet(Record* r, size_t* len);
 void RG_StringRecordSet(Record* r, char* val, size_t len);
 
@@ -52,7 +66,27 @@ void RG_LongRecordSet(Record* r, long val);
 Record* RG_HashSetRecordCreate();
 int RG_HashSetRecordSet(Record* r, char* key, Record* val);
 Record* RG_HashSetRecordGet(Record* r, char* key);
+/* Remove the key from the set without freeing its value, the value is returned to the caller */
+Record* RG_HashSetRecordTake(Record* r, char* key);
+/* The returned keys are valid as long as the record is not changed (except for taking those keys) */
 char** RG_HashSetRecordGetAllKeys(Record* r);
+size_t RG_HashSetRecordLen(Record* r);
+
+/*
+ * Iterate the fields of a hash set record without allocating, the iterator is usually kept on the stack.
+ * While iterating, the current field can be taken (RG_HashSetRecordTake) and values can be replaced,
+ * but no fields can be added. RG_HashSetRecordIteratorDone must be called when done.
+ */
+typedef struct HashSetRecordIterator{
+    Record* record;
+    size_t index;
+    Gears_dictIterator dictIter;
+}HashSetRecordIterator;
+
+void RG_HashSetRecordIteratorInit(HashSetRecordIterator* iter, Record* r);
+/* Return false when there are no more fields, key and val are optional */
+bool RG_HashSetRecordIteratorNext(HashSetRecordIterator* iter, const char** key, Record** val);
+void RG_HashSetRecordIteratorDone(HashSetRecordIterator* iter);
 void RG_HashSetRecordFreeKeysArray(char** keyArr);
 
 /* todo: think if we can removed this!! */
@@ -61,12 +95,58 @@ RedisModuleKey* RG_KeyHandlerRecordGet(Record* r);
 
 int RG_SerializeRecord(Gears_BufferWriter* bw, Record* r, char** err);
 Record* RG_DeserializeRecord(Gears_BufferReader* br);
+
+/*
+ * Compact records encoding, used for the records sent between the shards and for the spill files.
+ * Records are encoded in batches, a hash set field name is written only the first time it
+ * appears in the batch (and so is the type name of records of extension types) so the encoder
+ * and the decoder must see the same records in the same order.
+ * A batch written with RG_RecordsEncoderStart starts with the encoding version.
+ */
+#define RECORDS_ENCODING_VERSION 2
+
+typedef struct RecordsEncoder{
+    Gears_dict* fields; // fields names written on the current batch -> their index
+    Gears_dict* types; // extension record types names written on the current batch -> their index
+}RecordsEncoder;
+
+void RG_RecordsEncoderInit(RecordsEncoder* enc);
+void RG_RecordsEncoderFree(RecordsEncoder* enc);
+/* Start a new batch without writing the version */
+void RG_RecordsEncoderReset(RecordsEncoder* enc);
+void RG_RecordsEncoderStart(RecordsEncoder* enc, Gears_BufferWriter* bw);
+/* On failure the encoder state is restored, the caller should drop what was written for the record */
+int RG_RecordEncode(RecordsEncoder* enc, Gears_BufferWriter* bw, Record* r, char** err);
+
+typedef struct RecordsDecoder{
+    char** fields; // fields names read on the current batch, by their index
+    RecordType** types; // extension record types read on the current batch, by their index
+}RecordsDecoder;
+
+void RG_RecordsDecoderInit(RecordsDecoder* dec);
+void RG_RecordsDecoderFree(RecordsDecoder* dec);
+void RG_RecordsDecoderReset(RecordsDecoder* dec);
+/* Return REDISMODULE_ERR if the batch was encoded with an unsupported version */
+int RG_RecordsDecoderStart(RecordsDecoder* dec, Gears_BufferReader* br);
+Record* RG_RecordDecode(RecordsDecoder* dec, Gears_BufferReader* br);
 int RG_RecordSendReply(Record* record, RedisModuleCtx* rctx);
 
+/* Rough estimation of the memory used by the record, including nested records */
+size_t RG_RecordEstimateMemory(Record* r);
+
 Record* RG_ErrorRecordCreate(char* val, size_t len);
 
 void Record_Initialize();
+
+/*
+ * Add the records pools hits and misses to the INFO command output.
+ */
+void Record_AddInfo(RedisModuleInfoCtx *ctx);
 Record* RG_RecordCreate(RecordType* type);
+/*
+ * Return the execution arena the record was allocated from, NULL if it was allocated from the heap.
+ */
+struct Gears_Arena* RG_RecordGetArena(Record* r);
 RecordType* RG_RecordTypeCreate(const char* name, size_t size,
                                 RecordSendReply,
                                 RecordSerialize,
@@ -12,7 +12,7 @@
 #include "redismodule.h"
 #include "utils/arr_rm_alloc.h"
 
-#define REDISGEARS_LLAPI_VERSION 1
+#define REDISGEARS_LLAPI_VERSION 2
 
 #define MODULE_API_FUNC(x) (*x)
 
@@ -80,6 +80,21 @@ typedef struct Reader{
     void (*reset)(void* ctx, void * arg);
     void (*serialize)(void* ctx, Gears_BufferWriter* bw);
     void (*deserialize)(FlatExecutionPlan* fep, void* ctx, Gears_BufferReader* br);
+    /*
+     * The fields below were added in LLAPI version 2, they are only read from readers
+     * registered with RGM_RegisterReader (or RedisGears_RegisterReaderWithVersion) by
+     * a plugin built against LLAPI version 2 and above.
+     */
+    /*
+     * Optional, fill 'batch' with up to 'len' records and return the amount of records written.
+     * Returning 0 means the reader is depleted. When not set, 'next' is called repeatedly.
+     */
+    size_t (*nextBatch)(ExecutionCtx* rctx, void* ctx, Record** batch, size_t len);
+    /*
+     * Optional, called before the execution starts when only the first 'limit' records
+     * of the reader will be used. The reader may stop once it produced that many records.
+     */
+    void (*setLimit)(void* ctx, size_t limit);
 }Reader;
 
 /**
@@ -151,6 +166,13 @@ typedef struct RedisGears_ReaderCallbacks{
 
 /**
  * Operations/Steps callbacks definition
+ *
+ * When the ExecutionParallelism configuration is greater than 1, the foreach, map, flatmap,
+ * filter and extractor callbacks of the steps that follow a KeysReader (up to the first group,
+ * accumulate, collect or repartition step) might be called concurrently from several threads,
+ * each with its own copy of the argument. Such callbacks must synchronize any state they share
+ * between calls, acquire the Redis lock before touching the keyspace and never wait for other
+ * threads of the same execution while holding it (the shared reader takes it for each batch).
  */
 typedef void (*RedisGears_ForEachCallback)(ExecutionCtx* rctx, Record *data, void* arg);
 typedef Record* (*RedisGears_MapCallback)(ExecutionCtx* rctx, Record *data, void* arg);
@@ -159,6 +181,10 @@ typedef char* (*RedisGears_ExtractorCallback)(ExecutionCtx* rctx, Record *data,
 typedef Record* (*RedisGears_ReducerCallback)(ExecutionCtx* rctx, char* key, size_t keyLen, Record *records, void* arg);
 typedef Record* (*RedisGears_AccumulateCallback)(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
 typedef Record* (*RedisGears_AccumulateByKeyCallback)(ExecutionCtx* rctx, char* key, Record *accumulate, Record *r, void* arg);
+/**
+ * Return a negative number if a comes before b, a positive number if b comes before a and 0 if their order does not matter.
+ */
+typedef int (*RedisGears_CompareCallback)(ExecutionCtx* rctx, Record *a, Record *b, void* arg);
 
 /**
  * Reader ctx definition
@@ -173,6 +199,11 @@ StreamReaderCtx* MODULE_API_FUNC(RedisGears_StreamReaderCtxCreate)(const char* s
 void MODULE_API_FUNC(RedisGears_StreamReaderCtxFree)(StreamReaderCtx*);
 
 KeysReaderCtx* MODULE_API_FUNC(RedisGears_KeysReaderCtxCreate)(const char* match, bool readValue, const char* event, bool noScan);
+/*
+ * Only read keys of the given types (REDISMODULE_KEYTYPE_*), keys of other types are skipped
+ * without reading their value. The function takes ownership on keyTypes.
+ */
+void MODULE_API_FUNC(RedisGears_KeysReaderCtxSetKeyTypes)(KeysReaderCtx* readerCtx, Arr(int) keyTypes);
 void MODULE_API_FUNC(RedisGears_KeysReaderCtxFree)(KeysReaderCtx*);
 
 StreamReaderTriggerArgs* MODULE_API_FUNC(RedisGears_StreamReaderTriggerArgsCreate)(const char* prefix, size_t batchSize, size_t durationMS, OnFailedPolicy onFailedPolicy, size_t retryInterval, bool trimStream);
@@ -180,6 +211,13 @@ void MODULE_API_FUNC(RedisGears_StreamReaderTriggerArgsFree)(StreamReaderTrigger
 
 KeysReaderTriggerArgs* MODULE_API_FUNC(RedisGears_KeysReaderTriggerArgsCreate)(const char* prefix, Arr(char*) eventTypes, Arr(int) keyTypes, bool readValue);
 void MODULE_API_FUNC(RedisGears_KeysReaderTriggerArgsFree)(KeysReaderTriggerArgs* args);
+/*
+ * Make the registration maintain a materialized view of the matching hash keys in the viewKey hash
+ * instead of running its execution on each event. aggregation is "count" or "sum" (of valueField),
+ * the keys are grouped by groupField (NULL for a single group). Return REDISMODULE_ERR and set err
+ * if the arguments are invalid.
+ */
+int MODULE_API_FUNC(RedisGears_KeysReaderTriggerArgsSetView)(KeysReaderTriggerArgs* args, const char* viewKey, const char* aggregation, const char* groupField, const char* valueField, char** err);
 
 CommandReaderTriggerArgs* MODULE_API_FUNC(RedisGears_CommandReaderTriggerArgsCreate)(const char* trigger);
 void MODULE_API_FUNC(RedisGears_CommandReaderTriggerArgsFree)(CommandReaderTriggerArgs* args);
@@ -228,6 +266,7 @@ void MODULE_API_FUNC(RedisGears_ListRecordAdd)(Record* listRecord, Record* r);
 Record* MODULE_API_FUNC(RedisGears_ListRecordGet)(Record* listRecord, size_t index);
 Record* MODULE_API_FUNC(RedisGears_ListRecordPop)(Record* listRecord);
 Record* MODULE_API_FUNC(RedisGears_StringRecordCreate)(char* val, size_t len);
+Record* MODULE_API_FUNC(RedisGears_StringRecordCreateBorrowed)(RedisModuleString* str);
 char* MODULE_API_FUNC(RedisGears_StringRecordGet)(Record* r, size_t* len);
 void MODULE_API_FUNC(RedisGears_StringRecordSet)(Record* r, char* val, size_t len);
 Record* MODULE_API_FUNC(RedisGears_DoubleRecordCreate)(double val);
@@ -248,6 +287,11 @@ Arr(char*) MODULE_API_FUNC(RedisGears_HashSetRecordGetAllKeys)(Record* r);
  */
 int MODULE_API_FUNC(RedisGears_RegisterFlatExecutionPrivateDataType)(ArgType* type);
 int MODULE_API_FUNC(RedisGears_RegisterReader)(char* name, RedisGears_ReaderCallbacks* callbacks);
+/**
+ * Same as RedisGears_RegisterReader but also states the LLAPI version the reader was built
+ * against, readers registered with RedisGears_RegisterReader are considered version 1.
+ */
+int MODULE_API_FUNC(RedisGears_RegisterReaderWithVersion)(char* name, RedisGears_ReaderCallbacks* callbacks, int llapiVersion);
 int MODULE_API_FUNC(RedisGears_RegisterForEach)(char* name, RedisGears_ForEachCallback reader, ArgType* type);
 int MODULE_API_FUNC(RedisGears_RegisterMap)(char* name, RedisGears_MapCallback map, ArgType* type);
 int MODULE_API_FUNC(RedisGears_RegisterAccumulator)(char* name, RedisGears_AccumulateCallback accumulator, ArgType* type);
@@ -255,11 +299,22 @@ int MODULE_API_FUNC(RedisGears_RegisterAccumulatorByKey)(char* name, RedisGears_
 int MODULE_API_FUNC(RedisGears_RegisterFilter)(char* name, RedisGears_FilterCallback filter, ArgType* type);
 int MODULE_API_FUNC(RedisGears_RegisterGroupByExtractor)(char* name, RedisGears_ExtractorCallback extractor, ArgType* type);
 int MODULE_API_FUNC(RedisGears_RegisterReducer)(char* name, RedisGears_ReducerCallback reducer, ArgType* type);
+int MODULE_API_FUNC(RedisGears_RegisterCompare)(char* name, RedisGears_CompareCallback compare, ArgType* type);
+
+/**
+ * Register associative accumulators and reducers, i.e, callbacks that can also be applied
+ * on their own partial results (the accumulator gets a partial accumulator as the record
+ * and the reducer gets a list of partial reduce results). Groupby and accumulateby steps
+ * that use such callbacks will pre-aggregate locally before sending the records to the
+ * other shards.
+ */
+int MODULE_API_FUNC(RedisGears_RegisterAssociativeAccumulatorByKey)(char* name, RedisGears_AccumulateByKeyCallback accumulator, ArgType* type);
+int MODULE_API_FUNC(RedisGears_RegisterAssociativeReducer)(char* name, RedisGears_ReducerCallback reducer, ArgType* type);
 int MODULE_API_FUNC(RedisGears_RegisterExecutionOnStartCallback)(char* name, RedisGears_ExecutionOnStartCallback callback, ArgType* type);
 int MODULE_API_FUNC(RedisGears_RegisterExecutionOnUnpausedCallback)(char* name, RedisGears_ExecutionOnUnpausedCallback callback, ArgType* type);
 int MODULE_API_FUNC(RedisGears_RegisterFlatExecutionOnRegisteredCallback)(char* name, RedisGears_FlatExecutionOnRegisteredCallback callback, ArgType* type);
 
-#define RGM_RegisterReader(name) RedisGears_RegisterReader(#name, &name);
+#define RGM_RegisterReader(name) RedisGears_RegisterReaderWithVersion(#name, &name, REDISGEARS_LLAPI_VERSION);
 #define RGM_RegisterMap(name, type) RedisGears_RegisterMap(#name, name, type);
 #define RGM_RegisterAccumulator(name, type) RedisGears_RegisterAccumulator(#name, name, type);
 #define RGM_RegisterAccumulatorByKey(name, type) RedisGears_RegisterAccumulatorByKey(#name, name, type);
@@ -267,6 +322,9 @@ int MODULE_API_FUNC(RedisGears_RegisterFlatExecutionOnRegisteredCallback)(char*
 #define RGM_RegisterForEach(name, type) RedisGears_RegisterForEach(#name, name, type);
 #define RGM_RegisterGroupByExtractor(name, type) RedisGears_RegisterGroupByExtractor(#name, name, type);
 #define RGM_RegisterReducer(name, type) RedisGears_RegisterReducer(#name, name, type);
+#define RGM_RegisterCompare(name, type) RedisGears_RegisterCompare(#name, name, type);
+#define RGM_RegisterAssociativeAccumulatorByKey(name, type) RedisGears_RegisterAssociativeAccumulatorByKey(#name, name, type);
+#define RGM_RegisterAssociativeReducer(name, type) RedisGears_RegisterAssociativeReducer(#name, name, type);
 #define RGM_RegisterExecutionOnStartCallback(name, type) RedisGears_RegisterExecutionOnStartCallback(#name, name, type);
 #define RGM_RegisterExecutionOnUnpausedCallback(name, type) RedisGears_RegisterExecutionOnUnpausedCallback(#name, name, type);
 #define RGM_RegisterFlatExecutionOnRegisteredCallback(name, type) RedisGears_RegisterFlatExecutionOnRegisteredCallback(#name, name, type);
@@ -278,6 +336,21 @@ int MODULE_API_FUNC(RedisGears_RegisterFlatExecutionOnRegisteredCallback)(char*
 FlatExecutionPlan* MODULE_API_FUNC(RedisGears_CreateCtx)(char* readerName);
 int MODULE_API_FUNC(RedisGears_SetDesc)(FlatExecutionPlan* ctx, const char* desc);
 void MODULE_API_FUNC(RedisGears_SetMaxIdleTime)(FlatExecutionPlan* fep, long long executionMaxIdleTime);
+
+/**
+ * Set the number of finished executions that are kept for reuse by new executions of the flat execution.
+ * Registrations that are triggered at a high rate should increase it so executions will not be
+ * created and freed on each event, 0 keeps no execution. Must be set before the flat execution
+ * is registered.
+ */
+void MODULE_API_FUNC(RedisGears_SetExecutionPoolSize)(FlatExecutionPlan* fep, size_t executionPoolSize);
+
+/**
+ * Set a timeout in ms (0 means no timeout) for the executions of the flat execution. The timeout is
+ * counted from the execution creation, when reached the execution is cancelled and finishes with
+ * a 'Execution timeout reached' error.
+ */
+void MODULE_API_FUNC(RedisGears_SetExecutionTimeout)(FlatExecutionPlan* fep, long long timeout);
 #define RGM_CreateCtx(readerName) RedisGears_CreateCtx(#readerName)
 
 /**
@@ -351,6 +424,46 @@ int MODULE_API_FUNC(RedisGears_FlatMap)(FlatExecutionPlan* ctx, char* name, void
 int MODULE_API_FUNC(RedisGears_Limit)(FlatExecutionPlan* ctx, size_t offset, size_t len);
 #define RGM_Limit(ctx, offset, len) RedisGears_Limit(ctx, offset, len)
 
+/**
+ * Sort the records of each shard by the compare callback order. A following collect
+ * merges the sorted records of all the shards, keeping the order.
+ */
+int MODULE_API_FUNC(RedisGears_Sort)(FlatExecutionPlan* ctx, char* compareName, void* compareArg);
+#define RGM_Sort(ctx, compare, compareArg) RedisGears_Sort(ctx, #compare, compareArg)
+
+/**
+ * Like sort but only the first k records of each shard are kept, a following
+ * collect and limit give the first k records of the entire cluster.
+ * k must be positive, 0 is returned and no step is added otherwise.
+ */
+int MODULE_API_FUNC(RedisGears_TopK)(FlatExecutionPlan* ctx, size_t k, char* compareName, void* compareArg);
+#define RGM_TopK(ctx, k, compare, compareArg) RedisGears_TopK(ctx, k, #compare, compareArg)
+
+/**
+ * Inner join the records with the records of the keys that match buildPattern (read with the KeysReader).
+ * Both sides are repartitioned by the key their extractor returns and each shard joins its part with a
+ * hash table of the build side. When broadcast is set the build side (which should be small) is sent to
+ * all the shards instead and the records are joined where they are. buildMapper is optional and is
+ * applied on the build side records before the extractor. Each result is a hash set record with
+ * the 'key', 'left' (the record) and 'right' (the build side record) fields.
+ */
+int MODULE_API_FUNC(RedisGears_Join)(FlatExecutionPlan* ctx, const char* buildPattern, char* probeExtractorName, void* probeExtractorArg,
+                                     char* buildExtractorName, void* buildExtractorArg, char* buildMapperName, void* buildMapperArg, int broadcast);
+#define RGM_Join(ctx, buildPattern, probeExtractor, probeExtractorArg, buildExtractor, buildExtractorArg, broadcast)\
+        RedisGears_Join(ctx, buildPattern, #probeExtractor, probeExtractorArg, #buildExtractor, buildExtractorArg, NULL, NULL, broadcast)
+
+/**
+ * Accumulate the records into time windows of sizeMS milliseconds that starts every slideMS
+ * milliseconds (slideMS == sizeMS gives tumbling windows). The extractor returns the record
+ * time, a stream id or a number of milliseconds. The open windows are kept across the
+ * executions of a registration and a window is emitted, as a hash set record with the
+ * 'start', 'end' and 'value' fields, once a record with a time at or after its end arrives.
+ * Returns 0 if the window sizes are invalid.
+ */
+int MODULE_API_FUNC(RedisGears_Window)(FlatExecutionPlan* ctx, long long sizeMS, long long slideMS, char* extraxtorName, void* extractorArg, char* accumulateName, void* accumulateArg);
+#define RGM_Window(ctx, sizeMS, slideMS, extractor, extractorArg, accumulate, accumulateArg)\
+        RedisGears_Window(ctx, sizeMS, slideMS, #extractor, extractorArg, #accumulate, accumulateArg)
+
 ExecutionPlan* MODULE_API_FUNC(RedisGears_Run)(FlatExecutionPlan* ctx, ExecutionMode mode, void* arg, RedisGears_OnExecutionDoneCallback callback, void* privateData, WorkerData* worker, char** err);
 #define RGM_Run(ctx, mode, arg, callback, privateData, err) RedisGears_Run(ctx, mode, arg, callback, privateData, NULL, err)
 
@@ -401,6 +514,12 @@ void* MODULE_API_FUNC(RedisGears_GetFlatExecutionPrivateData)(ExecutionCtx* ectx
 void* MODULE_API_FUNC(RedisGears_GetPrivateData)(ExecutionCtx* ectx);
 void MODULE_API_FUNC(RedisGears_SetPrivateData)(ExecutionCtx* ctx, void* PD);
 
+/**
+ * Return true if the execution was cancelled (aborted or timed out). Readers and callbacks
+ * that might run for long should check it and stop, whatever they return is dropped anyway.
+ */
+bool MODULE_API_FUNC(RedisGears_IsCancelled)(ExecutionCtx* ectx);
+
 bool MODULE_API_FUNC(RedisGears_AddOnDoneCallback)(ExecutionPlan* ep, RedisGears_OnExecutionDoneCallback callback, void* privateData);
 
 const char* MODULE_API_FUNC(RedisGears_GetMyHashTag)();
@@ -439,6 +558,7 @@ static int RedisGears_Initialize(RedisModuleCtx* ctx){
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, BRReadBuffer);
 
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterReader);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterReaderWithVersion);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterForEach);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterAccumulator);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterAccumulatorByKey);
@@ -446,9 +566,14 @@ static int RedisGears_Initialize(RedisModuleCtx* ctx){
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterFilter);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterGroupByExtractor);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterReducer);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterCompare);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterAssociativeAccumulatorByKey);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterAssociativeReducer);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, CreateCtx);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, SetDesc);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, SetMaxIdleTime);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, SetExecutionPoolSize);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, SetExecutionTimeout);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterFlatExecutionPrivateDataType);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, SetFlatExecutionPrivateData);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, GetFlatExecutionPrivateDataFromFep);
@@ -465,16 +590,22 @@ static int RedisGears_Initialize(RedisModuleCtx* ctx){
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, Repartition);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, FlatMap);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, Limit);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, Sort);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, TopK);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, Window);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, Join);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, FreeFlatExecution);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, GetReader);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, StreamReaderCtxCreate);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, StreamReaderCtxFree);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, KeysReaderCtxCreate);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, KeysReaderCtxSetKeyTypes);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, KeysReaderCtxFree);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, StreamReaderTriggerArgsCreate);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, StreamReaderTriggerArgsFree);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, KeysReaderTriggerArgsCreate);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, KeysReaderTriggerArgsFree);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, KeysReaderTriggerArgsSetView);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, CommandReaderTriggerArgsCreate);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, CommandReaderTriggerArgsFree);
 
@@ -502,6 +633,7 @@ static int RedisGears_Initialize(RedisModuleCtx* ctx){
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, ListRecordGet);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, ListRecordPop);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, StringRecordCreate);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, StringRecordCreateBorrowed);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, StringRecordGet);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, StringRecordSet);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, DoubleRecordCreate);
@@ -527,6 +659,7 @@ static int RedisGears_Initialize(RedisModuleCtx* ctx){
 
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, GetPrivateData);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, SetPrivateData);
+    REDISGEARS_MODULE_INIT_FUNCTION(ctx, IsCancelled);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, SetFlatExecutionOnStartCallback);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, SetFlatExecutionOnRegisteredCallback);
     REDISGEARS_MODULE_INIT_FUNCTION(ctx, RegisterExecutionOnStartCallback);
@@ -21,6 +21,9 @@
 #include "utils/buffer.h"
 #include <pthread.h>
 #include "cluster.h"
+#include "sketches.h"
+#include "profiler.h"
+#include <frameobject.h>
 
 
 #define PY_OBJECT_TYPE_VERSION 1
@@ -103,6 +106,8 @@ static PythonThreadCtx* GetPythonThreadCtx();
 
 static long long CurrSessionId = 0;
 
+static ArgType* pyCallbackType = NULL;
+
 Gears_dict* SessionsDict = NULL;
 
 static char* venvDir = NULL;
@@ -756,6 +761,10 @@ static PythonThreadCtx* GetPythonThreadCtx(){
     return ptctx;
 }
 
+bool RedisGearsPy_IsPyCallbackArgType(ArgType* type){
+    return type && type == pyCallbackType;
+}
+
 bool RedisGearsPy_IsLockAcquired(){
     PythonThreadCtx* ptctx = GetPythonThreadCtx();
     return ptctx->lockCounter > 0;
@@ -768,6 +777,7 @@ PythonSessionCtx* RedisGearsPy_Lock(PythonSessionCtx* currSession){
     if(ptctx->lockCounter == 0){
         PyGILState_STATE oldState = PyGILState_Ensure();
         RedisModule_Assert(oldState == PyGILState_UNLOCKED);
+        Profiler_SetInPython(true);
     }
     ++ptctx->lockCounter;
     return oldSession;
@@ -780,6 +790,7 @@ void RedisGearsPy_Unlock(PythonSessionCtx* prevSession){
     ptctx->currSession = prevSession;
     if(--ptctx->lockCounter == 0){
         RedisModule_Assert(!prevSession);
+        Profiler_SetInPython(false);
         PyGILState_Release(PyGILState_UNLOCKED);
     }
 }
@@ -1003,6 +1014,229 @@ static PyObject* accumulate(PyObject *self, PyObject *args){
     return self;
 }
 
+/*
+ * Built in aggregations that run natively, without calling into the interpreter.
+ * The accumulator runs on each shard and the combiner merges the shards' results
+ * on the initiator, the optional finalizer turns the merged result into the output.
+ */
+typedef struct PyBuiltinAggregation{
+    const char* name;
+    bool toNative;
+    bool nativeOnly; // fail on records that stay python objects instead of passing them as is
+    char* accumulator;
+    char* combiner;
+    char* finalizer;
+    bool flatten;
+}PyBuiltinAggregation;
+
+static PyBuiltinAggregation pyBuiltinAggregations[] = {
+    {"count", false, false, "CountAccumulator", "SumAccumulator", NULL, false},
+    {"sum", true, false, "SumAccumulator", "SumAccumulator", NULL, false},
+    {"min", true, false, "MinAccumulator", "MinAccumulator", NULL, false},
+    {"max", true, false, "MaxAccumulator", "MaxAccumulator", NULL, false},
+    {"avg", true, false, "AvgAccumulator", "AvgAccumulator", "AvgMapper", false},
+    // python objects are not compared by their serialized value, GearsBuilder.distinct keeps them in a python set
+    {"distinct", true, true, "DistinctAccumulator", "DistinctAccumulator", "HashSetValuesMapper", true},
+    {"approxcountdistinct", true, false, "HllAccumulator", "HllAccumulator", "HllCountMapper", false},
+    {NULL, false, false, NULL, NULL, NULL, false},
+};
+
+static PyObject* builtinAggregate(PyObject *self, PyObject *args){
+    PyFlatExecution* pfep = (PyFlatExecution*)self;
+    if(PyTuple_Size(args) != 1){
+        PyErr_SetString(GearsError, "wrong number of args to builtinaggregate function");
+        return NULL;
+    }
+    PyObject* name = PyTuple_GetItem(args, 0);
+    if(!PyUnicode_Check(name)){
+        PyErr_SetString(GearsError, "builtinaggregate argument must be a string");
+        return NULL;
+    }
+    const char* nameStr = PyUnicode_AsUTF8AndSize(name, NULL);
+    PyBuiltinAggregation* agg = pyBuiltinAggregations;
+    for(; agg->name ; ++agg){
+        if(strcmp(agg->name, nameStr) == 0){
+            break;
+        }
+    }
+    if(!agg->name){
+        PyErr_SetString(GearsError, "unknown builtin aggregation");
+        return NULL;
+    }
+    if(agg->nativeOnly){
+        RGM_Map(pfep->fep, RedisGearsPy_ToNativeRecordOnlyMapper, NULL);
+    }else if(agg->toNative){
+        RGM_Map(pfep->fep, RedisGearsPy_ToNativeRecordMapper, NULL);
+    }
+    RedisGears_Accumulate(pfep->fep, agg->accumulator, NULL);
+    RGM_Collect(pfep->fep);
+    RedisGears_Accumulate(pfep->fep, agg->combiner, NULL);
+    if(agg->finalizer){
+        if(agg->flatten){
+            RedisGears_FlatMap(pfep->fep, agg->finalizer, NULL);
+        }else{
+            RedisGears_Map(pfep->fep, agg->finalizer, NULL);
+        }
+    }
+    RGM_Map(pfep->fep, RedisGearsPy_ToPyRecordMapper, NULL);
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* builtinCountby(PyObject *self, PyObject *args){
+    PyFlatExecution* pfep = (PyFlatExecution*)self;
+    if(PyTuple_Size(args) != 1){
+        PyErr_SetString(GearsError, "wrong number of args to builtincountby function");
+        return NULL;
+    }
+    PyObject* extractor = PyTuple_GetItem(args, 0);
+    if(!PyObject_TypeCheck(extractor, &PyFunction_Type)){
+        PyErr_SetString(GearsError, "builtincountby extractor argument must be a function");
+        return NULL;
+    }
+    Py_INCREF(extractor);
+    // counted locally by the combiner before the repartition
+    RGM_AccumulateBy(pfep->fep, RedisGearsPy_PyCallbackExtractor, extractor, CountByKeyAccumulator, NULL);
+    RGM_Map(pfep->fep, RedisGearsPy_ToPyRecordMapper, NULL);
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* builtinQuantiles(PyObject *self, PyObject *args){
+    PyFlatExecution* pfep = (PyFlatExecution*)self;
+    if(PyTuple_Size(args) != 1){
+        PyErr_SetString(GearsError, "wrong number of args to builtinquantiles function");
+        return NULL;
+    }
+    PyObject* quantiles = PyTuple_GetItem(args, 0);
+    if(!PyList_Check(quantiles) || PyList_Size(quantiles) == 0){
+        PyErr_SetString(GearsError, "builtinquantiles argument must be a non empty list");
+        return NULL;
+    }
+    size_t len = PyList_Size(quantiles);
+    double* qs = array_new(double, len);
+    for(size_t i = 0 ; i < len ; ++i){
+        double q = PyFloat_AsDouble(PyList_GetItem(quantiles, i));
+        if(PyErr_Occurred() || q < 0 || q > 1){
+            PyErr_Clear();
+            PyErr_SetString(GearsError, "quantiles must be numbers between 0 and 1");
+            array_free(qs);
+            return NULL;
+        }
+        qs = array_append(qs, q);
+    }
+    RGM_Map(pfep->fep, RedisGearsPy_ToNativeRecordMapper, NULL);
+    RGM_Accumulate(pfep->fep, TDigestAccumulator, NULL);
+    RGM_Collect(pfep->fep);
+    RGM_Accumulate(pfep->fep, TDigestAccumulator, NULL);
+    RGM_Map(pfep->fep, TDigestQuantilesMapper, Sketches_QuantilesArgCreate(qs, len));
+    RGM_Map(pfep->fep, RedisGearsPy_ToPyRecordMapper, NULL);
+    array_free(qs);
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* sort(PyObject *self, PyObject *args){
+    PyFlatExecution* pfep = (PyFlatExecution*)self;
+    if(PyTuple_Size(args) != 1){
+        PyErr_SetString(GearsError, "wrong number of args to sort function");
+        return NULL;
+    }
+    PyObject* callback = PyTuple_GetItem(args, 0);
+    if(!PyObject_TypeCheck(callback, &PyFunction_Type)){
+        PyErr_SetString(GearsError, "sort argument must be a function");
+        return NULL;
+    }
+    Py_INCREF(callback);
+    RGM_Sort(pfep->fep, RedisGearsPy_PyCallbackCompare, callback);
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* topk(PyObject *self, PyObject *args){
+    PyFlatExecution* pfep = (PyFlatExecution*)self;
+    if(PyTuple_Size(args) != 2){
+        PyErr_SetString(GearsError, "wrong number of args to topk function");
+        return NULL;
+    }
+    PyObject* k = PyTuple_GetItem(args, 0);
+    if(!PyLong_Check(k) || PyLong_AsLong(k) <= 0){
+        PyErr_SetString(GearsError, "topk first argument must be a positive number");
+        return NULL;
+    }
+    PyObject* callback = PyTuple_GetItem(args, 1);
+    if(!PyObject_TypeCheck(callback, &PyFunction_Type)){
+        PyErr_SetString(GearsError, "topk second argument must be a function");
+        return NULL;
+    }
+    Py_INCREF(callback);
+    RGM_TopK(pfep->fep, (size_t)PyLong_AsLong(k), RedisGearsPy_PyCallbackCompare, callback);
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* join(PyObject *self, PyObject *args){
+    PyFlatExecution* pfep = (PyFlatExecution*)self;
+    if(PyTuple_Size(args) != 4){
+        PyErr_SetString(GearsError, "wrong number of args to join function");
+        return NULL;
+    }
+    PyObject* pattern = PyTuple_GetItem(args, 0);
+    if(!PyUnicode_Check(pattern)){
+        PyErr_SetString(GearsError, "join pattern must be a string");
+        return NULL;
+    }
+    PyObject* probeExtractor = PyTuple_GetItem(args, 1);
+    PyObject* buildExtractor = PyTuple_GetItem(args, 2);
+    if(!PyObject_TypeCheck(probeExtractor, &PyFunction_Type) || !PyObject_TypeCheck(buildExtractor, &PyFunction_Type)){
+        PyErr_SetString(GearsError, "join extractors must be functions");
+        return NULL;
+    }
+    PyObject* broadcast = PyTuple_GetItem(args, 3);
+    Py_INCREF(probeExtractor);
+    Py_INCREF(buildExtractor);
+    // the build side is read natively, convert it to python records before the python extractor
+    RedisGears_Join(pfep->fep, PyUnicode_AsUTF8AndSize(pattern, NULL),
+                    "RedisGearsPy_PyCallbackExtractor", probeExtractor,
+                    "RedisGearsPy_PyCallbackExtractor", buildExtractor,
+                    "RedisGearsPy_ToPyRecordMapper", NULL, PyObject_IsTrue(broadcast));
+    RGM_Map(pfep->fep, RedisGearsPy_ToPyRecordMapper, NULL);
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* window(PyObject *self, PyObject *args){
+    PyFlatExecution* pfep = (PyFlatExecution*)self;
+    if(PyTuple_Size(args) != 4){
+        PyErr_SetString(GearsError, "wrong number of args to window function");
+        return NULL;
+    }
+    PyObject* size = PyTuple_GetItem(args, 0);
+    PyObject* slide = PyTuple_GetItem(args, 1);
+    if(!PyLong_Check(size) || !PyLong_Check(slide)){
+        PyErr_SetString(GearsError, "window size and slide must be numbers");
+        return NULL;
+    }
+    PyObject* extractor = PyTuple_GetItem(args, 2);
+    PyObject* accumulator = PyTuple_GetItem(args, 3);
+    if(!PyObject_TypeCheck(extractor, &PyFunction_Type) || !PyObject_TypeCheck(accumulator, &PyFunction_Type)){
+        PyErr_SetString(GearsError, "window extractor and accumulator must be functions");
+        return NULL;
+    }
+    Py_INCREF(extractor);
+    Py_INCREF(accumulator);
+    if(!RGM_Window(pfep->fep, PyLong_AsLongLong(size), PyLong_AsLongLong(slide),
+                   RedisGearsPy_PyCallbackExtractor, extractor, RedisGearsPy_PyCallbackAccumulate, accumulator)){
+        Py_DECREF(extractor);
+        Py_DECREF(accumulator);
+        PyErr_SetString(GearsError, "window size must be positive, slide must be positive and not bigger than the size, and a record can not fall on more than 1000 windows");
+        return NULL;
+    }
+    RGM_Map(pfep->fep, RedisGearsPy_ToPyRecordMapper, NULL);
+    Py_INCREF(self);
+    return self;
+}
+
 static void onDone(ExecutionPlan* ep, void* privateData){
     RedisModuleBlockedClient *bc = privateData;
     RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(bc);
@@ -1064,6 +1298,28 @@ static void* runCreateStreamReaderArgs(const char* pattern, PyObject *kargs){
     return RedisGears_StreamReaderCtxCreate(pattern, fromIdStr);
 }
 
+static int registerStrKeyTypeToInt(const char* keyType){
+    if(strcmp(keyType, "string") == 0){
+        return REDISMODULE_KEYTYPE_STRING;
+    }
+    if(strcmp(keyType, "list") == 0){
+        return REDISMODULE_KEYTYPE_LIST;
+    }
+    if(strcmp(keyType, "hash") == 0){
+        return REDISMODULE_KEYTYPE_HASH;
+    }
+    if(strcmp(keyType, "set") == 0){
+        return REDISMODULE_KEYTYPE_SET;
+    }
+    if(strcmp(keyType, "zset") == 0){
+        return REDISMODULE_KEYTYPE_ZSET;
+    }
+    if(strcmp(keyType, "module") == 0){
+        return REDISMODULE_KEYTYPE_MODULE;
+    }
+    return -1;
+}
+
 static void* runCreateKeysReaderArgs(const char* pattern, PyObject *kargs){
     bool noScan = false;
     PyObject* pyNoScan = GearsPyDict_GetItemString(kargs, "noScan");
@@ -1087,7 +1343,40 @@ static void* runCreateKeysReaderArgs(const char* pattern, PyObject *kargs){
             readValue = false;
         }
     }
-    return RedisGears_KeysReaderCtxCreate(pattern, readValue, NULL, noScan);
+
+    // getting key types white list (no list == all key types)
+    Arr(int) keyTypes = NULL;
+    PyObject* pyKeyTypes = GearsPyDict_GetItemString(kargs, "keyTypes");
+    if(pyKeyTypes && pyKeyTypes != Py_None){
+        PyObject* keyTypesIterator = PyObject_GetIter(pyKeyTypes);
+        if(!keyTypesIterator){
+            PyErr_SetString(GearsError, "given keyTypes is not iterable");
+            return NULL;
+        }
+        keyTypes = array_new(int, 10);
+        PyObject* keyType = NULL;
+        while((keyType = PyIter_Next(keyTypesIterator))){
+            int keyTypeInt = -1;
+            if(PyUnicode_Check(keyType)){
+                keyTypeInt = registerStrKeyTypeToInt(PyUnicode_AsUTF8AndSize(keyType, NULL));
+            }
+            Py_DECREF(keyType);
+            if(keyTypeInt == -1){
+                Py_DECREF(keyTypesIterator);
+                array_free(keyTypes);
+                PyErr_SetString(GearsError, "unknown key type");
+                return NULL;
+            }
+            keyTypes = array_append(keyTypes, keyTypeInt);
+        }
+        Py_DECREF(keyTypesIterator);
+    }
+
+    KeysReaderCtx* krctx = RedisGears_KeysReaderCtxCreate(pattern, readValue, NULL, noScan);
+    if(keyTypes){
+        RedisGears_KeysReaderCtxSetKeyTypes(krctx, keyTypes);
+    }
+    return krctx;
 }
 
 static PyObject* run(PyObject *self, PyObject *args,  PyObject *kargs){
@@ -1105,6 +1394,20 @@ static PyObject* run(PyObject *self, PyObject *args,  PyObject *kargs){
         return NULL;
     }
 
+    PyObject* pyTimeout = GearsPyDict_GetItemString(kargs, "timeout");
+    if(pyTimeout && pyTimeout != Py_None){
+        if(!PyLong_Check(pyTimeout)){
+            PyErr_SetString(GearsError, "timeout argument must be a number");
+            return NULL;
+        }
+        long long timeout = PyLong_AsLongLong(pyTimeout);
+        if(timeout < 0){
+            PyErr_SetString(GearsError, "timeout argument must be a positive number");
+            return NULL;
+        }
+        RedisGears_SetExecutionTimeout(pfep->fep, timeout);
+    }
+
     const char* defaultRegexStr = "*";
     const char* patternStr = defaultRegexStr;
     void* arg;
@@ -1172,28 +1475,6 @@ static PyObject* run(PyObject *self, PyObject *args,  PyObject *kargs){
     return Py_None;
 }
 
-static int registerStrKeyTypeToInt(const char* keyType){
-    if(strcmp(keyType, "string") == 0){
-        return REDISMODULE_KEYTYPE_STRING;
-    }
-    if(strcmp(keyType, "list") == 0){
-        return REDISMODULE_KEYTYPE_LIST;
-    }
-    if(strcmp(keyType, "hash") == 0){
-        return REDISMODULE_KEYTYPE_HASH;
-    }
-    if(strcmp(keyType, "set") == 0){
-        return REDISMODULE_KEYTYPE_SET;
-    }
-    if(strcmp(keyType, "zset") == 0){
-        return REDISMODULE_KEYTYPE_ZSET;
-    }
-    if(strcmp(keyType, "module") == 0){
-        return REDISMODULE_KEYTYPE_MODULE;
-    }
-    return -1;
-}
-
 static void* registerCreateKeysArgs(PyObject *kargs, const char* prefix, ExecutionMode mode){
     Arr(char*) eventTypes = NULL;
     Arr(int) keyTypes = NULL;
@@ -1266,7 +1547,30 @@ static void* registerCreateKeysArgs(PyObject *kargs, const char* prefix, Executi
         }
     }
 
-    return RedisGears_KeysReaderTriggerArgsCreate(prefix, eventTypes, keyTypes, readValue);
+    KeysReaderTriggerArgs* args = RedisGears_KeysReaderTriggerArgsCreate(prefix, eventTypes, keyTypes, readValue);
+
+    // view is a (viewKey, aggregation, groupField, valueField) tuple
+    PyObject* pyView = GearsPyDict_GetItemString(kargs, "view");
+    if(pyView && pyView != Py_None){
+        const char* viewKey;
+        const char* aggregation;
+        const char* groupField = NULL;
+        const char* valueField = NULL;
+        if(!PyTuple_Check(pyView) || !PyArg_ParseTuple(pyView, "ss|zz", &viewKey, &aggregation, &groupField, &valueField)){
+            RedisGears_KeysReaderTriggerArgsFree(args);
+            PyErr_Clear();
+            PyErr_SetString(GearsError, "view must be a (viewKey, aggregation, groupField, valueField) tuple");
+            return NULL;
+        }
+        char* err = NULL;
+        if(RedisGears_KeysReaderTriggerArgsSetView(args, viewKey, aggregation, groupField, valueField, &err) != REDISMODULE_OK){
+            RedisGears_KeysReaderTriggerArgsFree(args);
+            PyErr_SetString(GearsError, err);
+            RG_FREE(err);
+            return NULL;
+        }
+    }
+    return args;
 }
 
 static OnFailedPolicy getOnFailedPolicy(const char* onFailurePolicyStr){
@@ -1440,6 +1744,20 @@ static PyObject* registerExecution(PyObject *self, PyObject *args, PyObject *kar
         }
     }
 
+    PyObject* pyExecutionPoolSize = GearsPyDict_GetItemString(kargs, "executionPoolSize");
+    if(pyExecutionPoolSize && pyExecutionPoolSize != Py_None){
+        if(!PyLong_Check(pyExecutionPoolSize)){
+            PyErr_SetString(GearsError, "executionPoolSize argument must be a number");
+            return NULL;
+        }
+        long long executionPoolSize = PyLong_AsLongLong(pyExecutionPoolSize);
+        if(executionPoolSize < 0){
+            PyErr_SetString(GearsError, "executionPoolSize argument must be a non negative number");
+            return NULL;
+        }
+        RedisGears_SetExecutionPoolSize(pfep->fep, executionPoolSize);
+    }
+
     void* executionArgs = registerCreateArgs(pfep->fep, kargs, mode);
     if(executionArgs == NULL){
         return NULL;
@@ -1507,6 +1825,13 @@ PyMethodDef PyFlatExecutionMethods[] = {
     {"flatmap", flatmap, METH_VARARGS, "flat map a record to many records"},
     {"limit", limit, METH_VARARGS, "limit the results to a give size and offset"},
     {"accumulate", accumulate, METH_VARARGS, "accumulate the records to a single record"},
+    {"sort", sort, METH_VARARGS, "sort the records of each shard using the given compare function"},
+    {"topk", topk, METH_VARARGS, "keep the first k records of each shard using the given compare function"},
+    {"join", join, METH_VARARGS, "inner join the records with the records of the keys that match the given pattern"},
+    {"window", window, METH_VARARGS, "accumulate the records into time windows that are emitted once they are closed"},
+    {"builtinaggregate", builtinAggregate, METH_VARARGS, "run a native count, sum, min, max, avg, distinct or approxcountdistinct aggregation"},
+    {"builtincountby", builtinCountby, METH_VARARGS, "natively count the records by the extracted key"},
+    {"builtinquantiles", builtinQuantiles, METH_VARARGS, "approximate the given quantiles with a native t-digest"},
     {"run", (PyCFunction)run, METH_VARARGS|METH_KEYWORDS, "start the execution"},
     {"register", (PyCFunction)registerExecution, METH_VARARGS|METH_KEYWORDS, "register the execution on an event"},
     {NULL, NULL, 0, NULL}
@@ -3537,6 +3862,45 @@ static bool RedisGearsPy_PyCallbackFilter(ExecutionCtx* rctx, Record *record, vo
     return ret1;
 }
 
+static int RedisGearsPy_PyCallbackCompare(ExecutionCtx* rctx, Record *a, Record *b, void* arg){
+    RedisModule_Assert(RedisGears_RecordGetType(a) == pythonRecordType);
+    RedisModule_Assert(RedisGears_RecordGetType(b) == pythonRecordType);
+
+    PythonSessionCtx* sctx = RedisGears_GetFlatExecutionPrivateData(rctx);
+    RedisModule_Assert(sctx);
+
+    void* old = RedisGearsPy_Lock(sctx);
+
+    PyObject* pArgs = PyTuple_New(2);
+    PyObject* callback = arg;
+    PyObject* objA = PyObjRecordGet(a);
+    PyObject* objB = PyObjRecordGet(b);
+    Py_INCREF(objA);
+    Py_INCREF(objB);
+    PyTuple_SetItem(pArgs, 0, objA);
+    PyTuple_SetItem(pArgs, 1, objB);
+    PyObject* ret = PyObject_CallObject(callback, pArgs);
+    Py_DECREF(pArgs);
+    if(!ret){
+        fetchPyError(rctx);
+
+        RedisGearsPy_Unlock(old);
+        return 0;
+    }
+    if(!PyLong_Check(ret)){
+        Py_DECREF(ret);
+        RedisGears_SetError(rctx, RG_STRDUP("compare function must return a number"));
+
+        RedisGearsPy_Unlock(old);
+        return 0;
+    }
+    long res = PyLong_AsLong(ret);
+    Py_DECREF(ret);
+
+    RedisGearsPy_Unlock(old);
+    return res < 0 ? -1 : (res > 0 ? 1 : 0);
+}
+
 static char* RedisGearsPy_PyCallbackExtractor(ExecutionCtx* rctx, Record *record, void* arg, size_t* len){
     RedisModule_Assert(RedisGears_RecordGetType(record) == pythonRecordType);
 
@@ -3623,7 +3987,6 @@ static Record* RedisGearsPy_ToPyRecordMapperInternal(Record *record, void* arg){
     long longNum;
     double doubleNum;
     char* key;
-    Arr(char*) keys;
     size_t len;
     if(!record){
         Py_INCREF(Py_None);
@@ -3643,7 +4006,7 @@ static Record* RedisGearsPy_ToPyRecordMapperInternal(Record *record, void* arg){
         obj = PyLong_FromLong(longNum);
     }else if(RedisGears_RecordGetType(record) == doubleRecordType){
         doubleNum = RedisGears_DoubleRecordGet(record);
-        obj = PyLong_FromDouble(doubleNum);
+        obj = PyFloat_FromDouble(doubleNum);
     }else if(RedisGears_RecordGetType(record) == keyRecordType){
         key = RedisGears_KeyRecordGetKey(record, NULL);
         obj = PyDict_New();
@@ -3670,19 +4033,19 @@ static Record* RedisGearsPy_ToPyRecordMapperInternal(Record *record, void* arg){
             RedisGears_FreeRecord(tempRecord);
         }
     }else if(RedisGears_RecordGetType(record) == hashSetRecordType){
-        keys = RedisGears_HashSetRecordGetAllKeys(record);
+        HashSetRecordIterator iter;
+        const char* field;
         obj = PyDict_New();
-        for(size_t i = 0 ; i < array_len(keys) ; ++i){
-            key = keys[i];
-            temp = PyUnicode_FromString(key);
-            tempRecord = RedisGears_HashSetRecordGet(record, key);
+        RG_HashSetRecordIteratorInit(&iter, record);
+        while(RG_HashSetRecordIteratorNext(&iter, &field, &tempRecord)){
+            temp = PyUnicode_FromString(field);
             tempRecord = RedisGearsPy_ToPyRecordMapperInternal(tempRecord, arg);
             RedisModule_Assert(RedisGears_RecordGetType(tempRecord) == pythonRecordType);
             PyDict_SetItem(obj, temp, PyObjRecordGet(tempRecord));
             Py_DECREF(temp);
             RedisGears_FreeRecord(tempRecord);
         }
-        array_free(keys);
+        RG_HashSetRecordIteratorDone(&iter);
     }else if(RedisGears_RecordGetType(record) == pythonRecordType){
         obj = PyObjRecordGet(record);
         Py_INCREF(obj);
@@ -3732,6 +4095,62 @@ static Record* RedisGearsPy_InstallRequirementsMapper(ExecutionCtx* rctx, Record
     return RedisGears_StringRecordCreate(RG_STRDUP("Done"), strlen("Done"));
 }
 
+/*
+ * Convert python ints, floats and strings to native records so the built in accumulators
+ * can work on them without the interpreter, other objects are left as python records.
+ */
+static Record* RedisGearsPy_ToNativeRecordMapper(ExecutionCtx* rctx, Record *record, void* arg){
+    if(RedisGears_RecordGetType(record) != pythonRecordType){
+        return record;
+    }
+    PythonSessionCtx* sctx = RedisGears_GetFlatExecutionPrivateData(rctx);
+    RedisModule_Assert(sctx);
+
+    void* old = RedisGearsPy_Lock(sctx);
+    PyObject* obj = PyObjRecordGet(record);
+    Record* res = NULL;
+    if(PyLong_CheckExact(obj)){
+        int overflow;
+        long val = PyLong_AsLongAndOverflow(obj, &overflow);
+        if(!overflow && !PyErr_Occurred()){
+            res = RedisGears_LongRecordCreate(val);
+        }
+        PyErr_Clear();
+    }else if(PyFloat_CheckExact(obj)){
+        res = RedisGears_DoubleRecordCreate(PyFloat_AsDouble(obj));
+    }else if(PyUnicode_CheckExact(obj)){
+        Py_ssize_t len;
+        const char* str = PyUnicode_AsUTF8AndSize(obj, &len);
+        if(str){
+            char* val = RG_ALLOC(len + 1);
+            memcpy(val, str, len);
+            val[len] = '\0';
+            res = RedisGears_StringRecordCreate(val, len);
+        }
+        PyErr_Clear();
+    }
+    RedisGearsPy_Unlock(old);
+
+    if(!res){
+        return record;
+    }
+    RedisGears_FreeRecord(record);
+    return res;
+}
+
+/*
+ * Like RedisGearsPy_ToNativeRecordMapper but fails on python objects that can not be converted.
+ */
+static Record* RedisGearsPy_ToNativeRecordOnlyMapper(ExecutionCtx* rctx, Record *record, void* arg){
+    record = RedisGearsPy_ToNativeRecordMapper(rctx, record, arg);
+    if(RedisGears_RecordGetType(record) == pythonRecordType){
+        RedisGears_SetError(rctx, RG_STRDUP("native aggregation only supports ints, floats and strings"));
+        RedisGears_FreeRecord(record);
+        return NULL;
+    }
+    return record;
+}
+
 static Record* RedisGearsPy_ToPyRecordMapper(ExecutionCtx* rctx, Record *record, void* arg){
 
     PythonSessionCtx* sctx = RedisGears_GetFlatExecutionPrivateData(rctx);
@@ -4176,6 +4595,11 @@ static Record* PythonReader_Next(ExecutionCtx* rctx, void* ctx){
     if(pyCtx->isDone){
         return NULL;
     }
+    if(RedisGears_IsCancelled(rctx)){
+        // do not run the generator anymore, whatever it returns will be dropped
+        pyCtx->isDone = true;
+        return NULL;
+    }
 
     PythonSessionCtx* sctx = RedisGears_GetFlatExecutionPrivateData(rctx);
     RedisModule_Assert(sctx);
@@ -4450,6 +4874,76 @@ void RedisGearsPy_ForceStop(unsigned long threadID){
     RedisGearsPy_Unlock(old);
 }
 
+void RedisGearsPy_ForceStopIfRunning(unsigned long threadID, volatile bool* isRunning){
+    void* old = RedisGearsPy_Lock(NULL);
+    if(*isRunning){
+        PyThreadState_SetAsyncExc(threadID, ForceStoppedError);
+    }
+    RedisGearsPy_Unlock(old);
+}
+
+void RedisGearsPy_SetExecutionRunning(unsigned long threadID, volatile bool* isRunning, bool running){
+    void* old = RedisGearsPy_Lock(NULL);
+    *isRunning = running;
+    if(!running){
+        PyThreadState_SetAsyncExc(threadID, NULL);
+    }
+    RedisGearsPy_Unlock(old);
+}
+
+#define PROFILER_MAX_PYTHON_DEPTH 64
+
+#if PY_VERSION_HEX < 0x03090000
+static PyFrameObject* PyFrame_GetBack(PyFrameObject* frame){
+    Py_XINCREF(frame->f_back);
+    return frame->f_back;
+}
+
+static PyCodeObject* PyFrame_GetCode(PyFrameObject* frame){
+    Py_INCREF(frame->f_code);
+    return frame->f_code;
+}
+#endif
+
+void RedisGearsPy_AddThreadsStacks(unsigned long* threadIds, Gears_Buffer** stacks, size_t len){
+    void* old = RedisGearsPy_Lock(NULL);
+    PyObject* frames = _PyThread_CurrentFrames();
+    if(!frames){
+        PyErr_Clear();
+        RedisGearsPy_Unlock(old);
+        return;
+    }
+    for(size_t i = 0 ; i < len ; ++i){
+        PyObject* threadId = PyLong_FromUnsignedLong(threadIds[i]);
+        PyFrameObject* frame = (PyFrameObject*)PyDict_GetItem(frames, threadId);
+        Py_DECREF(threadId);
+        // frames are linked from the innermost one, the collapsed stack starts from the outermost
+        PyFrameObject* pyStack[PROFILER_MAX_PYTHON_DEPTH];
+        size_t depth = 0;
+        Py_XINCREF(frame);
+        while(frame && depth < PROFILER_MAX_PYTHON_DEPTH){
+            pyStack[depth++] = frame;
+            frame = PyFrame_GetBack(frame);
+        }
+        Py_XDECREF(frame);
+        while(depth > 0){
+            frame = pyStack[--depth];
+            PyCodeObject* code = PyFrame_GetCode(frame);
+            const char* name = PyUnicode_AsUTF8(code->co_name);
+            const char* file = PyUnicode_AsUTF8(code->co_filename);
+            char* entry;
+            rg_asprintf(&entry, ";%s (%s:%d)", name ? name : "?", file ? file : "?", PyFrame_GetLineNumber(frame));
+            Gears_BufferAdd(stacks[i], entry, strlen(entry));
+            RG_FREE(entry);
+            Py_DECREF(code);
+            Py_DECREF(frame);
+        }
+    }
+    PyErr_Clear();
+    Py_DECREF(frames);
+    RedisGearsPy_Unlock(old);
+}
+
 static int PythonRecord_SendReply(Record* r, RedisModuleCtx* rctx){
     PyObject* obj = PyObjRecordGet(r);
     if(PyList_Check(obj)){
@@ -4767,7 +5261,7 @@ int RedisGearsPy_Init(RedisModuleCtx *ctx){
                                                    PythonRecord_Deserialize,
                                                    PythonRecord_Free);
 
-    ArgType* pyCallbackType = RedisGears_CreateType("PyObjectType",
+    pyCallbackType = RedisGears_CreateType("PyObjectType",
                                                     PY_OBJECT_TYPE_VERSION,
                                                     RedisGearsPy_PyObjectFree,
                                                     RedisGearsPy_PyObjectDup,
@@ -4799,12 +5293,15 @@ int RedisGearsPy_Init(RedisModuleCtx *ctx){
     RGM_RegisterForEach(RedisGearsPy_PyCallbackForEach, pyCallbackType);
     RGM_RegisterFilter(RedisGearsPy_PyCallbackFilter, pyCallbackType);
     RGM_RegisterMap(RedisGearsPy_ToPyRecordMapper, NULL);
+    RGM_RegisterMap(RedisGearsPy_ToNativeRecordMapper, NULL);
+    RGM_RegisterMap(RedisGearsPy_ToNativeRecordOnlyMapper, NULL);
     RGM_RegisterMap(RedisGearsPy_PyCallbackFlatMapper, pyCallbackType);
     RGM_RegisterMap(RedisGearsPy_PyCallbackMapper, pyCallbackType);
     RGM_RegisterAccumulator(RedisGearsPy_PyCallbackAccumulate, pyCallbackType);
     RGM_RegisterAccumulatorByKey(RedisGearsPy_PyCallbackAccumulateByKey, pyCallbackType);
     RGM_RegisterGroupByExtractor(RedisGearsPy_PyCallbackExtractor, pyCallbackType);
     RGM_RegisterReducer(RedisGearsPy_PyCallbackReducer, pyCallbackType);
+    RGM_RegisterCompare(RedisGearsPy_PyCallbackCompare, pyCallbackType);
     RGM_RegisterExecutionOnUnpausedCallback(RedisGearsPy_OnExecutionUnpausedCallback, pyCallbackType);
     RGM_RegisterFlatExecutionOnRegisteredCallback(RedisGearsPy_OnRegistered, pyCallbackType);
 
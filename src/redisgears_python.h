@@ -11,6 +11,7 @@
 #include <Python.h>
 #include "redismodule.h"
 #include "redisgears.h"
+#include "utils/buffer.h"
 
 typedef struct PythonSessionCtx PythonSessionCtx;
 
@@ -22,9 +23,23 @@ int RedisGearsPy_Execute(RedisModuleCtx *ctx, RedisModuleString **argv, int argc
 int RedisGearsPy_ExecuteWithCallback(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, DoneCallbackFunction callback);
 int RedisGearsPy_Init(RedisModuleCtx *ctx);
 void RedisGearsPy_ForceStop(unsigned long threadID);
+/*
+ * Both are called with the running flag of an execution, which is only changed under the GIL.
+ * ForceStopIfRunning interrupts the thread only if the flag is set, clearing the flag drops
+ * a stop that the thread did not get yet.
+ */
+void RedisGearsPy_ForceStopIfRunning(unsigned long threadID, volatile bool* isRunning);
+void RedisGearsPy_SetExecutionRunning(unsigned long threadID, volatile bool* isRunning, bool running);
+
+/*
+ * Append the python stack of each of the given threads to its buffer (collapsed
+ * format, outermost frame first), threads that do not run python code are skipped.
+ */
+void RedisGearsPy_AddThreadsStacks(unsigned long* threadIds, Gears_Buffer** stacks, size_t len);
 PythonSessionCtx* RedisGearsPy_Lock(PythonSessionCtx* currSession);
 void RedisGearsPy_Unlock(PythonSessionCtx* prevSession);
 bool RedisGearsPy_IsLockAcquired();
+bool RedisGearsPy_IsPyCallbackArgType(ArgType* type);
 void RedisGearsPy_Clean();
 
 #endif /* SRC_REDISGEARG_PYTHON_H_ */
@@ -1,12 +1,273 @@
 #include "redismodule.h"
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
 #include "redisgears.h"
 #include "redisgears_memory.h"
+#include "record.h"
+#include "reducers.h"
+#include "utils/arr_rm_alloc.h"
+#include "utils/buffer.h"
+#include "common.h"
 
-Record* CountReducer(RedisModuleCtx* rctx, char* key, size_t keyLen, Record *records, void* arg, char** err){
+Record* CountReducer(ExecutionCtx* rctx, char* key, size_t keyLen, Record *records, void* arg){
     RedisModule_Assert(RedisGears_RecordGetType(records) == listRecordType);
-    Record* res =RedisGears_LongRecordCreate(RedisGears_ListRecordLen(records));
+    Record* res = RedisGears_LongRecordCreate(RedisGears_ListRecordLen(records));
     RedisGears_FreeRecord(records);
     return res;
 }
+
+static Record* Reducers_Error(ExecutionCtx* rctx, Record *accumulate, Record *r, const char* msg){
+    RedisGears_SetError(rctx, RG_STRDUP(msg));
+    if(accumulate){
+        RedisGears_FreeRecord(accumulate);
+    }
+    RedisGears_FreeRecord(r);
+    return NULL;
+}
+
+static bool Reducers_IsNumber(Record* r){
+    return RedisGears_RecordGetType(r) == longRecordType || RedisGears_RecordGetType(r) == doubleRecordType;
+}
+
+static double Reducers_GetNumber(Record* r){
+    if(RedisGears_RecordGetType(r) == longRecordType){
+        return RedisGears_LongRecordGet(r);
+    }
+    return RedisGears_DoubleRecordGet(r);
+}
+
+Record* CountAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    RedisGears_FreeRecord(r);
+    if(!accumulate){
+        return RedisGears_LongRecordCreate(1);
+    }
+    RedisGears_LongRecordSet(accumulate, RedisGears_LongRecordGet(accumulate) + 1);
+    return accumulate;
+}
+
+Record* SumAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    if(!Reducers_IsNumber(r)){
+        return Reducers_Error(rctx, accumulate, r, "SumAccumulator works only on long and double records");
+    }
+    if(!accumulate){
+        return r;
+    }
+    if(RedisGears_RecordGetType(accumulate) == longRecordType && RedisGears_RecordGetType(r) == longRecordType){
+        long res;
+        if(!__builtin_add_overflow(RedisGears_LongRecordGet(accumulate), RedisGears_LongRecordGet(r), &res)){
+            RedisGears_LongRecordSet(accumulate, res);
+            RedisGears_FreeRecord(r);
+            return accumulate;
+        }
+    }
+    double res = Reducers_GetNumber(accumulate) + Reducers_GetNumber(r);
+    RedisGears_FreeRecord(r);
+    if(RedisGears_RecordGetType(accumulate) == doubleRecordType){
+        RedisGears_DoubleRecordSet(accumulate, res);
+        return accumulate;
+    }
+    RedisGears_FreeRecord(accumulate);
+    return RedisGears_DoubleRecordCreate(res);
+}
+
+/*
+ * Compare two numbers or two strings, return REDISMODULE_ERR if the records can not be compared.
+ */
+static int Reducers_Compare(Record* a, Record* b, int* res){
+    if(Reducers_IsNumber(a) && Reducers_IsNumber(b)){
+        if(RedisGears_RecordGetType(a) == longRecordType && RedisGears_RecordGetType(b) == longRecordType){
+            long l1 = RedisGears_LongRecordGet(a);
+            long l2 = RedisGears_LongRecordGet(b);
+            *res = (l1 > l2) - (l1 < l2);
+        }else{
+            double d1 = Reducers_GetNumber(a);
+            double d2 = Reducers_GetNumber(b);
+            *res = (d1 > d2) - (d1 < d2);
+        }
+        return REDISMODULE_OK;
+    }
+    if(RedisGears_RecordGetType(a) == stringRecordType && RedisGears_RecordGetType(b) == stringRecordType){
+        size_t len1, len2;
+        char* s1 = RedisGears_StringRecordGet(a, &len1);
+        char* s2 = RedisGears_StringRecordGet(b, &len2);
+        *res = memcmp(s1, s2, len1 < len2 ? len1 : len2);
+        if(*res == 0){
+            *res = (len1 > len2) - (len1 < len2);
+        }
+        return REDISMODULE_OK;
+    }
+    return REDISMODULE_ERR;
+}
+
+static Record* Reducers_Select(ExecutionCtx* rctx, Record *accumulate, Record *r, int sign, const char* err){
+    if(!Reducers_IsNumber(r) && RedisGears_RecordGetType(r) != stringRecordType){
+        return Reducers_Error(rctx, accumulate, r, err);
+    }
+    if(!accumulate){
+        return r;
+    }
+    int res;
+    if(Reducers_Compare(r, accumulate, &res) != REDISMODULE_OK){
+        return Reducers_Error(rctx, accumulate, r, err);
+    }
+    if(res * sign > 0){
+        RedisGears_FreeRecord(accumulate);
+        return r;
+    }
+    RedisGears_FreeRecord(r);
+    return accumulate;
+}
+
+Record* MinAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    return Reducers_Select(rctx, accumulate, r, -1, "MinAccumulator works only on numbers or only on strings");
+}
+
+Record* MaxAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    return Reducers_Select(rctx, accumulate, r, 1, "MaxAccumulator works only on numbers or only on strings");
+}
+
+Record* AvgAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    double sum;
+    long count;
+    if(RedisGears_RecordGetType(r) == listRecordType){
+        // partial result of another shard
+        if(RedisGears_ListRecordLen(r) != 2 ||
+           RedisGears_RecordGetType(RedisGears_ListRecordGet(r, 0)) != doubleRecordType ||
+           RedisGears_RecordGetType(RedisGears_ListRecordGet(r, 1)) != longRecordType){
+            return Reducers_Error(rctx, accumulate, r, "AvgAccumulator got a bad partial result");
+        }
+        sum = RedisGears_DoubleRecordGet(RedisGears_ListRecordGet(r, 0));
+        count = RedisGears_LongRecordGet(RedisGears_ListRecordGet(r, 1));
+    }else if(Reducers_IsNumber(r)){
+        sum = Reducers_GetNumber(r);
+        count = 1;
+    }else{
+        return Reducers_Error(rctx, accumulate, r, "AvgAccumulator works only on long and double records");
+    }
+    RedisGears_FreeRecord(r);
+    if(!accumulate){
+        accumulate = RedisGears_ListRecordCreate(2);
+        RedisGears_ListRecordAdd(accumulate, RedisGears_DoubleRecordCreate(0));
+        RedisGears_ListRecordAdd(accumulate, RedisGears_LongRecordCreate(0));
+    }
+    Record* sumRecord = RedisGears_ListRecordGet(accumulate, 0);
+    Record* countRecord = RedisGears_ListRecordGet(accumulate, 1);
+    RedisGears_DoubleRecordSet(sumRecord, RedisGears_DoubleRecordGet(sumRecord) + sum);
+    RedisGears_LongRecordSet(countRecord, RedisGears_LongRecordGet(countRecord) + count);
+    return accumulate;
+}
+
+static char* Reducers_HexKey(char prefix, const char* buff, size_t len){
+    static const char hex[] = "0123456789abcdef";
+    char* key = RG_ALLOC(len * 2 + 2);
+    key[0] = prefix;
+    for(size_t i = 0 ; i < len ; ++i){
+        key[1 + i * 2] = hex[((unsigned char)buff[i]) >> 4];
+        key[2 + i * 2] = hex[((unsigned char)buff[i]) & 0xf];
+    }
+    key[len * 2 + 1] = '\0';
+    return key;
+}
+
+char* Reducers_DistinctKey(Record* r, char** err){
+    char* key = NULL;
+    if(RedisGears_RecordGetType(r) == longRecordType){
+        rg_asprintf(&key, "l%ld", RedisGears_LongRecordGet(r));
+        return key;
+    }
+    if(RedisGears_RecordGetType(r) == doubleRecordType){
+        double d = RedisGears_DoubleRecordGet(r);
+        if(d >= -9.2e18 && d <= 9.2e18 && d == (double)(long)d){
+            rg_asprintf(&key, "l%ld", (long)d);
+        }else{
+            rg_asprintf(&key, "d%.17g", d);
+        }
+        return key;
+    }
+    if(RedisGears_RecordGetType(r) == stringRecordType){
+        size_t len;
+        char* str = RedisGears_StringRecordGet(r, &len);
+        if(memchr(str, '\0', len)){
+            return Reducers_HexKey('b', str, len);
+        }
+        key = RG_ALLOC(len + 2);
+        key[0] = 's';
+        memcpy(key + 1, str, len);
+        key[len + 1] = '\0';
+        return key;
+    }
+    Gears_Buffer* buff = Gears_BufferCreate();
+    Gears_BufferWriter bw;
+    Gears_BufferWriterInit(&bw, buff);
+    if(RG_SerializeRecord(&bw, r, err) == REDISMODULE_OK){
+        key = Reducers_HexKey('x', buff->buff, buff->size);
+    }
+    Gears_BufferFree(buff);
+    return key;
+}
+
+Record* DistinctAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    if(!accumulate){
+        accumulate = RedisGears_HashSetRecordCreate();
+    }
+    if(RedisGears_RecordGetType(r) == hashSetRecordType){
+        // partial result of another shard
+        HashSetRecordIterator iter;
+        const char* key;
+        Record* val;
+        RG_HashSetRecordIteratorInit(&iter, r);
+        while(RG_HashSetRecordIteratorNext(&iter, &key, &val)){
+            if(RedisGears_HashSetRecordGet(accumulate, (char*)key)){
+                continue;
+            }
+            // set copies the key, take might free it so it must come last
+            RedisGears_HashSetRecordSet(accumulate, (char*)key, val);
+            RG_HashSetRecordTake(r, (char*)key);
+        }
+        RG_HashSetRecordIteratorDone(&iter);
+        RedisGears_FreeRecord(r);
+        return accumulate;
+    }
+    char* err = NULL;
+    char* key = Reducers_DistinctKey(r, &err);
+    if(!key){
+        Reducers_Error(rctx, accumulate, r, err ? err : "DistinctAccumulator failed serializing record");
+        if(err){
+            RG_FREE(err);
+        }
+        return NULL;
+    }
+    if(RedisGears_HashSetRecordGet(accumulate, key)){
+        RedisGears_FreeRecord(r);
+    }else{
+        RedisGears_HashSetRecordSet(accumulate, key, r);
+    }
+    RG_FREE(key);
+    return accumulate;
+}
+
+Record* CountByKeyAccumulator(ExecutionCtx* rctx, char* key, Record *accumulate, Record *r, void* arg){
+    if(RedisGears_RecordGetType(r) == longRecordType){
+        // partial count of the combiner
+        return SumAccumulator(rctx, accumulate, r, arg);
+    }
+    return CountAccumulator(rctx, accumulate, r, arg);
+}
+
+Record* SumByKeyAccumulator(ExecutionCtx* rctx, char* key, Record *accumulate, Record *r, void* arg){
+    if(RedisGears_RecordGetType(r) == keyRecordType){
+        Record* val = RedisGears_KeyRecordGetVal(r);
+        RedisGears_KeyRecordSetVal(r, NULL);
+        RedisGears_FreeRecord(r);
+        if(!val){
+            RedisGears_SetError(rctx, RG_STRDUP("SumByKeyAccumulator got a key record without a value"));
+            if(accumulate){
+                RedisGears_FreeRecord(accumulate);
+            }
+            return NULL;
+        }
+        r = val;
+    }
+    return SumAccumulator(rctx, accumulate, r, arg);
+}
@@ -0,0 +1,47 @@
+/*
+ * reducers.h
+ *
+ * Built in reducers and accumulators for the common aggregations
+ * (count, sum, min, max, avg and distinct) over long, double and string records.
+ */
+
+#ifndef SRC_REDUCERS_H_
+#define SRC_REDUCERS_H_
+
+#include "redisgears.h"
+
+/*
+ * Return a heap allocated key that identifies the record value, equal values get equal keys.
+ * Integral doubles get the same key as the equal long, records other than long, double and
+ * string are identified by their serialized value. Return NULL if the record can not be serialized.
+ */
+char* Reducers_DistinctKey(Record* r, char** err);
+
+Record* CountReducer(ExecutionCtx* rctx, char* key, size_t keyLen, Record *records, void* arg);
+
+/*
+ * Accumulators that can be used both locally and to combine the partial results of the shards.
+ * CountAccumulator counts any record, its partial results are combined with SumAccumulator.
+ * SumAccumulator works on long and double records, long sums that overflow turns into double.
+ * Min/MaxAccumulator works on numbers or on strings (compared byte wise), not on both.
+ * AvgAccumulator produces a [sum, count] list record, AvgMapper turns it into the average.
+ * DistinctAccumulator produces a hash set record, HashSetValuesMapper turns it into a list of
+ * the distinct records (to be used with flatmap). Records other than long, double and string
+ * are compared by their serialized value.
+ */
+Record* CountAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
+Record* SumAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
+Record* MinAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
+Record* MaxAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
+Record* AvgAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
+Record* DistinctAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
+
+/*
+ * Accumulate by key version of Count and Sum, both are associative. CountByKeyAccumulator
+ * takes long records as partial counts (like DistinctAccumulator takes hashset records),
+ * SumByKeyAccumulator also accepts key records holding a number.
+ */
+Record* CountByKeyAccumulator(ExecutionCtx* rctx, char* key, Record *accumulate, Record *r, void* arg);
+Record* SumByKeyAccumulator(ExecutionCtx* rctx, char* key, Record *accumulate, Record *r, void* arg);
+
+#endif /* SRC_REDUCERS_H_ */
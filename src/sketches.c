@@ -0,0 +1,475 @@
+/*
+ * sketches.c
+ *
+ * HyperLogLog and t-digest records and the accumulators that build them.
+ */
+
+#include "sketches.h"
+#include "reducers.h"
+#include "record.h"
+#include "redisgears_memory.h"
+#include "common.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define HLL_P 14
+#define HLL_REGISTERS (1 << HLL_P)
+
+#define TDIGEST_COMPRESSION 100
+#define TDIGEST_INITIAL_CAP (10 * TDIGEST_COMPRESSION)
+
+#define QUANTILES_TYPE_VERSION 1
+
+RecordType* hllRecordType;
+RecordType* tdigestRecordType;
+
+typedef struct HllRecord{
+    Record base;
+    uint8_t* registers;
+}HllRecord;
+
+typedef struct TDigestCentroid{
+    double mean;
+    double weight;
+}TDigestCentroid;
+
+typedef struct TDigestRecord{
+    Record base;
+    TDigestCentroid* points; // the first 'merged' points are compressed centroids sorted by mean
+    size_t len;
+    size_t merged;
+    size_t cap;
+    double totalWeight;
+    double min;
+    double max;
+}TDigestRecord;
+
+typedef struct QuantilesArg{
+    double* quantiles;
+    size_t len;
+}QuantilesArg;
+
+/*
+ * MurmurHash64A, the hash must be the same on all the shards so their hlls can be merged.
+ */
+static uint64_t Sketches_Hash(const char* key, size_t len){
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0xadc83b19ULL ^ (len * m);
+    const unsigned char* data = (const unsigned char*)key;
+    const unsigned char* end = data + (len - len % 8);
+    while(data != end){
+        uint64_t k;
+        memcpy(&k, data, sizeof(k));
+        data += 8;
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    switch(len & 7){
+    case 7: h ^= (uint64_t)data[6] << 48; // fall through
+    case 6: h ^= (uint64_t)data[5] << 40; // fall through
+    case 5: h ^= (uint64_t)data[4] << 32; // fall through
+    case 4: h ^= (uint64_t)data[3] << 24; // fall through
+    case 3: h ^= (uint64_t)data[2] << 16; // fall through
+    case 2: h ^= (uint64_t)data[1] << 8; // fall through
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+Record* Sketches_HllRecordCreate(){
+    HllRecord* r = (HllRecord*)RG_RecordCreate(hllRecordType);
+    r->registers = RG_CALLOC(HLL_REGISTERS, sizeof(uint8_t));
+    return &r->base;
+}
+
+void Sketches_HllRecordAdd(Record* base, const char* buff, size_t len){
+    RedisModule_Assert(base->type == hllRecordType);
+    HllRecord* r = (HllRecord*)base;
+    uint64_t hash = Sketches_Hash(buff, len);
+    size_t index = hash >> (64 - HLL_P);
+    // the remaining bits, with a stop bit so the rank is bounded
+    uint64_t bits = (hash << HLL_P) | (1ULL << (HLL_P - 1));
+    uint8_t rank = __builtin_clzll(bits) + 1;
+    if(rank > r->registers[index]){
+        r->registers[index] = rank;
+    }
+}
+
+void Sketches_HllRecordMerge(Record* base, Record* other){
+    RedisModule_Assert(base->type == hllRecordType && other->type == hllRecordType);
+    HllRecord* r = (HllRecord*)base;
+    HllRecord* o = (HllRecord*)other;
+    for(size_t i = 0 ; i < HLL_REGISTERS ; ++i){
+        if(o->registers[i] > r->registers[i]){
+            r->registers[i] = o->registers[i];
+        }
+    }
+}
+
+long long Sketches_HllRecordCount(Record* base){
+    RedisModule_Assert(base->type == hllRecordType);
+    HllRecord* r = (HllRecord*)base;
+    double m = HLL_REGISTERS;
+    double sum = 0;
+    size_t zeros = 0;
+    for(size_t i = 0 ; i < HLL_REGISTERS ; ++i){
+        sum += ldexp(1.0, -r->registers[i]);
+        if(r->registers[i] == 0){
+            ++zeros;
+        }
+    }
+    double alpha = 0.7213 / (1 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+    if(estimate <= 2.5 * m && zeros > 0){
+        // small range correction (linear counting)
+        estimate = m * log(m / zeros);
+    }
+    return llround(estimate);
+}
+
+static int HllRecord_SendReply(Record* r, RedisModuleCtx* rctx){
+    RedisModule_ReplyWithLongLong(rctx, Sketches_HllRecordCount(r));
+    return REDISMODULE_OK;
+}
+
+static int HllRecord_Serialize(Gears_BufferWriter* bw, Record* base, char** err){
+    HllRecord* r = (HllRecord*)base;
+    RedisGears_BWWriteBuffer(bw, (char*)r->registers, HLL_REGISTERS);
+    return REDISMODULE_OK;
+}
+
+static Record* HllRecord_Deserialize(Gears_BufferReader* br){
+    Record* base = Sketches_HllRecordCreate();
+    HllRecord* r = (HllRecord*)base;
+    size_t len;
+    char* registers = RedisGears_BRReadBuffer(br, &len);
+    RedisModule_Assert(len == HLL_REGISTERS);
+    memcpy(r->registers, registers, HLL_REGISTERS);
+    return base;
+}
+
+static void HllRecord_Free(Record* base){
+    HllRecord* r = (HllRecord*)base;
+    RG_FREE(r->registers);
+}
+
+Record* Sketches_TDigestRecordCreate(){
+    TDigestRecord* r = (TDigestRecord*)RG_RecordCreate(tdigestRecordType);
+    r->cap = TDIGEST_INITIAL_CAP;
+    r->points = RG_ALLOC(r->cap * sizeof(TDigestCentroid));
+    r->len = 0;
+    r->merged = 0;
+    r->totalWeight = 0;
+    r->min = INFINITY;
+    r->max = -INFINITY;
+    return &r->base;
+}
+
+static int TDigest_CompareCentroids(const void* a, const void* b){
+    double m1 = ((const TDigestCentroid*)a)->mean;
+    double m2 = ((const TDigestCentroid*)b)->mean;
+    return (m1 > m2) - (m1 < m2);
+}
+
+/*
+ * Merge the buffered points into the centroids. Neighbour centroids are merged as long as
+ * the result stays below 4 * total * q * (1 - q) / compression, so centroids at the tails
+ * stay small and the quantiles there are accurate.
+ */
+static void TDigest_Compress(TDigestRecord* r){
+    if(r->merged == r->len){
+        return;
+    }
+    qsort(r->points, r->len, sizeof(TDigestCentroid), TDigest_CompareCentroids);
+    double total = r->totalWeight;
+    double weightSoFar = 0;
+    size_t newLen = 0;
+    TDigestCentroid curr = r->points[0];
+    for(size_t i = 1 ; i < r->len ; ++i){
+        TDigestCentroid* p = r->points + i;
+        double proposed = curr.weight + p->weight;
+        double q0 = weightSoFar / total;
+        double q2 = (weightSoFar + proposed) / total;
+        double limit = 4 * total * fmin(q0 * (1 - q0), q2 * (1 - q2)) / TDIGEST_COMPRESSION;
+        if(proposed <= limit){
+            curr.mean += (p->mean - curr.mean) * p->weight / proposed;
+            curr.weight = proposed;
+        }else{
+            weightSoFar += curr.weight;
+            r->points[newLen++] = curr;
+            curr = *p;
+        }
+    }
+    r->points[newLen++] = curr;
+    r->len = r->merged = newLen;
+}
+
+static void TDigest_AddPoint(TDigestRecord* r, double mean, double weight){
+    if(r->len == r->cap){
+        TDigest_Compress(r);
+        if(r->len > r->cap / 2){
+            r->cap *= 2;
+            r->points = RG_REALLOC(r->points, r->cap * sizeof(TDigestCentroid));
+        }
+    }
+    r->points[r->len++] = (TDigestCentroid){.mean = mean, .weight = weight};
+    r->totalWeight += weight;
+}
+
+void Sketches_TDigestRecordAdd(Record* base, double val, double weight){
+    RedisModule_Assert(base->type == tdigestRecordType);
+    TDigestRecord* r = (TDigestRecord*)base;
+    if(isnan(val)){
+        return;
+    }
+    TDigest_AddPoint(r, val, weight);
+    r->min = fmin(r->min, val);
+    r->max = fmax(r->max, val);
+}
+
+void Sketches_TDigestRecordMerge(Record* base, Record* other){
+    RedisModule_Assert(base->type == tdigestRecordType && other->type == tdigestRecordType);
+    TDigestRecord* r = (TDigestRecord*)base;
+    TDigestRecord* o = (TDigestRecord*)other;
+    for(size_t i = 0 ; i < o->len ; ++i){
+        TDigest_AddPoint(r, o->points[i].mean, o->points[i].weight);
+    }
+    r->min = fmin(r->min, o->min);
+    r->max = fmax(r->max, o->max);
+}
+
+double Sketches_TDigestRecordQuantile(Record* base, double q){
+    RedisModule_Assert(base->type == tdigestRecordType);
+    TDigestRecord* r = (TDigestRecord*)base;
+    TDigest_Compress(r);
+    if(r->len == 0){
+        return NAN;
+    }
+    if(q <= 0){
+        return r->min;
+    }
+    if(q >= 1){
+        return r->max;
+    }
+    double target = q * r->totalWeight;
+    // each centroid is considered to be centered on the middle of its weight range
+    double prevCenter = 0;
+    double prevMean = r->min;
+    double weightSoFar = 0;
+    for(size_t i = 0 ; i < r->len ; ++i){
+        double center = weightSoFar + r->points[i].weight / 2;
+        if(target < center){
+            double t = center > prevCenter ? (target - prevCenter) / (center - prevCenter) : 0;
+            return prevMean + t * (r->points[i].mean - prevMean);
+        }
+        prevCenter = center;
+        prevMean = r->points[i].mean;
+        weightSoFar += r->points[i].weight;
+    }
+    double t = r->totalWeight > prevCenter ? (target - prevCenter) / (r->totalWeight - prevCenter) : 0;
+    return prevMean + t * (r->max - prevMean);
+}
+
+static int TDigestRecord_SendReply(Record* r, RedisModuleCtx* rctx){
+    // the median is the most sensible single value to show
+    RedisModule_ReplyWithDouble(rctx, Sketches_TDigestRecordQuantile(r, 0.5));
+    return REDISMODULE_OK;
+}
+
+static int TDigestRecord_Serialize(Gears_BufferWriter* bw, Record* base, char** err){
+    TDigestRecord* r = (TDigestRecord*)base;
+    TDigest_Compress(r);
+    double bounds[2] = {r->min, r->max};
+    RedisGears_BWWriteBuffer(bw, (char*)bounds, sizeof(bounds));
+    RedisGears_BWWriteBuffer(bw, (char*)r->points, r->len * sizeof(TDigestCentroid));
+    return REDISMODULE_OK;
+}
+
+static Record* TDigestRecord_Deserialize(Gears_BufferReader* br){
+    Record* base = Sketches_TDigestRecordCreate();
+    TDigestRecord* r = (TDigestRecord*)base;
+    size_t len;
+    double* bounds = (double*)RedisGears_BRReadBuffer(br, &len);
+    RedisModule_Assert(len == 2 * sizeof(double));
+    r->min = bounds[0];
+    r->max = bounds[1];
+    TDigestCentroid* points = (TDigestCentroid*)RedisGears_BRReadBuffer(br, &len);
+    len /= sizeof(TDigestCentroid);
+    if(len > r->cap){
+        r->cap = len;
+        r->points = RG_REALLOC(r->points, r->cap * sizeof(TDigestCentroid));
+    }
+    memcpy(r->points, points, len * sizeof(TDigestCentroid));
+    r->len = r->merged = len;
+    for(size_t i = 0 ; i < len ; ++i){
+        r->totalWeight += r->points[i].weight;
+    }
+    return base;
+}
+
+static void TDigestRecord_Free(Record* base){
+    TDigestRecord* r = (TDigestRecord*)base;
+    RG_FREE(r->points);
+}
+
+Record* HllAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    if(!accumulate){
+        accumulate = Sketches_HllRecordCreate();
+    }
+    if(RedisGears_RecordGetType(r) == hllRecordType){
+        // partial result of another shard
+        Sketches_HllRecordMerge(accumulate, r);
+        RedisGears_FreeRecord(r);
+        return accumulate;
+    }
+    char* err = NULL;
+    char* key = Reducers_DistinctKey(r, &err);
+    RedisGears_FreeRecord(r);
+    if(!key){
+        RedisGears_SetError(rctx, err ? err : RG_STRDUP("HllAccumulator failed serializing record"));
+        RedisGears_FreeRecord(accumulate);
+        return NULL;
+    }
+    Sketches_HllRecordAdd(accumulate, key, strlen(key));
+    RG_FREE(key);
+    return accumulate;
+}
+
+Record* HllCountMapper(ExecutionCtx* rctx, Record *record, void* arg){
+    if(RedisGears_RecordGetType(record) != hllRecordType){
+        RedisGears_SetError(rctx, RG_STRDUP("HllCountMapper works only on hll records"));
+        RedisGears_FreeRecord(record);
+        return NULL;
+    }
+    long long count = Sketches_HllRecordCount(record);
+    RedisGears_FreeRecord(record);
+    return RedisGears_LongRecordCreate(count);
+}
+
+Record* TDigestAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    if(RedisGears_RecordGetType(r) != tdigestRecordType &&
+       RedisGears_RecordGetType(r) != longRecordType &&
+       RedisGears_RecordGetType(r) != doubleRecordType){
+        RedisGears_SetError(rctx, RG_STRDUP("TDigestAccumulator works only on long and double records"));
+        if(accumulate){
+            RedisGears_FreeRecord(accumulate);
+        }
+        RedisGears_FreeRecord(r);
+        return NULL;
+    }
+    if(!accumulate){
+        accumulate = Sketches_TDigestRecordCreate();
+    }
+    if(RedisGears_RecordGetType(r) == tdigestRecordType){
+        // partial result of another shard
+        Sketches_TDigestRecordMerge(accumulate, r);
+    }else if(RedisGears_RecordGetType(r) == longRecordType){
+        Sketches_TDigestRecordAdd(accumulate, RedisGears_LongRecordGet(r), 1);
+    }else{
+        Sketches_TDigestRecordAdd(accumulate, RedisGears_DoubleRecordGet(r), 1);
+    }
+    RedisGears_FreeRecord(r);
+    return accumulate;
+}
+
+Record* TDigestQuantilesMapper(ExecutionCtx* rctx, Record *record, void* arg){
+    QuantilesArg* qa = arg;
+    if(RedisGears_RecordGetType(record) != tdigestRecordType){
+        RedisGears_SetError(rctx, RG_STRDUP("TDigestQuantilesMapper works only on t-digest records"));
+        RedisGears_FreeRecord(record);
+        return NULL;
+    }
+    Record* res = RedisGears_ListRecordCreate(qa->len);
+    for(size_t i = 0 ; i < qa->len ; ++i){
+        RedisGears_ListRecordAdd(res, RedisGears_DoubleRecordCreate(Sketches_TDigestRecordQuantile(record, qa->quantiles[i])));
+    }
+    RedisGears_FreeRecord(record);
+    return res;
+}
+
+void* Sketches_QuantilesArgCreate(const double* quantiles, size_t len){
+    QuantilesArg* qa = RG_ALLOC(sizeof(*qa));
+    qa->len = len;
+    qa->quantiles = RG_ALLOC(len * sizeof(double));
+    memcpy(qa->quantiles, quantiles, len * sizeof(double));
+    return qa;
+}
+
+static void Sketches_QuantilesArgFree(void* arg){
+    QuantilesArg* qa = arg;
+    RG_FREE(qa->quantiles);
+    RG_FREE(qa);
+}
+
+static void* Sketches_QuantilesArgDup(void* arg){
+    QuantilesArg* qa = arg;
+    return Sketches_QuantilesArgCreate(qa->quantiles, qa->len);
+}
+
+static int Sketches_QuantilesArgSerialize(void* arg, Gears_BufferWriter* bw, char** err){
+    QuantilesArg* qa = arg;
+    RedisGears_BWWriteBuffer(bw, (char*)qa->quantiles, qa->len * sizeof(double));
+    return REDISMODULE_OK;
+}
+
+static void* Sketches_QuantilesArgDeserialize(FlatExecutionPlan* fep, Gears_BufferReader* br, int version, char** err){
+    if(version > QUANTILES_TYPE_VERSION){
+        *err = RG_STRDUP("unsupported quantiles argument version");
+        return NULL;
+    }
+    size_t len;
+    double* quantiles = (double*)RedisGears_BRReadBuffer(br, &len);
+    return Sketches_QuantilesArgCreate(quantiles, len / sizeof(double));
+}
+
+static char* Sketches_QuantilesArgToString(void* arg){
+    QuantilesArg* qa = arg;
+    char* res = RG_STRDUP("[");
+    for(size_t i = 0 ; i < qa->len ; ++i){
+        char* temp;
+        rg_asprintf(&temp, "%s%s%g", res, i ? ", " : "", qa->quantiles[i]);
+        RG_FREE(res);
+        res = temp;
+    }
+    char* temp;
+    rg_asprintf(&temp, "%s]", res);
+    RG_FREE(res);
+    return temp;
+}
+
+void Sketches_Initialize(){
+    hllRecordType = RG_RecordTypeCreate("HllRecord", sizeof(HllRecord),
+                                        HllRecord_SendReply,
+                                        HllRecord_Serialize,
+                                        HllRecord_Deserialize,
+                                        HllRecord_Free);
+
+    tdigestRecordType = RG_RecordTypeCreate("TDigestRecord", sizeof(TDigestRecord),
+                                            TDigestRecord_SendReply,
+                                            TDigestRecord_Serialize,
+                                            TDigestRecord_Deserialize,
+                                            TDigestRecord_Free);
+
+    ArgType* quantilesType = RedisGears_CreateType("QuantilesType",
+                                                   QUANTILES_TYPE_VERSION,
+                                                   Sketches_QuantilesArgFree,
+                                                   Sketches_QuantilesArgDup,
+                                                   Sketches_QuantilesArgSerialize,
+                                                   Sketches_QuantilesArgDeserialize,
+                                                   Sketches_QuantilesArgToString);
+
+    RGM_RegisterAccumulator(HllAccumulator, NULL);
+    RGM_RegisterMap(HllCountMapper, NULL);
+    RGM_RegisterAccumulator(TDigestAccumulator, NULL);
+    RGM_RegisterMap(TDigestQuantilesMapper, quantilesType);
+}
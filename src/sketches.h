@@ -0,0 +1,48 @@
+/*
+ * sketches.h
+ *
+ * Approximate aggregations with bounded memory: a HyperLogLog distinct count
+ * and a t-digest quantiles sketch. Both are records that can be merged, so each
+ * shard builds its own sketch and only the sketches are collected.
+ */
+
+#ifndef SRC_SKETCHES_H_
+#define SRC_SKETCHES_H_
+
+#include "redisgears.h"
+
+extern RecordType* hllRecordType;
+extern RecordType* tdigestRecordType;
+
+void Sketches_Initialize();
+
+/** HyperLogLog record api, ~0.8% standard error using 16KB **/
+Record* Sketches_HllRecordCreate();
+void Sketches_HllRecordAdd(Record* r, const char* buff, size_t len);
+void Sketches_HllRecordMerge(Record* r, Record* other);
+long long Sketches_HllRecordCount(Record* r);
+
+/** t-digest record api **/
+Record* Sketches_TDigestRecordCreate();
+void Sketches_TDigestRecordAdd(Record* r, double val, double weight);
+void Sketches_TDigestRecordMerge(Record* r, Record* other);
+/* Return NAN if the digest is empty */
+double Sketches_TDigestRecordQuantile(Record* r, double q);
+
+/*
+ * Argument of TDigestQuantilesMapper, the quantiles array is copied.
+ */
+void* Sketches_QuantilesArgCreate(const double* quantiles, size_t len);
+
+/*
+ * HllAccumulator adds records by their value (see Reducers_DistinctKey) and merges hll records,
+ * HllCountMapper turns the hll into the estimated count (a long record).
+ * TDigestAccumulator adds long and double records and merges t-digest records,
+ * TDigestQuantilesMapper turns the t-digest into a list of the requested quantiles.
+ */
+Record* HllAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
+Record* HllCountMapper(ExecutionCtx* rctx, Record *record, void* arg);
+Record* TDigestAccumulator(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg);
+Record* TDigestQuantilesMapper(ExecutionCtx* rctx, Record *record, void* arg);
+
+#endif /* SRC_SKETCHES_H_ */
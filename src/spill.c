@@ -0,0 +1,292 @@
+/*
+ * spill.c
+ *
+ * Temporary files used by executions to hold records that did not fit
+ * the execution memory budget.
+ */
+
+#include "spill.h"
+#include "record.h"
+#include "config.h"
+#include "redisgears_memory.h"
+#include "utils/arr_rm_alloc.h"
+#include "utils/buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define SPILL_FILE_BUFFER_SIZE (64 * 1024)
+
+struct SpillFile{
+    int fd;
+    size_t len;            // records written and not yet read
+    off_t fileSize;        // bytes flushed to the file
+    off_t readOffset;      // file offset of the data that was not yet loaded to readBuff
+    Gears_Buffer* writeBuff;
+    Gears_Buffer* readBuff;
+    size_t readPos;        // position of the next record on readBuff
+    RecordsEncoder enc;    // the file is a single records batch, until it is truncated
+    RecordsDecoder dec;
+};
+
+SpillFile* SpillFile_Create(char** err){
+    const char* dir = GearsConfig_ExecutionSpillDir();
+    size_t pathLen = strlen(dir) + sizeof("/rg_spill_XXXXXX");
+    char* path = RG_ALLOC(pathLen);
+    snprintf(path, pathLen, "%s/rg_spill_XXXXXX", dir);
+    int fd = mkstemp(path);
+    if(fd < 0){
+        RG_FREE(path);
+        *err = RG_STRDUP(strerror(errno));
+        return NULL;
+    }
+    // the file is removed right away, it will be deleted once closed (or if we crash)
+    unlink(path);
+    RG_FREE(path);
+
+    SpillFile* sf = RG_ALLOC(sizeof(*sf));
+    sf->fd = fd;
+    sf->len = 0;
+    sf->fileSize = 0;
+    sf->readOffset = 0;
+    sf->writeBuff = Gears_BufferNew(SPILL_FILE_BUFFER_SIZE);
+    sf->readBuff = Gears_BufferNew(SPILL_FILE_BUFFER_SIZE);
+    sf->readPos = 0;
+    RG_RecordsEncoderInit(&sf->enc);
+    RG_RecordsDecoderInit(&sf->dec);
+    return sf;
+}
+
+void SpillFile_Free(SpillFile* sf){
+    close(sf->fd);
+    Gears_BufferFree(sf->writeBuff);
+    Gears_BufferFree(sf->readBuff);
+    RG_RecordsEncoderFree(&sf->enc);
+    RG_RecordsDecoderFree(&sf->dec);
+    RG_FREE(sf);
+}
+
+static int SpillFile_Flush(SpillFile* sf, char** err){
+    size_t written = 0;
+    while(written < sf->writeBuff->size){
+        ssize_t n = pwrite(sf->fd, sf->writeBuff->buff + written, sf->writeBuff->size - written, sf->fileSize + written);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            *err = RG_STRDUP(strerror(errno));
+            return REDISMODULE_ERR;
+        }
+        written += n;
+    }
+    sf->fileSize += written;
+    Gears_BufferClear(sf->writeBuff);
+    return REDISMODULE_OK;
+}
+
+int SpillFile_Write(SpillFile* sf, Record* r, char** err){
+    // flush before encoding, a record that was encoded must reach the file or the decoder will miss its fields names
+    if(sf->writeBuff->size >= SPILL_FILE_BUFFER_SIZE){
+        if(SpillFile_Flush(sf, err) != REDISMODULE_OK){
+            return REDISMODULE_ERR;
+        }
+    }
+    size_t start = sf->writeBuff->size;
+    Gears_BufferWriter bw;
+    Gears_BufferWriterInit(&bw, sf->writeBuff);
+    // each record is prefixed with its serialized size
+    RedisGears_BWWriteLong(&bw, 0);
+    if(RG_RecordEncode(&sf->enc, &bw, r, err) != REDISMODULE_OK){
+        sf->writeBuff->size = start;
+        return REDISMODULE_ERR;
+    }
+    long recordSize = sf->writeBuff->size - start - sizeof(long);
+    memcpy(sf->writeBuff->buff + start, &recordSize, sizeof(long));
+    ++sf->len;
+    return REDISMODULE_OK;
+}
+
+/*
+ * Make sure readBuff holds at least 'size' bytes after readPos.
+ */
+static int SpillFile_Load(SpillFile* sf, size_t size, char** err){
+    size_t available = sf->readBuff->size - sf->readPos;
+    if(available >= size){
+        return REDISMODULE_OK;
+    }
+    // keep the leftover of the current record at the beginning of the buffer
+    memmove(sf->readBuff->buff, sf->readBuff->buff + sf->readPos, available);
+    sf->readBuff->size = available;
+    sf->readPos = 0;
+    size_t missing = size - available;
+    if(sf->readOffset + (off_t)missing > sf->fileSize){
+        // the data we need was not yet flushed
+        if(SpillFile_Flush(sf, err) != REDISMODULE_OK){
+            return REDISMODULE_ERR;
+        }
+    }
+    // read ahead a full buffer, or the entire record if it is bigger
+    size_t maxRead = missing > SPILL_FILE_BUFFER_SIZE ? missing : SPILL_FILE_BUFFER_SIZE;
+    size_t toRead = sf->fileSize - sf->readOffset;
+    if(toRead > maxRead){
+        toRead = maxRead;
+    }
+    if(sf->readBuff->cap < available + toRead){
+        sf->readBuff->cap = available + toRead;
+        sf->readBuff->buff = RG_REALLOC(sf->readBuff->buff, sf->readBuff->cap);
+    }
+    size_t read = 0;
+    while(read < toRead){
+        ssize_t n = pread(sf->fd, sf->readBuff->buff + available + read, toRead - read, sf->readOffset + read);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            *err = RG_STRDUP(n < 0 ? strerror(errno) : "unexpected end of file");
+            return REDISMODULE_ERR;
+        }
+        read += n;
+    }
+    sf->readOffset += read;
+    sf->readBuff->size += read;
+    return sf->readBuff->size >= size ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+static void SpillFile_Truncate(SpillFile* sf){
+    if(ftruncate(sf->fd, 0) != 0){
+        RedisModule_Log(NULL, "warning", "Failed truncating spill file, %s", strerror(errno));
+    }
+    sf->fileSize = 0;
+    sf->readOffset = 0;
+    sf->readPos = 0;
+    Gears_BufferClear(sf->readBuff);
+    Gears_BufferClear(sf->writeBuff);
+    RG_RecordsEncoderReset(&sf->enc);
+    RG_RecordsDecoderReset(&sf->dec);
+}
+
+Record* SpillFile_Read(SpillFile* sf){
+    if(sf->len == 0){
+        return NULL;
+    }
+    char* err = NULL;
+    long recordSize;
+    if(SpillFile_Load(sf, sizeof(long), &err) != REDISMODULE_OK){
+        goto error;
+    }
+    memcpy(&recordSize, sf->readBuff->buff + sf->readPos, sizeof(long));
+    if(SpillFile_Load(sf, sizeof(long) + recordSize, &err) != REDISMODULE_OK){
+        goto error;
+    }
+    Gears_Buffer recordBuff = {
+        .buff = sf->readBuff->buff + sf->readPos + sizeof(long),
+        .size = recordSize,
+        .cap = recordSize,
+    };
+    Gears_BufferReader br;
+    Gears_BufferReaderInit(&br, &recordBuff);
+    Record* r = RG_RecordDecode(&sf->dec, &br);
+    sf->readPos += sizeof(long) + recordSize;
+    if(--sf->len == 0){
+        SpillFile_Truncate(sf);
+    }
+    return r;
+
+error:
+    RedisModule_Log(NULL, "warning", "Failed reading spilled records, %s", err ? err : "");
+    char* msg = RG_STRDUP("Failed reading spilled records");
+    Record* errRecord = RG_ErrorRecordCreate(msg, strlen(msg) + 1);
+    if(err){
+        RG_FREE(err);
+    }
+    sf->len = 0;
+    SpillFile_Truncate(sf);
+    return errRecord;
+}
+
+size_t SpillFile_Len(SpillFile* sf){
+    return sf->len;
+}
+
+bool Spill_IsOverBudget(size_t memoryUsage){
+    long long budget = GearsConfig_ExecutionMemoryBudget();
+    return budget > 0 && memoryUsage > (size_t)budget;
+}
+
+void SpillableRecords_Init(SpillableRecords* sr, size_t* memoryUsage){
+#define SPILLABLE_RECORDS_INITIAL_SIZE 10
+    sr->records = array_new(Record*, SPILLABLE_RECORDS_INITIAL_SIZE);
+    sr->file = NULL;
+    sr->memoryUsage = memoryUsage;
+}
+
+void SpillableRecords_Add(SpillableRecords* sr, Record* r){
+    if(GearsConfig_ExecutionMemoryBudget() == 0){
+        sr->records = array_append(sr->records, r);
+        return;
+    }
+    if(Spill_IsOverBudget(*sr->memoryUsage) && RedisGears_RecordGetType(r) != errorRecordType){
+        char* err = NULL;
+        if(!sr->file){
+            sr->file = SpillFile_Create(&err);
+            if(!sr->file){
+                RedisModule_Log(NULL, "warning", "Failed creating spill file on %s, %s", GearsConfig_ExecutionSpillDir(), err);
+                RG_FREE(err);
+                err = NULL;
+            }
+        }
+        if(sr->file){
+            if(SpillFile_Write(sr->file, r, &err) == REDISMODULE_OK){
+                RedisGears_FreeRecord(r);
+                return;
+            }
+            // the record can not be serialized or the write failed, keep it in memory
+            if(err){
+                RG_FREE(err);
+            }
+        }
+    }
+    *sr->memoryUsage += RG_RecordEstimateMemory(r);
+    sr->records = array_append(sr->records, r);
+}
+
+Record* SpillableRecords_Pop(SpillableRecords* sr){
+    if(array_len(sr->records) > 0){
+        Record* r = array_pop(sr->records);
+        if(*sr->memoryUsage > 0){
+            size_t size = RG_RecordEstimateMemory(r);
+            // the budget might have been turned on after the record was added
+            *sr->memoryUsage -= size < *sr->memoryUsage ? size : *sr->memoryUsage;
+        }
+        return r;
+    }
+    if(sr->file){
+        return SpillFile_Read(sr->file);
+    }
+    return NULL;
+}
+
+size_t SpillableRecords_Len(SpillableRecords* sr){
+    return array_len(sr->records) + (sr->file ? SpillFile_Len(sr->file) : 0);
+}
+
+void SpillableRecords_Clear(SpillableRecords* sr){
+    while(array_len(sr->records) > 0){
+        RedisGears_FreeRecord(SpillableRecords_Pop(sr));
+    }
+    if(sr->file){
+        // no need to read back the spilled records just to free them
+        sr->file->len = 0;
+        SpillFile_Truncate(sr->file);
+    }
+}
+
+void SpillableRecords_Free(SpillableRecords* sr){
+    SpillableRecords_Clear(sr);
+    array_free(sr->records);
+    if(sr->file){
+        SpillFile_Free(sr->file);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * spill.h
+ *
+ * Temporary files used by executions to hold records that did not fit
+ * the execution memory budget (see ExecutionMemoryBudget configuration).
+ */
+
+#ifndef SRC_SPILL_H_
+#define SRC_SPILL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "redisgears.h"
+
+/*
+ * FIFO of serialized records on a temporary file.
+ * Records can be written and read interchangeably, the file is truncated
+ * whenever all the records written to it were read.
+ */
+typedef struct SpillFile SpillFile;
+
+SpillFile* SpillFile_Create(char** err);
+void SpillFile_Free(SpillFile* sf);
+
+/*
+ * Write the record to the file, the record is not freed.
+ * On failure (the record can not be serialized or the write failed) nothing is written.
+ */
+int SpillFile_Write(SpillFile* sf, Record* r, char** err);
+
+/*
+ * Read the next record from the file, return NULL if there are no more records.
+ * On read failure an error record is returned and the rest of the records are dropped.
+ */
+Record* SpillFile_Read(SpillFile* sf);
+
+size_t SpillFile_Len(SpillFile* sf);
+
+/*
+ * Records buffered by a step until they are consumed.
+ * Records are held in memory as long as the execution is within its memory budget,
+ * after that they are written to a spill file.
+ * 'memoryUsage' is the memory used by all the buffers of the execution.
+ */
+typedef struct SpillableRecords{
+    Record** records;
+    SpillFile* file;
+    size_t* memoryUsage;
+}SpillableRecords;
+
+void SpillableRecords_Init(SpillableRecords* sr, size_t* memoryUsage);
+void SpillableRecords_Add(SpillableRecords* sr, Record* r);
+Record* SpillableRecords_Pop(SpillableRecords* sr);
+size_t SpillableRecords_Len(SpillableRecords* sr);
+void SpillableRecords_Clear(SpillableRecords* sr);
+void SpillableRecords_Free(SpillableRecords* sr);
+
+/*
+ * Return true if the execution memory usage is above the budget.
+ */
+bool Spill_IsOverBudget(size_t memoryUsage);
+
+#endif /* SRC_SPILL_H_ */
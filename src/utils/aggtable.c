@@ -0,0 +1,228 @@
+/*
+ * aggtable.c
+ *
+ * Flat open addressing hash table used to aggregate records by key.
+ */
+
+#include "aggtable.h"
+#include "dict.h"
+#include "../redisgears_memory.h"
+#include "redismodule.h"
+#include <string.h>
+
+#define AGG_TABLE_INIT_INDEX_SIZE 16
+#define AGG_TABLE_INIT_ENTRIES 8
+
+/*
+ * Each index slot holds the upper 32 bits of the key hash and the entry position + 1,
+ * so empty slots are 0 and mismatches are usually detected without touching the entry.
+ */
+#define AGG_TABLE_EMPTY 0
+#define AGG_TABLE_TOMBSTONE UINT64_MAX
+#define AGG_TABLE_MAX_ENTRIES (UINT32_MAX - 1)
+#define AGG_TABLE_HASH_TAG(h) ((uint32_t)((h) >> 32))
+#define AGG_TABLE_SLOT(h, pos) (((uint64_t)AGG_TABLE_HASH_TAG(h) << 32) | ((uint64_t)(pos) + 1))
+#define AGG_TABLE_SLOT_TAG(s) ((uint32_t)((s) >> 32))
+#define AGG_TABLE_SLOT_POS(s) ((uint32_t)(s) - 1)
+
+/*
+ * Keys above GEARS_ARENA_MAX_ALLOC are taken from the heap and freed one by one on clear.
+ */
+static char* Gears_AggTableKeyAlloc(Gears_AggTable* t, size_t keyLen){
+    if(!t->arena){
+        t->arena = Gears_ArenaCreate();
+    }
+    char* key = Gears_ArenaAlloc(t->arena, keyLen);
+    return key ? key : RG_ALLOC(keyLen);
+}
+
+static inline const char* Gears_AggTableEntryKey(Gears_AggTableEntry* e){
+    return e->keyLen <= GEARS_AGG_TABLE_INLINE_KEY_SIZE ? e->inlineKey : e->key;
+}
+
+Gears_AggTable* Gears_AggTableCreate(){
+    Gears_AggTable* t = RG_ALLOC(sizeof(*t));
+    t->indexSize = AGG_TABLE_INIT_INDEX_SIZE;
+    t->index = RG_CALLOC(t->indexSize, sizeof(uint64_t));
+    t->used = 0;
+    t->cap = AGG_TABLE_INIT_ENTRIES;
+    t->entries = RG_ALLOC(t->cap * sizeof(Gears_AggTableEntry));
+    t->len = 0;
+    t->size = 0;
+    t->arena = NULL;
+    return t;
+}
+
+void Gears_AggTableClear(Gears_AggTable* t, Gears_AggTableFreeValFunc freeVal){
+    for(size_t i = 0 ; i < t->len ; ++i){
+        Gears_AggTableEntry* e = t->entries + i;
+        if(!e->deleted && e->val && freeVal){
+            freeVal(e->val);
+        }
+        if(e->keyLen > GEARS_ARENA_MAX_ALLOC){
+            RG_FREE(e->key);
+        }
+    }
+    memset(t->index, 0, t->indexSize * sizeof(uint64_t));
+    t->used = 0;
+    t->len = 0;
+    t->size = 0;
+    if(t->arena){
+        Gears_ArenaFree(t->arena);
+        t->arena = NULL;
+    }
+}
+
+void Gears_AggTableFree(Gears_AggTable* t, Gears_AggTableFreeValFunc freeVal){
+    Gears_AggTableClear(t, freeVal);
+    RG_FREE(t->entries);
+    RG_FREE(t->index);
+    RG_FREE(t);
+}
+
+/*
+ * Return true if the key was found, slot is set to the key slot or to
+ * the slot the key should be added to.
+ */
+static bool Gears_AggTableLookup(Gears_AggTable* t, const char* key, size_t keyLen, uint64_t hash, size_t* slot){
+    size_t mask = t->indexSize - 1;
+    size_t i = hash & mask;
+    bool foundTombstone = false;
+    while(true){
+        uint64_t s = t->index[i];
+        if(s == AGG_TABLE_EMPTY){
+            if(!foundTombstone){
+                *slot = i;
+            }
+            return false;
+        }
+        if(s == AGG_TABLE_TOMBSTONE){
+            if(!foundTombstone){
+                foundTombstone = true;
+                *slot = i;
+            }
+        }else if(AGG_TABLE_SLOT_TAG(s) == AGG_TABLE_HASH_TAG(hash)){
+            Gears_AggTableEntry* e = t->entries + AGG_TABLE_SLOT_POS(s);
+            if(e->hash == hash && e->keyLen == keyLen && memcmp(Gears_AggTableEntryKey(e), key, keyLen) == 0){
+                *slot = i;
+                return true;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+/*
+ * Rebuild the index so it will be at most half full, this also drops the tombstones.
+ */
+static void Gears_AggTableRehash(Gears_AggTable* t){
+    size_t newSize = AGG_TABLE_INIT_INDEX_SIZE;
+    while(newSize < (t->size + 1) * 2){
+        newSize *= 2;
+    }
+    if(newSize != t->indexSize){
+        RG_FREE(t->index);
+        t->index = RG_CALLOC(newSize, sizeof(uint64_t));
+        t->indexSize = newSize;
+    }else{
+        memset(t->index, 0, t->indexSize * sizeof(uint64_t));
+    }
+    size_t mask = t->indexSize - 1;
+    for(size_t pos = 0 ; pos < t->len ; ++pos){
+        Gears_AggTableEntry* e = t->entries + pos;
+        if(e->deleted){
+            continue;
+        }
+        size_t i = e->hash & mask;
+        while(t->index[i] != AGG_TABLE_EMPTY){
+            i = (i + 1) & mask;
+        }
+        t->index[i] = AGG_TABLE_SLOT(e->hash, pos);
+    }
+    t->used = t->size;
+}
+
+void** Gears_AggTableFindOrAdd(Gears_AggTable* t, const char* key, size_t keyLen, bool* isNew){
+    uint64_t hash = Gears_dictGenHashFunction(key, keyLen);
+    size_t slot;
+    if(Gears_AggTableLookup(t, key, keyLen, hash, &slot)){
+        if(isNew){
+            *isNew = false;
+        }
+        return &t->entries[AGG_TABLE_SLOT_POS(t->index[slot])].val;
+    }
+
+    // keep the index at most 3/4 full so probing stays short
+    if((t->used + 1) * 4 > t->indexSize * 3){
+        Gears_AggTableRehash(t);
+        Gears_AggTableLookup(t, key, keyLen, hash, &slot);
+    }
+    RedisModule_Assert(t->len < AGG_TABLE_MAX_ENTRIES);
+    if(t->len == t->cap){
+        t->cap *= 2;
+        t->entries = RG_REALLOC(t->entries, t->cap * sizeof(Gears_AggTableEntry));
+    }
+    size_t pos = t->len++;
+    Gears_AggTableEntry* e = t->entries + pos;
+    e->hash = hash;
+    e->keyLen = keyLen;
+    e->deleted = false;
+    e->val = NULL;
+    if(keyLen <= GEARS_AGG_TABLE_INLINE_KEY_SIZE){
+        memcpy(e->inlineKey, key, keyLen);
+    }else{
+        e->key = Gears_AggTableKeyAlloc(t, keyLen);
+        memcpy(e->key, key, keyLen);
+    }
+    if(t->index[slot] == AGG_TABLE_EMPTY){
+        ++t->used;
+    }
+    t->index[slot] = AGG_TABLE_SLOT(hash, pos);
+    ++t->size;
+    if(isNew){
+        *isNew = true;
+    }
+    return &e->val;
+}
+
+void* Gears_AggTableFind(Gears_AggTable* t, const char* key, size_t keyLen){
+    uint64_t hash = Gears_dictGenHashFunction(key, keyLen);
+    size_t slot;
+    if(!Gears_AggTableLookup(t, key, keyLen, hash, &slot)){
+        return NULL;
+    }
+    return t->entries[AGG_TABLE_SLOT_POS(t->index[slot])].val;
+}
+
+void* Gears_AggTableDelete(Gears_AggTable* t, const char* key, size_t keyLen){
+    uint64_t hash = Gears_dictGenHashFunction(key, keyLen);
+    size_t slot;
+    if(!Gears_AggTableLookup(t, key, keyLen, hash, &slot)){
+        return NULL;
+    }
+    Gears_AggTableEntry* e = t->entries + AGG_TABLE_SLOT_POS(t->index[slot]);
+    t->index[slot] = AGG_TABLE_TOMBSTONE;
+    void* val = e->val;
+    e->val = NULL;
+    e->deleted = true;
+    --t->size;
+    return val;
+}
+
+size_t Gears_AggTableLen(Gears_AggTable* t){
+    return t->size;
+}
+
+void* Gears_AggTableTakeNext(Gears_AggTable* t, size_t* pos){
+    for(; *pos < t->len ; ++(*pos)){
+        Gears_AggTableEntry* e = t->entries + *pos;
+        if(e->deleted || !e->val){
+            continue;
+        }
+        void* val = e->val;
+        e->val = NULL;
+        ++(*pos);
+        return val;
+    }
+    return NULL;
+}
@@ -0,0 +1,82 @@
+/*
+ * aggtable.h
+ *
+ * Flat open addressing hash table used to aggregate records by key
+ * (group and accumulatebykey steps).
+ *
+ * Entries are kept in a dense array by insertion order and the hash index
+ * only holds the entry position and a part of the hash, so lookups rarely
+ * touch the entries themselves. Short keys are stored inline on the entry,
+ * longer keys are copied to a Gears_Arena that is freed at once when the
+ * table is cleared.
+ */
+
+#ifndef SRC_UTILS_AGGTABLE_H_
+#define SRC_UTILS_AGGTABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "arena.h"
+
+#define GEARS_AGG_TABLE_INLINE_KEY_SIZE 16
+
+typedef struct Gears_AggTableEntry{
+    uint64_t hash;
+    uint32_t keyLen;
+    bool deleted;
+    union{
+        char inlineKey[GEARS_AGG_TABLE_INLINE_KEY_SIZE];
+        char* key;
+    };
+    void* val;
+}Gears_AggTableEntry;
+
+typedef struct Gears_AggTable{
+    uint64_t* index;
+    size_t indexSize;
+    size_t used; // entries and tombstones on the index
+    Gears_AggTableEntry* entries;
+    size_t len; // entries including deleted ones
+    size_t cap;
+    size_t size; // live entries
+    Gears_Arena* arena; // longer keys, created on first use
+}Gears_AggTable;
+
+typedef void (*Gears_AggTableFreeValFunc)(void* val);
+
+Gears_AggTable* Gears_AggTableCreate();
+
+/*
+ * Free the table, the free function is called on each value that was not taken out of the table.
+ */
+void Gears_AggTableFree(Gears_AggTable* t, Gears_AggTableFreeValFunc freeVal);
+
+/*
+ * Remove all the entries and release the keys arena, the table can be reused afterwards.
+ */
+void Gears_AggTableClear(Gears_AggTable* t, Gears_AggTableFreeValFunc freeVal);
+
+/*
+ * Return the value slot of the given key, the key is added (with a NULL value) if not exists.
+ * The returned pointer is valid until the next addition to the table.
+ */
+void** Gears_AggTableFindOrAdd(Gears_AggTable* t, const char* key, size_t keyLen, bool* isNew);
+
+void* Gears_AggTableFind(Gears_AggTable* t, const char* key, size_t keyLen);
+
+/*
+ * Delete the key from the table, the value is returned to the caller.
+ */
+void* Gears_AggTableDelete(Gears_AggTable* t, const char* key, size_t keyLen);
+
+size_t Gears_AggTableLen(Gears_AggTable* t);
+
+/*
+ * Take the values out of the table by insertion order, starting from *pos.
+ * The value is removed from the table and the ownership goes to the caller.
+ * Return NULL when there are no more values.
+ */
+void* Gears_AggTableTakeNext(Gears_AggTable* t, size_t* pos);
+
+#endif /* SRC_UTILS_AGGTABLE_H_ */
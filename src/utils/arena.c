@@ -0,0 +1,83 @@
+/*
+ * arena.c
+ *
+ * Execution scoped allocator for small objects.
+ */
+
+#include "arena.h"
+#include "arr_rm_alloc.h"
+#include "../redisgears_memory.h"
+#include "redismodule.h"
+#include <pthread.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_SIZE_CLASS(size) (((size) + GEARS_ARENA_ALIGN - 1) / GEARS_ARENA_ALIGN - 1)
+
+typedef struct Gears_ArenaFreeItem{
+    struct Gears_ArenaFreeItem* next;
+}Gears_ArenaFreeItem;
+
+static pthread_key_t _arenaKey;
+
+int Gears_ArenaInitialize(){
+    int err = pthread_key_create(&_arenaKey, NULL);
+    if(err){
+        return REDISMODULE_ERR;
+    }
+    return REDISMODULE_OK;
+}
+
+Gears_Arena* Gears_ArenaCreate(){
+    Gears_Arena* arena = RG_CALLOC(1, sizeof(*arena));
+    arena->chunks = array_new(char*, 10);
+    return arena;
+}
+
+void Gears_ArenaFree(Gears_Arena* arena){
+    for(size_t i = 0 ; i < array_len(arena->chunks) ; ++i){
+        RG_FREE(arena->chunks[i]);
+    }
+    array_free(arena->chunks);
+    RG_FREE(arena);
+}
+
+void* Gears_ArenaAlloc(Gears_Arena* arena, size_t size){
+    if(size == 0 || size > GEARS_ARENA_MAX_ALLOC){
+        return NULL;
+    }
+    size_t sizeClass = ARENA_SIZE_CLASS(size);
+    Gears_ArenaFreeItem* item = arena->freeLists[sizeClass];
+    if(item){
+        arena->freeLists[sizeClass] = item->next;
+        return item;
+    }
+    size = (sizeClass + 1) * GEARS_ARENA_ALIGN;
+    if(size > arena->left){
+        // the leftover of the current chunk is small, it is not worth tracking it
+        char* chunk = RG_ALLOC(ARENA_CHUNK_SIZE);
+        arena->chunks = array_append(arena->chunks, chunk);
+        arena->pos = chunk;
+        arena->left = ARENA_CHUNK_SIZE;
+    }
+    void* ret = arena->pos;
+    arena->pos += size;
+    arena->left -= size;
+    return ret;
+}
+
+void Gears_ArenaRelease(Gears_Arena* arena, void* p, size_t size){
+    size_t sizeClass = ARENA_SIZE_CLASS(size);
+    Gears_ArenaFreeItem* item = p;
+    item->next = arena->freeLists[sizeClass];
+    arena->freeLists[sizeClass] = item;
+}
+
+Gears_Arena* Gears_ArenaSetCurrent(Gears_Arena* arena){
+    Gears_Arena* old = pthread_getspecific(_arenaKey);
+    pthread_setspecific(_arenaKey, arena);
+    return old;
+}
+
+Gears_Arena* Gears_ArenaGetCurrent(){
+    return pthread_getspecific(_arenaKey);
+}
@@ -0,0 +1,53 @@
+/*
+ * arena.h
+ *
+ * Execution scoped allocator for small objects (mainly records).
+ *
+ * Memory is carved out of large chunks and freed objects are kept on
+ * per size free lists, all the memory is returned at once when the
+ * arena is freed. An arena is not thread safe, it should only be used
+ * by the thread it is set as current on (see Gears_ArenaSetCurrent),
+ * objects dropped on other threads are simply not reused.
+ */
+
+#ifndef SRC_UTILS_ARENA_H_
+#define SRC_UTILS_ARENA_H_
+
+#include <stddef.h>
+
+#define GEARS_ARENA_ALIGN 16
+#define GEARS_ARENA_MAX_ALLOC 256
+
+typedef struct Gears_Arena{
+    char** chunks;
+    char* pos;
+    size_t left;
+    void* freeLists[GEARS_ARENA_MAX_ALLOC / GEARS_ARENA_ALIGN];
+}Gears_Arena;
+
+int Gears_ArenaInitialize();
+
+Gears_Arena* Gears_ArenaCreate();
+
+/*
+ * Release all the memory of the arena, including objects that were not returned to it.
+ */
+void Gears_ArenaFree(Gears_Arena* arena);
+
+/*
+ * Return NULL if size is above GEARS_ARENA_MAX_ALLOC, the caller should use the heap instead.
+ */
+void* Gears_ArenaAlloc(Gears_Arena* arena, size_t size);
+
+/*
+ * Return an object to the arena so it can be reused, size must be the size it was allocated with.
+ */
+void Gears_ArenaRelease(Gears_Arena* arena, void* p, size_t size);
+
+/*
+ * Set the arena used by the current thread, return the previous one so it can be restored.
+ */
+Gears_Arena* Gears_ArenaSetCurrent(Gears_Arena* arena);
+Gears_Arena* Gears_ArenaGetCurrent();
+
+#endif /* SRC_UTILS_ARENA_H_ */
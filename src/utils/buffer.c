@@ -26,7 +26,9 @@ void Gears_BufferFree(Gears_Buffer* buff){
 
 void Gears_BufferAdd(Gears_Buffer* buff, const char* data, size_t len){
     if (buff->size + len >= buff->cap){
-        buff->cap = buff->size + len;
+        // grow geometrically so serializing a large object does not realloc (and copy) on every write
+        size_t cap = buff->cap * 2;
+        buff->cap = cap > buff->size + len ? cap : buff->size + len;
         buff->buff = RG_REALLOC(buff->buff, buff->cap);
     }
     memcpy(buff->buff + buff->size, data, len);
@@ -83,3 +85,45 @@ char* Gears_BufferReaderReadString(Gears_BufferReader* br){
     return Gears_BufferReaderReadBuff(br, &len);
 }
 
+void Gears_BufferWriterWriteVarint(Gears_BufferWriter* bw, unsigned long long val){
+    char bytes[10];
+    size_t len = 0;
+    while(val >= 0x80){
+        bytes[len++] = (char)(val | 0x80);
+        val >>= 7;
+    }
+    bytes[len++] = (char)val;
+    Gears_BufferAdd(bw->buff, bytes, len);
+}
+
+void Gears_BufferWriterWriteVarintBuff(Gears_BufferWriter* bw, const char* buff, size_t len){
+    Gears_BufferWriterWriteVarint(bw, len);
+    Gears_BufferAdd(bw->buff, buff, len);
+}
+
+int Gears_BufferReaderReadVarint(Gears_BufferReader* br, unsigned long long* val){
+    unsigned long long ret = 0;
+    for(size_t shift = 0 ; shift < 64 ; shift += 7){
+        if(br->location >= br->buff->size){
+            return REDISMODULE_ERR;
+        }
+        unsigned char byte = br->buff->buff[br->location++];
+        ret |= ((unsigned long long)(byte & 0x7f)) << shift;
+        if(!(byte & 0x80)){
+            *val = ret;
+            return REDISMODULE_OK;
+        }
+    }
+    return REDISMODULE_ERR;
+}
+
+char* Gears_BufferReaderReadVarintBuff(Gears_BufferReader* br, size_t* len){
+    unsigned long long val;
+    if(Gears_BufferReaderReadVarint(br, &val) != REDISMODULE_OK || val > br->buff->size - br->location){
+        return BUFF_READ_ERROR;
+    }
+    *len = val;
+    char* ret = br->buff->buff + br->location;
+    br->location += val;
+    return ret;
+}
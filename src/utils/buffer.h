@@ -34,6 +34,10 @@ void Gears_BufferWriterInit(Gears_BufferWriter* bw, Gears_Buffer* buff);
 void Gears_BufferWriterWriteLong(Gears_BufferWriter* bw, long val);
 void Gears_BufferWriterWriteString(Gears_BufferWriter* bw, const char* str);
 void Gears_BufferWriterWriteBuff(Gears_BufferWriter* bw, const char* buff, size_t len);
+/* LEB128, 7 bits per byte, small values take a single byte */
+void Gears_BufferWriterWriteVarint(Gears_BufferWriter* bw, unsigned long long val);
+/* varint length followed by the bytes, without a NUL terminator */
+void Gears_BufferWriterWriteVarintBuff(Gears_BufferWriter* bw, const char* buff, size_t len);
 
 typedef struct Gears_BufferReader{
     Gears_Buffer* buff;
@@ -44,6 +48,9 @@ void Gears_BufferReaderInit(Gears_BufferReader* br, Gears_Buffer* buff);
 long Gears_BufferReaderReadLong(Gears_BufferReader* br);
 char* Gears_BufferReaderReadBuff(Gears_BufferReader* br, size_t* len);
 char* Gears_BufferReaderReadString(Gears_BufferReader* br);
+/* Return REDISMODULE_ERR if the buffer ended before the varint did */
+int Gears_BufferReaderReadVarint(Gears_BufferReader* br, unsigned long long* val);
+char* Gears_BufferReaderReadVarintBuff(Gears_BufferReader* br, size_t* len);
 
 
 
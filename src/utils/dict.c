@@ -572,16 +572,29 @@ static long long dictFingerprint(Gears_dict *d) {
     return hash;
 }
 
-Gears_dictIterator *Gears_dictGetIterator(Gears_dict *d)
+/* Initialize an iterator that is not allocated by the dict (e.g. on the stack),
+ * it must be released with Gears_dictResetIterator. */
+void Gears_dictInitIterator(Gears_dictIterator *iter, Gears_dict *d)
 {
-    Gears_dictIterator *iter = RG_ALLOC(sizeof(*iter));
-
     iter->d = d;
     iter->table = 0;
     iter->index = -1;
     iter->safe = 0;
     iter->entry = NULL;
     iter->nextEntry = NULL;
+}
+
+void Gears_dictInitSafeIterator(Gears_dictIterator *iter, Gears_dict *d)
+{
+    Gears_dictInitIterator(iter, d);
+    iter->safe = 1;
+}
+
+Gears_dictIterator *Gears_dictGetIterator(Gears_dict *d)
+{
+    Gears_dictIterator *iter = RG_ALLOC(sizeof(*iter));
+
+    Gears_dictInitIterator(iter, d);
     return iter;
 }
 
@@ -627,7 +640,7 @@ Gears_dictEntry *Gears_dictNext(Gears_dictIterator *iter)
     return NULL;
 }
 
-void Gears_dictReleaseIterator(Gears_dictIterator *iter)
+void Gears_dictResetIterator(Gears_dictIterator *iter)
 {
     if (!(iter->index == -1 && iter->table == 0)) {
         if (iter->safe)
@@ -635,6 +648,11 @@ void Gears_dictReleaseIterator(Gears_dictIterator *iter)
         else
             RedisModule_Assert(iter->fingerprint == dictFingerprint(iter->d));
     }
+}
+
+void Gears_dictReleaseIterator(Gears_dictIterator *iter)
+{
+    Gears_dictResetIterator(iter);
     RG_FREE(iter);
 }
 
@@ -162,6 +162,9 @@ void Gears_dictRelease(Gears_dict *d);
 Gears_dictEntry * Gears_dictFind(Gears_dict *d, const void *key);
 void *Gears_dictFetchValue(Gears_dict *d, const void *key);
 int Gears_dictResize(Gears_dict *d);
+void Gears_dictInitIterator(Gears_dictIterator *iter, Gears_dict *d);
+void Gears_dictInitSafeIterator(Gears_dictIterator *iter, Gears_dict *d);
+void Gears_dictResetIterator(Gears_dictIterator *iter);
 Gears_dictIterator *Gears_dictGetIterator(Gears_dict *d);
 Gears_dictIterator *Gears_dictGetSafeIterator(Gears_dict *d);
 Gears_dictEntry *Gears_dictNext(Gears_dictIterator *iter);
@@ -0,0 +1,82 @@
+/*
+ * histogram.c
+ *
+ * Log-linear histogram used for the steps latency percentiles.
+ */
+
+#include "histogram.h"
+#include "../redisgears_memory.h"
+#include <string.h>
+
+#define HISTOGRAM_SUB_MASK (GEARS_HISTOGRAM_SUB_BUCKETS - 1)
+
+/*
+ * Values smaller than GEARS_HISTOGRAM_SUB_BUCKETS have a bucket of their own, bigger values
+ * are bucketed by their highest bit and the GEARS_HISTOGRAM_SUB_BUCKETS_BITS bits after it.
+ */
+static size_t Gears_HistogramBucket(uint64_t val){
+    if(val < GEARS_HISTOGRAM_SUB_BUCKETS){
+        return val;
+    }
+    size_t exponent = 63 - __builtin_clzll(val);
+    if(exponent > GEARS_HISTOGRAM_MAX_EXPONENT){
+        return GEARS_HISTOGRAM_BUCKETS - 1;
+    }
+    size_t sub = (val >> (exponent - GEARS_HISTOGRAM_SUB_BUCKETS_BITS)) & HISTOGRAM_SUB_MASK;
+    return (exponent - GEARS_HISTOGRAM_SUB_BUCKETS_BITS + 1) * GEARS_HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+static uint64_t Gears_HistogramBucketUpperBound(size_t bucket){
+    if(bucket < GEARS_HISTOGRAM_SUB_BUCKETS){
+        return bucket;
+    }
+    size_t exponent = bucket / GEARS_HISTOGRAM_SUB_BUCKETS + GEARS_HISTOGRAM_SUB_BUCKETS_BITS - 1;
+    size_t shift = exponent - GEARS_HISTOGRAM_SUB_BUCKETS_BITS;
+    uint64_t lower = ((uint64_t)(GEARS_HISTOGRAM_SUB_BUCKETS + (bucket & HISTOGRAM_SUB_MASK))) << shift;
+    return lower + (((uint64_t)1) << shift) - 1;
+}
+
+Gears_Histogram* Gears_HistogramCreate(){
+    return RG_CALLOC(1, sizeof(Gears_Histogram));
+}
+
+void Gears_HistogramFree(Gears_Histogram* h){
+    RG_FREE(h);
+}
+
+void Gears_HistogramRecord(Gears_Histogram* h, uint64_t val){
+    ++h->buckets[Gears_HistogramBucket(val)];
+    ++h->count;
+    if(val > h->max){
+        h->max = val;
+    }
+}
+
+void Gears_HistogramMerge(Gears_Histogram* dst, Gears_Histogram* src){
+    for(size_t i = 0 ; i < GEARS_HISTOGRAM_BUCKETS ; ++i){
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    if(src->max > dst->max){
+        dst->max = src->max;
+    }
+}
+
+uint64_t Gears_HistogramPercentile(Gears_Histogram* h, double percentile){
+    if(h->count == 0){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)((percentile / 100) * h->count + 0.5);
+    if(rank == 0){
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for(size_t i = 0 ; i < GEARS_HISTOGRAM_BUCKETS ; ++i){
+        seen += h->buckets[i];
+        if(seen >= rank){
+            uint64_t val = Gears_HistogramBucketUpperBound(i);
+            return val < h->max ? val : h->max;
+        }
+    }
+    return h->max;
+}
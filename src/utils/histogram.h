@@ -0,0 +1,45 @@
+/*
+ * histogram.h
+ *
+ * Log-linear (HDR style) histogram of non negative values, used to keep
+ * the per record latency of the execution steps.
+ *
+ * Each power of 2 is split into GEARS_HISTOGRAM_SUB_BUCKETS linear buckets
+ * so the reported percentiles are within 1/GEARS_HISTOGRAM_SUB_BUCKETS of
+ * the real value, whatever its magnitude. Recording a value is a couple of
+ * bit operations and an increment.
+ */
+
+#ifndef SRC_UTILS_HISTOGRAM_H_
+#define SRC_UTILS_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GEARS_HISTOGRAM_SUB_BUCKETS_BITS 3
+#define GEARS_HISTOGRAM_SUB_BUCKETS (1 << GEARS_HISTOGRAM_SUB_BUCKETS_BITS)
+#define GEARS_HISTOGRAM_MAX_EXPONENT 47 // larger values are counted on the last bucket
+#define GEARS_HISTOGRAM_BUCKETS ((GEARS_HISTOGRAM_MAX_EXPONENT - GEARS_HISTOGRAM_SUB_BUCKETS_BITS + 2) * GEARS_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct Gears_Histogram{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[GEARS_HISTOGRAM_BUCKETS];
+}Gears_Histogram;
+
+Gears_Histogram* Gears_HistogramCreate();
+void Gears_HistogramFree(Gears_Histogram* h);
+void Gears_HistogramRecord(Gears_Histogram* h, uint64_t val);
+
+/*
+ * Add all the values recorded on 'src' to 'dst'.
+ */
+void Gears_HistogramMerge(Gears_Histogram* dst, Gears_Histogram* src);
+
+/*
+ * Return the value at the given percentile (0-100), 0 if nothing was recorded.
+ * The returned value is the upper bound of the bucket, capped by the max recorded value.
+ */
+uint64_t Gears_HistogramPercentile(Gears_Histogram* h, double percentile);
+
+#endif /* SRC_UTILS_HISTOGRAM_H_ */
@@ -0,0 +1,203 @@
+/*
+ * slab.c
+ *
+ * Fixed size objects pools with thread local caches.
+ */
+
+#include "slab.h"
+#include "arr_rm_alloc.h"
+#include "../redisgears_memory.h"
+#include "redismodule.h"
+#include <pthread.h>
+
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_CACHE_BATCH 64 // number of objects moved at once between a thread cache and its pool
+#define SLAB_CACHE_MAX (2 * SLAB_CACHE_BATCH)
+
+typedef struct Gears_SlabFreeItem{
+    struct Gears_SlabFreeItem* next;
+}Gears_SlabFreeItem;
+
+struct Gears_SlabPool{
+    size_t id;
+    size_t objSize;
+    pthread_mutex_t lock; // protects freeList, slabs, pos and left
+    Gears_SlabFreeItem* freeList;
+    char** slabs;
+    char* pos;
+    size_t left;
+    unsigned long long exitedHits; // counters of threads that already exited, protected by the global lock
+    unsigned long long exitedMisses;
+};
+
+typedef struct Gears_SlabCache{
+    Gears_SlabFreeItem* head;
+    size_t len;
+    unsigned long long hits; // written only by the owner thread, read by Gears_SlabPoolGetStats
+    unsigned long long misses;
+}Gears_SlabCache;
+
+typedef struct Gears_SlabThreadCaches{
+    Gears_SlabCache caches[GEARS_SLAB_MAX_POOLS]; // indexed by the pool id
+}Gears_SlabThreadCaches;
+
+typedef struct Gears_SlabData{
+    pthread_key_t cachesKey;
+    pthread_mutex_t lock; // protects pools, poolsLen and threadsCaches
+    Gears_SlabPool* pools[GEARS_SLAB_MAX_POOLS];
+    size_t poolsLen;
+    Gears_SlabThreadCaches** threadsCaches;
+}Gears_SlabData;
+
+static Gears_SlabData slabData;
+
+static void Gears_SlabFlush(Gears_SlabPool* pool, Gears_SlabCache* cache, size_t n){
+    Gears_SlabFreeItem* head = cache->head;
+    Gears_SlabFreeItem* tail = head;
+    for(size_t i = 1 ; i < n ; ++i){
+        tail = tail->next;
+    }
+    cache->head = tail->next;
+    cache->len -= n;
+
+    pthread_mutex_lock(&pool->lock);
+    tail->next = pool->freeList;
+    pool->freeList = head;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Called when a thread exits, return its cached objects to the pools so other threads will reuse them.
+ */
+static void Gears_SlabThreadCachesFree(void* arg){
+    Gears_SlabThreadCaches* threadCaches = arg;
+
+    pthread_mutex_lock(&slabData.lock);
+    for(size_t i = 0 ; i < slabData.poolsLen ; ++i){
+        Gears_SlabPool* pool = slabData.pools[i];
+        Gears_SlabCache* cache = threadCaches->caches + i;
+        if(cache->len > 0){
+            Gears_SlabFlush(pool, cache, cache->len);
+        }
+        pool->exitedHits += cache->hits;
+        pool->exitedMisses += cache->misses;
+    }
+    size_t len = array_len(slabData.threadsCaches);
+    for(size_t i = 0 ; i < len ; ++i){
+        if(slabData.threadsCaches[i] == threadCaches){
+            slabData.threadsCaches[i] = slabData.threadsCaches[len - 1];
+            array_trimm_len(slabData.threadsCaches, len - 1);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&slabData.lock);
+
+    RG_FREE(threadCaches);
+}
+
+int Gears_SlabInitialize(){
+    if(pthread_key_create(&slabData.cachesKey, Gears_SlabThreadCachesFree)){
+        return REDISMODULE_ERR;
+    }
+    pthread_mutex_init(&slabData.lock, NULL);
+    slabData.poolsLen = 0;
+    slabData.threadsCaches = array_new(Gears_SlabThreadCaches*, 10);
+    return REDISMODULE_OK;
+}
+
+Gears_SlabPool* Gears_SlabPoolCreate(size_t objSize){
+    if(objSize == 0 || objSize > GEARS_SLAB_MAX_SIZE){
+        return NULL;
+    }
+    pthread_mutex_lock(&slabData.lock);
+    if(slabData.poolsLen == GEARS_SLAB_MAX_POOLS){
+        pthread_mutex_unlock(&slabData.lock);
+        return NULL;
+    }
+    Gears_SlabPool* pool = RG_CALLOC(1, sizeof(*pool));
+    pool->id = slabData.poolsLen;
+    pool->objSize = ((objSize + GEARS_SLAB_ALIGN - 1) / GEARS_SLAB_ALIGN) * GEARS_SLAB_ALIGN;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->slabs = array_new(char*, 10);
+    slabData.pools[slabData.poolsLen++] = pool;
+    pthread_mutex_unlock(&slabData.lock);
+    return pool;
+}
+
+static Gears_SlabCache* Gears_SlabGetCache(Gears_SlabPool* pool){
+    Gears_SlabThreadCaches* threadCaches = pthread_getspecific(slabData.cachesKey);
+    if(!threadCaches){
+        threadCaches = RG_CALLOC(1, sizeof(*threadCaches));
+        pthread_setspecific(slabData.cachesKey, threadCaches);
+        pthread_mutex_lock(&slabData.lock);
+        slabData.threadsCaches = array_append(slabData.threadsCaches, threadCaches);
+        pthread_mutex_unlock(&slabData.lock);
+    }
+    return threadCaches->caches + pool->id;
+}
+
+static void Gears_SlabRefill(Gears_SlabPool* pool, Gears_SlabCache* cache){
+    pthread_mutex_lock(&pool->lock);
+    while(cache->len < SLAB_CACHE_BATCH){
+        Gears_SlabFreeItem* item = pool->freeList;
+        if(item){
+            pool->freeList = item->next;
+        }else{
+            if(pool->left < pool->objSize){
+                // the leftover of the current slab is smaller than an object, it is not worth tracking it
+                char* slab = RG_ALLOC(SLAB_SIZE);
+                pool->slabs = array_append(pool->slabs, slab);
+                pool->pos = slab;
+                pool->left = SLAB_SIZE;
+            }
+            item = (Gears_SlabFreeItem*)pool->pos;
+            pool->pos += pool->objSize;
+            pool->left -= pool->objSize;
+        }
+        item->next = cache->head;
+        cache->head = item;
+        ++cache->len;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void* Gears_SlabAlloc(Gears_SlabPool* pool){
+    Gears_SlabCache* cache = Gears_SlabGetCache(pool);
+    if(cache->head){
+        __atomic_store_n(&cache->hits, cache->hits + 1, __ATOMIC_RELAXED);
+    }else{
+        Gears_SlabRefill(pool, cache);
+        __atomic_store_n(&cache->misses, cache->misses + 1, __ATOMIC_RELAXED);
+    }
+    Gears_SlabFreeItem* item = cache->head;
+    cache->head = item->next;
+    --cache->len;
+    return item;
+}
+
+void Gears_SlabRelease(Gears_SlabPool* pool, void* p){
+    Gears_SlabCache* cache = Gears_SlabGetCache(pool);
+    Gears_SlabFreeItem* item = p;
+    item->next = cache->head;
+    cache->head = item;
+    if(++cache->len > SLAB_CACHE_MAX){
+        // keep a batch on the cache so a thread that allocates and frees in turns will not hit the pool lock
+        Gears_SlabFlush(pool, cache, cache->len - SLAB_CACHE_BATCH);
+    }
+}
+
+void Gears_SlabPoolGetStats(Gears_SlabPool* pool, Gears_SlabPoolStats* stats){
+    pthread_mutex_lock(&slabData.lock);
+    stats->hits = pool->exitedHits;
+    stats->misses = pool->exitedMisses;
+    for(size_t i = 0 ; i < array_len(slabData.threadsCaches) ; ++i){
+        Gears_SlabCache* cache = slabData.threadsCaches[i]->caches + pool->id;
+        stats->hits += __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&cache->misses, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&slabData.lock);
+
+    pthread_mutex_lock(&pool->lock);
+    stats->slabs = array_len(pool->slabs);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,47 @@
+/*
+ * slab.h
+ *
+ * Pools of fixed size objects (mainly records) shared by all the threads.
+ *
+ * Each thread keeps a cache of free objects per pool, allocating and releasing
+ * an object only touches the cache of the current thread. When the cache is
+ * empty (a miss) it is refilled with a batch of objects from the pool, under the
+ * pool lock, and when it grows too big a batch is returned to the pool. The pool
+ * carves new objects out of large slabs that are never returned to the allocator.
+ * An object can be released on a different thread than the one it was allocated on.
+ */
+
+#ifndef SRC_UTILS_SLAB_H_
+#define SRC_UTILS_SLAB_H_
+
+#include <stddef.h>
+
+#define GEARS_SLAB_ALIGN 16
+#define GEARS_SLAB_MAX_SIZE 256
+#define GEARS_SLAB_MAX_POOLS 64
+
+typedef struct Gears_SlabPool Gears_SlabPool;
+
+typedef struct Gears_SlabPoolStats{
+    unsigned long long hits; // allocations served by the thread cache
+    unsigned long long misses; // allocations that refilled the thread cache from the pool
+    size_t slabs;
+}Gears_SlabPoolStats;
+
+int Gears_SlabInitialize();
+
+/*
+ * Return NULL if objSize is above GEARS_SLAB_MAX_SIZE or GEARS_SLAB_MAX_POOLS pools were
+ * already created, the caller should use the heap instead. Pools are never freed.
+ */
+Gears_SlabPool* Gears_SlabPoolCreate(size_t objSize);
+
+void* Gears_SlabAlloc(Gears_SlabPool* pool);
+void Gears_SlabRelease(Gears_SlabPool* pool, void* p);
+
+/*
+ * The counters are summed over all the threads without stopping them, so they are not an exact snapshot.
+ */
+void Gears_SlabPoolGetStats(Gears_SlabPool* pool, Gears_SlabPoolStats* stats);
+
+#endif /* SRC_UTILS_SLAB_H_ */